@@ -0,0 +1,158 @@
+/* Throughput of the concurrent tree (btree_olc.h) against a plain tree behind
+ * one global mutex, from 1 thread up to the given number, doubling, for
+ * a read-only, a read-mostly and a write-heavy mix of operations.
+ *
+ * usage: bench_concurrent [max threads] [number of keys] */
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btree.h"
+#include "btree_olc.h"
+
+#define DEGREE         16
+#define OPS_PER_THREAD 500000
+
+static size_t N = 1000000;
+
+struct mix {
+	const char *name;
+	unsigned    search; /* percent, the rest are insertions and deletions */
+};
+
+static const struct mix mixes[] = {
+	{ "100% search", 100 },
+	{ "90% search",   90 },
+	{ "50% search",   50 },
+};
+
+#define NMIXES (sizeof(mixes) / sizeof(mixes[0]))
+
+static struct btree     *locked;
+static pthread_mutex_t   lock = PTHREAD_MUTEX_INITIALIZER;
+static struct btree_olc *olc;
+static pthread_barrier_t start;
+
+struct worker {
+	pthread_t   thread;
+	uint64_t    seed;
+	unsigned    search;
+	int         use_olc;
+};
+
+static int cmp_u64(const void *a, const void *b) {
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static void* work(void *arg) {
+	struct worker *w = arg;
+	uint64_t key, out;
+	size_t   i;
+
+	pthread_barrier_wait(&start);
+	for (i = 0; i < OPS_PER_THREAD; i++) {
+		const uint64_t r  = xorshift(&w->seed);
+		const unsigned op = r % 100;
+
+		/* Keys are drawn from twice the range the trees were filled with */
+		key = (r >> 8) % (2 * N);
+		if (w->use_olc) {
+			if      (op < w->search)            btree_olc_search(olc, &key, &out);
+			else if ((op - w->search) % 2 == 0) btree_olc_insert(olc, &key);
+			else                                btree_olc_delete(olc, &key);
+		} else {
+			pthread_mutex_lock(&lock);
+			if      (op < w->search)            btree_search(locked, &key);
+			else if ((op - w->search) % 2 == 0) btree_insert(locked, &key);
+			else                                btree_delete(locked, &key);
+			pthread_mutex_unlock(&lock);
+		}
+	}
+	return NULL;
+}
+
+/* returnvalue: million operations per second */
+static double run(size_t threads, unsigned search, int use_olc) {
+	struct worker *workers = malloc(sizeof(struct worker) * threads);
+	double t0;
+	size_t i;
+
+	pthread_barrier_init(&start, NULL, threads + 1);
+	for (i = 0; i < threads; i++) {
+		workers[i].seed    = 0x9e3779b97f4a7c15ull * (i + 1);
+		workers[i].search  = search;
+		workers[i].use_olc = use_olc;
+		pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+	}
+	pthread_barrier_wait(&start);
+	t0 = now();
+	for (i = 0; i < threads; i++) pthread_join(workers[i].thread, NULL);
+	t0 = now() - t0;
+
+	pthread_barrier_destroy(&start);
+	free(workers);
+	return threads * OPS_PER_THREAD / t0 / 1e6;
+}
+
+int main(int argc, char **argv) {
+	size_t   max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t   threads, i, m;
+	uint64_t key;
+
+	if (argc > 1) max_threads = strtoul(argv[1], NULL, 10);
+	if (argc > 2) N = strtoul(argv[2], NULL, 10);
+	if (max_threads < 1) max_threads = 1;
+
+	printf("uint64_t keys, n=%lu, degree=%d, %d ops per thread, %lu cores\n",
+	       (unsigned long)N, DEGREE, OPS_PER_THREAD,
+	       (unsigned long)sysconf(_SC_NPROCESSORS_ONLN));
+
+	for (m = 0; m < NMIXES; m++) {
+		printf("%s\n", mixes[m].name);
+		for (threads = 1; threads <= max_threads; threads *= 2) {
+			double mutex_ops, olc_ops;
+
+			/* Every run starts from the same tree, filled with the even keys */
+			locked = btree_new(sizeof(uint64_t), DEGREE, cmp_u64);
+			olc    = btree_olc_new(sizeof(uint64_t), DEGREE, cmp_u64);
+			for (i = 0; i < N; i++) {
+				key = 2 * i;
+				btree_insert(locked, &key);
+				btree_olc_insert(olc, &key);
+			}
+
+			mutex_ops = run(threads, mixes[m].search, 0);
+			olc_ops   = run(threads, mixes[m].search, 1);
+			printf("  %3lu threads   mutex %8.2f Mops/s   olc %8.2f Mops/s   %5.2fx\n",
+			       (unsigned long)threads, mutex_ops, olc_ops, olc_ops / mutex_ops);
+
+			btree_free(&locked);
+			btree_olc_free(&olc);
+
+			if (threads < max_threads && threads * 2 > max_threads) {
+				threads = max_threads / 2;
+			}
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/* Compares cache misses of lookups in the packed and split node layouts.
+ * Misses are counted with perf_event_open(2), where the kernel or the
+ * hardware does not provide the counters only timings are reported.
+ *
+ * usage: bench_layout [number of keys] [degree] */
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btree.h"
+
+#define LOOKUPS 2000000
+
+struct counter {
+	const char *name;
+	uint32_t    type;
+	uint64_t    config;
+	int         fd;
+};
+
+static struct counter counters[] = {
+	{ "LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1 },
+	{ "L1D misses", PERF_TYPE_HW_CACHE,
+	  PERF_COUNT_HW_CACHE_L1D
+	  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+	  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), -1 },
+	{ "dTLB misses", PERF_TYPE_HW_CACHE,
+	  PERF_COUNT_HW_CACHE_DTLB
+	  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+	  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), -1 },
+};
+
+#define NCOUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+static void counters_open(void) {
+	size_t i;
+	for (i = 0; i < NCOUNTERS; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size           = sizeof(attr);
+		attr.type           = counters[i].type;
+		attr.config         = counters[i].config;
+		attr.disabled       = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+		counters[i].fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+}
+
+static void counters_start(void) {
+	size_t i;
+	for (i = 0; i < NCOUNTERS; i++) {
+		if (counters[i].fd < 0) continue;
+		ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+static void counters_stop(uint64_t *out) {
+	size_t i;
+	for (i = 0; i < NCOUNTERS; i++) {
+		out[i] = 0;
+		if (counters[i].fd < 0) continue;
+		ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counters[i].fd, &out[i], sizeof(out[i])) != sizeof(out[i])) {
+			out[i] = 0;
+		}
+	}
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static void run(const char *name, enum btree_layout layout,
+                const uint64_t *keys, size_t n, size_t degree) {
+	struct btree *tree = btree_new(sizeof(uint64_t), degree, cmp_u64);
+	uint64_t      seed = 42;
+	uint64_t      found = 0;
+	uint64_t      counts[NCOUNTERS];
+	double        t0, elapsed;
+	size_t        i;
+
+	btree_set_layout(tree, layout);
+	for (i = 0; i < n; i++) btree_insert(tree, (void*)&keys[i]);
+
+	counters_start();
+	t0 = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		found += btree_search(tree, (void*)&keys[xorshift(&seed) % n]) != NULL;
+	}
+	elapsed = now() - t0;
+	counters_stop(counts);
+
+	printf("%-7s %8.1f ns/lookup", name, elapsed * 1e9 / LOOKUPS);
+	for (i = 0; i < NCOUNTERS; i++) {
+		if (counters[i].fd < 0) printf("   %s: n/a", counters[i].name);
+		else printf("   %s: %6.2f/lookup", counters[i].name,
+		            (double)counts[i] / LOOKUPS);
+	}
+	putchar('\n');
+
+	if (found != LOOKUPS) fputs("lookups failed!\n", stderr);
+	btree_free(&tree);
+}
+
+int main(int argc, char **argv) {
+	size_t    n      = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	size_t    degree = argc > 2 ? strtoul(argv[2], NULL, 10) : 16;
+	uint64_t  seed   = 0x9e3779b97f4a7c15ull;
+	uint64_t *keys   = malloc(sizeof(uint64_t) * n);
+	size_t    i;
+
+	for (i = 0; i < n; i++) keys[i] = xorshift(&seed);
+
+	counters_open();
+	printf("random lookups, n=%lu, degree=%lu\n",
+	       (unsigned long)n, (unsigned long)degree);
+	run("packed", BTREE_LAYOUT_PACKED, keys, n, degree);
+	run("split",  BTREE_LAYOUT_SPLIT,  keys, n, degree);
+
+	free(keys);
+	return EXIT_SUCCESS;
+}
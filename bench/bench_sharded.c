@@ -0,0 +1,139 @@
+/* Ingest throughput of a sharded tree (btree_sharded.h) against a plain tree
+ * behind one global mutex, from 1 thread up to the given number, doubling,
+ * each thread inserting its share of the keys one by one, and of the
+ * shard-parallel batch insertion of all keys at once.
+ *
+ * usage: bench_sharded [max threads] [number of keys] [shards] */
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btree.h"
+#include "btree_sharded.h"
+
+#define DEGREE 16
+
+static size_t N      = 1000000;
+static size_t SHARDS = 16;
+
+static uint64_t             *keys;
+static struct btree         *locked;
+static pthread_mutex_t       lock = PTHREAD_MUTEX_INITIALIZER;
+static struct btree_sharded *sharded;
+
+struct worker {
+	pthread_t thread;
+	size_t    from;
+	size_t    to;
+	int       use_sharded;
+};
+
+static int cmp_u64(const void *a, const void *b) {
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static size_t hash_u64(const void *a) {
+	return (size_t)((*(const uint64_t*)a * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static void* work(void *arg) {
+	struct worker *w = arg;
+	size_t i;
+
+	for (i = w->from; i < w->to; i++) {
+		if (w->use_sharded) {
+			btree_sharded_insert(sharded, &keys[i]);
+		} else {
+			pthread_mutex_lock(&lock);
+			btree_insert(locked, &keys[i]);
+			pthread_mutex_unlock(&lock);
+		}
+	}
+	return NULL;
+}
+
+/* returnvalue: million insertions per second */
+static double run(size_t threads, int use_sharded) {
+	struct worker *workers = malloc(sizeof(struct worker) * threads);
+	double t0 = now();
+	size_t i;
+
+	for (i = 0; i < threads; i++) {
+		workers[i].from        = N * i / threads;
+		workers[i].to          = N * (i + 1) / threads;
+		workers[i].use_sharded = use_sharded;
+		pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+	}
+	for (i = 0; i < threads; i++) pthread_join(workers[i].thread, NULL);
+
+	free(workers);
+	return N / (now() - t0) / 1e6;
+}
+
+int main(int argc, char **argv) {
+	size_t   max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t   threads, i;
+	uint64_t seed = 0x9e3779b97f4a7c15ull;
+
+	if (argc > 1) max_threads = strtoul(argv[1], NULL, 10);
+	if (argc > 2) N           = strtoul(argv[2], NULL, 10);
+	if (argc > 3) SHARDS      = strtoul(argv[3], NULL, 10);
+	if (max_threads < 1) max_threads = 1;
+
+	keys = malloc(sizeof(uint64_t) * N);
+	for (i = 0; i < N; i++) keys[i] = xorshift(&seed);
+
+	printf("uint64_t keys, n=%lu, degree=%d, %lu shards, %lu cores\n",
+	       (unsigned long)N, DEGREE, (unsigned long)SHARDS,
+	       (unsigned long)sysconf(_SC_NPROCESSORS_ONLN));
+
+	for (threads = 1; threads <= max_threads; threads *= 2) {
+		double mutex_ops, sharded_ops, batch_ops, t0;
+
+		locked  = btree_new(sizeof(uint64_t), DEGREE, cmp_u64);
+		sharded = btree_sharded_new_hash(sizeof(uint64_t), DEGREE, cmp_u64,
+		                                 hash_u64, SHARDS);
+		mutex_ops   = run(threads, 0);
+		sharded_ops = run(threads, 1);
+		btree_free(&locked);
+		btree_sharded_free(&sharded);
+
+		sharded = btree_sharded_new_hash(sizeof(uint64_t), DEGREE, cmp_u64,
+		                                 hash_u64, SHARDS);
+		t0 = now();
+		btree_sharded_insert_batch(sharded, keys, N, threads);
+		batch_ops = N / (now() - t0) / 1e6;
+		btree_sharded_free(&sharded);
+
+		printf("  %3lu threads   mutex %8.2f Mops/s   sharded %8.2f Mops/s   "
+		       "sharded batch %8.2f Mops/s\n",
+		       (unsigned long)threads, mutex_ops, sharded_ops, batch_ops);
+
+		if (threads < max_threads && threads * 2 > max_threads) {
+			threads = max_threads / 2;
+		}
+	}
+
+	free(keys);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/* Compares the generic `btree_*` API, which goes through a comparator
+ * function pointer and `elem_size` memcpys, with a `BTREE_DEFINE` generated
+ * tree over the same keys.
+ *
+ * usage: bench_typed [number of keys] */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "btree.h"
+#include "btree_typed.h"
+
+BTREE_DEFINE(u64tree, uint64_t, BTREE_CMP_NUM(a, b));
+
+#define DEGREE 32
+
+static size_t N = 1000000;
+
+static int cmp_u64(const void *a, const void *b) {
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static void report(const char *op, double generic, double typed) {
+	printf("%-8s generic %8.1f ns/op   typed %8.1f ns/op   speedup %5.2fx\n",
+	       op, generic * 1e9 / N, typed * 1e9 / N, generic / typed);
+}
+
+int main(int argc, char **argv) {
+	uint64_t *keys;
+	uint64_t  seed = 0x9e3779b97f4a7c15ull;
+	uint64_t  sum_g = 0, sum_t = 0;
+	double    t0, g_ins, g_find, g_iter, g_del, t_ins, t_find, t_iter, t_del;
+	size_t    i;
+
+	struct btree        *generic = btree_new(sizeof(uint64_t), DEGREE, cmp_u64);
+	struct btree_iter_t *it;
+	struct u64tree      *typed   = u64tree_new(DEGREE);
+	struct u64tree_iter  tit;
+	uint64_t            *p;
+
+	if (argc > 1) N = strtoul(argv[1], NULL, 10);
+	keys = malloc(sizeof(uint64_t) * N);
+	for (i = 0; i < N; i++) keys[i] = xorshift(&seed);
+
+	t0 = now();
+	for (i = 0; i < N; i++) btree_insert(generic, &keys[i]);
+	g_ins = now() - t0;
+
+	t0 = now();
+	for (i = 0; i < N; i++) sum_g += *(uint64_t*)btree_search(generic, &keys[i]);
+	g_find = now() - t0;
+
+	t0 = now();
+	it = btree_iter_t_new(generic);
+	while ((p = btree_iter(generic, it)) != NULL) sum_g += *p;
+	free(it);
+	g_iter = now() - t0;
+
+	t0 = now();
+	for (i = 0; i < N; i++) btree_delete(generic, &keys[i]);
+	g_del = now() - t0;
+
+	t0 = now();
+	for (i = 0; i < N; i++) u64tree_insert(typed, keys[i]);
+	t_ins = now() - t0;
+
+	t0 = now();
+	for (i = 0; i < N; i++) sum_t += *u64tree_search(typed, keys[i]);
+	t_find = now() - t0;
+
+	t0 = now();
+	u64tree_iter_init(typed, &tit);
+	while ((p = u64tree_iter_next(&tit)) != NULL) sum_t += *p;
+	t_iter = now() - t0;
+
+	t0 = now();
+	for (i = 0; i < N; i++) u64tree_delete(typed, keys[i]);
+	t_del = now() - t0;
+
+	printf("uint64_t keys, n=%lu, degree=%d\n", (unsigned long)N, DEGREE);
+	report("insert", g_ins,  t_ins);
+	report("search", g_find, t_find);
+	report("iterate", g_iter, t_iter);
+	report("delete", g_del,  t_del);
+
+	if (sum_g != sum_t) {
+		fputs("generic and typed trees disagree!\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	btree_free(&generic);
+	u64tree_free(&typed);
+	free(keys);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,376 @@
+/* Throughput and latency of the generic tree under common workloads, for
+ * every combination of the given degrees and element sizes:
+ *
+ *   insert_seq    inserting keys in ascending order, into an empty tree
+ *   insert_rand   inserting keys in random order, into an empty tree
+ *   search_unif   looking up keys chosen uniformly
+ *   search_zipf   looking up keys chosen by a Zipfian distribution
+ *   iterate       walking all elements in order
+ *   ycsb_a        50% lookups, 50% updates, Zipfian
+ *   ycsb_b        95% lookups,  5% updates, Zipfian
+ *   ycsb_e        95% short range scans, 5% insertions of new keys
+ *   delete_rand   deleting keys in random order
+ *
+ * Elements are `elem_size` bytes, a 64-bit key followed by the payload, and
+ * updates rewrite the payload of an element found by `btree_insert_or_get`.
+ * Every `LAT_SAMPLE`-th operation is timed on its own for the latency
+ * percentiles, the rate covers all of them.
+ *
+ * Results go to stdout as CSV, one row per workload and configuration.
+ *
+ * usage: bench_workloads [-n keys] [-o operations] [-d degrees] [-e sizes]
+ *                        [-w workloads]
+ * where degrees, sizes and workloads are comma-separated lists, e.g.
+ *   bench_workloads -n 1000000 -d 8,16,32 -e 8,128 -w search_zipf,ycsb_a */
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btree.h"
+
+#define LAT_SAMPLE 16
+#define ZIPF_THETA 0.99
+#define SCAN_MAX   100
+
+#define MAX_LIST 32
+
+static size_t N   = 200000;
+static size_t OPS = 200000;
+
+static const char *workloads[] = {
+	"insert_seq", "insert_rand", "search_unif", "search_zipf", "iterate",
+	"ycsb_a", "ycsb_b", "ycsb_e", "delete_rand",
+};
+
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static int enabled[NWORKLOADS];
+
+/* Workload state */
+static struct btree *tree;
+static size_t        elem_size;
+static unsigned char elem[4096];
+static uint64_t      seed = 0x9e3779b97f4a7c15ull;
+static size_t        inserted; /* keys 0 .. inserted - 1 have been added */
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x, y;
+	memcpy(&x, a, sizeof(x));
+	memcpy(&y, b, sizeof(y));
+	return (x > y) - (x < y);
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* The i-th key, keys being spread over the whole range in random order */
+static uint64_t key_of(uint64_t i) {
+	uint64_t z = i + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static void *elem_with(uint64_t key) {
+	memcpy(elem, &key, sizeof(key));
+	return elem;
+}
+
+/* Zipfian ranks in [0, n), as generated by YCSB (Gray et al., "Quickly
+ * generating billion-record synthetic databases") */
+struct zipf {
+	size_t n;
+	double theta, alpha, zetan, eta;
+};
+
+static double zeta(size_t n, double theta) {
+	double sum = 0;
+	size_t i;
+	for (i = 1; i <= n; i++) sum += 1.0 / pow((double)i, theta);
+	return sum;
+}
+
+static void zipf_init(struct zipf *z, size_t n, double theta) {
+	const double zeta2 = zeta(2, theta);
+
+	z->n     = n;
+	z->theta = theta;
+	z->alpha = 1.0 / (1.0 - theta);
+	z->zetan = zeta(n, theta);
+	z->eta   = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static size_t zipf_next(const struct zipf *z, uint64_t *s) {
+	const double u  = (double)(xorshift(s) >> 11) / 9007199254740992.0;
+	const double uz = u * z->zetan;
+	size_t       rank;
+
+	if (uz < 1.0) return 0;
+	if (uz < 1.0 + pow(0.5, z->theta)) return 1;
+	rank = (size_t)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+	return rank < z->n ? rank : z->n - 1;
+}
+
+/* Hot ranks should not be neighbours in the tree, nor the oldest keys */
+static size_t zipf_key(const struct zipf *z, uint64_t *s) {
+	return key_of(zipf_next(z, s)) % inserted;
+}
+
+/* Operations, each returning something to keep the compiler honest */
+
+static struct zipf zipf;
+
+static uint64_t op_insert_seq(size_t i) {
+	btree_insert(tree, elem_with(i));
+	return 0;
+}
+
+static uint64_t op_insert_rand(size_t i) {
+	btree_insert(tree, elem_with(key_of(i)));
+	return 0;
+}
+
+static uint64_t op_search_unif(size_t i) {
+	(void)i;
+	return btree_search(tree, elem_with(key_of(xorshift(&seed) % inserted)))
+	       != NULL;
+}
+
+static uint64_t op_search_zipf(size_t i) {
+	(void)i;
+	return btree_search(tree, elem_with(key_of(zipf_key(&zipf, &seed))))
+	       != NULL;
+}
+
+static struct btree_iter_t *iter;
+
+static uint64_t op_iterate(size_t i) {
+	unsigned char *e = btree_iter(tree, iter);
+	(void)i;
+	if (e == NULL) {
+		btree_iter_t_reset(tree, &iter);
+		e = btree_iter(tree, iter);
+	}
+	return e[elem_size - 1];
+}
+
+static uint64_t op_update(void) {
+	unsigned char *e = btree_insert_or_get(tree,
+	                       elem_with(key_of(zipf_key(&zipf, &seed))));
+	if (elem_size > sizeof(uint64_t)) {
+		memset(e + sizeof(uint64_t), (int)seed, elem_size - sizeof(uint64_t));
+	}
+	return e[0];
+}
+
+static uint64_t op_ycsb_a(size_t i) {
+	(void)i;
+	if (xorshift(&seed) % 100 < 50) return op_update();
+	return op_search_zipf(i);
+}
+
+static uint64_t op_ycsb_b(size_t i) {
+	(void)i;
+	if (xorshift(&seed) % 100 < 5) return op_update();
+	return op_search_zipf(i);
+}
+
+static int scan_count(void *e, void *ctx) {
+	size_t *left = ctx;
+	(void)e;
+	return --*left == 0;
+}
+
+static uint64_t op_ycsb_e(size_t i) {
+	size_t left;
+	(void)i;
+	if (xorshift(&seed) % 100 < 5) {
+		btree_insert(tree, elem_with(key_of(inserted++)));
+		return 0;
+	}
+	left = 1 + xorshift(&seed) % SCAN_MAX;
+	return btree_range(tree, elem_with(key_of(zipf_key(&zipf, &seed))), NULL,
+	                   scan_count, &left);
+}
+
+/* Deletes key p(i), p being a permutation of [0, N) */
+static size_t stride;
+
+static uint64_t op_delete_rand(size_t i) {
+	return btree_delete(tree, elem_with(key_of(i * stride % N)));
+}
+
+/* Running and reporting */
+
+static int cmp_lat(const void *a, const void *b) {
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t *lat;
+
+static void run(const char *name, size_t degree, size_t ops,
+                uint64_t (*op)(size_t)) {
+	volatile uint64_t sink = 0;
+	size_t            samples = 0;
+	uint64_t          t0, elapsed;
+	size_t            i;
+	size_t            w;
+
+	for (w = 0; w < NWORKLOADS; w++) {
+		if (strcmp(workloads[w], name) == 0) break;
+	}
+	if (!enabled[w]) {
+		/* The other workloads run on the tree this one builds */
+		if (op == op_insert_rand) for (i = 0; i < ops; i++) sink += op(i);
+		return;
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < ops; i++) {
+		if (i % LAT_SAMPLE == 0) {
+			const uint64_t s = now_ns();
+			sink += op(i);
+			lat[samples++] = now_ns() - s;
+		} else {
+			sink += op(i);
+		}
+	}
+	elapsed = now_ns() - t0;
+
+	qsort(lat, samples, sizeof(uint64_t), cmp_lat);
+	printf("%s,%lu,%lu,%lu,%lu,%.6f,%.0f,%lu,%lu,%lu,%lu,%lu\n",
+	       name, (unsigned long)degree, (unsigned long)elem_size,
+	       (unsigned long)N, (unsigned long)ops, elapsed * 1e-9,
+	       ops / (elapsed * 1e-9),
+	       (unsigned long)lat[samples * 50 / 100],
+	       (unsigned long)lat[samples * 90 / 100],
+	       (unsigned long)lat[samples * 99 / 100],
+	       (unsigned long)lat[samples * 999 / 1000],
+	       (unsigned long)lat[samples - 1]);
+	fflush(stdout);
+}
+
+static size_t gcd(size_t a, size_t b) {
+	while (b != 0) {
+		const size_t r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+static void run_config(size_t degree) {
+	memset(elem, 0, sizeof(elem));
+
+	/* Sequential insertions get a tree of their own */
+	tree = btree_new(elem_size, degree, cmp_u64);
+	run("insert_seq", degree, N, op_insert_seq);
+	btree_free(&tree);
+
+	tree = btree_new(elem_size, degree, cmp_u64);
+	run("insert_rand", degree, N, op_insert_rand);
+	inserted = N;
+
+	run("search_unif", degree, OPS, op_search_unif);
+	run("search_zipf", degree, OPS, op_search_zipf);
+
+	iter = btree_iter_t_new(tree);
+	run("iterate", degree, OPS, op_iterate);
+	free(iter);
+
+	run("ycsb_a", degree, OPS, op_ycsb_a);
+	run("ycsb_b", degree, OPS, op_ycsb_b);
+	run("ycsb_e", degree, OPS, op_ycsb_e);
+
+	/* The keys added by ycsb_e stay, only the original ones are deleted */
+	for (stride = N / 2 + 1; gcd(stride, N) != 1; stride++);
+	run("delete_rand", degree, N, op_delete_rand);
+	btree_free(&tree);
+}
+
+static size_t parse_list(char *arg, size_t *out) {
+	size_t n = 0;
+	char  *tok;
+
+	for (tok = strtok(arg, ","); tok != NULL && n < MAX_LIST;
+	     tok = strtok(NULL, ",")) {
+		out[n++] = strtoul(tok, NULL, 10);
+	}
+	return n;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-n keys] [-o operations] [-d degrees] "
+	                "[-e sizes] [-w workloads]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+	size_t degrees[MAX_LIST] = { 4, 8, 16, 32, 64 };
+	size_t sizes[MAX_LIST]   = { 8, 64, 256 };
+	size_t ndegrees = 5;
+	size_t nsizes   = 3;
+	size_t d, e, w;
+	char  *tok;
+	int    opt;
+
+	for (w = 0; w < NWORKLOADS; w++) enabled[w] = 1;
+
+	while ((opt = getopt(argc, argv, "n:o:d:e:w:")) != -1) {
+		switch (opt) {
+		case 'n': N   = strtoul(optarg, NULL, 10); break;
+		case 'o': OPS = strtoul(optarg, NULL, 10); break;
+		case 'd': ndegrees = parse_list(optarg, degrees); break;
+		case 'e': nsizes   = parse_list(optarg, sizes);   break;
+		case 'w':
+			for (w = 0; w < NWORKLOADS; w++) enabled[w] = 0;
+			for (tok = strtok(optarg, ","); tok != NULL;
+			     tok = strtok(NULL, ",")) {
+				for (w = 0; w < NWORKLOADS; w++) {
+					if (strcmp(workloads[w], tok) == 0) break;
+				}
+				if (w == NWORKLOADS) usage(argv[0]);
+				enabled[w] = 1;
+			}
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (N < 2 || OPS == 0) usage(argv[0]);
+	for (e = 0; e < nsizes; e++) {
+		if (sizes[e] < sizeof(uint64_t) || sizes[e] > sizeof(elem)) {
+			usage(argv[0]);
+		}
+	}
+
+	lat = malloc(sizeof(uint64_t) * ((N > OPS ? N : OPS) / LAT_SAMPLE + 1));
+	zipf_init(&zipf, N, ZIPF_THETA);
+
+	puts("workload,degree,elem_size,keys,ops,seconds,ops_per_sec,"
+	     "p50_ns,p90_ns,p99_ns,p999_ns,max_ns");
+	for (e = 0; e < nsizes; e++) {
+		elem_size = sizes[e];
+		for (d = 0; d < ndegrees; d++) run_config(degrees[d]);
+	}
+
+	free(lat);
+	return EXIT_SUCCESS;
+}
@@ -1,11 +1,22 @@
-#include "btree.h"
+#define _POSIX_C_SOURCE 200809L
 
+#include "btree.h"
+#include "btree_bplus.h"
+#include "btree_file.h"
+#include "btree_layout.h"
+#include "btree_simd.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <sys/types.h>
+#include <unistd.h>
 
 /* Definitions */
 typedef unsigned char byte;
@@ -15,6 +26,41 @@ struct node {
 	ssize_t      c; /* number of children */
 	byte        *items;
 	struct node **children;
+	/* The number of parents, trees and snapshots referring to this node, see
+	 * `node_own`. Once there are none, the next node in the retire list */
+	union {
+		size_t       refs;
+		struct node *retired;
+	} shared;
+};
+
+/* Serialized trees, see `btree_dump`. The header is followed by all
+ * elements in order, in native byte order */
+#define BTREE_DUMP_MAGIC   "BTREEDMP"
+#define BTREE_DUMP_VERSION 1
+
+#define BTREE_DUMP_ORDER_STATS 0x1
+#define BTREE_DUMP_SPLIT       0x2
+
+struct dump_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t elem_size;
+	uint64_t degree;
+	uint64_t count;
+};
+
+/* Values of key-value trees are drawn from slabs of this many */
+#define BTREE_VALUE_SLAB 256
+
+/* Fixed-size object pool, see `pool_get` */
+struct pool {
+	size_t  obj_size;
+	size_t  align;
+	size_t  per_slab;
+	void   *free;
+	void   *slabs;
 };
 
 struct btree {
@@ -22,6 +68,19 @@ struct btree {
 	void *(*alloc)(size_t);
 	void  (*dealloc)(void*);
 
+	/* Node memory, see `node_layout`. Drawn from the allocator or, if
+	 * `pooled`, from slabs of `slab_nodes` nodes */
+	enum btree_layout layout;
+	bool              pooled;
+	size_t            slab_nodes;
+	size_t            items_offset;    /* packed layout only */
+	size_t            children_offset; /* packed layout only */
+	struct pool       leaf_pool;       /* packed: whole leafs */
+	struct pool       inner_pool;      /* packed: whole branching nodes */
+	struct pool       node_pool;       /* split: `struct node`s */
+	struct pool       items_pool;      /* split: item arrays */
+	struct pool       children_pool;   /* split: child pointer arrays */
+
 	/* Size stuffs */
 	size_t elem_size;
 	ssize_t degree;
@@ -30,6 +89,51 @@ struct btree {
 
 	/* comparison */
 	int (*cmp)(const void *a, const void *b);
+
+	/* Number of elements */
+	size_t count;
+	/* Whether branching nodes keep the sizes of their subtrees */
+	bool   order_stats;
+	/* What inserting an element equal to one present does */
+	enum btree_duplicates duplicates;
+
+	/* Key-value trees: elements are the key, padded to `value_offset`, and a
+	 * pointer to the value, which lives in `value_pool`. See `btree_new_kv` */
+	size_t      key_size;
+	size_t      value_size; /* 0 for plain trees */
+	size_t      value_offset;
+	struct pool value_pool;
+	byte       *kv_elem; /* room to put an element together */
+
+	/* Tombstones: deleted elements of key-value trees stay in their node,
+	 * with a NULL value, until `btree_compact` removes them. It goes on
+	 * behind `compact_key`, if `compact_resume`. See `btree_set_tombstones` */
+	bool        tombstones;
+	size_t      dead;
+	byte       *compact_key;
+	bool        compact_resume;
+
+	/* in-node search, see `node_find` */
+	enum btree_search search;
+	ssize_t           search_cutoff;
+	btree_find_kernel find_kernel; /* integer trees only */
+	bool              prefetch;    /* see `node_prefetch` */
+
+	/* Pages of a file, in place of `root`, see `btree_open` */
+	struct btree_file *file;
+	/* A B+tree, in place of `root`, see `btree_new_bplus` */
+	struct bplus      *bplus;
+
+#ifdef BTREE_STATS
+	/* see `btree_stats` */
+	struct btree_counters counters;
+#endif
+
+	/* Snapshots: the tree a snapshot was taken from, NULL for the tree
+	 * itself, which frees the nodes its snapshots leave in `retired`.
+	 * Keep `retired` last, see `btree_snapshot` */
+	struct btree *origin;
+	struct node  *retired;
 };
 
 struct btree_iter_t {
@@ -40,6 +144,21 @@ struct btree_iter_t {
 	} stack[512];
 	/* This heavily relies on the assumption that a tree never grows deeper than
 	 * 512 nodes */
+	struct file_iter file;        /* file-backed trees only */
+	struct bplus_pos bplus;       /* B+trees only */
+};
+
+/* A cursor sits on one element: the item at `pos` of the node on top of the
+ * stack. Every node below the top has `pos` set to the child we descended
+ * into. With an empty stack the cursor is off one end of the tree. */
+struct btree_cursor_t {
+	size_t head; /* number of nodes on the stack */
+	bool   before_first; /* which end the cursor is off, if `head` is 0 */
+	struct {
+		ssize_t      pos;
+		struct node *node;
+	} stack[512];
+	struct bplus_pos bplus; /* B+trees only, off the tree if `leaf` is NULL */
 };
 
 /**********************/
@@ -49,75 +168,372 @@ struct btree_iter_t {
 node_leaf(node) (node->children == NULL)
 
 #define \
-node_maxdegree(t) (2 * t - 1)
+node_maxdegree(t) BTREE_NODE_MAX_ITEMS(t)
+
+#define \
+node_mindegree(t) BTREE_NODE_MIN_ITEMS(t)
+
+#define \
+node_full(degree, t) BTREE_NODE_FULL(degree, t)
 
+/* Number of elements in each subtree of a branching node, stored right behind
+ * its child pointers. Only there if `btree->order_stats` */
 #define \
-node_mindegree(t) (t - 1)
+node_counts(btree, node) \
+	((size_t*)((node)->children + BTREE_NODE_CHILD_SLOTS((btree)->degree)))
 
+/* Counting for `btree_stats`, if built with `BTREE_STATS`. Readers sharing
+ * a tree may lose counts, but never block each other over them */
+#ifdef BTREE_STATS
 #define \
-node_full(degree, t) (t->n >= 2 * degree - 1)
+stat_add(btree, counter, k) \
+	__atomic_store_n(&(btree)->counters.counter, \
+	                 __atomic_load_n(&(btree)->counters.counter, \
+	                                 __ATOMIC_RELAXED) + (k), \
+	                 __ATOMIC_RELAXED)
+#define \
+stat_get(btree, counter) \
+	__atomic_load_n(&(btree)->counters.counter, __ATOMIC_RELAXED)
+#else
+#define \
+stat_add(btree, counter, k) ((void)0)
+#endif
+
+/* All comparisons go through this */
+#define \
+elem_cmp(btree, a, b) (stat_add(btree, cmps, 1), (btree)->cmp(a, b))
 
 /* Node memory */
 
-/* `node_new` allocates a new leaf node, children should be added and allocated
- * when the node is no longer a leaf node */
-struct node* node_new(const ssize_t degree, const size_t elem_size) {
-	const size_t max_items = 2 * degree;
-	struct node *retval = calloc(1, sizeof(struct node));
+/* Alignment the allocators are assumed to guarantee */
+#define MEM_ALIGN 16
+
+#define \
+elem_value(btree, elem) (*(void**)((byte*)(elem) + (btree)->value_offset))
+
+/* Whether `elem` is a tombstone, see `btree_set_tombstones` */
+#define \
+elem_dead(btree, elem) \
+	((btree)->tombstones && elem_value(btree, elem) == NULL)
+
+#define \
+align_up(size, align) (((size) + (align) - 1) / (align) * (align))
+
+byte* mem_align(byte *p, const size_t align) {
+	return p + (align_up((size_t)p, align) - (size_t)p);
+}
+
+/* `mem_get` requests `size` bytes from the tree's allocator, aligned to
+ * `align`. Blocks aligned beyond `MEM_ALIGN` keep the pointer the allocator
+ * returned right in front of them. */
+void* mem_get(struct btree *btree, const size_t size, const size_t align) {
+	byte *raw;
+	byte *obj;
+
+	if (align <= MEM_ALIGN) return btree->alloc(size);
+
+	raw = btree->alloc(size + sizeof(void*) + align - 1);
+	if (raw == NULL) return NULL;
+
+	obj = mem_align(raw + sizeof(void*), align);
+	((void**)obj)[-1] = raw;
+	return obj;
+}
+
+void mem_put(struct btree *btree, void *obj, const size_t align) {
+	if (align <= MEM_ALIGN) btree->dealloc(obj);
+	else                    btree->dealloc(((void**)obj)[-1]);
+}
+
+void pool_init(struct pool *pool,
+               const size_t obj_size,
+               const size_t align,
+               const size_t per_slab) {
+	pool->obj_size = align_up(obj_size, align);
+	pool->align    = align;
+	pool->per_slab = per_slab;
+	pool->free     = NULL;
+	pool->slabs    = NULL;
+}
+
+/* Every slab starts with a pointer to the next slab, followed by `per_slab`
+ * objects from the first `align`ed address on. Free objects are linked
+ * together through their first word. */
+void* pool_get(struct btree *btree, struct pool *pool) {
+	void *obj;
+
+	if (pool->free == NULL) {
+		byte  *slab = btree->alloc(sizeof(void*) + pool->align - 1
+		                           + pool->obj_size * pool->per_slab);
+		byte  *objs;
+		size_t i;
+
+		if (slab == NULL) return NULL;
+
+		*(void**)slab = pool->slabs;
+		pool->slabs   = slab;
+		objs          = mem_align(slab + sizeof(void*), pool->align);
+
+		/* Push in reverse, so objects are handed out in address order */
+		for (i = pool->per_slab; i > 0; i--) {
+			void *o = objs + pool->obj_size * (i - 1);
+			*(void**)o = pool->free;
+			pool->free = o;
+		}
+	}
+
+	obj        = pool->free;
+	pool->free = *(void**)obj;
+	return obj;
+}
+
+void pool_put(struct pool *pool, void *obj) {
+	*(void**)obj = pool->free;
+	pool->free   = obj;
+}
+
+void pool_destroy(struct btree *btree, struct pool *pool) {
+	while (pool->slabs != NULL) {
+		void *next = *(void**)pool->slabs;
+		btree->dealloc(pool->slabs);
+		pool->slabs = next;
+	}
+	pool->free = NULL;
+}
+
+/* All node memory goes through these two, which either use the pools or the
+ * tree's allocator */
+void* node_mem_get(struct btree *btree, struct pool *pool) {
+	if (btree->pooled) return pool_get(btree, pool);
+	return mem_get(btree, pool->obj_size, pool->align);
+}
+
+void node_mem_put(struct btree *btree, struct pool *pool, void *obj) {
+	if (obj == NULL) return;
+	if (btree->pooled) pool_put(pool, obj);
+	else               mem_put(btree, obj, pool->align);
+}
+
+/* `node_layout` sizes the node memory after the degree, element size and
+ * layout of the tree.
+ * In the packed layout a node is a single block, aligned to a cache line:
+ *
+ *   | struct node | items | children (branching nodes only) |
+ *
+ * so the header shares its cache line with the first items, and leafs, which
+ * are most of the nodes, do not pay for child pointers. The split layout
+ * allocates the header, the items and the children separately. */
+void node_layout(struct btree *btree) {
+	const size_t items_size    = BTREE_NODE_ITEM_SLOTS(btree->degree)
+	                           * btree->elem_size;
+	const size_t children_size = BTREE_NODE_CHILD_SLOTS(btree->degree)
+	                           * (sizeof(struct node*)
+	                              + (btree->order_stats ? sizeof(size_t) : 0));
+	/* Only branching nodes have children, which are a minority */
+	const size_t inner_per_slab = btree->slab_nodes / 8 + 1;
+
+	btree->items_offset    = align_up(sizeof(struct node), MEM_ALIGN);
+	btree->children_offset = align_up(btree->items_offset + items_size,
+	                                  MEM_ALIGN);
+
+	pool_init(&btree->leaf_pool, btree->children_offset,
+	          BTREE_CACHE_LINE, btree->slab_nodes);
+	pool_init(&btree->inner_pool, btree->children_offset + children_size,
+	          BTREE_CACHE_LINE, inner_per_slab);
+
+	pool_init(&btree->node_pool, sizeof(struct node),
+	          MEM_ALIGN, btree->slab_nodes);
+	pool_init(&btree->items_pool, items_size,
+	          MEM_ALIGN, btree->slab_nodes);
+	pool_init(&btree->children_pool, children_size,
+	          MEM_ALIGN, inner_per_slab);
+}
+
+/* Hands all slabs back, only to be used when no node is left */
+void node_pools_destroy(struct btree *btree) {
+	pool_destroy(btree, &btree->leaf_pool);
+	pool_destroy(btree, &btree->inner_pool);
+	pool_destroy(btree, &btree->node_pool);
+	pool_destroy(btree, &btree->items_pool);
+	pool_destroy(btree, &btree->children_pool);
+}
+
+/* `node_new` allocates a new, empty node, a leaf if `leaf` and otherwise a
+ * branching node with room for children */
+struct node* node_new(struct btree *btree, const bool leaf) {
+	struct node *retval;
+
+	if (btree->layout == BTREE_LAYOUT_PACKED) {
+		byte *block = node_mem_get(btree, leaf ? &btree->leaf_pool
+		                                       : &btree->inner_pool);
+		if (block == NULL) return NULL;
+
+		retval = (struct node*)block;
+		retval->items    = block + btree->items_offset;
+		retval->children = leaf ? NULL
+		                        : (struct node**)(block + btree->children_offset);
+	} else {
+		retval = node_mem_get(btree, &btree->node_pool);
+		if (retval == NULL) return NULL;
+
+		retval->items    = node_mem_get(btree, &btree->items_pool);
+		retval->children = leaf ? NULL
+		                        : node_mem_get(btree, &btree->children_pool);
+		if (retval->items == NULL || (!leaf && retval->children == NULL)) {
+			node_mem_put(btree, &btree->children_pool, retval->children);
+			node_mem_put(btree, &btree->items_pool,    retval->items);
+			node_mem_put(btree, &btree->node_pool,     retval);
+			return NULL;
+		}
+	}
+
+	retval->n           = 0;
+	retval->c           = 0;
+	retval->shared.refs = 1;
 
-	retval->n = 0;
-	retval->c = 0;
-	retval->items    = calloc(max_items, elem_size);
-	retval->children = NULL;
+	if (!leaf) {
+		ssize_t c;
+		for (c = 0; c < BTREE_NODE_CHILD_SLOTS(btree->degree); c++) {
+			retval->children[c] = NULL;
+		}
+	}
 
 	return retval;
 }
 
-/* `node_transition` turns a leaf node into a non-leaf. Children are not
- * allocated.
- * returnvalue: `false` if we we're unable to allocate space for the new
- * children. */
-bool node_transition(struct node *node, const ssize_t degree) {
-	const int max_children = 2 * degree + 1;
-	int c;
+/* `node_prefetch` starts loading the header of `x` and, in the packed layout,
+ * up to `BTREE_PREFETCH_BYTES` of its items right behind it, so the probes of
+ * the in-node search all hit lines on their way in rather than missing one
+ * after the other. The items of the split layout are elsewhere, and finding
+ * them takes loading the header first. */
+void node_prefetch(const struct btree *btree, const struct node *x) {
+#ifdef __GNUC__
+	const byte   *p     = (const byte*)x;
+	const size_t  items = BTREE_NODE_ITEM_SLOTS(btree->degree) * btree->elem_size;
+	const byte   *end   = p + btree->items_offset
+	                    + (items < BTREE_PREFETCH_BYTES ? items : BTREE_PREFETCH_BYTES);
+
+	if (btree->layout != BTREE_LAYOUT_PACKED) end = p + 1;
+	for (; p < end; p += BTREE_CACHE_LINE) __builtin_prefetch(p);
+#else
+	(void)btree;
+	(void)x;
+#endif
+}
+
+/* `node_total` is the number of elements in the subtree rooted at `node` */
+size_t node_total(struct btree *btree, const struct node *node) {
+	size_t  total = node->n;
+	ssize_t i;
+
+	if (node_leaf(node)) return total;
 
-	if (!node_leaf(node)) {
-		perror("node_transition was called on an already non-leaf node?");
-		return false;
+	if (btree->order_stats) {
+		for (i = 0; i < node->c; i++) total += node_counts(btree, node)[i];
+	} else {
+		for (i = 0; i < node->c; i++) total += node_total(btree, node->children[i]);
+	}
+	return total;
+}
+
+/* `node_release` frees the memory of `node` itself, leaving its children be */
+void node_release(struct btree *btree, struct node *node) {
+	if (btree->layout == BTREE_LAYOUT_PACKED) {
+		node_mem_put(btree, node_leaf(node) ? &btree->leaf_pool
+		                                    : &btree->inner_pool, node);
+	} else {
+		node_mem_put(btree, &btree->children_pool, node->children);
+		node_mem_put(btree, &btree->items_pool,    node->items);
+		node_mem_put(btree, &btree->node_pool,     node);
 	}
+}
 
-	/* Allocate pointers for children */
-	node->children = calloc(max_children, sizeof(struct node*));
+/* Snapshots hand the nodes they free over to the tree they were taken from,
+ * whose allocator is not to be used from other threads. `node_retire` pushes
+ * `node` onto its list, `node_reclaim` frees the list */
+void node_retire(struct btree *origin, struct node *node) {
+	struct node *head = __atomic_load_n(&origin->retired, __ATOMIC_RELAXED);
 
-	if (node->children == NULL) {
-		perror("could not allocate space for children pointers");
-		return false;
+	do {
+		node->shared.retired = head;
+	} while (!__atomic_compare_exchange_n(&origin->retired, &head, node, true,
+	                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void node_reclaim(struct btree *btree) {
+	struct node *node;
+
+	if (__atomic_load_n(&btree->retired, __ATOMIC_RELAXED) == NULL) return;
+
+	node = __atomic_exchange_n(&btree->retired, NULL, __ATOMIC_ACQUIRE);
+	while (node != NULL) {
+		struct node *next = node->shared.retired;
+		node_release(btree, node);
+		node = next;
 	}
+}
+
+/* `node_free` drops a reference to `*node`, and frees it along with its
+ * subtree once nothing refers to it anymore */
+void node_free(struct btree *btree, struct node **node) {
+	struct node *x = *node;
+
+	if (x == NULL) return;
+	*node = NULL;
+
+	if (__atomic_sub_fetch(&x->shared.refs, 1, __ATOMIC_ACQ_REL) > 0) return;
 
-	/* Allocate children */
-	for (c = 0; c < max_children; c++) {
-		node->children[c] = NULL;
+	if (!node_leaf(x)) {
+		ssize_t i;
+		for (i = 0; i < x->c; i++) {
+			node_free(btree, &x->children[i]);
+		}
 	}
 
-	return true;
+	if (btree->origin != NULL) node_retire(btree->origin, x);
+	else                       node_release(btree, x);
 }
 
-void node_free(struct node **node, size_t elem_size, void (*dealloc)(void*)) {
-	if (*node == NULL) return;
+/* `node_own` makes sure the node at `*node` is referred to by its parent
+ * alone, which is required before writing to it. If a snapshot shares it, it
+ * is replaced by a copy, which shares the children in turn. Copying the nodes
+ * on the way down like this leaves whatever snapshots see untouched.
+ * returnvalue: `false` if we ran out of memory */
+bool node_own(struct btree *btree, struct node **node) {
+	struct node *x = *node;
+	struct node *copy;
+
+	if (__atomic_load_n(&x->shared.refs, __ATOMIC_ACQUIRE) == 1) return true;
 
-	if (!node_leaf((*node))) {
+	copy = node_new(btree, node_leaf(x));
+	if (copy == NULL) {
+		fputs("BTree error: Failed to copy node shared with a snapshot!\n", stderr);
+		return false;
+	}
+
+	copy->n = x->n;
+	copy->c = x->c;
+	memcpy(copy->items, x->items, btree->elem_size * x->n);
+	if (!node_leaf(x)) {
 		ssize_t i;
-		for (i = 0; i < (*node)->c; i++) {
-			node_free(&((*node)->children[i]), elem_size, dealloc);
+		for (i = 0; i < x->c; i++) {
+			copy->children[i] = x->children[i];
+			__atomic_add_fetch(&x->children[i]->shared.refs, 1, __ATOMIC_RELAXED);
+		}
+		if (btree->order_stats) {
+			memcpy(node_counts(btree, copy), node_counts(btree, x),
+			       sizeof(size_t) * x->c);
 		}
-		dealloc((*node)->children);
 	}
 
-	dealloc((*node)->items);
-	(*node)->items = NULL;
+	node_free(btree, node);
+	*node = copy;
+	return true;
+}
 
-	dealloc(*node);
-	*node = NULL;
+/* Owns the children `i` and `i+1` of `x`, which are about to be rebalanced */
+bool node_own_pair(struct btree *btree, struct node *x, ssize_t i) {
+	return node_own(btree, &x->children[i]) && node_own(btree, &x->children[i+1]);
 }
 
 
@@ -131,19 +547,26 @@ void node_free(struct node **node, size_t elem_size, void (*dealloc)(void*)) {
  * full nodes we encounter on the way down, including the leafs themselves.
  * By doing this, we are assured that whenever we split a node, its parent has
  * room for the median key. */
-void node_tree_split_child(
-		const ssize_t t,
-		const size_t elem_size,
+bool node_tree_split_child(
+		struct btree *btree,
 		struct node *nonfull,
 		ssize_t i) {
-	struct node *z = node_new(t, elem_size);
-	struct node *y = nonfull->children[i];
+	const ssize_t t         = btree->degree;
+	const size_t  elem_size = btree->elem_size;
+	struct node *y;
+	struct node *z;
 	ssize_t j;
 
+	if (!node_own(btree, &nonfull->children[i])) return false;
+	y = nonfull->children[i];
 	/* `z` should be a branching node if `y` is */
-	if (!node_leaf(y)) {
-		node_transition(z, t);
+	z = node_new(btree, node_leaf(y));
+
+	if (z == NULL) {
+		fputs("BTree error: Failed to allocate new node for split!\n", stderr);
+		return false;
 	}
+	stat_add(btree, splits, 1);
 
 	z->n = t - 1;
 
@@ -172,6 +595,22 @@ void node_tree_split_child(
 		nonfull->children[j+1] = nonfull->children[j];
 	}
 
+	if (btree->order_stats) {
+		size_t *counts = node_counts(btree, nonfull);
+		size_t  z_total = z->n;
+
+		if (!node_leaf(z)) {
+			memcpy(node_counts(btree, z), node_counts(btree, y) + t,
+			       sizeof(size_t) * t);
+			for (j = 0; j < t; j++) z_total += node_counts(btree, z)[j];
+		}
+		for (j = nonfull->n; j > i; j--) {
+			counts[j+1] = counts[j];
+		}
+		counts[i+1]  = z_total;
+		counts[i]   -= z_total + 1;
+	}
+
 	/* new child */
 	nonfull->children[i+1] = z;
 	nonfull->c++;
@@ -191,6 +630,7 @@ void node_tree_split_child(
 	       elem_size);
 
 	nonfull->n++;
+	return true;
 }
 
 /* `node_child_merge`: Merges two children around the key at index `i` (k)
@@ -203,13 +643,16 @@ void node_tree_split_child(
  * WARNING: THIS FUNCTION ASSUMES THAT `i` IS A VALID INDEX
  */
 void node_child_merge(
+		struct btree *btree,
 		struct node *x,
-		ssize_t i,
-		const size_t elem_size, void (*dealloc)(void*)) {
+		ssize_t i) {
+	const size_t elem_size = btree->elem_size;
 	struct node* y = x->children[i  ];
 	struct node* z = x->children[i+1];
 	int j = 0;
 
+	stat_add(btree, merges, 1);
+
 	/* append k to y */
 	memcpy(y->items + (elem_size * y->n++),
 	       x->items + (elem_size * i),
@@ -225,6 +668,19 @@ void node_child_merge(
 	for (j = 0; j < z->c; j++) {
 		y->children[y->c + j] = z->children[j];
 	}
+
+	if (btree->order_stats) {
+		size_t *counts = node_counts(btree, x);
+
+		if (!node_leaf(z)) {
+			memcpy(node_counts(btree, y) + y->c, node_counts(btree, z),
+			       sizeof(size_t) * z->c);
+		}
+		counts[i] += 1 + counts[i+1];
+		for (j = i+1; j < x->c; j++) {
+			counts[j] = counts[j+1];
+		}
+	}
 	y->c += z->c;
 
 	/* Remove z from x */
@@ -240,18 +696,21 @@ void node_child_merge(
 	        elem_size * (x->n - i));
 	x->n--;
 
-	dealloc(z); /* DO NOT USE THE RECURSIVE ONE AS CHILDREN WILL BE LOST!!! */
+	node_release(btree, z); /* DO NOT USE THE RECURSIVE ONE AS CHILDREN WILL BE LOST!!! */
 }
 
 /* ASSUME i < x->c */
 void node_shift_left(
+		struct btree *btree,
 		struct node *x,
-		ssize_t i,
-		const size_t elem_size) {
+		ssize_t i) {
+	const size_t elem_size = btree->elem_size;
 	struct node* y = x->children[i  ];
 	struct node* z = x->children[i+1];
 	byte *x_k = x->items + (elem_size * i);
 
+	stat_add(btree, shifts_left, 1);
+
 	/* Append x.k[i] to y */
 	memcpy(y->items + (elem_size * y->n++),
 	       x_k,
@@ -267,6 +726,23 @@ void node_shift_left(
 	        z->items + elem_size,
 	        elem_size * (z->n - 1));
 
+	if (btree->order_stats) {
+		size_t moved = 1;
+
+		if (!node_leaf(z)) {
+			size_t *z_counts = node_counts(btree, z);
+			ssize_t j;
+
+			moved += z_counts[0];
+			node_counts(btree, y)[y->c] = z_counts[0];
+			for (j = 0; j < z->c; j++) {
+				z_counts[j] = z_counts[j+1];
+			}
+		}
+		node_counts(btree, x)[i]   += moved;
+		node_counts(btree, x)[i+1] -= moved;
+	}
+
 	if (!node_leaf(z)) {
 		ssize_t j;
 		/* append first child of z to y */
@@ -283,13 +759,16 @@ void node_shift_left(
 }
 
 void node_shift_right(
+		struct btree *btree,
 		struct node *x,
-		ssize_t i,
-		const size_t elem_size) {
+		ssize_t i) {
+	const size_t elem_size = btree->elem_size;
 	struct node* y = x->children[i  ];
 	struct node* z = x->children[i+1];
 	byte *x_k = x->items + (elem_size * i);
 
+	stat_add(btree, shifts_right, 1);
+
 	/* Shift z's items right */
 	memmove(z->items + elem_size,
 	        z->items,
@@ -305,6 +784,23 @@ void node_shift_right(
 	       y->items + (elem_size * --(y->n)),
 	       elem_size);
 
+	if (btree->order_stats) {
+		size_t moved = 1;
+
+		if (!node_leaf(z)) {
+			size_t *z_counts = node_counts(btree, z);
+			ssize_t j;
+
+			moved += node_counts(btree, y)[y->c - 1];
+			for (j = z->c; j > 0; j--) {
+				z_counts[j] = z_counts[j-1];
+			}
+			z_counts[0] = node_counts(btree, y)[y->c - 1];
+		}
+		node_counts(btree, x)[i]   -= moved;
+		node_counts(btree, x)[i+1] += moved;
+	}
+
 	if (!node_leaf(z)) {
 		size_t j;
 		/* Shift z's children right */
@@ -320,135 +816,340 @@ void node_shift_right(
 	z->n++;
 }
 
-/* return: Returns the new root, if a split happens */
-void node_insert_nonfull(
+/* `node_find` locates `key` within the items of `x`.
+ * returnvalue: the index of the first item that is not less than `key`, which
+ * is `x->n` if every item is less than `key`. This is also the index of the
+ * child to descend into, should `key` not be present in `x`.
+ * `cmp_res`: set to the result of comparing `key` against the item at the
+ * returned index, or `BTREE_CMP_GT` if the index is `x->n`. */
+ssize_t node_find(struct btree *btree,
+                  const struct node *x,
+                  const void *key,
+                  int *cmp_res) {
+	const size_t elem_size = btree->elem_size;
+	ssize_t lo  = 0;
+	ssize_t hi  = x->n;
+	int     res = BTREE_CMP_GT; /* result of comparing against items[hi] */
+	int     c;
+
+	stat_add(btree, finds, 1);
+	if (btree->search == BTREE_SEARCH_SIMD) {
+		return btree->find_kernel(x->items, x->n, key, cmp_res);
+	}
+
+	if (btree->search != BTREE_SEARCH_LINEAR) {
+		const ssize_t cutoff = btree->search == BTREE_SEARCH_BINARY
+		                     ? 0
+		                     : btree->search_cutoff;
+
+		/* Narrow down [lo, hi) until the remainder is small enough to scan */
+		while (hi - lo > cutoff) {
+			const ssize_t mid = lo + (hi - lo) / 2;
+			c = elem_cmp(btree, key, x->items + elem_size * mid);
+			if (c > 0) {
+				lo = mid + 1;
+			} else {
+				hi  = mid;
+				res = c;
+			}
+		}
+	}
+
+	while (lo < hi && (c = elem_cmp(btree, key, x->items + elem_size * lo)) > 0) {
+		lo++;
+	}
+	if (lo < hi) res = c;
+
+	*cmp_res = res;
+	return lo;
+}
+
+/* `node_find_upper` is `node_find` for the first item greater than `key` */
+ssize_t node_find_upper(struct btree *btree,
+                        const struct node *x,
+                        const void *key,
+                        int *cmp_res) {
+	ssize_t i = node_find(btree, x, key, cmp_res);
+
+	while (i < x->n && *cmp_res == 0) {
+		i++;
+		*cmp_res = i < x->n ? elem_cmp(btree, key, x->items + btree->elem_size * i)
+		                    : BTREE_CMP_GT;
+	}
+	return i;
+}
+
+/* `node_insert_nonfull` inserts `elem` below the non-full `root`. Multisets
+ * descend past equal items, so that equal elements keep the order they were
+ * inserted in; the other modes stop at the first equal item, which is
+ * overwritten by `BTREE_DUPLICATES_REPLACE`.
+ * returnvalue: the inserted element, or the equal one found, in which case
+ * `*inserted` is false. NULL if we ran out of memory splitting nodes */
+void* node_insert_nonfull(
+		struct btree *btree,
 		struct node *root,
 		void *elem,
-		const ssize_t degree,
-		const size_t elem_size,
-		int (*cmp)(const void *a, const void *b)) {
-
-	/* TODO check correctness */
-	ssize_t i = root->n - 1;
+		enum btree_duplicates mode,
+		bool *inserted) {
+	const size_t elem_size = btree->elem_size;
+	const bool   multi     = mode == BTREE_DUPLICATES_MULTISET;
+	int     res;
+	ssize_t i = multi ? node_find_upper(btree, root, elem, &res)
+	                  : node_find(btree, root, elem, &res);
+	byte   *slot;
+
+	if (!multi && res == 0) {
+		slot = root->items + elem_size * i;
+		if (mode == BTREE_DUPLICATES_REPLACE) memcpy(slot, elem, elem_size);
+		*inserted = false;
+		return slot;
+	}
 
 	if (node_leaf(root)) {
-		size_t offset = elem_size * i;
-		while (i >= 0 && cmp(elem, root->items + offset) < 0) {
-			/* TODO This can be done with one memcpy */
-			memcpy(root->items + offset + elem_size,
-			       root->items + offset,
-			       elem_size);
-
-			i--;
-			offset = elem_size * i;
-		}
-		offset = elem_size * (++i);
-		memcpy(root->items + offset, elem, elem_size);
+		slot = root->items + elem_size * i;
+		memmove(slot + elem_size, slot, elem_size * (root->n - i));
+		memcpy(slot, elem, elem_size);
 		root->n++;
+		btree->count++;
+		*inserted = true;
+		return slot;
 
 	} else {
-		size_t offset = elem_size * i;
-		struct node *nextchild = NULL;
-		while (i >= 0 && cmp(elem, root->items + offset) < 0) {
-			i--;
-			offset = elem_size * i;
+		struct node *nextchild = root->children[i];
+		if (node_full(btree->degree, nextchild)) {
+			if (!node_tree_split_child(btree, root, i)) return NULL;
+			/* The median moved up into items[i], only it needs comparing */
+			res = elem_cmp(btree, elem, root->items + elem_size * i);
+			if (!multi && res == 0) {
+				return node_insert_nonfull(btree, root, elem, mode, inserted);
+			}
+			if (res >= 0) i++;
 		}
-		i++;
+		if (!node_own(btree, &root->children[i])) return NULL;
 		nextchild = root->children[i];
-		if (node_full(degree, nextchild)) {
-			/* TODO Check if the root has changed */
-			node_tree_split_child(degree, elem_size, root, i);
-			if (cmp(elem, root->items + elem_size * i) > 0) {
-				nextchild = root->children[++i];
-			}
+		slot = node_insert_nonfull(btree, nextchild, elem, mode, inserted);
+		if (slot != NULL && *inserted && btree->order_stats) {
+			node_counts(btree, root)[i]++;
 		}
-		node_insert_nonfull(nextchild, elem, degree, elem_size, cmp);
+		return slot;
 	}
 }
 
-/* Returns the new root, if a split occurs */
-struct node* node_insert(
-		struct node *root,
+/* `node_insert` inserts `elem` into the tree as `node_insert_nonfull` does,
+ * growing a new root first if the root is full */
+void* node_insert(
+		struct btree *btree,
 		void *elem,
-		const ssize_t degree,
-		const size_t elem_size,
-		int (*cmp)(const void *a, const void *b)) {
+		enum btree_duplicates mode,
+		bool *inserted) {
+	struct node *s;
 
-	struct node *s = root;
+	*inserted = false;
+	if (btree->root == NULL) {
+		btree->root = node_new(btree, true);
+		if (btree->root == NULL) {
+			fputs("BTree error: Failed to create new root node!\n", stderr);
+			return NULL;
+		}
+	} else if (!node_own(btree, &btree->root)) {
+		return NULL;
+	}
 
-	if (node_full(degree, root)) {
-		s = node_new(degree, elem_size);
+	if (node_full(btree->degree, btree->root)) {
+		s = node_new(btree, false);
 		if (s == NULL) {
 			fputs("BTree error: Failed to allocate new node for insertion!\n", stderr);
 			return NULL;
 		}
-		node_transition(s, degree);
-		s->children[s->c++] = root;
-		/* TODO Check if the root has changed */
-		node_tree_split_child(degree, elem_size, s, 0);
-		node_insert_nonfull(s, elem, degree, elem_size, cmp);
-	}
-	else {
-		node_insert_nonfull(s, elem, degree, elem_size, cmp);
+		s->children[s->c++] = btree->root;
+		if (btree->order_stats) node_counts(btree, s)[0] = btree->count;
+		if (!node_tree_split_child(btree, s, 0)) {
+			node_release(btree, s);
+			return NULL;
+		}
+		btree->root = s;
 	}
-	return s;
+	return node_insert_nonfull(btree, btree->root, elem, mode, inserted);
 }
 
-void* node_search(struct node *x,
-                  void *key,
-                  int(*cmp)(const void *a, const void *b),
-                  const size_t elem_size) {
-	/* We set to one, since we pre-emptively do a comparison with the assumption
-	 * that there's already one in the items */
-	ssize_t i = 0;
-	int    last_cmp_res;
+/* `node_insert_run` inserts a prefix of the `n` sorted elements of `run` in a
+ * single descent from the non-full `root`, splitting full nodes on the way
+ * down like `node_insert_nonfull`. All elements that belong into the same leaf
+ * as the first one are merged into it at once, as far as it has room.
+ * Unless the tree is a multiset, `run` must not hold equal elements, and the
+ * ones already present are handled as by `node_insert_nonfull`, which may
+ * reorder the prefix.
+ * returnvalue: the number of elements dealt with, 0 if a split failed */
+size_t node_insert_run(
+		struct btree *btree,
+		struct node *root,
+		byte *run,
+		const size_t n) {
+	const size_t elem_size = btree->elem_size;
+	const bool   multi     = btree->duplicates == BTREE_DUPLICATES_MULTISET;
+	const bool   replace   = btree->duplicates == BTREE_DUPLICATES_REPLACE;
+	const byte  *upper     = NULL; /* smallest item on the path above the leaf */
+	struct node *x         = root;
+	size_t      *path[512]; /* subtree sizes along the path, if kept */
+	size_t       depth     = 0;
+	size_t k;
+	ssize_t i, j, w, first;
+
+	while (!node_leaf(x)) {
+		int res;
+		i = multi ? node_find_upper(btree, x, run, &res)
+		          : node_find(btree, x, run, &res);
+		if (!multi && res == 0) {
+			if (replace) memcpy(x->items + elem_size * i, run, elem_size);
+			return 1;
+		}
+		if (node_full(btree->degree, x->children[i])) {
+			if (!node_tree_split_child(btree, x, i)) return 0;
+			res = elem_cmp(btree, run, x->items + elem_size * i);
+			if (!multi && res == 0) {
+				if (replace) memcpy(x->items + elem_size * i, run, elem_size);
+				return 1;
+			}
+			if (res >= 0) i++;
+		}
+		if (i < x->n) upper = x->items + elem_size * i;
+		if (btree->order_stats) path[depth++] = node_counts(btree, x) + i;
+		if (!node_own(btree, &x->children[i])) return 0;
+		x = x->children[i];
+	}
 
-	while (i < x->n
-	   &&  (last_cmp_res = cmp(key, (const void*)(x->items + (i * elem_size))))
-	      > 0) {
-		i++;
+	/* Everything up to the upper fence belongs here */
+	k = 1;
+	while (k < n
+	   && (ssize_t)k < node_maxdegree(btree->degree) - x->n
+	   && (upper == NULL || elem_cmp(btree, run + elem_size * k, upper) < 0)) {
+		k++;
 	}
 
-	if ((ssize_t)i < x->n && last_cmp_res == 0) {
-		return (void*)(x->items + (i * elem_size));
-	} else if (node_leaf(x)) {
-		return NULL;
+	/* Elements already present are dropped or replace them, the others are
+	 * moved up to the back of the run, [first, k) */
+	first = 0;
+	if (!multi) {
+		i     = x->n - 1;
+		first = k;
+		for (j = k - 1; j >= 0; j--) {
+			const byte *e = run + elem_size * j;
+			int         c = BTREE_CMP_GT;
+			while (i >= 0 && (c = elem_cmp(btree, x->items + elem_size * i, e)) > 0) i--;
+			if (i >= 0 && c == 0) {
+				if (replace) memcpy(x->items + elem_size * i, e, elem_size);
+			} else if (--first != j) {
+				memcpy(run + elem_size * first, e, elem_size);
+			}
+		}
+	}
+
+	/* Merge the run into the leaf, back to front */
+	i = x->n - 1;
+	j = k - 1;
+	w = x->n + k - first - 1;
+	while (j >= first) {
+		if (i >= 0 && elem_cmp(btree, x->items + elem_size * i, run + elem_size * j) > 0) {
+			memcpy(x->items + elem_size * w--, x->items + elem_size * i--, elem_size);
+		} else {
+			memcpy(x->items + elem_size * w--, run + elem_size * j--, elem_size);
+		}
+	}
+	x->n += k - first;
+	btree->count += k - first;
+	while (depth > 0) *path[--depth] += k - first;
+
+	return k;
+}
+
+void* node_search(struct btree *btree, struct node *x, void *key) {
+	if (x != NULL && btree->prefetch) node_prefetch(btree, x);
+
+	while (x != NULL) {
+		int     res;
+		ssize_t i = node_find(btree, x, key, &res);
+
+		if (i < x->n && res == 0) {
+			return (void*)(x->items + (i * btree->elem_size));
+		} else if (node_leaf(x)) {
+			return NULL;
+		}
+
+		/* Assumption: ¬node_leaf(x) → x.children is allocated */
+		x = x->children[i];
+		if (btree->prefetch) node_prefetch(btree, x);
 	}
+	return NULL;
+}
+
+/* What `node_delete` removes from a subtree: an element equal to the key, or
+ * the first or last element. Among equal elements, only the latter two pin
+ * down which one it is, as replacing an item by its neighbour requires */
+enum delete_target {
+	DELETE_KEY,
+	DELETE_FIRST,
+	DELETE_LAST
+};
 
-	/* Assumption: ¬node_leaf(x) → x.children is allocated */
-	return node_search(x->children[i], key, cmp, elem_size);
+/* `node_delete` deletes from the subtree at `x`. For key-value trees, `value`
+ * (if not NULL) is set to the value of the element deleted, so its caller
+ * can free it without looking the key up first */
+int node_delete(struct btree *btree,
+                struct node *x,
+                void *key,
+                enum delete_target target,
+                void **value);
+
+/* `node_delete_in` deletes from the subtree at child `i` of `x` */
+int node_delete_in(struct btree *btree,
+                   struct node *x,
+                   ssize_t i,
+                   void *key,
+                   enum delete_target target,
+                   void **value) {
+	int res;
+
+	if (!node_own(btree, &x->children[i])) return 0;
+	res = node_delete(btree, x->children[i], key, target, value);
+
+	if (res && btree->order_stats) node_counts(btree, x)[i]--;
+	return res;
 }
 
-int node_delete(struct node *x,
+int node_delete(struct btree *btree,
+                struct node *x,
                 void *key,
-                int(*cmp)(const void *a, const void *b),
-                const ssize_t degree,
-                const size_t elem_size, void *(*alloc)(size_t), void (*dealloc)(void*)) {
-	/* Determine wether the key is in the node */
-	int i = 0; /* Index of `k`, if found */
-	int last_cmp_res;
-
-	while (i < x->n
-	   && (last_cmp_res = cmp(key, (const void*)(x->items + (i * elem_size))))
-	      > 0) {
-		i++;
+                enum delete_target target,
+                void **value) {
+	const size_t  elem_size = btree->elem_size;
+	const ssize_t degree    = btree->degree;
+	int     last_cmp_res    = BTREE_CMP_GT;
+	ssize_t i; /* Index of `k` */
+
+	if (target == DELETE_KEY) {
+		i = node_find(btree, x, key, &last_cmp_res);
+	} else if (node_leaf(x)) {
+		/* The first or last item is k, if there is any */
+		i = target == DELETE_FIRST ? 0 : x->n - 1;
+		if (x->n > 0) last_cmp_res = BTREE_CMP_EQ;
+	} else {
+		/* k lies in the first or last child */
+		i = target == DELETE_FIRST ? 0 : x->n;
 	}
 
-	if (last_cmp_res == 0) {
+	if (i >= 0 && i < x->n && last_cmp_res == 0) {
 
 		if (node_leaf(x)) {
 			/* 1. k ϵ x && node_leaf(x) */
 			/* Delete k from x */
-			int j = i;
-			while (j + 1 < x->n) {
-				const size_t offset_dst = elem_size * j;
-				const size_t offset_src = elem_size * (j+1);
-				memcpy((x->items) + offset_dst,
-				       (x->items) + offset_src,
-				       elem_size);
-				j++;
+			if (value != NULL) {
+				*value = elem_value(btree, x->items + elem_size * i);
 			}
+			memmove(x->items + elem_size * i,
+			        x->items + elem_size * (i + 1),
+			        elem_size * (x->n - i - 1));
 			x->n--;
+			btree->count--;
 			return 1;
 		} else {
 			/* 2. k ϵ x && !node_leaf(x) */
@@ -456,64 +1157,51 @@ int node_delete(struct node *x,
 			/* 2a: if size(child[i]) >= t; find the largest k' in child[i] */
 			/* replace k with k' */
 			if (x->children[i]->n >= degree) {
-				struct node* y = x->children[i];
-				byte *kk = alloc(elem_size);
+				struct node* y   = x->children[i];
+				struct node* tmp = y;
 
 				/* Find the predecessor, k' of k in y */
-				{
-					struct node* tmp = y;
-					while (!node_leaf(tmp)) {
-						tmp = tmp->children[tmp->n-1];
-					}
-
-					/* copy kk */
-					memcpy(kk, tmp->items + elem_size * (tmp->n - 1), elem_size);
+				while (!node_leaf(tmp)) {
+					tmp = tmp->children[tmp->c - 1];
 				}
 
-				/* Recursively delete kk from y */
-				return node_delete(y, kk, cmp, degree, elem_size, alloc, dealloc);
-
-				/* replace k with kk */
-				memcpy(x->items  + (elem_size * i),
-				       kk,
+				/* replace k with k', then recursively delete k', the last
+				 * element, from y */
+				if (value != NULL) {
+					*value = elem_value(btree, x->items + elem_size * i);
+				}
+				memcpy(x->items + (elem_size * i),
+				       tmp->items + elem_size * (tmp->n - 1),
 				       elem_size);
 
-				dealloc(kk);
-
-				return 1;
+				return node_delete_in(btree, x, i, NULL, DELETE_LAST, NULL);
 
 			} else if (x->children[i+1]->n >= degree) {
-				struct node* z = x->children[i+1];
-				byte *kk = alloc(elem_size);
+				struct node* z   = x->children[i+1];
+				struct node* tmp = z;
 
 				/* Find the successor, k' of k in z */
-				{
-					struct node* tmp = z->children[0];
-					while (!node_leaf(tmp)) {
-						tmp = tmp->children[0];
-					}
-
-					/* copy kk */
-					memcpy(kk, tmp->items + elem_size * (tmp->n - 1), elem_size);
+				while (!node_leaf(tmp)) {
+					tmp = tmp->children[0];
 				}
 
-				/* Recursively delete kk from y */
-				return node_delete(z, kk, cmp, degree, elem_size, alloc, dealloc);
-
-				/* replace k with kk */
+				/* replace k with k', then recursively delete k', the first
+				 * element, from z */
+				if (value != NULL) {
+					*value = elem_value(btree, x->items + elem_size * i);
+				}
 				memcpy(x->items + (elem_size * i),
-				       kk,
+				       tmp->items,
 				       elem_size);
 
-				dealloc(kk);
-
-				return 1;
+				return node_delete_in(btree, x, i + 1, NULL, DELETE_FIRST, NULL);
 			} else {
 				/* Merge k and z into y */
-				node_child_merge(x, i, elem_size, dealloc);
+				if (!node_own_pair(btree, x, i)) return 0;
+				node_child_merge(btree, x, i);
 
 				/* recurse */
-				return node_delete(x->children[i], key, cmp, degree, elem_size, alloc, dealloc);
+				return node_delete_in(btree, x, i, key, target, value);
 			}
 		}
 	} else if (node_leaf(x)) {
@@ -523,34 +1211,32 @@ int node_delete(struct node *x,
 
 		/*  if x is a leaf, then it is not in the tree */
 
-		struct node* y;
-		int ii; /* index of x.c[i] */
-
-		/* Determine x.c[i] that must contain k */
-		/* if last cmp < 0, then the child must be in the left child of x.items[i]*/
-		if (last_cmp_res < 0) ii = i;
-		/* Otherwise, it must be the very last child */
-		else if (i < x->n) ii = i+1;
-		else ii = i;
-
-		y = x->children[ii];
+		/* x.c[i] must contain k, as `i` is the index of the first key greater
+		 * than k */
+		const ssize_t ii = i;
+		ssize_t      yi = ii;
+		struct node* y  = x->children[ii];
 
 		if (y->n < degree) {
 			/* we are left biased */
 			if        (ii > 0        && x->children[ii-1]->n >= degree) {
-				node_shift_right(x, ii-1, elem_size);
+				if (!node_own_pair(btree, x, ii-1)) return 0;
+				node_shift_right(btree, x, ii-1);
 
 			} else if (ii < x->c - 1 && x->children[ii+1]->n >= degree) {
-				node_shift_left (x, ii,   elem_size);
+				if (!node_own_pair(btree, x, ii)) return 0;
+				node_shift_left (btree, x, ii);
 
 			} else {
 				/* We need to determine wether we merge left or right, if possible */
 				if (ii > 0)             {
-					node_child_merge(x, ii - 1, elem_size, dealloc);
-					y = x->children[ii - 1];
+					if (!node_own_pair(btree, x, ii-1)) return 0;
+					node_child_merge(btree, x, ii - 1);
+					yi = ii - 1;
 				}
 				else if (ii < x->c - 1) {
-					node_child_merge(x, ii,     elem_size, dealloc);
+					if (!node_own_pair(btree, x, ii)) return 0;
+					node_child_merge(btree, x, ii);
 				}
 				else {
 					perror("Cannot merge!");
@@ -559,92 +1245,1102 @@ int node_delete(struct node *x,
 
 		}
 
-		return node_delete(y, key, cmp, degree, elem_size, alloc, dealloc);
+		return node_delete_in(btree, x, yi, key, target, value);
 	}
 	return 0;
 }
 
+/* Bulk loading */
 
-/***********************/
-/* Btree functionality */
-/***********************/
-struct btree* btree_new(size_t elem_size,
-                        size_t t,
-                        int(*cmp)(const void *a, const void *b)) {
-	return btree_new_with_allocator(elem_size, t, cmp, malloc, free);
-}
+/* `elem_sort` sorts `n` elements with the tree's comparator, which qsort has
+ * no way of passing along. A stable merge sort, `tmp` must have room for `n`
+ * elements. */
+void elem_sort(struct btree *btree, byte *elems, const size_t n, byte *tmp) {
+	const size_t elem_size = btree->elem_size;
+	const size_t half      = n / 2;
+	size_t i = 0;
+	size_t j = half;
+	size_t k = 0;
 
-struct btree* btree_new_with_allocator(size_t elem_size,
-                        size_t t,
-                        int(*cmp)(const void *a, const void *b),
-                        void *(*alloc)(size_t),
-                        void (*dealloc)(void*)) {
-	struct btree *new_tree = alloc(sizeof(struct btree));
+	if (n < 2) return;
 
-	new_tree->alloc     = alloc;
-	new_tree->dealloc   = dealloc;
+	elem_sort(btree, elems,                     half,     tmp);
+	elem_sort(btree, elems + elem_size * half,  n - half, tmp);
 
-	new_tree->elem_size = elem_size;
-	new_tree->degree    = t;
+	/* Already in order, nothing to merge */
+	if (elem_cmp(btree, elems + elem_size * (half - 1),
+	                    elems + elem_size * half) <= 0) {
+		return;
+	}
 
-	new_tree->root      = NULL;
+	while (i < half && j < n) {
+		const byte *a = elems + elem_size * i;
+		const byte *b = elems + elem_size * j;
+		if (elem_cmp(btree, b, a) < 0) { memcpy(tmp + elem_size * k++, b, elem_size); j++; }
+		else                            { memcpy(tmp + elem_size * k++, a, elem_size); i++; }
+	}
+	memcpy(tmp + elem_size * k, elems + elem_size * i, elem_size * (half - i));
+	k += half - i;
+	memcpy(elems, tmp, elem_size * k);
+}
 
-	new_tree->cmp       = cmp;
+/* `node_build_count` determines how many nodes a level of `n` items is packed
+ * into. Aiming for `per_node` items per node, with one item left between every
+ * two nodes as their separator in the level above. Every node gets at least
+ * t-1 items, unless all items fit into a single (root) node. */
+size_t node_build_count(const ssize_t t, const size_t n, const size_t per_node) {
+	size_t m = (n + 1 + per_node) / (per_node + 1);
 
-	return new_tree;
+	if (m == 0) m = 1;
+	while (m > 1 && (n - (m - 1)) / m < (size_t)node_mindegree(t)) m--;
+	return m;
 }
 
-void btree_free(struct btree **btree) {
-	node_free(&((*btree)->root), (*btree)->elem_size, (*btree)->dealloc);
-	(*btree)->dealloc(*btree);
-	*btree = NULL;
-}
+/* `node_build_level` packs the `n` sorted `items` into `m` nodes, the first
+ * (n - (m - 1)) % m of which get one item more than the others. The item
+ * following every node but the last is copied into `seps`, they become the
+ * items of the level above. If `children` is not NULL the nodes are branching
+ * nodes and consume the `n + 1` children in order.
+ * returnvalue: `false` if a node could not be allocated, in which case all
+ * nodes and children are freed. */
+bool node_build_level(struct btree *btree,
+                      const byte *items,
+                      const size_t n,
+                      struct node **children,
+                      struct node **nodes,
+                      const size_t m,
+                      byte *seps) {
+	const size_t elem_size = btree->elem_size;
+	const size_t base      = (n - (m - 1)) / m;
+	const size_t rem       = (n - (m - 1)) % m;
+	size_t j;
+	size_t child = 0;
+
+	for (j = 0; j < m; j++) {
+		const size_t k = base + (j < rem);
+		struct node *x = node_new(btree, children == NULL);
+
+		if (x == NULL) {
+			size_t f;
+			for (f = 0; f < j; f++) node_free(btree, &nodes[f]);
+			if (children != NULL) {
+				for (f = child; f < n + 1; f++) node_free(btree, &children[f]);
+			}
+			return false;
+		}
 
-void btree_insert(struct btree *btree, void *elem) {
-	if (btree == NULL) {
-		fputs("BTree error: Inserting into a NULL ptr!\n", stderr);
-		return;
-	}
-	if (elem == NULL) {
-		fputs("BTree error: Inserting NULL into a tree!\n", stderr);
-		return;
-	}
-	if (btree->root == NULL) {
-		btree->root = node_new(btree->degree, btree->elem_size);
-		if (btree->root == NULL) {
-			fputs("BTree error: Failed to create new root node!\n", stderr);
-			return;
+		memcpy(x->items, items, elem_size * k);
+		x->n   = k;
+		items += elem_size * k;
+
+		if (children != NULL) {
+			memcpy(x->children, children + child, sizeof(struct node*) * (k + 1));
+			x->c   = k + 1;
+			child += k + 1;
+
+			if (btree->order_stats) {
+				size_t c;
+				for (c = 0; c < k + 1; c++) {
+					node_counts(btree, x)[c] = node_total(btree, x->children[c]);
+				}
+			}
 		}
-		node_insert(btree->root,
-		            elem,
-		            btree->degree,
-		            btree->elem_size,
-		            btree->cmp);
+
+		if (j + 1 < m) {
+			memcpy(seps, items, elem_size);
+			seps  += elem_size;
+			items += elem_size;
+		}
+		nodes[j] = x;
 	}
-	else {
-		btree->root = node_insert(btree->root,
-		                          elem,
-		                          btree->degree,
-		                          btree->elem_size,
-		                          btree->cmp);
+	return true;
+}
+
+/* A leaf level being built by several threads, see `node_build_leaves` */
+struct build_job {
+	struct btree *btree;
+	const byte   *items;
+	struct node **nodes;
+	byte         *seps;
+	size_t        m;
+	size_t        base;  /* items per leaf, see `node_build_level` */
+	size_t        rem;   /* leaves with one more */
+	size_t        chunk; /* leaves per grab */
+	size_t        next;  /* first leaf not grabbed yet */
+	bool          failed;
+};
+
+void* node_build_worker(void *arg) {
+	struct build_job *job       = arg;
+	const size_t      elem_size = job->btree->elem_size;
+
+	for (;;) {
+		const size_t from = __atomic_fetch_add(&job->next, job->chunk,
+		                                       __ATOMIC_RELAXED);
+		size_t j;
+
+		if (from >= job->m) return NULL;
+
+		for (j = from; j < from + job->chunk && j < job->m; j++) {
+			/* Leaf `j` starts behind `j` leaves and their separators */
+			const size_t start = j * (job->base + 1) + (j < job->rem ? j : job->rem);
+			const size_t k     = job->base + (j < job->rem);
+			struct node *x     = job->nodes[j];
+
+			if (x == NULL) x = node_new(job->btree, true);
+			if (x == NULL) {
+				__atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+				return NULL;
+			}
+
+			memcpy(x->items, job->items + elem_size * start, elem_size * k);
+			x->n = k;
+			if (j + 1 < job->m) {
+				memcpy(job->seps  + elem_size * j,
+				       job->items + elem_size * (start + k),
+				       elem_size);
+			}
+			job->nodes[j] = x;
+		}
+	}
+}
+
+/* `node_build_leaves` is `node_build_level` for the leaves, on up to
+ * `threads` threads, the calling one included, which grab chunks of leaves
+ * until none are left. The threads allocate the leaves themselves, unless the
+ * tree draws them from its node pool, which is not to be shared. */
+bool node_build_leaves(struct btree *btree,
+                       const byte *items,
+                       const size_t n,
+                       struct node **nodes,
+                       const size_t m,
+                       byte *seps,
+                       size_t threads) {
+	struct build_job job;
+	pthread_t *workers = NULL;
+	size_t     started = 0;
+	size_t     j;
+
+	job.btree  = btree;
+	job.items  = items;
+	job.nodes  = nodes;
+	job.seps   = seps;
+	job.m      = m;
+	job.base   = (n - (m - 1)) / m;
+	job.rem    = (n - (m - 1)) % m;
+	job.chunk  = BTREE_BUILD_CHUNK / (job.base + 1) + 1;
+	job.next   = 0;
+	job.failed = false;
+
+	for (j = 0; j < m; j++) nodes[j] = NULL;
+	if (btree->pooled) {
+		for (j = 0; j < m && !job.failed; j++) {
+			nodes[j]   = node_new(btree, true);
+			job.failed = nodes[j] == NULL;
+		}
+	}
+
+	if (threads > (m + job.chunk - 1) / job.chunk) {
+		threads = (m + job.chunk - 1) / job.chunk;
+	}
+	if (!job.failed && threads > 1) {
+		workers = btree->alloc(sizeof(pthread_t) * (threads - 1));
+	}
+
+	/* Whatever threads we do not get, we make up for ourselves */
+	if (workers != NULL) {
+		for (j = 0; j < threads - 1; j++) {
+			if (pthread_create(&workers[started], NULL,
+			                   node_build_worker, &job) == 0) {
+				started++;
+			}
+		}
+	}
+	if (!job.failed) node_build_worker(&job);
+
+	for (j = 0; j < started; j++) pthread_join(workers[j], NULL);
+	if (workers != NULL) btree->dealloc(workers);
+
+	if (job.failed) {
+		for (j = 0; j < m; j++) node_free(btree, &nodes[j]);
+		return false;
+	}
+	return true;
+}
+
+/* `node_build` builds a tree out of `n` sorted items bottom-up, level by
+ * level, filling nodes up to `per_node` items. The leaves, which hold most of
+ * the items, are built on up to `threads` threads.
+ * returnvalue: the root, NULL if we ran out of memory */
+struct node* node_build(struct btree *btree,
+                        const byte *items,
+                        size_t n,
+                        const size_t per_node,
+                        const size_t threads) {
+	struct node **children = NULL;
+	byte         *level    = NULL; /* items of the current level, if not `items` */
+	struct node  *root;
+
+	for (;;) {
+		const size_t  m     = node_build_count(btree->degree, n, per_node);
+		struct node **nodes = btree->alloc(sizeof(struct node*) * m);
+		byte         *seps  = m > 1 ? btree->alloc(btree->elem_size * (m - 1))
+		                            : NULL;
+		bool ok;
+
+		if (nodes == NULL || (m > 1 && seps == NULL)) {
+			size_t f;
+			for (f = 0; children != NULL && f < n + 1; f++) {
+				node_free(btree, &children[f]);
+			}
+			ok = false;
+		} else if (children == NULL && threads > 1) {
+			ok = node_build_leaves(btree, items, n, nodes, m, seps, threads);
+		} else {
+			ok = node_build_level(btree, level != NULL ? level : items, n,
+			                      children, nodes, m, seps);
+		}
+
+		if (children != NULL) btree->dealloc(children);
+		if (level    != NULL) btree->dealloc(level);
+
+		if (!ok) {
+			fputs("BTree error: Failed to allocate while bulk loading!\n", stderr);
+			if (nodes != NULL) btree->dealloc(nodes);
+			if (seps  != NULL) btree->dealloc(seps);
+			return NULL;
+		}
+
+		if (m == 1) {
+			root = nodes[0];
+			btree->dealloc(nodes);
+			return root;
+		}
+
+		children = nodes;
+		level    = seps;
+		n        = m - 1;
+	}
+}
+
+
+/***********************/
+/* Btree functionality */
+/***********************/
+struct btree* btree_new(size_t elem_size,
+                        size_t t,
+                        int(*cmp)(const void *a, const void *b)) {
+	return btree_new_with_allocator(elem_size, t, cmp, malloc, free);
+}
+
+struct btree* btree_new_with_allocator(size_t elem_size,
+                        size_t t,
+                        int(*cmp)(const void *a, const void *b),
+                        void *(*alloc)(size_t),
+                        void (*dealloc)(void*)) {
+	struct btree *new_tree = alloc(sizeof(struct btree));
+
+	new_tree->alloc     = alloc;
+	new_tree->dealloc   = dealloc;
+
+	new_tree->elem_size = elem_size;
+	new_tree->degree    = t;
+
+	new_tree->root      = NULL;
+
+	new_tree->cmp       = cmp;
+
+	new_tree->count       = 0;
+	new_tree->order_stats = false;
+	new_tree->duplicates  = BTREE_DUPLICATES_MULTISET;
+
+	new_tree->key_size     = elem_size;
+	new_tree->value_size   = 0;
+	new_tree->value_offset = 0;
+	new_tree->kv_elem      = NULL;
+	new_tree->tombstones     = false;
+	new_tree->dead           = 0;
+	new_tree->compact_key    = NULL;
+	new_tree->compact_resume = false;
+	pool_init(&new_tree->value_pool, sizeof(void*), MEM_ALIGN, BTREE_VALUE_SLAB);
+
+	new_tree->layout     = BTREE_LAYOUT_PACKED;
+	new_tree->pooled     = false;
+	new_tree->slab_nodes = 0;
+	node_layout(new_tree);
+
+	new_tree->search        = BTREE_SEARCH_HYBRID;
+	new_tree->search_cutoff = BTREE_SEARCH_CUTOFF_DEFAULT;
+	new_tree->find_kernel   = NULL;
+	new_tree->prefetch      = false;
+
+	new_tree->file  = NULL;
+	new_tree->bplus = NULL;
+
+	btree_stats_reset(new_tree);
+
+	new_tree->origin  = NULL;
+	new_tree->retired = NULL;
+
+	return new_tree;
+}
+
+struct btree* btree_new_u32(size_t t) {
+	struct btree *new_tree = btree_new(sizeof(uint32_t), t, btree_cmp_u32);
+
+	if (new_tree != NULL) {
+		new_tree->find_kernel = btree_simd_find_u32();
+		new_tree->search      = BTREE_SEARCH_SIMD;
+	}
+	return new_tree;
+}
+
+struct btree* btree_new_u64(size_t t) {
+	struct btree *new_tree = btree_new(sizeof(uint64_t), t, btree_cmp_u64);
+
+	if (new_tree != NULL) {
+		new_tree->find_kernel = btree_simd_find_u64();
+		new_tree->search      = BTREE_SEARCH_SIMD;
+	}
+	return new_tree;
+}
+
+struct btree* btree_new_kv(size_t key_size,
+                           size_t value_size,
+                           size_t t,
+                           int(*cmp)(const void *a, const void *b)) {
+	const size_t value_offset = align_up(key_size, sizeof(void*));
+	struct btree *new_tree;
+
+	if (value_size == 0) {
+		fputs("BTree error: Values of key-value trees cannot be empty!\n", stderr);
+		return NULL;
+	}
+
+	new_tree = btree_new(value_offset + sizeof(void*), t, cmp);
+	if (new_tree == NULL) return NULL;
+
+	new_tree->kv_elem = new_tree->alloc(new_tree->elem_size);
+	if (new_tree->kv_elem == NULL) {
+		btree_free(&new_tree);
+		return NULL;
+	}
+	memset(new_tree->kv_elem, 0, new_tree->elem_size);
+
+	new_tree->key_size     = key_size;
+	new_tree->value_size   = value_size;
+	new_tree->value_offset = value_offset;
+	pool_init(&new_tree->value_pool,
+	          value_size > sizeof(void*) ? value_size : sizeof(void*),
+	          MEM_ALIGN, BTREE_VALUE_SLAB);
+	return new_tree;
+}
+
+struct btree* btree_new_bplus(size_t elem_size,
+                              size_t key_size,
+                              size_t t,
+                              int(*cmp)(const void *a, const void *b)) {
+	struct btree *new_tree = btree_new(elem_size, t, cmp);
+
+	if (new_tree == NULL) return NULL;
+
+	new_tree->bplus = bplus_new(elem_size, key_size, t, cmp,
+	                            new_tree->alloc, new_tree->dealloc);
+	if (new_tree->bplus == NULL) btree_free(&new_tree);
+	return new_tree;
+}
+
+void btree_set_search(struct btree *btree,
+                      enum btree_search strategy,
+                      size_t cutoff) {
+	if (btree == NULL) return;
+	if (strategy == BTREE_SEARCH_SIMD && btree->find_kernel == NULL) return;
+	btree->search        = strategy;
+	btree->search_cutoff = cutoff;
+}
+
+void btree_set_prefetch(struct btree *btree, int enabled) {
+	if (btree == NULL) return;
+	btree->prefetch = enabled != 0;
+}
+
+int btree_set_node_pool(struct btree *btree, size_t nodes_per_slab) {
+	if (btree == NULL || btree->root != NULL || btree->origin != NULL
+	||  btree->file != NULL || btree->bplus != NULL) return -1;
+
+	node_pools_destroy(btree);
+	btree->pooled     = nodes_per_slab > 0;
+	btree->slab_nodes = nodes_per_slab;
+	node_layout(btree);
+	return 0;
+}
+
+int btree_set_layout(struct btree *btree, enum btree_layout layout) {
+	if (btree == NULL || btree->root != NULL || btree->origin != NULL
+	||  btree->file != NULL || btree->bplus != NULL) return -1;
+
+	node_pools_destroy(btree);
+	btree->layout = layout;
+	node_layout(btree);
+	return 0;
+}
+
+int btree_set_order_stats(struct btree *btree, int enabled) {
+	if (btree == NULL || btree->root != NULL || btree->origin != NULL
+	||  btree->file != NULL || btree->bplus != NULL
+	||  (enabled && btree->tombstones)) return -1;
+
+	node_pools_destroy(btree);
+	btree->order_stats = enabled != 0;
+	node_layout(btree);
+	return 0;
+}
+
+int btree_set_tombstones(struct btree *btree, int enabled) {
+	if (btree == NULL || btree->root != NULL || btree->value_size == 0
+	||  (enabled && btree->order_stats)) return -1;
+
+	if (enabled && btree->compact_key == NULL) {
+		btree->compact_key = btree->alloc(btree->elem_size);
+		if (btree->compact_key == NULL) return -1;
+	}
+	btree->tombstones = enabled != 0;
+	return 0;
+}
+
+int btree_set_duplicates(struct btree *btree, enum btree_duplicates mode) {
+	if (btree == NULL || btree->file != NULL || btree->bplus != NULL) return -1;
+	btree->duplicates = mode;
+	return 0;
+}
+
+/* File-backed trees and B+trees support the operations listed at
+ * `btree_open` and `btree_new_bplus` only */
+bool btree_classic(struct btree *btree) {
+	if (btree->file != NULL) {
+		fputs("BTree error: Not supported by file-backed trees!\n", stderr);
+	} else if (btree->bplus != NULL) {
+		fputs("BTree error: Not supported by B+trees!\n", stderr);
+	} else {
+		return true;
+	}
+	return false;
+}
+
+/* Elements of key-value trees only ever come together in `btree_put` */
+bool btree_plain(struct btree *btree) {
+	if (btree->value_size == 0) return true;
+	fputs("BTree error: Not supported by key-value trees!\n", stderr);
+	return false;
+}
+
+struct btree* btree_snapshot(struct btree *btree) {
+	struct btree *snapshot;
+
+	if (btree == NULL || !btree_classic(btree) || !btree_plain(btree)) {
+		return NULL;
+	}
+
+	snapshot = btree->alloc(sizeof(struct btree));
+	if (snapshot == NULL) {
+		fputs("BTree error: Failed to allocate snapshot!\n", stderr);
+		return NULL;
+	}
+
+	/* Same settings and contents, the nodes just get another reference. The
+	 * retire list comes last, as other snapshots may be pushing to it */
+	memcpy(snapshot, btree, offsetof(struct btree, retired));
+	snapshot->origin  = btree->origin != NULL ? btree->origin : btree;
+	snapshot->retired = NULL;
+	if (snapshot->root != NULL) {
+		__atomic_add_fetch(&snapshot->root->shared.refs, 1, __ATOMIC_RELAXED);
 	}
+	return snapshot;
+}
+
+/* Snapshots are read-only */
+bool btree_writable(struct btree *btree) {
+	if (btree->origin == NULL) {
+		node_reclaim(btree);
+		return true;
+	}
+	fputs("BTree error: Writing to a snapshot!\n", stderr);
+	return false;
+}
+
+void btree_free(struct btree **btree) {
+	if ((*btree)->file != NULL) {
+		file_close(&(*btree)->file);
+	} else if ((*btree)->bplus != NULL) {
+		bplus_free(&(*btree)->bplus);
+	} else if ((*btree)->origin != NULL) {
+		/* Its nodes belong to the tree it was taken from */
+		node_free(*btree, &((*btree)->root));
+	} else if ((*btree)->pooled) {
+		/* Every node lives in a slab, no need to visit them */
+		node_pools_destroy(*btree);
+	} else {
+		node_free(*btree, &((*btree)->root));
+		node_reclaim(*btree);
+	}
+	pool_destroy(*btree, &(*btree)->value_pool);
+	if ((*btree)->kv_elem != NULL) (*btree)->dealloc((*btree)->kv_elem);
+	if ((*btree)->compact_key != NULL) (*btree)->dealloc((*btree)->compact_key);
+	(*btree)->dealloc(*btree);
+	*btree = NULL;
+}
+
+struct btree* btree_open(const char *path,
+                         size_t elem_size,
+                         size_t page_size,
+                         int    (*cmp)(const void *a, const void *b)) {
+	struct btree_file *file = file_open(path, elem_size, page_size, cmp);
+	struct btree      *btree;
+
+	if (file == NULL) return NULL;
+
+	btree = btree_new(elem_size, file_degree(file), cmp);
+	if (btree == NULL) {
+		file_close(&file);
+		return NULL;
+	}
+	btree->file = file;
+	return btree;
+}
+
+int btree_sync(struct btree *btree) {
+	if (btree == NULL || btree->file == NULL) return 0;
+	return file_sync(btree->file);
+}
+
+int btree_close(struct btree **btree) {
+	int res = 0;
+
+	if ((*btree)->file != NULL) res = file_close(&(*btree)->file);
+	btree_free(btree);
+	return res;
+}
+
+int btree_insert_elem(struct btree *btree, void *elem);
+
+int btree_insert(struct btree *btree, void *elem) {
+	if (btree == NULL) {
+		fputs("BTree error: Inserting into a NULL ptr!\n", stderr);
+		return -1;
+	}
+	if (elem == NULL) {
+		fputs("BTree error: Inserting NULL into a tree!\n", stderr);
+		return -1;
+	}
+	if (!btree_plain(btree)) return -1;
+	return btree_insert_elem(btree, elem);
+}
+
+int btree_insert_elem(struct btree *btree, void *elem) {
+	bool inserted;
+
+	if (btree->file != NULL) return file_insert(btree->file, elem);
+	if (btree->bplus != NULL) {
+		if (bplus_insert(btree->bplus, elem) != 0) {
+			fputs("BTree error: Failed to allocate B+tree node!\n", stderr);
+			return -1;
+		}
+		return 0;
+	}
+	if (!btree_writable(btree)) return -1;
+	return node_insert(btree, elem, btree->duplicates, &inserted) != NULL ? 0 : -1;
+}
+
+void* btree_insert_or_get(struct btree *btree, void *elem) {
+	bool inserted;
+
+	if (btree == NULL || elem == NULL) {
+		fputs("BTree error: Inserting into a NULL ptr!\n", stderr);
+		return NULL;
+	}
+	if (!btree_classic(btree) || !btree_plain(btree)
+	||  !btree_writable(btree)) {
+		return NULL;
+	}
+	return node_insert(btree, elem, BTREE_DUPLICATES_REJECT, &inserted);
 }
 
 void* btree_search(struct btree *btree, void *elem) {
-	return node_search(btree->root, elem, btree->cmp, btree->elem_size);
+	void *found;
+
+	if (btree->file  != NULL) return file_search(btree->file, elem);
+	if (btree->bplus != NULL) return bplus_search(btree->bplus, elem);
+
+	found = node_search(btree, btree->root, elem);
+	return found != NULL && !elem_dead(btree, found) ? found : NULL;
 }
 
-int btree_delete(struct btree *btree, void *elem) {
-	struct node *newroot = btree->root;
-	int res = node_delete(btree->root, elem, btree->cmp, btree->degree, btree->elem_size, btree->alloc, btree->dealloc);
+size_t btree_search_many(struct btree *btree,
+                         const void *keys,
+                         size_t n,
+                         void **out) {
+	const byte  *key = keys;
+	struct node *group[BTREE_SEARCH_GROUP];
+	size_t       found = 0;
+	size_t       g;
+	size_t       j;
+
+	if (btree->file != NULL || btree->bplus != NULL) {
+		for (j = 0; j < n; j++) {
+			out[j]  = btree_search(btree, (void*)(key + btree->key_size * j));
+			found  += out[j] != NULL;
+		}
+		return found;
+	}
+
+	/* Descend with a group of keys at once, one level after the other, so
+	 * the nodes of the next level are on their way in for all of them while
+	 * we search the current one */
+	for (g = 0; g < n; g += BTREE_SEARCH_GROUP) {
+		const size_t m   = n - g < BTREE_SEARCH_GROUP ? n - g : BTREE_SEARCH_GROUP;
+		size_t       left = btree->root != NULL ? m : 0;
+
+		for (j = 0; j < m; j++) {
+			group[j]   = btree->root;
+			out[g + j] = NULL;
+		}
+
+		while (left > 0) {
+			for (j = 0; j < m; j++) {
+				struct node *x = group[j];
+				int          res;
+				ssize_t      i;
+
+				if (x == NULL) continue;
+
+				i = node_find(btree, x, key + btree->key_size * (g + j), &res);
+				if (i < x->n && res == 0) {
+					byte *elem = x->items + btree->elem_size * i;
+
+					if (!elem_dead(btree, elem)) {
+						out[g + j] = elem;
+						found++;
+					}
+					group[j] = NULL;
+					left--;
+				} else if (node_leaf(x)) {
+					group[j] = NULL;
+					left--;
+				} else {
+					group[j] = x->children[i];
+					node_prefetch(btree, group[j]);
+				}
+			}
+		}
+	}
+	return found;
+}
+
+/* `btree_delete_elem` deletes `elem` from any kind of tree, handing back
+ * the value of key-value trees in `value`, see `node_delete` */
+int btree_delete_elem(struct btree *btree, void *elem, void **value) {
+	struct node *newroot;
+	int res;
+	if (btree->file  != NULL) return file_delete(btree->file, elem);
+	if (btree->bplus != NULL) return bplus_delete(btree->bplus, elem);
+	if (btree->root == NULL || !btree_writable(btree)) return 0;
+	if (!node_own(btree, &btree->root)) return 0;
+	newroot = btree->root;
+	res = node_delete(btree, newroot, elem, DELETE_KEY, value);
 	if (newroot->n == 0) {
 		if (node_leaf(newroot)) return res;
 		/* shrink the tree */
-		struct node *newroot_p = newroot->children[0];
-		btree->dealloc(newroot);
-		btree->root = newroot_p;
+		btree->root = newroot->children[0];
+		node_release(btree, newroot);
+	}
+	return res;
+}
+
+int btree_delete(struct btree *btree, void *elem) {
+	void *found;
+	void *value;
+
+	if (btree->value_size == 0) return btree_delete_elem(btree, elem, NULL);
+
+	/* The value goes along with its key */
+	if (btree->tombstones) {
+		/* Leave the key where it is, the tree as it is */
+		found = btree_search(btree, elem);
+		if (found == NULL) return 0;
+		value = elem_value(btree, found);
+		elem_value(btree, found) = NULL;
+		btree->dead++;
+	} else if (!btree_delete_elem(btree, elem, &value)) {
+		return 0;
+	}
+	pool_put(&btree->value_pool, value);
+	return 1;
+}
+
+int btree_put(struct btree *btree, const void *key, const void *value) {
+	byte *elem;
+	void *slot;
+	bool  inserted;
+
+	if (btree->value_size == 0) {
+		fputs("BTree error: Not a key-value tree!\n", stderr);
+		return -1;
+	}
+	if (!btree_writable(btree)) return -1;
+
+	/* A value is set up in advance, and handed back if the key is present,
+	 * so that a single descent does either */
+	slot = pool_get(btree, &btree->value_pool);
+	if (slot == NULL) {
+		fputs("BTree error: Failed to allocate value!\n", stderr);
+		return -1;
+	}
+	memcpy(btree->kv_elem, key, btree->key_size);
+	elem_value(btree, btree->kv_elem) = slot;
+
+	elem = node_insert(btree, btree->kv_elem, BTREE_DUPLICATES_REJECT, &inserted);
+	if (elem != NULL && !inserted && elem_dead(btree, elem)) {
+		/* Back from the dead, in the slot it was deleted from */
+		elem_value(btree, elem) = slot;
+		btree->dead--;
+		inserted = true;
+	} else if (elem == NULL || !inserted) {
+		pool_put(&btree->value_pool, slot);
+	}
+	if (elem == NULL) return -1;
+
+	memcpy(elem_value(btree, elem), value, btree->value_size);
+	return inserted ? 1 : 0;
+}
+
+void* btree_get(struct btree *btree, const void *key) {
+	byte *elem;
+
+	if (btree->value_size == 0) return NULL;
+	elem = node_search(btree, btree->root, (void*)key);
+	return elem != NULL ? elem_value(btree, elem) : NULL;
+}
+
+void* btree_value(struct btree *btree, const void *elem) {
+	if (btree->value_size == 0 || elem == NULL) return NULL;
+	return elem_value(btree, elem);
+}
+
+size_t btree_insert_batch(struct btree *btree, const void *elems, size_t count) {
+	byte  *sorted;
+	byte  *tmp;
+	size_t done = 0;
+	size_t unique;
+
+	if (btree == NULL || count == 0 || !btree_plain(btree)) return 0;
+	if (btree->file != NULL) {
+		/* Pages are written in place, there is nothing to gain from sorting */
+		while (done < count
+		   &&  file_insert(btree->file,
+		                   (const byte*)elems + btree->elem_size * done) == 0) {
+			done++;
+		}
+		return done;
+	}
+	if (btree->bplus != NULL) {
+		while (done < count
+		   &&  bplus_insert(btree->bplus,
+		                    (const byte*)elems + btree->elem_size * done) == 0) {
+			done++;
+		}
+		return done;
+	}
+	if (!btree_writable(btree)) return 0;
+
+	sorted = btree->alloc(btree->elem_size * count);
+	tmp    = btree->alloc(btree->elem_size * count);
+	if (sorted == NULL || tmp == NULL) {
+		fputs("BTree error: Failed to allocate batch for insertion!\n", stderr);
+		if (sorted != NULL) btree->dealloc(sorted);
+		if (tmp    != NULL) btree->dealloc(tmp);
+		return 0;
+	}
+	memcpy(sorted, elems, btree->elem_size * count);
+	elem_sort(btree, sorted, count, tmp);
+	btree->dealloc(tmp);
+
+	/* Of equal elements in the batch, the first one counts when rejecting and
+	 * the last one when replacing, as if they were inserted one by one */
+	unique = count;
+	if (btree->duplicates != BTREE_DUPLICATES_MULTISET) {
+		size_t r;
+		for (r = 1, unique = 1; r < count; r++) {
+			const byte *e = sorted + btree->elem_size * r;
+			byte       *l = sorted + btree->elem_size * (unique - 1);
+			if (elem_cmp(btree, l, e) != 0) {
+				l += btree->elem_size;
+				unique++;
+			} else if (btree->duplicates != BTREE_DUPLICATES_REPLACE) {
+				continue;
+			}
+			if (l != e) memcpy(l, e, btree->elem_size);
+		}
+	}
+
+	if (btree->root == NULL) btree->root = node_new(btree, true);
+
+	while (btree->root != NULL && done < unique) {
+		size_t k;
+
+		if (!node_own(btree, &btree->root)) break;
+
+		/* Grow the tree first if needed, just like `node_insert` */
+		if (node_full(btree->degree, btree->root)) {
+			struct node *s = node_new(btree, false);
+			if (s == NULL) break;
+			s->children[s->c++] = btree->root;
+			if (btree->order_stats) node_counts(btree, s)[0] = btree->count;
+			if (!node_tree_split_child(btree, s, 0)) {
+				node_release(btree, s);
+				break;
+			}
+			btree->root = s;
+		}
+
+		k = node_insert_run(btree, btree->root,
+		                    sorted + btree->elem_size * done, unique - done);
+		if (k == 0) break;
+		done += k;
+	}
+
+	if (done < unique) {
+		fputs("BTree error: Failed to allocate nodes for batch insertion!\n", stderr);
+	} else {
+		done = count;
+	}
+
+	btree->dealloc(sorted);
+	return done;
+}
+
+int btree_build_elems(struct btree *btree,
+                      const void *elems,
+                      size_t count,
+                      double fill_factor,
+                      size_t threads);
+
+int btree_build_sorted(struct btree *btree,
+                       const void *elems,
+                       size_t count,
+                       double fill_factor) {
+	return btree_build_sorted_parallel(btree, elems, count, fill_factor, 1);
+}
+
+int btree_build_sorted_parallel(struct btree *btree,
+                                const void *elems,
+                                size_t count,
+                                double fill_factor,
+                                size_t threads) {
+	if (!btree_classic(btree) || !btree_plain(btree)
+	||  !btree_writable(btree)) return -1;
+	return btree_build_elems(btree, elems, count, fill_factor, threads);
+}
+
+/* `btree_build_elems` is `btree_build_sorted_parallel` for any tree, key-value
+ * trees included, whose elements already point to their values */
+int btree_build_elems(struct btree *btree,
+                      const void *elems,
+                      size_t count,
+                      double fill_factor,
+                      size_t threads) {
+	const ssize_t max_items = node_maxdegree(btree->degree);
+	ssize_t per_node = (ssize_t)(fill_factor * max_items + 0.5);
+	struct node *root = NULL;
+
+	if (per_node > max_items)                     per_node = max_items;
+	if (per_node < node_mindegree(btree->degree)) per_node = node_mindegree(btree->degree);
+	if (per_node < 1)                             per_node = 1;
+
+	if (count > 0) {
+		root = node_build(btree, elems, count, per_node, threads);
+		if (root == NULL) return -1;
+	}
+
+	node_free(btree, &btree->root);
+	btree->root  = root;
+	btree->count = count;
+	btree->dead  = 0;
+	return 0;
+}
+
+int btree_build(struct btree *btree,
+                const void *elems,
+                size_t count,
+                double fill_factor) {
+	byte *sorted;
+	byte *tmp;
+	int   res;
+
+	if (!btree_classic(btree) || !btree_plain(btree)
+	||  !btree_writable(btree)) return -1;
+	if (count == 0) return btree_build_sorted(btree, elems, count, fill_factor);
+
+	sorted = btree->alloc(btree->elem_size * count);
+	tmp    = btree->alloc(btree->elem_size * count);
+	if (sorted == NULL || tmp == NULL) {
+		if (sorted != NULL) btree->dealloc(sorted);
+		if (tmp    != NULL) btree->dealloc(tmp);
+		return -1;
+	}
+
+	memcpy(sorted, elems, btree->elem_size * count);
+	elem_sort(btree, sorted, count, tmp);
+	btree->dealloc(tmp);
+
+	res = btree_build_sorted(btree, sorted, count, fill_factor);
+	btree->dealloc(sorted);
+	return res;
+}
+
+/* Serialization */
+
+/* returnvalue: `false` if writing failed */
+bool fd_write(int fd, const byte *buf, size_t len) {
+	while (len > 0) {
+		const ssize_t done = write(fd, buf, len);
+		if (done < 0 && errno == EINTR) continue;
+		if (done <= 0) return false;
+		buf += done;
+		len -= done;
+	}
+	return true;
+}
+
+/* returnvalue: `false` if reading failed or ended early */
+bool fd_read(int fd, byte *buf, size_t len) {
+	while (len > 0) {
+		const ssize_t done = read(fd, buf, len);
+		if (done < 0 && errno == EINTR) continue;
+		if (done <= 0) return false;
+		buf += done;
+		len -= done;
+	}
+	return true;
+}
+
+int btree_dump(struct btree *btree, int fd) {
+	const size_t elem_size = btree->elem_size;
+	const size_t cap       = BTREE_DUMP_BUFFER / elem_size * elem_size;
+	struct dump_header   header;
+	struct btree_iter_t  iter;
+	struct btree_iter_t *it   = &iter;
+	size_t               fill = 0;
+	byte                *buf;
+	void                *elem;
+
+	if (!btree_plain(btree)) return -1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BTREE_DUMP_MAGIC, sizeof(header.magic));
+	header.version   = BTREE_DUMP_VERSION;
+	header.flags     = (btree->order_stats ? BTREE_DUMP_ORDER_STATS : 0)
+	                 | (btree->layout == BTREE_LAYOUT_SPLIT ? BTREE_DUMP_SPLIT : 0);
+	header.elem_size = elem_size;
+	header.degree    = btree->degree;
+	header.count     = btree_size(btree);
+
+	buf = btree->alloc(cap > elem_size ? cap : elem_size);
+	if (buf == NULL) {
+		fputs("BTree error: Failed to allocate dump buffer!\n", stderr);
+		return -1;
+	}
+
+	/* Elements are gathered into large writes */
+	memcpy(buf, &header, sizeof(header));
+	fill = sizeof(header);
+	btree_iter_t_reset(btree, &it);
+	while ((elem = btree_iter(btree, it)) != NULL) {
+		if (fill + elem_size > cap) {
+			if (!fd_write(fd, buf, fill)) break;
+			fill = 0;
+		}
+		memcpy(buf + fill, elem, elem_size);
+		fill += elem_size;
+	}
+
+	if (elem != NULL || !fd_write(fd, buf, fill)) {
+		perror("BTree error: Cannot write dump");
+		btree->dealloc(buf);
+		return -1;
+	}
+	btree->dealloc(buf);
+	return 0;
+}
+
+/* Whether a tree of the degree and element size in `header` has nodes whose
+ * size `node_layout` can compute, with room to spare for aligning them.
+ * Anything else comes from a corrupt dump, never from `btree_dump`. */
+bool dump_sizes_valid(const struct dump_header *header) {
+	const size_t limit = (size_t)-1 / 4;
+	const size_t child = sizeof(struct node*) + sizeof(size_t);
+
+	if (header->elem_size == 0 || header->elem_size > limit
+	||  header->degree < 2 || header->degree > SSIZE_MAX / 2) return false;
+	return BTREE_NODE_ITEM_SLOTS(header->degree) <= limit / header->elem_size
+	    && BTREE_NODE_CHILD_SLOTS(header->degree) <= limit / child
+	    && header->count <= (size_t)-1 / header->elem_size;
+}
+
+/* Whether the `count` elements of `elems` are sorted by `cmp` */
+bool dump_sorted(const byte *elems,
+                 size_t count,
+                 size_t elem_size,
+                 int (*cmp)(const void *a, const void *b)) {
+	size_t i;
+
+	for (i = 1; i < count; i++) {
+		if (cmp(elems + (i - 1) * elem_size, elems + i * elem_size) > 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct btree* btree_load(int fd, int (*cmp)(const void *a, const void *b)) {
+	struct dump_header header;
+	struct btree *btree;
+	byte         *elems;
+	int           res;
+
+	if (!fd_read(fd, (byte*)&header, sizeof(header))
+	||  memcmp(header.magic, BTREE_DUMP_MAGIC, sizeof(header.magic)) != 0
+	||  header.version != BTREE_DUMP_VERSION
+	||  !dump_sizes_valid(&header)) {
+		fputs("BTree error: Not a tree dump!\n", stderr);
+		return NULL;
+	}
+
+	btree = btree_new(header.elem_size, header.degree, cmp);
+	if (btree == NULL) return NULL;
+	btree_set_order_stats(btree, header.flags & BTREE_DUMP_ORDER_STATS);
+	if (header.flags & BTREE_DUMP_SPLIT) btree_set_layout(btree, BTREE_LAYOUT_SPLIT);
+	if (header.count == 0) return btree;
+
+	/* One read for all elements, then a bottom-up build */
+	elems = btree->alloc(header.elem_size * header.count);
+	if (elems == NULL) {
+		fputs("BTree error: Failed to allocate elements to load!\n", stderr);
+		btree_free(&btree);
+		return NULL;
+	}
+	if (!fd_read(fd, elems, header.elem_size * header.count)) {
+		fputs("BTree error: Truncated tree dump!\n", stderr);
+		res = -1;
+	} else if (!dump_sorted(elems, header.count, header.elem_size, cmp)) {
+		fputs("BTree error: Tree dump is not sorted!\n", stderr);
+		res = -1;
+	} else {
+		res = btree_build_sorted(btree, elems, header.count,
+		                         BTREE_LOAD_FILL_FACTOR);
 	}
-	return res;
+	btree->dealloc(elems);
+	if (res != 0) btree_free(&btree);
+	return btree;
 }
 
 void node_print(struct node *root, const size_t elem_size, const int indent, void (*print_elem)(const void*)) {
@@ -684,13 +2380,24 @@ void node_print(struct node *root, const size_t elem_size, const int indent, voi
 
 void btree_print(struct btree *btree, void (*print_elem)(const void*)) {
 	printf("BTRee: degree:%ld\n", btree->degree);
-	if (btree->root == NULL) return;
+	if (!btree_classic(btree) || btree->root == NULL) return;
 	node_print(btree->root, btree->elem_size, 0, print_elem);
 }
 
 void* btree_first(struct btree *btree) {
 	struct node *root;
 	if (btree == NULL) return NULL;
+	if (btree->file != NULL) return file_first(btree->file);
+	if (btree->bplus != NULL) {
+		struct bplus_pos pos;
+		bplus_first(btree->bplus, &pos);
+		return bplus_elem(btree->bplus, &pos);
+	}
+	if (btree->tombstones) {
+		/* Which may be dead, step to the first that is not */
+		struct btree_cursor_t cur;
+		return btree_cursor_first(btree, &cur);
+	}
 	root = btree->root;
 
 	if (root == NULL) return NULL;
@@ -705,11 +2412,21 @@ void* btree_last(struct btree *btree) {
 	struct node *root;
 
 	if (btree == NULL) return NULL;
+	if (btree->file != NULL) return file_last(btree->file);
+	if (btree->bplus != NULL) {
+		struct bplus_pos pos;
+		bplus_last(btree->bplus, &pos);
+		return bplus_elem(btree->bplus, &pos);
+	}
+	if (btree->tombstones) {
+		struct btree_cursor_t cur;
+		return btree_cursor_last(btree, &cur);
+	}
 	root = btree->root;
 
 	if (root == NULL) return NULL;
 
-	while (!node_leaf(root)) root = root->children[root->c];
+	while (!node_leaf(root)) root = root->children[root->c - 1];
 
 	if (root->n == 0) return NULL;
 	return root->items + btree->elem_size * (root->n - 1); /* Return first element */
@@ -720,6 +2437,8 @@ size_t btree_height(struct btree *btree) {
 	size_t height = 0;
 
 	if (btree == NULL) return 0;
+	if (btree->file  != NULL) return file_height(btree->file);
+	if (btree->bplus != NULL) return bplus_height(btree->bplus);
 	root = btree->root;
 
 	if (root == NULL) return 0;
@@ -732,18 +2451,164 @@ size_t btree_height(struct btree *btree) {
 	return height;
 }
 
-size_t u32_pow(size_t base, size_t exponent) {
-	size_t res = 1;
-	while (exponent > 0) {
-		res *= base;
-		exponent--;
+size_t btree_size(struct btree *btree) {
+	if (btree == NULL) return 0;
+	if (btree->file  != NULL) return file_size(btree->file);
+	if (btree->bplus != NULL) return bplus_size(btree->bplus);
+	return btree->count - btree->dead;
+}
+
+/* Adds the nodes of the subtree rooted at `x` to `out` */
+void node_stats(struct btree *btree,
+                const struct node *x,
+                struct btree_stats *out) {
+	const ssize_t max = node_maxdegree(btree->degree);
+	ssize_t bucket    = x->n * BTREE_STATS_FILL_BUCKETS / max;
+	ssize_t i;
+
+	if (bucket >= BTREE_STATS_FILL_BUCKETS) bucket = BTREE_STATS_FILL_BUCKETS - 1;
+	out->fill_histogram[bucket]++;
+	out->fill += (double)x->n / max;
+	out->nodes++;
+
+	if (btree->layout == BTREE_LAYOUT_PACKED) {
+		out->node_bytes += node_leaf(x) ? btree->leaf_pool.obj_size
+		                                : btree->inner_pool.obj_size;
+	} else {
+		out->node_bytes += btree->node_pool.obj_size + btree->items_pool.obj_size
+		                 + (node_leaf(x) ? 0 : btree->children_pool.obj_size);
 	}
-	return res;
+
+	if (node_leaf(x)) {
+		out->leaves++;
+		return;
+	}
+	for (i = 0; i < x->c; i++) node_stats(btree, x->children[i], out);
 }
 
+/* Bytes in the slabs of `pool` */
+size_t pool_bytes(const struct pool *pool) {
+	const size_t slab_size = sizeof(void*) + pool->align - 1
+	                       + pool->obj_size * pool->per_slab;
+	const void  *slab;
+	size_t       bytes = 0;
 
-size_t btree_size(struct btree *btree) {
-	return u32_pow(2 * btree->degree, btree_height(btree)) - 1;
+	for (slab = pool->slabs; slab != NULL; slab = *(void* const*)slab) {
+		bytes += slab_size;
+	}
+	return bytes;
+}
+
+int btree_stats(struct btree *btree, struct btree_stats *out) {
+	if (btree == NULL || out == NULL || !btree_classic(btree)) return -1;
+
+	memset(out, 0, sizeof(*out));
+	out->elements   = btree_size(btree);
+	out->tombstones = btree->dead;
+	out->height   = btree_height(btree);
+	if (btree->root != NULL) node_stats(btree, btree->root, out);
+	if (out->nodes > 0) out->fill /= out->nodes;
+
+	/* Snapshots see the slabs as of when they were taken */
+	if (btree->pooled) {
+		out->allocated_bytes = pool_bytes(&btree->leaf_pool)
+		                     + pool_bytes(&btree->inner_pool)
+		                     + pool_bytes(&btree->node_pool)
+		                     + pool_bytes(&btree->items_pool)
+		                     + pool_bytes(&btree->children_pool);
+	} else if (btree->layout == BTREE_LAYOUT_PACKED) {
+		/* plus what `mem_get` takes to align them */
+		out->allocated_bytes = out->node_bytes + out->nodes
+		                     * (sizeof(void*) + BTREE_CACHE_LINE - 1);
+	} else {
+		out->allocated_bytes = out->node_bytes;
+	}
+	out->allocated_bytes += pool_bytes(&btree->value_pool);
+
+#ifdef BTREE_STATS
+	out->counting = 1;
+	out->counters.finds        = stat_get(btree, finds);
+	out->counters.cmps         = stat_get(btree, cmps);
+	out->counters.splits       = stat_get(btree, splits);
+	out->counters.merges       = stat_get(btree, merges);
+	out->counters.shifts_left  = stat_get(btree, shifts_left);
+	out->counters.shifts_right = stat_get(btree, shifts_right);
+#endif
+	return 0;
+}
+
+void btree_stats_reset(struct btree *btree) {
+	if (btree == NULL) return;
+#ifdef BTREE_STATS
+	memset(&btree->counters, 0, sizeof(btree->counters));
+#endif
+}
+
+size_t btree_rank(struct btree *btree, const void *key) {
+	struct node *x;
+	size_t rank = 0;
+
+	if (btree == NULL || !btree_classic(btree) || btree->root == NULL) return 0;
+
+	if (!btree->order_stats) {
+		/* Count them one by one */
+		struct btree_iter_t  iter;
+		struct btree_iter_t *it = &iter;
+		void *elem;
+
+		btree_iter_t_reset(btree, &it);
+		while ((elem = btree_iter(btree, it)) != NULL
+		   &&  elem_cmp(btree, elem, key) < 0) {
+			rank++;
+		}
+		return rank;
+	}
+
+	x = btree->root;
+	for (;;) {
+		int     res;
+		ssize_t i = node_find(btree, x, key, &res);
+		ssize_t j;
+
+		/* Items 0..i-1 are smaller, and so are all children left of them */
+		rank += i;
+		if (node_leaf(x)) return rank;
+		for (j = 0; j < i; j++) rank += node_counts(btree, x)[j];
+
+		x = x->children[i];
+	}
+}
+
+void* btree_select(struct btree *btree, size_t k) {
+	struct node *x;
+
+	if (btree == NULL || !btree_classic(btree)
+	||  btree->root == NULL || k >= btree_size(btree)) return NULL;
+
+	if (!btree->order_stats) {
+		struct btree_iter_t  iter;
+		struct btree_iter_t *it = &iter;
+		void *elem;
+
+		btree_iter_t_reset(btree, &it);
+		while ((elem = btree_iter(btree, it)) != NULL && k-- > 0);
+		return elem;
+	}
+
+	x = btree->root;
+	while (!node_leaf(x)) {
+		const size_t *counts = node_counts(btree, x);
+		ssize_t i;
+
+		/* Skip children and items until the k-th element is in reach */
+		for (i = 0; i < x->n && k >= counts[i]; i++) {
+			k -= counts[i];
+			if (k == 0) return x->items + btree->elem_size * i;
+			k--;
+		}
+		x = x->children[i];
+	}
+	return x->items + btree->elem_size * k;
 }
 
 
@@ -760,6 +2625,8 @@ struct btree_iter_t* btree_iter_t_new(struct btree *tree) {
 
 		iter->stack[iter->head].pos  = 0;
 		iter->stack[iter->head].node = tree->root;
+		if (tree->file  != NULL) file_iter_reset(tree->file, &iter->file);
+		if (tree->bplus != NULL) bplus_first(tree->bplus, &iter->bplus);
 	} else {
 		perror("Cannot instantiate iterator from null-pointer tree");
 	}
@@ -772,14 +2639,24 @@ void btree_iter_t_reset(struct btree *tree, struct btree_iter_t** it) {
 
 	(*it)->stack[0].pos  = 0;
 	(*it)->stack[0].node = tree->root;
+	if (tree->file  != NULL) file_iter_reset(tree->file, &(*it)->file);
+	if (tree->bplus != NULL) bplus_first(tree->bplus, &(*it)->bplus);
 }
 
 
-void* btree_iter(struct btree *tree, struct btree_iter_t *iter) {
+/* `iter_next` is `btree_iter` including tombstones */
+void* iter_next(struct btree *tree, struct btree_iter_t *iter) {
 	register int     pos  = 0;
 	register ssize_t head = 0;
 	register ssize_t n    = 0;
 
+	if (tree->file != NULL) return file_iter_next(tree->file, &iter->file);
+	if (tree->bplus != NULL) {
+		/* A walk along the leaves */
+		void *elem = bplus_elem(tree->bplus, &iter->bplus);
+		if (elem != NULL) bplus_step(tree->bplus, &iter->bplus, true);
+		return elem;
+	}
 	if (iter->stack[head].node == NULL) return NULL;
 
 	head = iter->head;
@@ -822,15 +2699,25 @@ void* btree_iter(struct btree *tree, struct btree_iter_t *iter) {
 	/* On evens, we decent into children */
 	if (!node_leaf(iter->stack[head].node)) {
 		if (pos % 2 == 0) {
+			struct node *x = iter->stack[head].node;
+
+			/* Fetch the subtree after the one we are about to walk */
+			if (tree->prefetch && pos / 2 + 1 < x->c) {
+				node_prefetch(tree, x->children[pos / 2 + 1]);
+			}
+
 			/* push child node onto iter->stack */
 			iter->stack[head + 1].pos  = 0;
-			iter->stack[head + 1].node = iter->stack[head].node->children[pos / 2];
+			iter->stack[head + 1].node = x->children[pos / 2];
 			iter->head++; head++;
 
 			/* Decent all the way to the left, if pos == 0 */
 			while (!node_leaf(iter->stack[iter->head].node)) {
+				x = iter->stack[head].node;
+				if (tree->prefetch) node_prefetch(tree, x->children[1]);
+
 				iter->stack[head + 1].pos  = 0;
-				iter->stack[head + 1].node = iter->stack[head].node->children[0];
+				iter->stack[head + 1].node = x->children[0];
 				iter->head++; head++;
 			}
 		}
@@ -848,3 +2735,676 @@ void* btree_iter(struct btree *tree, struct btree_iter_t *iter) {
 
 	return iter->stack[head].node->items + tree->elem_size * ( (pos - 1) / 2 );
 }
+
+void* btree_iter(struct btree *tree, struct btree_iter_t *iter) {
+	void *elem;
+
+	do {
+		elem = iter_next(tree, iter);
+	} while (elem != NULL && elem_dead(tree, elem));
+	return elem;
+}
+
+
+/* `iter_seek` positions `iter` in front of the first element not less than
+ * (`upper`: greater than) `key`. Every node on the path is left at the child
+ * the element is to be found in, or, if that child runs out, the item after
+ * it. See `btree_iter` for how positions are encoded. */
+void iter_seek(struct btree *tree,
+               struct btree_iter_t *iter,
+               const void *key,
+               const bool upper) {
+	struct node *x = tree->root;
+
+	if (tree->file != NULL) {
+		file_iter_seek(tree->file, &iter->file, key, upper);
+		return;
+	}
+	if (tree->bplus != NULL) {
+		bplus_seek(tree->bplus, &iter->bplus, key, upper);
+		return;
+	}
+
+	iter->head = 0;
+	iter->stack[0].pos  = 0;
+	iter->stack[0].node = x;
+	if (x == NULL) return;
+
+	for (;;) {
+		int     res;
+		ssize_t i = upper ? node_find_upper(tree, x, key, &res)
+		                  : node_find(tree, x, key, &res);
+
+		iter->stack[iter->head].pos  = 2 * i;
+		iter->stack[iter->head].node = x;
+
+		if (node_leaf(x)) break;
+
+		x = x->children[i];
+		iter->head++;
+	}
+}
+
+void btree_lower_bound(struct btree *tree,
+                       struct btree_iter_t *iter,
+                       const void *key) {
+	iter_seek(tree, iter, key, false);
+}
+
+void btree_upper_bound(struct btree *tree,
+                       struct btree_iter_t *iter,
+                       const void *key) {
+	iter_seek(tree, iter, key, true);
+}
+
+size_t btree_range(struct btree *tree,
+                   const void *lo,
+                   const void *hi,
+                   int (*callback)(void *elem, void *ctx),
+                   void *ctx) {
+	struct btree_iter_t  iter;
+	struct btree_iter_t *it      = &iter;
+	size_t               visited = 0;
+	void                *elem;
+
+	if (tree == NULL || btree_size(tree) == 0) return 0;
+
+	/* No allocations, the iterator lives on the stack */
+	if (lo != NULL) {
+		iter_seek(tree, it, lo, false);
+	} else {
+		btree_iter_t_reset(tree, &it);
+	}
+
+	while ((elem = btree_iter(tree, it)) != NULL
+	   &&  (hi == NULL || elem_cmp(tree, elem, hi) < 0)) {
+		visited++;
+		if (callback(elem, ctx) != 0) break;
+	}
+	return visited;
+}
+
+/* `compact_all` rebuilds the tree bottom-up out of the live elements.
+ * returnvalue: `false` if we ran out of memory, leaving the tree as it is */
+bool compact_all(struct btree *btree) {
+	const size_t         live  = btree->count - btree->dead;
+	byte                *elems = NULL;
+	struct btree_iter_t  iter;
+	struct btree_iter_t *it = &iter;
+	byte                *elem;
+	size_t               k = 0;
+
+	if (live > 0) {
+		elems = btree->alloc(btree->elem_size * live);
+		if (elems == NULL) return false;
+	}
+
+	btree_iter_t_reset(btree, &it);
+	while ((elem = btree_iter(btree, it)) != NULL) {
+		memcpy(elems + btree->elem_size * k++, elem, btree->elem_size);
+	}
+
+	if (btree_build_elems(btree, elems, live, BTREE_COMPACT_FILL_FACTOR, 1) != 0) {
+		if (elems != NULL) btree->dealloc(elems);
+		return false;
+	}
+	if (elems != NULL) btree->dealloc(elems);
+	btree->compact_resume = false;
+	return true;
+}
+
+/* Incremental compaction works one window at a time: a branching node right
+ * above the leaves, along with its leaves. The tombstones in there, and the
+ * one following the window, are squeezed out in place, then the nodes that
+ * ran underfull are fixed, once per window rather than once per tombstone */
+
+/* `compact_squeeze` moves the live items of the leaf `x` together.
+ * returnvalue: the number of tombstones dropped */
+size_t compact_squeeze(struct btree *btree, struct node *x) {
+	const size_t elem_size = btree->elem_size;
+	ssize_t live = 0;
+	ssize_t i;
+	size_t  dropped;
+
+	for (i = 0; i < x->n; i++) {
+		byte *elem = x->items + elem_size * i;
+
+		if (elem_dead(btree, elem)) continue;
+		if (live < i) memcpy(x->items + elem_size * live, elem, elem_size);
+		live++;
+	}
+	dropped = x->n - live;
+	x->n    = live;
+	return dropped;
+}
+
+/* `compact_unlink` removes item `i` of `x` along with child `i+1`, an empty
+ * leaf */
+void compact_unlink(struct btree *btree, struct node *x, ssize_t i) {
+	const size_t elem_size = btree->elem_size;
+
+	node_release(btree, x->children[i+1]);
+	memmove(x->items + elem_size * i, x->items + elem_size * (i+1),
+	        elem_size * (x->n - i - 1));
+	memmove(x->children + i + 1, x->children + i + 2,
+	        sizeof(struct node*) * (x->c - i - 2));
+	x->n--;
+	x->c--;
+}
+
+/* `compact_fill` brings child `i` of `x` up to t-1 items, shifting them over
+ * from a sibling that can spare some, or merging with one that cannot.
+ * returnvalue: the index of the child the items ended up in */
+ssize_t compact_fill(struct btree *btree, struct node *x, ssize_t i) {
+	const ssize_t t = btree->degree;
+
+	while (x->children[i]->n < node_mindegree(t)) {
+		if (i > 0 && x->children[i-1]->n >= t) {
+			node_shift_right(btree, x, i-1);
+		} else if (i < x->n && x->children[i+1]->n >= t) {
+			node_shift_left(btree, x, i);
+		} else if (i > 0) {
+			node_child_merge(btree, x, i-1);
+			i--;
+		} else if (i < x->n) {
+			node_child_merge(btree, x, i);
+		} else {
+			break; /* the only child of the root */
+		}
+	}
+	return i;
+}
+
+/* `compact_window` squeezes the tombstones out of the window at `x`, and
+ * takes the place of the tombstone at `fence`, the item following it, if it
+ * can. Fixing underfull nodes is left to the caller.
+ * returnvalue: the number of elements looked at */
+size_t compact_window(struct btree *btree, struct node *x, byte *fence) {
+	const size_t elem_size = btree->elem_size;
+	size_t  seen    = x->n;
+	size_t  dropped = 0;
+	ssize_t i;
+
+	if (node_leaf(x)) {
+		dropped = compact_squeeze(btree, x);
+		btree->count -= dropped;
+		btree->dead  -= dropped;
+		return seen;
+	}
+
+	for (i = 0; i < x->c; i++) {
+		seen    += x->children[i]->n;
+		dropped += compact_squeeze(btree, x->children[i]);
+	}
+
+	/* A dead item takes the place of its predecessor or successor, if the
+	 * leaves around it have any left, or goes along with the empty right one */
+	for (i = x->n - 1; i >= 0; i--) {
+		byte        *elem = x->items + elem_size * i;
+		struct node *y    = x->children[i  ];
+		struct node *z    = x->children[i+1];
+
+		if (!elem_dead(btree, elem)) continue;
+		dropped++;
+
+		if (y->n > 0) {
+			memcpy(elem, y->items + elem_size * --y->n, elem_size);
+		} else if (z->n > 0) {
+			memcpy(elem, z->items, elem_size);
+			memmove(z->items, z->items + elem_size, elem_size * --z->n);
+		} else {
+			compact_unlink(btree, x, i);
+		}
+	}
+
+	/* The fence takes the place of the last element of the window */
+	if (fence != NULL && elem_dead(btree, fence)) {
+		struct node *y = x->children[x->n];
+
+		if (y->n > 0) {
+			memcpy(fence, y->items + elem_size * --y->n, elem_size);
+			dropped++;
+		} else if (x->n > 0) {
+			memcpy(fence, x->items + elem_size * (x->n - 1), elem_size);
+			compact_unlink(btree, x, x->n - 1);
+			dropped++;
+		}
+	}
+
+	btree->count -= dropped;
+	btree->dead  -= dropped;
+	return seen;
+}
+
+size_t btree_compact(struct btree *btree, size_t budget) {
+	const size_t elem_size = btree != NULL ? btree->elem_size : 0;
+	struct {
+		struct node *node;
+		ssize_t      pos;
+	} path[512];
+	bool wrapped;
+
+	if (btree == NULL || !btree->tombstones || btree->dead == 0) return 0;
+
+	if (budget == 0 || budget >= btree->count) {
+		if (!compact_all(btree)) {
+			fputs("BTree error: Failed to allocate while compacting!\n", stderr);
+		}
+		return btree->dead;
+	}
+
+	/* Go on behind the last window, once around at most */
+	wrapped = !btree->compact_resume;
+	while (budget > 0 && btree->dead > 0) {
+		struct node *x      = btree->root;
+		size_t       depth  = 0;
+		byte        *fence  = NULL;
+		bool         fenced = false;
+		size_t       seen;
+		size_t       d;
+
+		while (!node_leaf(x) && !node_leaf(x->children[0])) {
+			int     res;
+			ssize_t i = 0;
+
+			if (btree->compact_resume) {
+				i = node_find_upper(btree, x, btree->compact_key, &res);
+			}
+			path[depth].node = x;
+			path[depth].pos  = i;
+			depth++;
+			x = x->children[i];
+		}
+		for (d = depth; d > 0 && fence == NULL; d--) {
+			if (path[d-1].pos < path[d-1].node->n) {
+				fence = path[d-1].node->items + elem_size * path[d-1].pos;
+			}
+		}
+
+		seen    = compact_window(btree, x, fence);
+		budget -= seen < budget ? seen : budget;
+		if (fence != NULL) {
+			memcpy(btree->compact_key, fence, elem_size);
+			fenced = true;
+		}
+
+		/* Fix the window's node first, so its leaves have neighbours to
+		 * borrow from even if all but one of its own are gone, then the
+		 * leaves, then whatever ran underfull on the way up */
+		if (depth > 0) {
+			path[depth-1].pos = compact_fill(btree, path[depth-1].node,
+			                                 path[depth-1].pos);
+			x = path[depth-1].node->children[path[depth-1].pos];
+		}
+		if (!node_leaf(x)) {
+			ssize_t i;
+			for (i = 0; i < x->c; i++) i = compact_fill(btree, x, i);
+		}
+		for (d = depth; d > 0; d--) {
+			compact_fill(btree, path[d-1].node, path[d-1].pos);
+		}
+		while (!node_leaf(btree->root) && btree->root->n == 0) {
+			x = btree->root;
+			btree->root = x->children[0];
+			node_release(btree, x);
+		}
+
+		/* No leaf left to take the fence's place, delete it the usual way */
+		if (fenced && elem_dead(btree, btree->compact_key)
+		&&  btree_delete_elem(btree, btree->compact_key, NULL)) {
+			btree->dead--;
+		}
+
+		btree->compact_resume = fenced;
+		if (!fenced) {
+			if (wrapped) break;
+			wrapped = true;
+		}
+	}
+	return btree->dead;
+}
+
+/* Subtrees walked by several threads, see `btree_parallel_for_each` */
+struct scan_job {
+	struct btree *tree;
+	struct node **tasks;
+	size_t        ntasks;
+	size_t        next;    /* first subtree not taken yet */
+	size_t        workers; /* number of threads that joined so far */
+	void        (*fn)(void *elem, void *ctx, size_t worker);
+	void         *ctx;
+};
+
+/* Calls `fn` on the elements below `x` in order */
+void node_walk(struct scan_job *job, struct node *x, const size_t worker) {
+	const size_t elem_size = job->tree->elem_size;
+	ssize_t i;
+
+	for (i = 0; i < x->n; i++) {
+		byte *elem = x->items + elem_size * i;
+
+		if (!node_leaf(x)) node_walk(job, x->children[i], worker);
+		if (!elem_dead(job->tree, elem)) job->fn(elem, job->ctx, worker);
+	}
+	if (!node_leaf(x)) node_walk(job, x->children[x->n], worker);
+}
+
+/* Takes on one subtree after the other, until none are left */
+void node_walk_tasks(struct scan_job *job, const size_t worker) {
+	for (;;) {
+		const size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+
+		if (i >= job->ntasks) return;
+		node_walk(job, job->tasks[i], worker);
+	}
+}
+
+void* node_walk_worker(void *arg) {
+	struct scan_job *job = arg;
+
+	node_walk_tasks(job, __atomic_fetch_add(&job->workers, 1, __ATOMIC_RELAXED));
+	return NULL;
+}
+
+int btree_parallel_for_each(struct btree *tree,
+                            size_t threads,
+                            void (*fn)(void *elem, void *ctx, size_t worker),
+                            void *ctx) {
+	struct scan_job job;
+	struct node    *root;
+	pthread_t      *workers = NULL;
+	size_t          started = 0;
+	size_t          i;
+
+	if (tree == NULL || !btree_classic(tree)) return -1;
+
+	root        = tree->root;
+	job.tree    = tree;
+	job.tasks   = &root;
+	job.ntasks  = root != NULL;
+	job.next    = 0;
+	job.workers = 1; /* we are worker 0 */
+	job.fn      = fn;
+	job.ctx     = ctx;
+
+	/* Split the tree into the subtrees a level or two down, walking the items
+	 * in between right away, until there are enough to go around. Running
+	 * out of memory just leaves us with fewer, larger subtrees */
+	while (threads > 1 && job.ntasks > 0 && !node_leaf(job.tasks[0])
+	   &&  job.ntasks < threads * BTREE_PARALLEL_TASKS) {
+		struct node **level;
+		size_t        n = 0;
+		size_t        j;
+
+		for (j = 0; j < job.ntasks; j++) n += job.tasks[j]->c;
+		level = tree->alloc(sizeof(struct node*) * n);
+		if (level == NULL) break;
+
+		for (n = 0, j = 0; j < job.ntasks; j++) {
+			struct node *x = job.tasks[j];
+			ssize_t k;
+
+			for (k = 0; k < x->c; k++) level[n++] = x->children[k];
+			for (k = 0; k < x->n; k++) {
+				byte *elem = x->items + tree->elem_size * k;
+				if (!elem_dead(tree, elem)) fn(elem, ctx, 0);
+			}
+		}
+
+		if (job.tasks != &root) tree->dealloc(job.tasks);
+		job.tasks  = level;
+		job.ntasks = n;
+	}
+
+	if (threads > job.ntasks) threads = job.ntasks;
+	if (threads > 1) workers = tree->alloc(sizeof(pthread_t) * (threads - 1));
+
+	/* Whatever threads we do not get, we make up for ourselves */
+	if (workers != NULL) {
+		for (i = 0; i < threads - 1; i++) {
+			if (pthread_create(&workers[started], NULL,
+			                   node_walk_worker, &job) == 0) {
+				started++;
+			}
+		}
+	}
+	node_walk_tasks(&job, 0);
+
+	for (i = 0; i < started; i++) pthread_join(workers[i], NULL);
+	if (workers != NULL)    tree->dealloc(workers);
+	if (job.tasks != &root) tree->dealloc(job.tasks);
+	return 0;
+}
+
+
+/**************************/
+/* Bidirectional cursors  */
+/**************************/
+#define \
+cursor_top(cur) ((cur)->stack[(cur)->head - 1])
+
+struct btree_cursor_t* btree_cursor_t_new(struct btree *tree) {
+	struct btree_cursor_t *cur;
+
+	if (tree == NULL || (tree->bplus == NULL && !btree_classic(tree))) {
+		return NULL;
+	}
+
+	cur = tree->alloc(sizeof(struct btree_cursor_t));
+	if (cur != NULL) {
+		cur->head         = 0;
+		cur->before_first = false;
+		cur->bplus.leaf   = NULL;
+	}
+	return cur;
+}
+
+void btree_cursor_t_free(struct btree *tree, struct btree_cursor_t **cur) {
+	if (*cur == NULL) return;
+	tree->dealloc(*cur);
+	*cur = NULL;
+}
+
+void* cursor_elem(struct btree *tree, struct btree_cursor_t *cur) {
+	if (cur->head == 0) return NULL;
+	return cursor_top(cur).node->items + tree->elem_size * cursor_top(cur).pos;
+}
+
+void cursor_push(struct btree_cursor_t *cur, struct node *x, ssize_t pos) {
+	cur->stack[cur->head].pos  = pos;
+	cur->stack[cur->head].node = x;
+	cur->head++;
+}
+
+/* Pushes the path to the first (`leftmost`) or last element below `x` */
+void* cursor_descend(struct btree *tree,
+                     struct btree_cursor_t *cur,
+                     struct node *x,
+                     const bool leftmost) {
+	while (!node_leaf(x)) {
+		cursor_push(cur, x, leftmost ? 0 : x->c - 1);
+		x = x->children[leftmost ? 0 : x->c - 1];
+	}
+	if (x->n == 0) {
+		/* Only the root can be empty, and then so is the tree */
+		cur->head         = 0;
+		cur->before_first = !leftmost;
+		return NULL;
+	}
+	cursor_push(cur, x, leftmost ? 0 : x->n - 1);
+	return cursor_elem(tree, cur);
+}
+
+/* Pops nodes whose children we are done with, until one has an item after
+ * (`forward`) or before the child we came from */
+void* cursor_ascend(struct btree *tree,
+                    struct btree_cursor_t *cur,
+                    const bool forward) {
+	cur->head--;
+	while (cur->head > 0) {
+		const ssize_t child = cursor_top(cur).pos;
+		if (forward && child < cursor_top(cur).node->n) {
+			return cursor_elem(tree, cur); /* item `child` follows child `child` */
+		}
+		if (!forward && child > 0) {
+			cursor_top(cur).pos = child - 1;
+			return cursor_elem(tree, cur);
+		}
+		cur->head--;
+	}
+	cur->before_first = !forward;
+	return NULL;
+}
+
+void* cursor_first(struct btree *tree, struct btree_cursor_t *cur) {
+	cur->head         = 0;
+	cur->before_first = false;
+	if (tree->bplus != NULL) {
+		bplus_first(tree->bplus, &cur->bplus);
+		return bplus_elem(tree->bplus, &cur->bplus);
+	}
+	if (tree->root == NULL) return NULL;
+	return cursor_descend(tree, cur, tree->root, true);
+}
+
+void* cursor_last(struct btree *tree, struct btree_cursor_t *cur) {
+	cur->head         = 0;
+	cur->before_first = false;
+	if (tree->bplus != NULL) {
+		bplus_last(tree->bplus, &cur->bplus);
+		return bplus_elem(tree->bplus, &cur->bplus);
+	}
+	if (tree->root == NULL) return NULL;
+	return cursor_descend(tree, cur, tree->root, false);
+}
+
+void* cursor_seek(struct btree *tree,
+                        struct btree_cursor_t *cur,
+                        const void *key) {
+	struct node *x = tree->root;
+
+	cur->head         = 0;
+	cur->before_first = false;
+	if (tree->bplus != NULL) {
+		bplus_seek(tree->bplus, &cur->bplus, key, false);
+		return bplus_elem(tree->bplus, &cur->bplus);
+	}
+	if (x == NULL) return NULL;
+
+	for (;;) {
+		int     res;
+		ssize_t i = node_find(tree, x, key, &res);
+
+		cursor_push(cur, x, i);
+		if (node_leaf(x)) {
+			if (i < x->n) return cursor_elem(tree, cur);
+			/* Everything in here is smaller, continue after this leaf */
+			return cursor_ascend(tree, cur, true);
+		}
+		x = x->children[i];
+	}
+}
+
+void* cursor_next(struct btree *tree, struct btree_cursor_t *cur) {
+	struct node *x;
+	ssize_t      pos;
+
+	if (tree->bplus != NULL) {
+		/* Leaves are linked, no need to go up and down */
+		if (cur->bplus.leaf == NULL) {
+			return cur->before_first ? cursor_first(tree, cur) : NULL;
+		}
+		bplus_step(tree->bplus, &cur->bplus, true);
+		return bplus_elem(tree->bplus, &cur->bplus);
+	}
+
+	if (cur->head == 0) {
+		return cur->before_first ? cursor_first(tree, cur) : NULL;
+	}
+
+	x   = cursor_top(cur).node;
+	pos = cursor_top(cur).pos;
+
+	if (!node_leaf(x)) {
+		/* The successor is the first element of the next child */
+		cursor_top(cur).pos = pos + 1;
+		return cursor_descend(tree, cur, x->children[pos + 1], true);
+	}
+	if (pos + 1 < x->n) {
+		cursor_top(cur).pos = pos + 1;
+		return cursor_elem(tree, cur);
+	}
+	return cursor_ascend(tree, cur, true);
+}
+
+void* cursor_prev(struct btree *tree, struct btree_cursor_t *cur) {
+	struct node *x;
+	ssize_t      pos;
+
+	if (tree->bplus != NULL) {
+		if (cur->bplus.leaf == NULL) {
+			return cur->before_first ? NULL : cursor_last(tree, cur);
+		}
+		bplus_step(tree->bplus, &cur->bplus, false);
+		cur->before_first = cur->bplus.leaf == NULL;
+		return bplus_elem(tree->bplus, &cur->bplus);
+	}
+
+	if (cur->head == 0) {
+		return cur->before_first ? NULL : cursor_last(tree, cur);
+	}
+
+	x   = cursor_top(cur).node;
+	pos = cursor_top(cur).pos;
+
+	if (!node_leaf(x)) {
+		/* The predecessor is the last element of the child before */
+		return cursor_descend(tree, cur, x->children[pos], false);
+	}
+	if (pos > 0) {
+		cursor_top(cur).pos = pos - 1;
+		return cursor_elem(tree, cur);
+	}
+	return cursor_ascend(tree, cur, false);
+}
+
+/* The public cursor functions step over tombstones, in the direction they
+ * moved in */
+void* cursor_skip(struct btree *tree,
+                  struct btree_cursor_t *cur,
+                  void *elem,
+                  const bool forward) {
+	while (elem != NULL && elem_dead(tree, elem)) {
+		elem = forward ? cursor_next(tree, cur) : cursor_prev(tree, cur);
+	}
+	return elem;
+}
+
+void* btree_cursor_first(struct btree *tree, struct btree_cursor_t *cur) {
+	return cursor_skip(tree, cur, cursor_first(tree, cur), true);
+}
+
+void* btree_cursor_last(struct btree *tree, struct btree_cursor_t *cur) {
+	return cursor_skip(tree, cur, cursor_last(tree, cur), false);
+}
+
+void* btree_cursor_seek(struct btree *tree,
+                        struct btree_cursor_t *cur,
+                        const void *key) {
+	return cursor_skip(tree, cur, cursor_seek(tree, cur, key), true);
+}
+
+void* btree_cursor_next(struct btree *tree, struct btree_cursor_t *cur) {
+	return cursor_skip(tree, cur, cursor_next(tree, cur), true);
+}
+
+void* btree_cursor_prev(struct btree *tree, struct btree_cursor_t *cur) {
+	return cursor_skip(tree, cur, cursor_prev(tree, cur), false);
+}
+
+void* btree_cursor_get(struct btree *tree, struct btree_cursor_t *cur) {
+	if (tree->bplus != NULL) return bplus_elem(tree->bplus, &cur->bplus);
+	return cursor_elem(tree, cur);
+}
+
+#undef cursor_top
@@ -12,8 +12,93 @@
 #define BTREE_CMP_EQ        (  0 )
 #define BTREE_CMP_GT        (  1 )
 
+/* Nodes with at most this many keys are scanned linearly by the hybrid
+ * in-node search, larger ones are narrowed down by binary search first */
+#define BTREE_SEARCH_CUTOFF_DEFAULT 16
+
+/* Prefetching loads up to this many bytes of a node's items ahead of time,
+ * see `btree_set_prefetch` */
+#define BTREE_PREFETCH_BYTES 512
+/* `btree_search_many` descends with this many keys at a time */
+#define BTREE_SEARCH_GROUP 16
+
+/* `btree_dump` writes in chunks of this many bytes */
+#define BTREE_DUMP_BUFFER (1 << 20)
+/* Fill factor of the trees built by `btree_load`, see `btree_build_sorted` */
+#define BTREE_LOAD_FILL_FACTOR 0.9
+
+/* Page size of new file-backed trees, see `btree_open` */
+#define BTREE_PAGE_SIZE_DEFAULT 4096
+/* File-backed trees sync their log every this many operations */
+#define BTREE_WAL_GROUP 1024
+/* and write their log in chunks of this many bytes */
+#define BTREE_WAL_BUFFER (64 << 10)
+/* and checkpoint once the log or the pages changed since the last checkpoint
+ * exceed this many bytes */
+#define BTREE_WAL_CHECKPOINT (64 << 20)
+
+/* Parallel bulk builds hand out leaves in chunks of about this many elements */
+#define BTREE_BUILD_CHUNK (16 << 10)
+/* `btree_parallel_for_each` splits the tree into at least this many subtrees
+ * per thread, as far as it has nodes, so threads finishing early find more */
+#define BTREE_PARALLEL_TASKS 8
+
+/* Fill factor of the trees rebuilt by `btree_compact` */
+#define BTREE_COMPACT_FILL_FACTOR 0.7
+
+/* `btree_stats` sorts nodes into this many buckets by how full they are */
+#define BTREE_STATS_FILL_BUCKETS 10
+
+enum btree_search {
+	BTREE_SEARCH_LINEAR, /* one comparison per key, left to right */
+	BTREE_SEARCH_BINARY, /* binary search all the way down */
+	BTREE_SEARCH_HYBRID, /* binary search down to `cutoff` keys, then linear */
+	BTREE_SEARCH_SIMD    /* vector compares, integer trees only, see below */
+};
+
+enum btree_layout {
+	BTREE_LAYOUT_PACKED, /* header, items and children in one aligned block */
+	BTREE_LAYOUT_SPLIT   /* header, items and children allocated separately */
+};
+
+enum btree_duplicates {
+	BTREE_DUPLICATES_MULTISET, /* equal elements are kept, in insertion order */
+	BTREE_DUPLICATES_REJECT,   /* an element equal to one present is dropped */
+	BTREE_DUPLICATES_REPLACE   /* it overwrites the one present (upsert) */
+};
+
 struct btree;
 struct btree_iter_t;
+struct btree_cursor_t;
+
+/* What the tree did since it was created, or since `btree_stats_reset`.
+ * Only counted if the library was built with `BTREE_STATS` defined, see
+ * `btree_stats`; without it, the counting compiles to nothing. */
+struct btree_counters {
+	size_t finds;        /* nodes searched for a key */
+	size_t cmps;         /* calls to the comparator */
+	size_t splits;       /* nodes split in two */
+	size_t merges;       /* pairs of nodes merged into one */
+	size_t shifts_left;  /* items borrowed from a right sibling */
+	size_t shifts_right; /* items borrowed from a left sibling */
+};
+
+struct btree_stats {
+	size_t elements;
+	size_t tombstones; /* see `btree_set_tombstones` */
+	size_t height;
+	size_t nodes;
+	size_t leaves;
+	size_t node_bytes;      /* memory of the nodes themselves */
+	size_t allocated_bytes; /* memory of nodes and values, with unused slab room */
+	/* Mean number of items per node, relative to the maximum of 2t-1, and the
+	 * number of nodes per tenth of that, the full ones counting to the last */
+	double fill;
+	size_t fill_histogram[BTREE_STATS_FILL_BUCKETS];
+	/* Whether `counters` were counted, i.e. `BTREE_STATS` was defined */
+	int    counting;
+	struct btree_counters counters;
+};
 
 /* elem_size: the size of the elements, typically `sizeof(struct <your struct>)`
  * t: degree of the btree, if you're in doubt, use `BTREE_SIZE_DEFAULT`
@@ -36,22 +121,340 @@ struct btree* btree_new_with_allocator(
                         void  *(*alloc)(size_t),
                         void   (*dealloc)(void*));
 
+/* Trees of unsigned 32-bit or 64-bit integers, `elem_size` is the size of the
+ * integer and elements are compared as such, no comparator is needed.
+ * These trees search nodes with SSE2/AVX2 compares (`BTREE_SEARCH_SIMD`),
+ * whichever the CPU supports, or a scalar binary search on other hardware.
+ */
+struct btree* btree_new_u32(size_t t);
+struct btree* btree_new_u64(size_t t);
+
+/* Key-value trees keep only the keys in their nodes, next to a pointer to the
+ * value, which lives in slabs of its own. Large values thus neither thin out
+ * the nodes nor get moved around by splits, shifts and merges.
+ * `cmp` compares keys. Such trees are filled with `btree_put` rather than
+ * `btree_insert`, batches or bulk builds, and do not support snapshots or
+ * dumps. Elements, as returned by searches, iterators and cursors, start with
+ * the key, see `btree_value` for the value.
+ */
+struct btree* btree_new_kv(size_t key_size,
+                           size_t value_size,
+                           size_t t,
+                           int    (*cmp)(const void *a, const void *b));
+
+/* B+trees keep all elements in their leaves, which are linked to each other,
+ * and only the leading `key_size` bytes of elements as separators in the inner
+ * nodes, so `cmp` must not look beyond those. In-order iteration and cursors
+ * thus walk from leaf to leaf instead of up and down the tree, and the inner
+ * nodes stay small enough to be cached. Searches always descend to a leaf.
+ * Such trees support inserts, batches, deletes, searches, bounds, iterators and
+ * cursors, but no order statistics, bulk builds or snapshots.
+ */
+struct btree* btree_new_bplus(size_t elem_size,
+                              size_t key_size,
+                              size_t t,
+                              int    (*cmp)(const void *a, const void *b));
+
+/* Selects how keys are located within a single node. Trees start out with
+ * `BTREE_SEARCH_HYBRID` and `BTREE_SEARCH_CUTOFF_DEFAULT`; this is meant to be
+ * called right after `btree_new`, but it is safe to change at any time.
+ * `cutoff` is only used by `BTREE_SEARCH_HYBRID`. `BTREE_SEARCH_SIMD` is only
+ * accepted by trees created with `btree_new_u32` or `btree_new_u64`.
+ */
+void   btree_set_search(struct btree *btree,
+                        enum btree_search strategy,
+                        size_t cutoff);
+
+/* Makes searches prefetch every node they descend into as a whole, and
+ * iterators prefetch the next subtree while walking the current one. This
+ * pays off for trees much larger than the CPU caches, and costs a little for
+ * smaller ones. Trees start out without it; safe to change at any time.
+ */
+void   btree_set_prefetch(struct btree *btree, int enabled);
+
+/* Makes the tree take its nodes from slabs of `nodes_per_slab` nodes, which
+ * are requested from the tree's allocator. Nodes freed by deletions are
+ * recycled for later insertions, and slabs are only handed back by
+ * `btree_free`. A `nodes_per_slab` of 0 allocates every node on its own again.
+ * returnvalue: 0 on success, -1 if the tree already holds elements.
+ */
+int    btree_set_node_pool(struct btree *btree, size_t nodes_per_slab);
+
+/* Selects how nodes are laid out in memory. Trees start out with
+ * `BTREE_LAYOUT_PACKED`, where each node is a single block aligned to
+ * a 64 byte cache line, holding the node header, its items and, for branching
+ * nodes only, its child pointers.
+ * returnvalue: 0 on success, -1 if the tree already holds elements.
+ */
+int    btree_set_layout(struct btree *btree, enum btree_layout layout);
+
+/* Makes branching nodes keep the number of elements in each of their
+ * subtrees, which `btree_rank` and `btree_select` need to run in O(log n).
+ * It costs an extra word per child, and updating the counts on the way down.
+ * returnvalue: 0 on success, -1 if the tree already holds elements.
+ */
+int    btree_set_order_stats(struct btree *btree, int enabled);
+
+/* Makes deleting from a key-value tree free the value and leave the key in
+ * its node as a tombstone, rather than take the key out and merge or shift
+ * nodes on the way down. Tombstones are skipped by searches, iterators,
+ * cursors and all other functions, and `btree_put` revives them in place.
+ * `btree_compact` takes them out. Not supported with order statistics.
+ * returnvalue: 0 on success, -1 if the tree already holds elements or is no
+ * key-value tree.
+ */
+int    btree_set_tombstones(struct btree *btree, int enabled);
+
+/* Selects what inserting an element equal to one already in the tree does,
+ * see `enum btree_duplicates`. Trees start out as `BTREE_DUPLICATES_MULTISET`.
+ * Either way, it takes a single descent. Not supported by file-backed trees
+ * and B+trees, which are multisets.
+ * returnvalue: 0 on success, -1 otherwise.
+ */
+int    btree_set_duplicates(struct btree *btree, enum btree_duplicates mode);
+
+/* Returns a read-only copy of the tree in O(1), which is left as it is while
+ * the tree changes. Both share their nodes, and writes to the tree copy the
+ * nodes they touch first, as long as any snapshot still refers to them.
+ * Snapshots support all reading functions, including iterators and cursors.
+ * They may be read and freed from other threads while the tree is written to,
+ * given an allocator that may be called from any thread, such as `malloc`.
+ * They must be taken by the thread writing, and be freed before the tree.
+ */
+struct btree* btree_snapshot(struct btree *btree);
+
+/* Opens the tree stored in the file at `path`, creating it if it is empty.
+ * Nodes are pages of `page_size` bytes (0: the file's, or
+ * `BTREE_PAGE_SIZE_DEFAULT` for a new one), the degree being the largest that
+ * fits. The file is mapped into memory, so opening takes O(1) however large
+ * the tree, and the elements returned point right into the mapping.
+ *
+ * File-backed trees support searching, inserting, deleting, batch insertion,
+ * iterators and bounds, `btree_first`/`last`, `btree_size` and `btree_height`.
+ * Inserting may move the mapping, which invalidates returned elements and
+ * iterators just like any write does.
+ *
+ * Changes are logged to "<path>-wal" and only written to the file itself by
+ * checkpoints, which happen as the log grows and on closing. Opening replays
+ * the log, so a crash loses no more than the changes since the last sync,
+ * which happens every `BTREE_WAL_GROUP` changes, or on `btree_sync`.
+ *
+ * returnvalue: NULL if the file cannot be opened, or holds a tree of another
+ * element or page size.
+ */
+struct btree* btree_open(const char *path,
+                         size_t elem_size,
+                         size_t page_size,
+                         int    (*cmp)(const void *a, const void *b));
+/* Waits for all changes to reach the log on disk.
+ * returnvalue: 0 on success, -1 otherwise. Once writing to the log failed,
+ * this keeps failing, as a crash may lose changes made since. */
+int    btree_sync(struct btree *btree);
+/* Checkpoints and frees a file-backed tree, removing its log. `btree_free`
+ * does the same but does not report errors. returnvalue: see `btree_sync`. */
+int    btree_close(struct btree **btree);
+
 void   btree_free(struct btree **btree);
 
 void*  btree_search(struct btree *btree, void *elem);
-void   btree_insert(struct btree *btree, void *elem);
+/* Searches all `n` keys of `keys`, stored one after the other, and stores what
+ * `btree_search` returns for each to `out`. Groups of `BTREE_SEARCH_GROUP`
+ * keys descend the tree side by side, prefetching the nodes they descend
+ * into, so their cache misses overlap rather than add up. Keys are elements
+ * for plain trees and keys for key-value trees.
+ * returnvalue: the number of keys found.
+ */
+size_t btree_search_many(struct btree *btree,
+                         const void *keys,
+                         size_t n,
+                         void **out);
+
+/* Inserts a copy of `elem`, see `btree_set_duplicates` for equal elements.
+ * returnvalue: 0 on success, -1 if we ran out of memory or, for file-backed
+ * trees, could not log the insertion, in which case it was not made. Should
+ * syncing the log fail later on, `btree_sync` and `btree_close` tell. */
+int    btree_insert(struct btree *btree, void *elem);
+/* returnvalue: 1 if an element equal to `elem` was deleted, 0 if there was
+ * none, -1 if a file-backed tree could not log the deletion, in which case it
+ * was not made, see `btree_insert`. */
 int    btree_delete(struct btree *btree, void *elem);
 
+/* Returns the element equal to `elem` if there is one, and inserts a copy of
+ * `elem` and returns that otherwise, in a single descent, whatever
+ * `btree_set_duplicates` says. Check `btree_size` to tell which happened.
+ * The element may be modified in place as long as its key stays the same,
+ * until the tree is modified.
+ * returnvalue: NULL on errors.
+ */
+void*  btree_insert_or_get(struct btree *btree, void *elem);
+
+/* Stores a copy of `value` under `key`, replacing the value already there.
+ * returnvalue: 1 if the key is new, 0 if it was replaced, -1 on errors. */
+int    btree_put(struct btree *btree, const void *key, const void *value);
+/* The value stored under `key`, NULL if there is none */
+void*  btree_get(struct btree *btree, const void *key);
+/* The value of an element of a key-value tree */
+void*  btree_value(struct btree *btree, const void *elem);
+
+/* Takes tombstones out of the tree, see `btree_set_tombstones`. It goes on
+ * where the last call left off, a run of leaves under one parent at a time,
+ * until it looked at about `budget` elements, so the time spent per call is
+ * bounded. The tombstones in such a run are squeezed out in place, and the
+ * nodes that run underfull are fixed once for the whole run.
+ * A `budget` of 0, or one of at least all elements, rebuilds the tree
+ * bottom-up out of the live elements instead, like `btree_build_sorted`
+ * with `BTREE_COMPACT_FILL_FACTOR`.
+ * returnvalue: the number of tombstones left.
+ */
+size_t btree_compact(struct btree *btree, size_t budget);
+
+/* Inserts the `count` elements of `elems`, in any order. The batch is sorted
+ * first, then every descent inserts all elements that belong into the same
+ * leaf at once, as far as the leaf has room, so a leaf is split at most once
+ * per fill rather than visited once per element. Equal elements are handled
+ * as if inserted one by one, in the order of `elems`.
+ * returnvalue: the number of elements dealt with, which is only less than
+ * `count` if we ran out of memory.
+ */
+size_t btree_insert_batch(struct btree *btree, const void *elems, size_t count);
+
+/* Replaces the contents of the tree with the `count` elements of `elems`,
+ * which must be sorted by the tree's comparator. Rather than inserting them
+ * one by one, the tree is built bottom-up in O(count), packing nodes with
+ * `fill_factor` * (2 * degree - 1) elements, except where that would leave a
+ * node with fewer than degree - 1. A `fill_factor` of 1 gives the smallest
+ * tree, but also makes the first insertions split all the way up.
+ * returnvalue: 0 on success, -1 if we ran out of memory, in which case the tree
+ * is left untouched.
+ */
+int    btree_build_sorted(struct btree *btree,
+                          const void *elems,
+                          size_t count,
+                          double fill_factor);
+
+/* Same as `btree_build_sorted`, with up to `threads` threads, the calling one
+ * included, building the leaves, which hold all but a fraction 1/degree of
+ * the elements. The levels above are built by the calling thread. Unless the
+ * tree has a node pool, its allocator is called from all threads, so it must
+ * be thread-safe, as `malloc` is.
+ */
+int    btree_build_sorted_parallel(struct btree *btree,
+                                   const void *elems,
+                                   size_t count,
+                                   double fill_factor,
+                                   size_t threads);
+
+/* Same as `btree_build_sorted`, but for elements in any order. They are
+ * sorted in a copy first, equal elements keep their order.
+ */
+int    btree_build(struct btree *btree,
+                   const void *elems,
+                   size_t count,
+                   double fill_factor);
+
+/* Writes the degree, element size and all elements in order to `fd`, in
+ * large sequential writes, so that `btree_load` can rebuild the tree without
+ * sorting or inserting. The format uses the native byte order.
+ * returnvalue: 0 on success, -1 if writing failed.
+ */
+int    btree_dump(struct btree *btree, int fd);
+/* Reads a tree written by `btree_dump` from `fd`, and builds it bottom-up
+ * like `btree_build_sorted`. `cmp` must order the elements as the dumped
+ * tree's comparator did. Order statistics and the layout are restored, other
+ * settings start out at their defaults.
+ * returnvalue: NULL if `fd` does not hold a dump, or one whose elements are
+ * out of order under `cmp`, or if we ran out of memory.
+ */
+struct btree* btree_load(int fd, int (*cmp)(const void *a, const void *b));
+
 void   btree_print(struct btree *btree, void (*print_elem)(const void*));
 
 void*  btree_first(struct btree *btree);
 void*  btree_last(struct btree *btree);
 
+/* The exact number of elements, in O(1) */
 size_t btree_size(struct btree *btree);
 
+/* Walks the whole tree in O(n / t) to fill in `out`, and copies the counters.
+ * Comparing `counters` before and after a workload tells e.g. the comparisons
+ * per search, or how often nodes are split and merged; the fill histogram
+ * tells how much of the nodes is wasted. Build with `make stats` to count.
+ * Not supported by file-backed trees and B+trees.
+ * returnvalue: 0 on success, -1 otherwise.
+ */
+int    btree_stats(struct btree *btree, struct btree_stats *out);
+/* Sets all counters back to 0 */
+void   btree_stats_reset(struct btree *btree);
+
+/* Number of elements less than `key` */
+size_t btree_rank(struct btree *btree, const void *key);
+/* The `k`-th smallest element, counting from 0, NULL if there are fewer */
+void*  btree_select(struct btree *btree, size_t k);
+/* Both take O(log n) with `btree_set_order_stats`, and O(n) otherwise. */
+
 struct btree_iter_t* btree_iter_t_new(struct btree* tree);
 void                 btree_iter_t_reset(struct btree *tree, struct btree_iter_t** it);
 
 void*  btree_iter(struct btree *tree, struct btree_iter_t *iter);
 
+/* Position `iter` in O(log n), such that the next call to `btree_iter` returns
+ * the first element not less than `key` (`btree_lower_bound`), or the first
+ * element greater than `key` (`btree_upper_bound`). Iterating carries on in
+ * order from there.
+ */
+void   btree_lower_bound(struct btree *tree,
+                         struct btree_iter_t *iter,
+                         const void *key);
+void   btree_upper_bound(struct btree *tree,
+                         struct btree_iter_t *iter,
+                         const void *key);
+
+/* Calls `callback` on every element in [lo, hi) in order, with `ctx` passed
+ * along, until it returns non-zero. A NULL `lo` or `hi` leaves that end open.
+ * Nothing is allocated.
+ * returnvalue: the number of elements `callback` was called on.
+ */
+size_t btree_range(struct btree *tree,
+                   const void *lo,
+                   const void *hi,
+                   int (*callback)(void *elem, void *ctx),
+                   void *ctx);
+
+/* Calls `fn` on every element, on up to `threads` threads, the calling one
+ * included. The tree is split into the subtrees a level or two below the
+ * root, and every thread takes on one subtree after the other, so those
+ * done early help out with the rest. Elements thus come in no particular
+ * order, except that each subtree is walked in order. `worker` numbers the
+ * threads from 0, the calling one, to `threads - 1`, so they can accumulate
+ * into a slot of `ctx` each without locking. The tree must not be
+ * written to meanwhile. Not supported by file-backed trees and B+trees.
+ * returnvalue: 0 on success, -1 otherwise.
+ */
+int    btree_parallel_for_each(struct btree *tree,
+                               size_t threads,
+                               void (*fn)(void *elem, void *ctx, size_t worker),
+                               void *ctx);
+
+/* Bidirectional cursors. A cursor sits on one element of the tree, or off
+ * either end of it. Moving it to the first or last element, or seeking a key,
+ * costs O(log n); stepping costs O(1) amortized, so walking N elements from
+ * any position costs O(log n + N). All functions return the element the
+ * cursor ends up on, NULL once it moved off an end. Stepping back from past
+ * the last element yields the last element, and vice versa.
+ * Cursors are invalidated by insertions and deletions.
+ */
+struct btree_cursor_t* btree_cursor_t_new(struct btree *tree);
+void                   btree_cursor_t_free(struct btree *tree,
+                                           struct btree_cursor_t **cur);
+
+void*  btree_cursor_first(struct btree *tree, struct btree_cursor_t *cur);
+void*  btree_cursor_last(struct btree *tree, struct btree_cursor_t *cur);
+/* Moves to the first element not less than `key` */
+void*  btree_cursor_seek(struct btree *tree,
+                         struct btree_cursor_t *cur,
+                         const void *key);
+void*  btree_cursor_next(struct btree *tree, struct btree_cursor_t *cur);
+void*  btree_cursor_prev(struct btree *tree, struct btree_cursor_t *cur);
+void*  btree_cursor_get(struct btree *tree, struct btree_cursor_t *cur);
+
 #endif
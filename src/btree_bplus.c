@@ -0,0 +1,506 @@
+#include "btree.h"
+#include "btree_bplus.h"
+#include "btree_layout.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Definitions */
+typedef unsigned char byte;
+
+/* All elements live in the leaves, which are chained in order. Branching nodes
+ * hold separator keys only: every element below child i is not greater than
+ * key i, and not less than key i - 1. A separator is a copy of the largest
+ * key of its left side at the time of the split, and need not be present in
+ * the tree anymore. */
+
+struct bnode {
+	size_t        n;    /* items of a leaf, keys of a branching node */
+	bool          leaf;
+	struct bnode *prev; /* neighbouring leaves, leaves only */
+	struct bnode *next;
+	/* items or keys at `items_offset`, children at `children_offset` */
+};
+
+struct bplus {
+	/* Size stuffs */
+	size_t elem_size;
+	size_t key_size;
+	size_t degree;
+	size_t count;
+
+	/* comparison, of keys */
+	int (*cmp)(const void *a, const void *b);
+
+	/* Memory stuffs */
+	void *(*alloc)(size_t);
+	void  (*dealloc)(void*);
+	size_t items_offset;
+	size_t children_offset;
+
+	struct bnode *root;
+};
+
+#define MEM_ALIGN 16
+
+#define \
+align_up(size, align) (((size) + (align) - 1) / (align) * (align))
+
+#define \
+bnode_max(bp) (2 * (bp)->degree - 1)
+
+#define \
+bnode_min(bp) ((bp)->degree - 1)
+
+/* The size of the items or keys in `x` */
+#define \
+bnode_stride(bp, x) ((x)->leaf ? (bp)->elem_size : (bp)->key_size)
+
+#define \
+bnode_item(bp, x, i) \
+	((byte*)(x) + (bp)->items_offset + bnode_stride(bp, x) * (size_t)(i))
+
+#define \
+bnode_children(bp, x) ((struct bnode**)((byte*)(x) + (bp)->children_offset))
+
+/* Scans touch the leaves one after the other, fetch the next while the
+ * current one is being read */
+#ifdef __GNUC__
+#define bnode_prefetch(bp, x) do {                            \
+	__builtin_prefetch(x);                                    \
+	__builtin_prefetch((byte*)(x) + (bp)->items_offset);      \
+} while (0)
+#else
+#define bnode_prefetch(bp, x) ((void)0)
+#endif
+
+/**********************/
+/* Node functionality */
+/**********************/
+
+static struct bnode* bnode_new(struct bplus *bp, bool leaf) {
+	const size_t size = leaf
+	                  ? bp->items_offset + bp->elem_size * bnode_max(bp)
+	                  : bp->children_offset
+	                    + sizeof(struct bnode*) * (bnode_max(bp) + 1);
+	struct bnode *x = bp->alloc(size);
+
+	if (x == NULL) return NULL;
+	x->n    = 0;
+	x->leaf = leaf;
+	x->prev = NULL;
+	x->next = NULL;
+	return x;
+}
+
+static void bnode_free(struct bplus *bp, struct bnode *x) {
+	size_t i;
+
+	if (!x->leaf) {
+		for (i = 0; i <= x->n; i++) bnode_free(bp, bnode_children(bp, x)[i]);
+	}
+	bp->dealloc(x);
+}
+
+/* Same as `node_find`, by binary search */
+static size_t bnode_find(struct bplus *bp,
+                         const struct bnode *x,
+                         const void *key,
+                         int *cmp_res) {
+	size_t lo  = 0;
+	size_t hi  = x->n;
+	int    res = BTREE_CMP_GT;
+
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		const int    c   = bp->cmp(key, bnode_item(bp, x, mid));
+		if (c > 0) {
+			lo = mid + 1;
+		} else {
+			hi  = mid;
+			res = c;
+		}
+	}
+	*cmp_res = res;
+	return lo;
+}
+
+/* `bnode_find_upper` is `bnode_find` for the first item greater than `key` */
+static size_t bnode_find_upper(struct bplus *bp,
+                               const struct bnode *x,
+                               const void *key) {
+	size_t lo = 0;
+	size_t hi = x->n;
+
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (bp->cmp(key, bnode_item(bp, x, mid)) >= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* `bnode_split_child` splits the full child `i` of `x`. A leaf keeps the
+ * lower t items and passes a copy of the largest key up, a branching node
+ * passes its median key up. */
+static bool bnode_split_child(struct bplus *bp, struct bnode *x, size_t i) {
+	const size_t  t = bp->degree;
+	struct bnode *y = bnode_children(bp, x)[i];
+	struct bnode *z = bnode_new(bp, y->leaf);
+	const byte   *sep;
+
+	if (z == NULL) return false;
+
+	if (y->leaf) {
+		memcpy(bnode_item(bp, z, 0), bnode_item(bp, y, t),
+		       bp->elem_size * (t - 1));
+		z->n = t - 1;
+		y->n = t;
+		sep  = bnode_item(bp, y, t - 1);
+
+		z->prev = y;
+		z->next = y->next;
+		if (y->next != NULL) y->next->prev = z;
+		y->next = z;
+	} else {
+		memcpy(bnode_item(bp, z, 0), bnode_item(bp, y, t),
+		       bp->key_size * (t - 1));
+		memcpy(bnode_children(bp, z), bnode_children(bp, y) + t,
+		       sizeof(struct bnode*) * t);
+		z->n = t - 1;
+		y->n = t - 1;
+		sep  = bnode_item(bp, y, t - 1);
+	}
+
+	memmove(bnode_children(bp, x) + i + 2, bnode_children(bp, x) + i + 1,
+	        sizeof(struct bnode*) * (x->n - i));
+	bnode_children(bp, x)[i + 1] = z;
+	memmove(bnode_item(bp, x, i + 1), bnode_item(bp, x, i),
+	        bp->key_size * (x->n - i));
+	memcpy(bnode_item(bp, x, i), sep, bp->key_size);
+	x->n++;
+	return true;
+}
+
+/* `bnode_merge` merges child `i + 1` of `x` into child `i` */
+static void bnode_merge(struct bplus *bp, struct bnode *x, size_t i) {
+	struct bnode *y = bnode_children(bp, x)[i];
+	struct bnode *z = bnode_children(bp, x)[i + 1];
+
+	if (y->leaf) {
+		memcpy(bnode_item(bp, y, y->n), bnode_item(bp, z, 0),
+		       bp->elem_size * z->n);
+		y->n += z->n;
+		y->next = z->next;
+		if (z->next != NULL) z->next->prev = y;
+	} else {
+		/* The separator comes down between them */
+		memcpy(bnode_item(bp, y, y->n), bnode_item(bp, x, i), bp->key_size);
+		memcpy(bnode_item(bp, y, y->n + 1), bnode_item(bp, z, 0),
+		       bp->key_size * z->n);
+		memcpy(bnode_children(bp, y) + y->n + 1, bnode_children(bp, z),
+		       sizeof(struct bnode*) * (z->n + 1));
+		y->n += z->n + 1;
+	}
+
+	memmove(bnode_item(bp, x, i), bnode_item(bp, x, i + 1),
+	        bp->key_size * (x->n - i - 1));
+	memmove(bnode_children(bp, x) + i + 1, bnode_children(bp, x) + i + 2,
+	        sizeof(struct bnode*) * (x->n - i - 1));
+	x->n--;
+	bp->dealloc(z);
+}
+
+/* `bnode_borrow_left` moves the last item of child `i - 1` of `x` to the
+ * front of child `i` */
+static void bnode_borrow_left(struct bplus *bp, struct bnode *x, size_t i) {
+	struct bnode *y = bnode_children(bp, x)[i - 1];
+	struct bnode *z = bnode_children(bp, x)[i];
+	const size_t  stride = bnode_stride(bp, z);
+
+	memmove(bnode_item(bp, z, 1), bnode_item(bp, z, 0), stride * z->n);
+	if (z->leaf) {
+		memcpy(bnode_item(bp, z, 0), bnode_item(bp, y, y->n - 1), stride);
+		y->n--;
+		memcpy(bnode_item(bp, x, i - 1), bnode_item(bp, y, y->n - 1),
+		       bp->key_size);
+	} else {
+		memcpy(bnode_item(bp, z, 0), bnode_item(bp, x, i - 1), stride);
+		memmove(bnode_children(bp, z) + 1, bnode_children(bp, z),
+		        sizeof(struct bnode*) * (z->n + 1));
+		bnode_children(bp, z)[0] = bnode_children(bp, y)[y->n];
+		memcpy(bnode_item(bp, x, i - 1), bnode_item(bp, y, y->n - 1),
+		       bp->key_size);
+		y->n--;
+	}
+	z->n++;
+}
+
+/* `bnode_borrow_right` moves the first item of child `i + 1` of `x` to the
+ * end of child `i` */
+static void bnode_borrow_right(struct bplus *bp, struct bnode *x, size_t i) {
+	struct bnode *y = bnode_children(bp, x)[i];
+	struct bnode *z = bnode_children(bp, x)[i + 1];
+	const size_t  stride = bnode_stride(bp, y);
+
+	if (y->leaf) {
+		memcpy(bnode_item(bp, y, y->n), bnode_item(bp, z, 0), stride);
+		memcpy(bnode_item(bp, x, i), bnode_item(bp, z, 0), bp->key_size);
+	} else {
+		memcpy(bnode_item(bp, y, y->n), bnode_item(bp, x, i), stride);
+		bnode_children(bp, y)[y->n + 1] = bnode_children(bp, z)[0];
+		memcpy(bnode_item(bp, x, i), bnode_item(bp, z, 0), bp->key_size);
+		memmove(bnode_children(bp, z), bnode_children(bp, z) + 1,
+		        sizeof(struct bnode*) * z->n);
+	}
+	memmove(bnode_item(bp, z, 0), bnode_item(bp, z, 1), stride * (z->n - 1));
+	y->n++;
+	z->n--;
+}
+
+/* `bnode_fix` refills child `i` of `x`, should it have fallen short */
+static void bnode_fix(struct bplus *bp, struct bnode *x, size_t i) {
+	struct bnode **children = bnode_children(bp, x);
+
+	if (children[i]->n >= bnode_min(bp)) return;
+
+	if (i > 0 && children[i - 1]->n > bnode_min(bp)) {
+		bnode_borrow_left(bp, x, i);
+	} else if (i < x->n && children[i + 1]->n > bnode_min(bp)) {
+		bnode_borrow_right(bp, x, i);
+	} else if (i > 0) {
+		bnode_merge(bp, x, i - 1);
+	} else {
+		bnode_merge(bp, x, i);
+	}
+}
+
+static int bnode_delete(struct bplus *bp, struct bnode *x, const void *key) {
+	int    res;
+	size_t i = bnode_find(bp, x, key, &res);
+
+	if (x->leaf) {
+		if (i == x->n || res != 0) return 0;
+		memmove(bnode_item(bp, x, i), bnode_item(bp, x, i + 1),
+		        bp->elem_size * (x->n - i - 1));
+		x->n--;
+		return 1;
+	}
+
+	/* Elements equal to a separator may be on either side of it */
+	for (;;) {
+		if (bnode_delete(bp, bnode_children(bp, x)[i], key)) {
+			bnode_fix(bp, x, i);
+			return 1;
+		}
+		if (i == x->n || bp->cmp(key, bnode_item(bp, x, i)) != 0) return 0;
+		i++;
+	}
+}
+
+/***********************/
+/* Tree functionality  */
+/***********************/
+
+struct bplus* bplus_new(size_t elem_size,
+                        size_t key_size,
+                        size_t t,
+                        int    (*cmp)(const void *a, const void *b),
+                        void  *(*alloc)(size_t),
+                        void   (*dealloc)(void*)) {
+	struct bplus *bp;
+
+	if (t < 2 || key_size == 0 || key_size > elem_size) {
+		fputs("BTree error: Invalid B+tree parameters!\n", stderr);
+		return NULL;
+	}
+
+	bp = alloc(sizeof(struct bplus));
+	if (bp == NULL) return NULL;
+
+	bp->elem_size = elem_size;
+	bp->key_size  = key_size;
+	bp->degree    = t;
+	bp->count     = 0;
+	bp->cmp       = cmp;
+	bp->alloc     = alloc;
+	bp->dealloc   = dealloc;
+	bp->root      = NULL;
+
+	bp->items_offset    = align_up(sizeof(struct bnode), MEM_ALIGN);
+	bp->children_offset = align_up(bp->items_offset + key_size * (2 * t - 1),
+	                               sizeof(struct bnode*));
+	return bp;
+}
+
+void bplus_free(struct bplus **bp) {
+	if ((*bp)->root != NULL) bnode_free(*bp, (*bp)->root);
+	(*bp)->dealloc(*bp);
+	*bp = NULL;
+}
+
+size_t bplus_size(const struct bplus *bp) {
+	return bp->count;
+}
+
+size_t bplus_height(const struct bplus *bp) {
+	const struct bnode *x = bp->root;
+	size_t height = 0;
+
+	if (x == NULL) return 0;
+	while (!x->leaf) {
+		x = bnode_children(bp, x)[0];
+		height++;
+	}
+	return height;
+}
+
+void* bplus_search(struct bplus *bp, const void *key) {
+	struct bplus_pos pos;
+	void *elem;
+
+	bplus_seek(bp, &pos, key, false);
+	elem = bplus_elem(bp, &pos);
+	return elem != NULL && bp->cmp(key, elem) == 0 ? elem : NULL;
+}
+
+int bplus_insert(struct bplus *bp, const void *elem) {
+	struct bnode *x;
+
+	if (bp->root == NULL) {
+		bp->root = bnode_new(bp, true);
+		if (bp->root == NULL) return -1;
+	}
+
+	/* Split full nodes on the way down, starting with the root */
+	if (bp->root->n == bnode_max(bp)) {
+		struct bnode *s = bnode_new(bp, false);
+		if (s == NULL) return -1;
+		bnode_children(bp, s)[0] = bp->root;
+		if (!bnode_split_child(bp, s, 0)) {
+			bp->dealloc(s);
+			return -1;
+		}
+		bp->root = s;
+	}
+
+	x = bp->root;
+	for (;;) {
+		int    res;
+		size_t i = bnode_find(bp, x, elem, &res);
+
+		if (x->leaf) {
+			memmove(bnode_item(bp, x, i + 1), bnode_item(bp, x, i),
+			        bp->elem_size * (x->n - i));
+			memcpy(bnode_item(bp, x, i), elem, bp->elem_size);
+			x->n++;
+			bp->count++;
+			return 0;
+		}
+		if (bnode_children(bp, x)[i]->n == bnode_max(bp)) {
+			if (!bnode_split_child(bp, x, i)) return -1;
+			if (bp->cmp(elem, bnode_item(bp, x, i)) > 0) i++;
+		}
+		x = bnode_children(bp, x)[i];
+	}
+}
+
+int bplus_delete(struct bplus *bp, const void *key) {
+	struct bnode *root = bp->root;
+
+	if (root == NULL || !bnode_delete(bp, root, key)) return 0;
+	bp->count--;
+
+	if (!root->leaf && root->n == 0) {
+		/* shrink the tree */
+		bp->root = bnode_children(bp, root)[0];
+		bp->dealloc(root);
+	}
+	return 1;
+}
+
+/*************/
+/* Positions */
+/*************/
+
+void bplus_first(struct bplus *bp, struct bplus_pos *pos) {
+	struct bnode *x = bp->root;
+
+	pos->leaf = NULL;
+	pos->pos  = 0;
+	if (x == NULL) return;
+	while (!x->leaf) x = bnode_children(bp, x)[0];
+	if (x->n > 0) pos->leaf = x;
+}
+
+void bplus_last(struct bplus *bp, struct bplus_pos *pos) {
+	struct bnode *x = bp->root;
+
+	pos->leaf = NULL;
+	pos->pos  = 0;
+	if (x == NULL) return;
+	while (!x->leaf) x = bnode_children(bp, x)[x->n];
+	if (x->n > 0) {
+		pos->leaf = x;
+		pos->pos  = x->n - 1;
+	}
+}
+
+void bplus_seek(struct bplus *bp,
+                struct bplus_pos *pos,
+                const void *key,
+                int upper) {
+	struct bnode *x = bp->root;
+	int    res;
+	size_t i = 0;
+
+	pos->leaf = NULL;
+	pos->pos  = 0;
+	if (x == NULL) return;
+
+	for (;;) {
+		i = upper ? bnode_find_upper(bp, x, key) : bnode_find(bp, x, key, &res);
+		if (x->leaf) break;
+		x = bnode_children(bp, x)[i];
+	}
+
+	/* Everything in this leaf is smaller, the next one starts at the
+	 * separator we followed */
+	if (i == x->n) {
+		x = x->next;
+		i = 0;
+	}
+	pos->leaf = x;
+	pos->pos  = i;
+}
+
+void bplus_step(struct bplus *bp, struct bplus_pos *pos, int forward) {
+	struct bnode *x = pos->leaf;
+
+	if (x == NULL) return;
+
+	if (forward) {
+		if (++pos->pos < x->n) return;
+		x = x->next;
+		pos->pos = 0;
+		if (x != NULL && x->next != NULL) bnode_prefetch(bp, x->next);
+	} else {
+		if (pos->pos-- > 0) return;
+		x = x->prev;
+		if (x != NULL) {
+			pos->pos = x->n - 1;
+			if (x->prev != NULL) bnode_prefetch(bp, x->prev);
+		}
+	}
+	pos->leaf = x;
+}
+
+void* bplus_elem(struct bplus *bp, const struct bplus_pos *pos) {
+	if (pos->leaf == NULL) return NULL;
+	return bnode_item(bp, (struct bnode*)pos->leaf, pos->pos);
+}
@@ -0,0 +1,46 @@
+#ifndef BTREE_BPLUS_H
+#define BTREE_BPLUS_H
+
+/* B+trees, see `btree_new_bplus`. Internal to btree.c, which dispatches to
+ * these for trees created as B+trees. */
+
+#include <stddef.h>
+
+struct bplus;
+
+/* A position within the leaves: the item at `pos` of `leaf`, or off either
+ * end of the tree if `leaf` is NULL */
+struct bplus_pos {
+	void   *leaf;
+	size_t  pos;
+};
+
+struct bplus* bplus_new(size_t elem_size,
+                        size_t key_size,
+                        size_t t,
+                        int    (*cmp)(const void *a, const void *b),
+                        void  *(*alloc)(size_t),
+                        void   (*dealloc)(void*));
+void   bplus_free(struct bplus **bp);
+
+size_t bplus_size(const struct bplus *bp);
+size_t bplus_height(const struct bplus *bp);
+
+void*  bplus_search(struct bplus *bp, const void *key);
+/* returnvalue: 0 on success, -1 if we ran out of memory */
+int    bplus_insert(struct bplus *bp, const void *elem);
+int    bplus_delete(struct bplus *bp, const void *key);
+
+void   bplus_first(struct bplus *bp, struct bplus_pos *pos);
+void   bplus_last(struct bplus *bp, struct bplus_pos *pos);
+/* Moves to the first element not less than (`upper`: greater than) `key` */
+void   bplus_seek(struct bplus *bp,
+                  struct bplus_pos *pos,
+                  const void *key,
+                  int upper);
+/* Moves to the next (`forward`) or previous element */
+void   bplus_step(struct bplus *bp, struct bplus_pos *pos, int forward);
+/* The element at `pos`, NULL if it is off the tree */
+void*  bplus_elem(struct bplus *bp, const struct bplus_pos *pos);
+
+#endif
@@ -0,0 +1,1138 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "btree.h"
+#include "btree_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* A file-backed tree is an array of fixed-size pages. Page 0 holds the
+ * header, every other page is either a node or on the free list. Child
+ * pointers are page numbers, page 0 doubling as NULL.
+ *
+ * The file is mapped privately, so changes stay in memory until a checkpoint
+ * writes the pages changed since the last one back. Before that, every
+ * change goes to a write-ahead log next to the file ("<path>-wal"):
+ *
+ *  - inserts and deletes are appended as they happen, and synced in groups
+ *    of `BTREE_WAL_GROUP`, or by `btree_sync`
+ *  - a checkpoint appends the images of all changed pages and syncs the log,
+ *    then writes the pages in place, syncs the file and empties the log
+ *
+ * On open, the pages of every complete checkpoint in the log are written
+ * (again), then the operations logged after it are replayed. Splits and
+ * merges thus never reach the file halfway, and a crash loses at most the
+ * operations not synced yet.
+ *
+ * All integers are stored in native byte order, the files are not meant to
+ * move between architectures.
+ */
+
+typedef unsigned char byte;
+
+#define FILE_MAGIC   "BTREEPG"
+#define FILE_VERSION 2
+
+/* The file grows by at least this many pages at once */
+#define FILE_GROW_PAGES 16
+
+#define WAL_SUFFIX "-wal"
+
+struct file_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t page_size;
+	uint64_t elem_size;
+	uint64_t degree;
+	uint64_t root;  /* 0 if the tree is empty */
+	uint64_t pages; /* pages in use or on the free list, header included */
+	uint64_t free;  /* first page of the free list, 0 if there is none */
+	uint64_t count; /* number of elements */
+	uint64_t lsn;   /* the last logged operation the pages include */
+};
+
+/* A node page: the header, `2t - 1` items, then, aligned, `2t` child page
+ * numbers. A free page starts with the page number of the next free one. */
+struct page {
+	uint32_t n;
+	uint32_t leaf;
+};
+
+enum wal_type {
+	WAL_INSERT = 1,
+	WAL_DELETE,
+	WAL_CHECKPOINT
+};
+
+/* A log record is this, `len` bytes of payload and a checksum over both. The
+ * payload is the element for inserts and deletes, and a page number followed
+ * by the page, for every page of a checkpoint. */
+struct wal_record {
+	uint64_t lsn; /* of the operation, or the last one a checkpoint includes */
+	uint64_t len;
+	uint32_t type;
+	uint32_t unused;
+};
+
+struct btree_file {
+	int     fd;
+	byte   *map;
+	size_t  capacity; /* mapped pages, the size of the file */
+
+	size_t  page_size;
+	size_t  elem_size;
+	size_t  degree;
+	size_t  children_offset;
+
+	int (*cmp)(const void *a, const void *b);
+
+	/* Pages changed since the last checkpoint, see `file_dirty` */
+	byte     *dirty_bits; /* one per mapped page */
+	uint64_t *dirty;      /* room for every mapped page */
+	size_t    ndirty;
+
+	/* Write-ahead log */
+	int     wal_fd;
+	char   *wal_path;
+	byte   *wal_buf;     /* `BTREE_WAL_BUFFER` bytes */
+	size_t  wal_fill;    /* bytes in `wal_buf` */
+	size_t  wal_written; /* bytes in the log file */
+	size_t  wal_pending; /* operations not synced yet */
+	/* A change was made that may not have reached the log, from here on
+	 * syncing fails, see `wal_commit` */
+	bool    wal_failed;
+
+	byte   *scratch; /* a page */
+};
+
+#define \
+file_header(file) ((struct file_header*)(file)->map)
+
+#define \
+file_page(file, no) ((struct page*)((file)->map + (size_t)(no) * (file)->page_size))
+
+#define \
+page_no(file, p) ((uint64_t)(((byte*)(p) - (file)->map) / (file)->page_size))
+
+#define \
+page_dirty(file, p) file_dirty(file, page_no(file, p))
+
+#define \
+page_item(file, p, i) \
+	((byte*)(p) + sizeof(struct page) + (file)->elem_size * (size_t)(i))
+
+#define \
+page_children(file, p) ((uint64_t*)((byte*)(p) + (file)->children_offset))
+
+#define \
+page_child(file, p, i) file_page(file, page_children(file, p)[i])
+
+#define \
+page_full(file, p) ((p)->n == 2 * (file)->degree - 1)
+
+#define \
+align_up(size, align) (((size) + (align) - 1) / (align) * (align))
+
+static int tree_insert(struct btree_file *file, const void *elem);
+static int tree_delete(struct btree_file *file, const void *key);
+
+/*****************/
+/* File handling */
+/*****************/
+
+static bool fd_write_at(int fd, const void *buf, size_t len, size_t off) {
+	const byte *p = buf;
+
+	while (len > 0) {
+		const ssize_t done = pwrite(fd, p, len, (off_t)off);
+		if (done < 0 && errno == EINTR) continue;
+		if (done <= 0) return false;
+		p   += done;
+		off += done;
+		len -= done;
+	}
+	return true;
+}
+
+static bool fd_read_at(int fd, void *buf, size_t len, size_t off) {
+	byte *p = buf;
+
+	while (len > 0) {
+		const ssize_t done = pread(fd, p, len, (off_t)off);
+		if (done < 0 && errno == EINTR) continue;
+		if (done <= 0) return false;
+		p   += done;
+		off += done;
+		len -= done;
+	}
+	return true;
+}
+
+/* `file_layout` picks the largest degree whose nodes fit into a page.
+ * returnvalue: `false` if not even a node of degree 2 fits */
+static bool file_layout(struct btree_file *file) {
+	const size_t page_size = file->page_size;
+	const size_t elem_size = file->elem_size;
+	size_t t = (page_size - sizeof(struct page) + elem_size)
+	         / (2 * (elem_size + sizeof(uint64_t)));
+
+	for (; t >= 2; t--) {
+		const size_t children = align_up(sizeof(struct page)
+		                                 + elem_size * (2 * t - 1),
+		                                 sizeof(uint64_t));
+		if (children + sizeof(uint64_t) * 2 * t <= page_size) {
+			file->degree          = t;
+			file->children_offset = children;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* `file_dirty` marks page `no` as changed since the last checkpoint */
+static void file_dirty(struct btree_file *file, uint64_t no) {
+	const byte bit = 1 << (no % 8);
+
+	if (file->dirty_bits[no / 8] & bit) return;
+	file->dirty_bits[no / 8] |= bit;
+	file->dirty[file->ndirty++] = no;
+}
+
+/* `file_map` maps the first `capacity` pages anew. Changed pages only exist
+ * in the current mapping, they are carried over. */
+static bool file_map(struct btree_file *file, size_t capacity) {
+	const size_t page_size = file->page_size;
+	const size_t old_bits  = (file->capacity + 7) / 8;
+	const size_t new_bits  = (capacity + 7) / 8;
+	byte     *map;
+	byte     *bits;
+	uint64_t *dirty;
+	size_t    i;
+
+	map = mmap(NULL, capacity * page_size, PROT_READ | PROT_WRITE,
+	           MAP_PRIVATE, file->fd, 0);
+	if (map == MAP_FAILED) return false;
+
+	bits = realloc(file->dirty_bits, new_bits);
+	if (bits != NULL) file->dirty_bits = bits;
+	dirty = realloc(file->dirty, sizeof(uint64_t) * capacity);
+	if (dirty != NULL) file->dirty = dirty;
+	if (bits == NULL || dirty == NULL) {
+		munmap(map, capacity * page_size);
+		return false;
+	}
+	if (new_bits > old_bits) memset(bits + old_bits, 0, new_bits - old_bits);
+
+	if (file->map != NULL) {
+		for (i = 0; i < file->ndirty; i++) {
+			const size_t off = file->dirty[i] * page_size;
+			memcpy(map + off, file->map + off, page_size);
+		}
+		munmap(file->map, file->capacity * page_size);
+	}
+	file->map      = map;
+	file->capacity = capacity;
+	return true;
+}
+
+/* `file_reserve` makes sure `extra` more pages may be taken without growing
+ * the file, so that pages are never moved in the middle of an operation */
+static bool file_reserve(struct btree_file *file, size_t extra) {
+	const size_t needed   = file_header(file)->pages + extra;
+	size_t       capacity = file->capacity;
+
+	if (needed <= capacity) return true;
+
+	while (capacity < needed) {
+		capacity += capacity > FILE_GROW_PAGES ? capacity : FILE_GROW_PAGES;
+	}
+	return ftruncate(file->fd, (off_t)(capacity * file->page_size)) == 0
+	    && file_map(file, capacity);
+}
+
+static uint64_t file_page_new(struct btree_file *file, bool leaf) {
+	struct file_header *header = file_header(file);
+	struct page *page;
+	uint64_t     no;
+
+	if (header->free != 0) {
+		no = header->free;
+		memcpy(&header->free, file_page(file, no), sizeof(uint64_t));
+	} else {
+		no = header->pages++;
+	}
+	file_dirty(file, 0);
+	file_dirty(file, no);
+
+	page = file_page(file, no);
+	page->n    = 0;
+	page->leaf = leaf;
+	return no;
+}
+
+static void file_page_free(struct btree_file *file, uint64_t no) {
+	struct file_header *header = file_header(file);
+
+	memcpy(file_page(file, no), &header->free, sizeof(uint64_t));
+	header->free = no;
+	file_dirty(file, 0);
+	file_dirty(file, no);
+}
+
+/*********************/
+/* Write-ahead log   */
+/*********************/
+
+/* FNV-1a */
+static uint64_t wal_hash(uint64_t hash, const void *data, size_t len) {
+	const byte *p = data;
+
+	while (len-- > 0) hash = (hash ^ *p++) * UINT64_C(0x100000001b3);
+	return hash;
+}
+
+#define WAL_HASH_SEED UINT64_C(0xcbf29ce484222325)
+
+static bool wal_flush(struct btree_file *file) {
+	if (file->wal_fill == 0) return true;
+	if (!fd_write_at(file->wal_fd, file->wal_buf, file->wal_fill,
+	                 file->wal_written)) {
+		return false;
+	}
+	file->wal_written += file->wal_fill;
+	file->wal_fill     = 0;
+	return true;
+}
+
+/* `wal_write` appends `len` bytes to the log, adding them to `hash` */
+static bool wal_write(struct btree_file *file,
+                      const void *data,
+                      size_t len,
+                      uint64_t *hash) {
+	if (hash != NULL) *hash = wal_hash(*hash, data, len);
+
+	if (file->wal_fill + len > BTREE_WAL_BUFFER) {
+		if (!wal_flush(file)) return false;
+		if (len > BTREE_WAL_BUFFER) {
+			if (!fd_write_at(file->wal_fd, data, len, file->wal_written)) {
+				return false;
+			}
+			file->wal_written += len;
+			return true;
+		}
+	}
+	memcpy(file->wal_buf + file->wal_fill, data, len);
+	file->wal_fill += len;
+	return true;
+}
+
+/* `wal_undo` drops whatever was appended after offset `end` of the log, so
+ * that a record we failed to write does not hide the ones after it. Should
+ * that fail, the next record would reuse its number, so the log is given up */
+static void wal_undo(struct btree_file *file, size_t end) {
+	if (end >= file->wal_written) {
+		file->wal_fill = end - file->wal_written;
+	} else if (ftruncate(file->wal_fd, (off_t)end) == 0) {
+		file->wal_written = end;
+		file->wal_fill    = 0;
+	} else {
+		file->wal_failed = true;
+	}
+}
+
+/* Once syncing failed, the log may lack operations the pages have, and a
+ * sync that happens to succeed later would not bring them back */
+static int wal_commit(struct btree_file *file) {
+	if (file->wal_failed) return -1;
+	if (!wal_flush(file) || fdatasync(file->wal_fd) != 0) {
+		perror("BTree error: Cannot write to the log");
+		file->wal_failed = true;
+		return -1;
+	}
+	file->wal_pending = 0;
+	return 0;
+}
+
+/* `file_checkpoint` writes the changed pages back, see the top of the file */
+static int file_checkpoint(struct btree_file *file) {
+	const size_t page_size = file->page_size;
+	struct wal_record rec;
+	uint64_t hash = WAL_HASH_SEED;
+	size_t   start, i;
+	bool     ok;
+
+	if (wal_commit(file) != 0) return -1;
+	start = file->wal_written;
+
+	/* Sorted, so that they are written back in one sweep */
+	for (i = 1; i < file->ndirty; i++) {
+		const uint64_t no = file->dirty[i];
+		size_t j = i;
+		for (; j > 0 && file->dirty[j - 1] > no; j--) {
+			file->dirty[j] = file->dirty[j - 1];
+		}
+		file->dirty[j] = no;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.lsn  = file_header(file)->lsn;
+	rec.len  = file->ndirty * (sizeof(uint64_t) + page_size);
+	rec.type = WAL_CHECKPOINT;
+
+	ok = file->ndirty == 0 || wal_write(file, &rec, sizeof(rec), &hash);
+	for (i = 0; ok && i < file->ndirty; i++) {
+		ok = wal_write(file, &file->dirty[i], sizeof(uint64_t), &hash)
+		  && wal_write(file, file_page(file, file->dirty[i]), page_size, &hash);
+	}
+	ok = ok && (file->ndirty == 0 || wal_write(file, &hash, sizeof(hash), NULL))
+	        && wal_flush(file) && fdatasync(file->wal_fd) == 0;
+	if (!ok) {
+		perror("BTree error: Cannot write checkpoint to the log");
+		wal_undo(file, start);
+		return -1;
+	}
+
+	/* The log holds every page now, the file may change */
+	for (i = 0; ok && i < file->ndirty; i++) {
+		ok = fd_write_at(file->fd, file_page(file, file->dirty[i]), page_size,
+		                 file->dirty[i] * page_size);
+	}
+	if (!ok || fdatasync(file->fd) != 0) {
+		perror("BTree error: Cannot write checkpoint");
+		return -1;
+	}
+	if (ftruncate(file->wal_fd, 0) == 0) file->wal_written = 0;
+
+	/* Let go of the changed pages, the file has them. Should mapping fail, the
+	 * current one is just as good */
+	for (i = 0; i < file->ndirty; i++) {
+		file->dirty_bits[file->dirty[i] / 8] = 0;
+	}
+	file->ndirty = 0;
+	file_map(file, file->capacity);
+	return 0;
+}
+
+/* `wal_log` appends an operation, before the pages are changed, so a change
+ * that cannot be logged is not made at all.
+ * returnvalue: the offset of the log the record starts at, to be handed to
+ * `wal_undo` should the operation not change anything after all, or
+ * (size_t)-1 if writing failed */
+static size_t wal_log(struct btree_file *file, enum wal_type type, const void *elem) {
+	const size_t start = file->wal_written + file->wal_fill;
+	struct wal_record rec;
+	uint64_t hash = WAL_HASH_SEED;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.lsn  = file_header(file)->lsn + 1;
+	rec.len  = file->elem_size;
+	rec.type = type;
+
+	if (!wal_write(file, &rec, sizeof(rec), &hash)
+	||  !wal_write(file, elem, file->elem_size, &hash)
+	||  !wal_write(file, &hash, sizeof(hash), NULL)) {
+		perror("BTree error: Cannot write to the log");
+		wal_undo(file, start);
+		return (size_t)-1;
+	}
+	return start;
+}
+
+/* `wal_logged` counts the operation logged last in, once the pages include
+ * it, committing a group once it is complete, and checkpointing once the log
+ * or the changed pages grow too large.
+ * The operation is made either way, so failures are not reported to its
+ * caller: a failed commit makes `wal_commit` fail from now on, and thus
+ * `file_sync` and `file_close`, while a failed checkpoint leaves the log and
+ * the changed pages as they were, to be tried again */
+static void wal_logged(struct btree_file *file) {
+	file_header(file)->lsn++;
+	file_dirty(file, 0);
+
+	if (++file->wal_pending >= BTREE_WAL_GROUP && wal_commit(file) != 0) {
+		return;
+	}
+	if (file->wal_written + file->wal_fill >= BTREE_WAL_CHECKPOINT
+	||  file->ndirty * file->page_size  >= BTREE_WAL_CHECKPOINT) {
+		file_checkpoint(file);
+	}
+}
+
+/* `wal_read` reads the record at `off` of the log, and verifies it. The
+ * payload of an operation ends up in `scratch`.
+ * returnvalue: the offset of the next record, 0 if there is no complete one */
+static size_t wal_read(struct btree_file *file,
+                       size_t off,
+                       struct wal_record *rec) {
+	uint64_t hash = WAL_HASH_SEED;
+	uint64_t sum;
+	size_t   left;
+
+	if (!fd_read_at(file->wal_fd, rec, sizeof(*rec), off)) return 0;
+	if (rec->type == WAL_CHECKPOINT
+	  ? rec->len % (sizeof(uint64_t) + file->page_size) != 0
+	  : (rec->type != WAL_INSERT && rec->type != WAL_DELETE)
+	    || rec->len != file->elem_size) {
+		return 0;
+	}
+	hash = wal_hash(hash, rec, sizeof(*rec));
+	off += sizeof(*rec);
+
+	for (left = rec->len; left > 0; ) {
+		const size_t k = left < file->page_size ? left : file->page_size;
+		if (!fd_read_at(file->wal_fd, file->scratch, k, off)) return 0;
+		hash  = wal_hash(hash, file->scratch, k);
+		off  += k;
+		left -= k;
+	}
+	if (!fd_read_at(file->wal_fd, &sum, sizeof(sum), off) || sum != hash) {
+		return 0;
+	}
+	return off + sizeof(sum);
+}
+
+/* `wal_recover` writes the pages of the checkpoints in the log to the file,
+ * and cuts off what a crash left of the last record */
+static bool wal_recover(struct btree_file *file) {
+	const size_t page_size = file->page_size;
+	struct wal_record rec;
+	size_t off = 0;
+	size_t next;
+	bool   written = false;
+
+	while ((next = wal_read(file, off, &rec)) != 0) {
+		if (rec.type == WAL_CHECKPOINT) {
+			size_t pos = off + sizeof(rec);
+			size_t left;
+
+			for (left = rec.len; left > 0; left -= sizeof(uint64_t) + page_size) {
+				uint64_t no;
+				if (!fd_read_at(file->wal_fd, &no, sizeof(no), pos)
+				||  !fd_read_at(file->wal_fd, file->scratch, page_size,
+				                pos + sizeof(no))
+				||  !fd_write_at(file->fd, file->scratch, page_size,
+				                 no * page_size)) {
+					return false;
+				}
+				pos += sizeof(no) + page_size;
+			}
+			written = true;
+		}
+		off = next;
+	}
+
+	if (ftruncate(file->wal_fd, (off_t)off) != 0) return false;
+	file->wal_written = off;
+	return !written || fdatasync(file->fd) == 0;
+}
+
+/* `wal_replay` redoes the operations the pages do not include yet */
+static bool wal_replay(struct btree_file *file) {
+	struct wal_record rec;
+	size_t off = 0;
+
+	while (off < file->wal_written && (off = wal_read(file, off, &rec)) != 0) {
+		if (rec.type == WAL_CHECKPOINT || rec.lsn <= file_header(file)->lsn) {
+			continue;
+		}
+		if (rec.type == WAL_INSERT) {
+			if (tree_insert(file, file->scratch) != 0) return false;
+		} else {
+			tree_delete(file, file->scratch);
+		}
+		file_header(file)->lsn = rec.lsn;
+	}
+	return file_checkpoint(file) == 0;
+}
+
+/*********************/
+/* Opening the file  */
+/*********************/
+
+static void file_destroy(struct btree_file *file) {
+	if (file->map != NULL) munmap(file->map, file->capacity * file->page_size);
+	if (file->fd     >= 0) close(file->fd);
+	if (file->wal_fd >= 0) close(file->wal_fd);
+	free(file->dirty_bits);
+	free(file->dirty);
+	free(file->wal_path);
+	free(file->wal_buf);
+	free(file->scratch);
+	free(file);
+}
+
+/* `file_create` writes the header of a new tree. The header page reaches the
+ * disk before the file grows any further, so that a crash in between leaves
+ * a tree file, rather than one full of zeros */
+static bool file_create(struct btree_file *file, size_t page_size) {
+	struct file_header *header;
+	bool ok;
+
+	if (page_size == 0) page_size = BTREE_PAGE_SIZE_DEFAULT;
+	if (page_size < sizeof(struct file_header) || page_size % sizeof(uint64_t)) {
+		fputs("BTree error: Invalid page size!\n", stderr);
+		return false;
+	}
+	file->page_size = page_size;
+	if (!file_layout(file)) {
+		fputs("BTree error: Elements too large for the page size!\n", stderr);
+		return false;
+	}
+
+	header = calloc(1, page_size);
+	if (header == NULL) {
+		fputs("BTree error: Failed to allocate file header!\n", stderr);
+		return false;
+	}
+	memcpy(header->magic, FILE_MAGIC, sizeof(header->magic));
+	header->version   = FILE_VERSION;
+	header->page_size = page_size;
+	header->elem_size = file->elem_size;
+	header->degree    = file->degree;
+	header->pages     = 1;
+
+	ok = fd_write_at(file->fd, header, page_size, 0)
+	  && fdatasync(file->fd) == 0
+	  && ftruncate(file->fd, (off_t)(page_size * FILE_GROW_PAGES)) == 0;
+	free(header);
+	if (!ok) perror("BTree error: Cannot create tree file");
+	return ok;
+}
+
+/* `file_unwritten` tells whether the header is all zeros, as a crash while
+ * the file was being created may leave it */
+static bool file_unwritten(struct btree_file *file) {
+	struct file_header header;
+	const byte *bytes = (const byte*)&header;
+	size_t i;
+
+	if (!fd_read_at(file->fd, &header, sizeof(header), 0)) return false;
+	for (i = 0; i < sizeof(header); i++) {
+		if (bytes[i] != 0) return false;
+	}
+	return true;
+}
+
+struct btree_file* file_open(const char *path,
+                             size_t elem_size,
+                             size_t page_size,
+                             int    (*cmp)(const void *a, const void *b)) {
+	struct btree_file  *file = malloc(sizeof(struct btree_file));
+	struct file_header  header;
+	struct stat         st;
+
+	if (file == NULL) {
+		fputs("BTree error: Failed to allocate file-backed tree!\n", stderr);
+		return NULL;
+	}
+	memset(file, 0, sizeof(struct btree_file));
+	file->cmp       = cmp;
+	file->elem_size = elem_size;
+	file->wal_fd    = -1;
+	file->wal_path  = malloc(strlen(path) + sizeof(WAL_SUFFIX));
+	file->wal_buf   = malloc(BTREE_WAL_BUFFER);
+	if (file->wal_path == NULL || file->wal_buf == NULL) {
+		fputs("BTree error: Failed to allocate file-backed tree!\n", stderr);
+		file->fd = -1;
+		goto fail;
+	}
+	strcat(strcpy(file->wal_path, path), WAL_SUFFIX);
+
+	file->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (file->fd < 0 || fstat(file->fd, &st) != 0) {
+		perror("BTree error: Cannot open tree file");
+		goto fail;
+	}
+	if ((st.st_size == 0 || file_unwritten(file))
+	&&  !file_create(file, page_size)) goto fail;
+
+	/* Sizes never change, so the header tells them even before recovery */
+	if (!fd_read_at(file->fd, &header, sizeof(header), 0)
+	||  memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0
+	||  header.version != FILE_VERSION) {
+		fputs("BTree error: Not a tree file!\n", stderr);
+		goto fail;
+	}
+	if (header.elem_size != elem_size
+	||  (page_size != 0 && header.page_size != page_size)) {
+		fputs("BTree error: Tree file has a different element or page size!\n", stderr);
+		goto fail;
+	}
+	file->page_size = header.page_size;
+	if (!file_layout(file) || file->degree != header.degree) {
+		fputs("BTree error: Corrupt tree file!\n", stderr);
+		goto fail;
+	}
+
+	file->scratch = malloc(file->page_size);
+	file->wal_fd  = open(file->wal_path, O_RDWR | O_CREAT, 0644);
+	if (file->scratch == NULL || file->wal_fd < 0 || !wal_recover(file)) {
+		perror("BTree error: Cannot recover from the log");
+		goto fail;
+	}
+
+	if (!fd_read_at(file->fd, &header, sizeof(header), 0)
+	||  fstat(file->fd, &st) != 0
+	||  (size_t)st.st_size < header.pages * file->page_size) {
+		fputs("BTree error: Corrupt tree file!\n", stderr);
+		goto fail;
+	}
+	if (!file_map(file, (size_t)st.st_size / file->page_size)) {
+		perror("BTree error: Cannot map tree file");
+		goto fail;
+	}
+	if (!wal_replay(file)) {
+		fputs("BTree error: Cannot replay the log!\n", stderr);
+		goto fail;
+	}
+	return file;
+
+fail:
+	file_destroy(file);
+	return NULL;
+}
+
+int file_sync(struct btree_file *file) {
+	return wal_commit(file);
+}
+
+int file_close(struct btree_file **file) {
+	struct btree_file *f = *file;
+	int res = file_checkpoint(f);
+
+	if (res == 0) {
+		/* Give back the room reserved for growing, the log is empty */
+		if (ftruncate(f->fd, (off_t)(file_header(f)->pages * f->page_size)) != 0) {
+			res = -1;
+		}
+		unlink(f->wal_path);
+	}
+	file_destroy(f);
+	*file = NULL;
+	return res;
+}
+
+size_t file_degree(const struct btree_file *file) {
+	return file->degree;
+}
+
+size_t file_size(const struct btree_file *file) {
+	return file_header(file)->count;
+}
+
+size_t file_height(const struct btree_file *file) {
+	uint64_t no     = file_header(file)->root;
+	size_t   height = 0;
+
+	if (no == 0) return 0;
+	while (!file_page(file, no)->leaf) {
+		no = page_children(file, file_page(file, no))[0];
+		height++;
+	}
+	return height;
+}
+
+/**********************/
+/* Node functionality */
+/**********************/
+
+/* Same as `node_find`, by binary search */
+static size_t page_find(struct btree_file *file,
+                        const struct page *x,
+                        const void *key,
+                        int *cmp_res) {
+	size_t lo  = 0;
+	size_t hi  = x->n;
+	int    res = 1;
+
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		const int    c   = file->cmp(key, page_item(file, x, mid));
+		if (c > 0) {
+			lo = mid + 1;
+		} else {
+			hi  = mid;
+			res = c;
+		}
+	}
+	*cmp_res = res;
+	return lo;
+}
+
+/* `page_split_child` splits the full child `i` of `x`, see
+ * `node_tree_split_child` */
+static void page_split_child(struct btree_file *file, struct page *x, size_t i) {
+	const size_t elem_size = file->elem_size;
+	const size_t t         = file->degree;
+	struct page *y  = page_child(file, x, i);
+	uint64_t     zn = file_page_new(file, y->leaf);
+	struct page *z  = file_page(file, zn);
+
+	page_dirty(file, x);
+	page_dirty(file, y);
+
+	/* The upper half of y goes to z */
+	memcpy(page_item(file, z, 0), page_item(file, y, t), elem_size * (t - 1));
+	if (!y->leaf) {
+		memcpy(page_children(file, z), page_children(file, y) + t,
+		       sizeof(uint64_t) * t);
+	}
+	z->n = t - 1;
+	y->n = t - 1;
+
+	/* z becomes child i + 1 of x, the median goes up */
+	memmove(page_children(file, x) + i + 2, page_children(file, x) + i + 1,
+	        sizeof(uint64_t) * (x->n - i));
+	page_children(file, x)[i + 1] = zn;
+	memmove(page_item(file, x, i + 1), page_item(file, x, i),
+	        elem_size * (x->n - i));
+	memcpy(page_item(file, x, i), page_item(file, y, t - 1), elem_size);
+	x->n++;
+}
+
+/* `page_merge` merges item `i` of `x` and child `i + 1` into child `i`, see
+ * `node_child_merge` */
+static void page_merge(struct btree_file *file, struct page *x, size_t i) {
+	const size_t elem_size = file->elem_size;
+	const uint64_t zn = page_children(file, x)[i + 1];
+	struct page *y = page_child(file, x, i);
+	struct page *z = file_page(file, zn);
+
+	page_dirty(file, x);
+	page_dirty(file, y);
+
+	memcpy(page_item(file, y, y->n), page_item(file, x, i), elem_size);
+	memcpy(page_item(file, y, y->n + 1), page_item(file, z, 0),
+	       elem_size * z->n);
+	if (!y->leaf) {
+		memcpy(page_children(file, y) + y->n + 1, page_children(file, z),
+		       sizeof(uint64_t) * (z->n + 1));
+	}
+	y->n += z->n + 1;
+
+	memmove(page_item(file, x, i), page_item(file, x, i + 1),
+	        elem_size * (x->n - i - 1));
+	memmove(page_children(file, x) + i + 1, page_children(file, x) + i + 2,
+	        sizeof(uint64_t) * (x->n - i - 1));
+	x->n--;
+
+	file_page_free(file, zn);
+}
+
+/* `page_shift_left` moves item `i` of `x` to the end of child `i`, and the
+ * first item of child `i + 1` up in its place, see `node_shift_left` */
+static void page_shift_left(struct btree_file *file, struct page *x, size_t i) {
+	const size_t elem_size = file->elem_size;
+	struct page *y = page_child(file, x, i);
+	struct page *z = page_child(file, x, i + 1);
+
+	page_dirty(file, x);
+	page_dirty(file, y);
+	page_dirty(file, z);
+
+	memcpy(page_item(file, y, y->n), page_item(file, x, i), elem_size);
+	memcpy(page_item(file, x, i), page_item(file, z, 0), elem_size);
+	memmove(page_item(file, z, 0), page_item(file, z, 1),
+	        elem_size * (z->n - 1));
+	if (!y->leaf) {
+		page_children(file, y)[y->n + 1] = page_children(file, z)[0];
+		memmove(page_children(file, z), page_children(file, z) + 1,
+		        sizeof(uint64_t) * z->n);
+	}
+	y->n++;
+	z->n--;
+}
+
+/* `page_shift_right` is the mirror image of `page_shift_left` */
+static void page_shift_right(struct btree_file *file, struct page *x, size_t i) {
+	const size_t elem_size = file->elem_size;
+	struct page *y = page_child(file, x, i);
+	struct page *z = page_child(file, x, i + 1);
+
+	page_dirty(file, x);
+	page_dirty(file, y);
+	page_dirty(file, z);
+
+	memmove(page_item(file, z, 1), page_item(file, z, 0), elem_size * z->n);
+	memcpy(page_item(file, z, 0), page_item(file, x, i), elem_size);
+	memcpy(page_item(file, x, i), page_item(file, y, y->n - 1), elem_size);
+	if (!z->leaf) {
+		memmove(page_children(file, z) + 1, page_children(file, z),
+		        sizeof(uint64_t) * (z->n + 1));
+		page_children(file, z)[0] = page_children(file, y)[y->n];
+	}
+	y->n--;
+	z->n++;
+}
+
+static int page_delete(struct btree_file *file, struct page *x, const void *key) {
+	const size_t elem_size = file->elem_size;
+	const size_t t         = file->degree;
+	int    res;
+	size_t i = page_find(file, x, key, &res);
+
+	if (i < x->n && res == 0) {
+		struct page *tmp;
+
+		page_dirty(file, x);
+		if (x->leaf) {
+			memmove(page_item(file, x, i), page_item(file, x, i + 1),
+			        elem_size * (x->n - i - 1));
+			x->n--;
+			file_header(file)->count--;
+			file_dirty(file, 0);
+			return 1;
+		}
+
+		if (page_child(file, x, i)->n >= t) {
+			/* Replace with the predecessor and delete that one instead */
+			tmp = page_child(file, x, i);
+			while (!tmp->leaf) tmp = page_child(file, tmp, tmp->n);
+			memcpy(page_item(file, x, i), page_item(file, tmp, tmp->n - 1),
+			       elem_size);
+			return page_delete(file, page_child(file, x, i),
+			                   page_item(file, x, i));
+		}
+		if (page_child(file, x, i + 1)->n >= t) {
+			/* or the successor */
+			tmp = page_child(file, x, i + 1);
+			while (!tmp->leaf) tmp = page_child(file, tmp, 0);
+			memcpy(page_item(file, x, i), page_item(file, tmp, 0), elem_size);
+			return page_delete(file, page_child(file, x, i + 1),
+			                   page_item(file, x, i));
+		}
+		page_merge(file, x, i);
+		return page_delete(file, page_child(file, x, i), key);
+	}
+
+	if (x->leaf) return 0;
+
+	/* Make sure the child we descend into can spare an item */
+	if (page_child(file, x, i)->n < t) {
+		if (i > 0 && page_child(file, x, i - 1)->n >= t) {
+			page_shift_right(file, x, i - 1);
+		} else if (i < x->n && page_child(file, x, i + 1)->n >= t) {
+			page_shift_left(file, x, i);
+		} else if (i > 0) {
+			page_merge(file, x, i - 1);
+			i--;
+		} else {
+			page_merge(file, x, i);
+		}
+	}
+	return page_delete(file, page_child(file, x, i), key);
+}
+
+/***********************/
+/* Tree functionality  */
+/***********************/
+
+void* file_search(struct btree_file *file, const void *key) {
+	uint64_t no = file_header(file)->root;
+
+	while (no != 0) {
+		struct page *x = file_page(file, no);
+		int    res;
+		size_t i = page_find(file, x, key, &res);
+
+		if (i < x->n && res == 0) return page_item(file, x, i);
+		if (x->leaf) return NULL;
+		no = page_children(file, x)[i];
+	}
+	return NULL;
+}
+
+static int tree_insert(struct btree_file *file, const void *elem) {
+	struct file_header *header;
+	struct page *x;
+
+	/* A split per level, plus a new root */
+	if (!file_reserve(file, file_height(file) + 2)) {
+		perror("BTree error: Cannot grow tree file");
+		return -1;
+	}
+	header = file_header(file);
+
+	if (header->root == 0) header->root = file_page_new(file, true);
+
+	x = file_page(file, header->root);
+	if (page_full(file, x)) {
+		const uint64_t sn = file_page_new(file, false);
+
+		page_children(file, file_page(file, sn))[0] = header->root;
+		header->root = sn;
+		x = file_page(file, sn);
+		page_split_child(file, x, 0);
+	}
+
+	for (;;) {
+		int    res;
+		size_t i = page_find(file, x, elem, &res);
+
+		if (x->leaf) {
+			memmove(page_item(file, x, i + 1), page_item(file, x, i),
+			        file->elem_size * (x->n - i));
+			memcpy(page_item(file, x, i), elem, file->elem_size);
+			x->n++;
+			header->count++;
+			page_dirty(file, x);
+			file_dirty(file, 0);
+			return 0;
+		}
+		if (page_full(file, page_child(file, x, i))) {
+			page_split_child(file, x, i);
+			if (file->cmp(elem, page_item(file, x, i)) > 0) i++;
+		}
+		x = page_child(file, x, i);
+	}
+}
+
+static int tree_delete(struct btree_file *file, const void *key) {
+	struct file_header *header = file_header(file);
+	struct page *root;
+	int res;
+
+	if (header->root == 0) return 0;
+
+	root = file_page(file, header->root);
+	res  = page_delete(file, root, key);
+
+	if (root->n == 0 && !root->leaf) {
+		/* shrink the tree */
+		const uint64_t old = header->root;
+		header->root = page_children(file, root)[0];
+		file_page_free(file, old);
+	}
+	return res;
+}
+
+/* Both work on a copy, as the element may well point into the tree. The
+ * operation is logged first, see `wal_log` */
+int file_insert(struct btree_file *file, const void *elem) {
+	memcpy(file->scratch, elem, file->elem_size);
+
+	/* Grow the file up front, so that inserting cannot fail once logged */
+	if (!file_reserve(file, file_height(file) + 2)) {
+		perror("BTree error: Cannot grow tree file");
+		return -1;
+	}
+	if (wal_log(file, WAL_INSERT, file->scratch) == (size_t)-1) return -1;
+
+	tree_insert(file, file->scratch);
+	wal_logged(file);
+	return 0;
+}
+
+int file_delete(struct btree_file *file, const void *key) {
+	size_t start;
+
+	memcpy(file->scratch, key, file->elem_size);
+	start = wal_log(file, WAL_DELETE, file->scratch);
+	if (start == (size_t)-1) return -1;
+
+	if (!tree_delete(file, file->scratch)) {
+		/* Nothing to log after all */
+		wal_undo(file, start);
+		return 0;
+	}
+	wal_logged(file);
+	return 1;
+}
+
+void* file_first(struct btree_file *file) {
+	uint64_t no = file_header(file)->root;
+	struct page *x;
+
+	if (no == 0) return NULL;
+	x = file_page(file, no);
+	while (!x->leaf) x = page_child(file, x, 0);
+	return x->n > 0 ? page_item(file, x, 0) : NULL;
+}
+
+void* file_last(struct btree_file *file) {
+	uint64_t no = file_header(file)->root;
+	struct page *x;
+
+	if (no == 0) return NULL;
+	x = file_page(file, no);
+	while (!x->leaf) x = page_child(file, x, x->n);
+	return x->n > 0 ? page_item(file, x, x->n - 1) : NULL;
+}
+
+/*************/
+/* Iterators */
+/*************/
+
+/* `iter_descend` pushes page `no` and the leftmost path below it */
+static void iter_descend(struct btree_file *file,
+                         struct file_iter *iter,
+                         uint64_t no) {
+	for (;;) {
+		struct page *x = file_page(file, no);
+
+		iter->stack[iter->head].page = no;
+		iter->stack[iter->head].pos  = 0;
+		iter->head++;
+		if (x->leaf) return;
+		no = page_children(file, x)[0];
+	}
+}
+
+void file_iter_reset(struct btree_file *file, struct file_iter *iter) {
+	iter->head = 0;
+	if (file_header(file)->root != 0) {
+		iter_descend(file, iter, file_header(file)->root);
+	}
+}
+
+void file_iter_seek(struct btree_file *file,
+                    struct file_iter *iter,
+                    const void *key,
+                    int upper) {
+	uint64_t no = file_header(file)->root;
+
+	iter->head = 0;
+	while (no != 0) {
+		struct page *x = file_page(file, no);
+		int    res;
+		size_t i = page_find(file, x, key, &res);
+
+		/* Skip over the elements equal to `key` too */
+		while (upper && i < x->n && res == 0) {
+			i++;
+			res = i < x->n ? file->cmp(key, page_item(file, x, i)) : 1;
+		}
+
+		iter->stack[iter->head].page = no;
+		iter->stack[iter->head].pos  = i;
+		iter->head++;
+		no = x->leaf ? 0 : page_children(file, x)[i];
+	}
+}
+
+void* file_iter_next(struct btree_file *file, struct file_iter *iter) {
+	while (iter->head > 0) {
+		struct file_stack *top = &iter->stack[iter->head - 1];
+		struct page       *x   = file_page(file, top->page);
+
+		if (top->pos < x->n) {
+			void *elem = page_item(file, x, top->pos++);
+
+			/* The subtree right of it comes before the next item */
+			if (!x->leaf) {
+				iter_descend(file, iter, page_children(file, x)[top->pos]);
+			}
+			return elem;
+		}
+		iter->head--;
+	}
+	return NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef BTREE_FILE_H
+#define BTREE_FILE_H
+
+/* File-backed trees, see `btree_open`. Internal to btree.c, which dispatches
+ * to these for trees opened from a file. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* No tree of degree 2 or more with less than 2^64 elements grows deeper */
+#define BTREE_FILE_MAX_HEIGHT 64
+
+struct btree_file;
+
+/* Iteration state, kept by page number so that it is independent of where
+ * the file is mapped */
+struct file_iter {
+	size_t head;
+	struct file_stack {
+		uint64_t page;
+		size_t   pos; /* the next item to return */
+	} stack[BTREE_FILE_MAX_HEIGHT];
+};
+
+struct btree_file* file_open(const char *path,
+                             size_t elem_size,
+                             size_t page_size,
+                             int    (*cmp)(const void *a, const void *b));
+int    file_sync(struct btree_file *file);
+int    file_close(struct btree_file **file);
+
+size_t file_degree(const struct btree_file *file);
+size_t file_size(const struct btree_file *file);
+size_t file_height(const struct btree_file *file);
+
+void*  file_search(struct btree_file *file, const void *key);
+int    file_insert(struct btree_file *file, const void *elem);
+int    file_delete(struct btree_file *file, const void *key);
+
+void*  file_first(struct btree_file *file);
+void*  file_last(struct btree_file *file);
+
+void   file_iter_reset(struct btree_file *file, struct file_iter *iter);
+/* Positions `iter` in front of the first element not less than (`upper`:
+ * greater than) `key` */
+void   file_iter_seek(struct btree_file *file,
+                      struct file_iter *iter,
+                      const void *key,
+                      int upper);
+void*  file_iter_next(struct btree_file *file, struct file_iter *iter);
+
+#endif
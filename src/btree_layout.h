@@ -0,0 +1,21 @@
+#ifndef BTREE_LAYOUT_H
+#define BTREE_LAYOUT_H
+
+/* Node sizing shared by the generic tree (btree.c) and the typed trees
+ * generated by `BTREE_DEFINE` (btree_typed.h), so both agree on what a node of
+ * degree `t` holds. */
+
+/* Bounds on the number of items in a non-root node */
+#define BTREE_NODE_MAX_ITEMS(t)   (2 * (t) - 1)
+#define BTREE_NODE_MIN_ITEMS(t)   ((t) - 1)
+
+/* Allocated slots, items get one spare slot so merges may overshoot by one */
+#define BTREE_NODE_ITEM_SLOTS(t)  (2 * (t))
+#define BTREE_NODE_CHILD_SLOTS(t) (2 * (t) + 1)
+
+#define BTREE_NODE_FULL(t, node)  ((node)->n >= BTREE_NODE_MAX_ITEMS(t))
+
+/* Nodes of the packed layout are aligned to this */
+#define BTREE_CACHE_LINE 64
+
+#endif
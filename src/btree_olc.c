@@ -0,0 +1,925 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "btree.h"
+#include "btree_layout.h"
+#include "btree_olc.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+/* Definitions */
+typedef unsigned char byte;
+
+/* Node versions: bit 0 marks nodes removed from the tree, bit 1 locked ones.
+ * Unlocking adds to the remaining bits, so every write leaves a new version */
+#define OLC_OBSOLETE ((uint64_t)1)
+#define OLC_LOCKED   ((uint64_t)2)
+
+/* Operations retry this often before yielding the CPU */
+#define OLC_SPINS 64
+
+/* Number of counters the running operations are spread over */
+#define OLC_STRIPES 64
+
+/* Returned by the optimistic operations if they have to start over */
+#define OLC_RESTART (-2)
+
+struct olc_node {
+	uint64_t         version;
+	ssize_t          n;       /* number of items, branching nodes have n+1 children */
+	bool             leaf;
+	struct olc_node *retired; /* next node in the retire list */
+	/* items at `items_offset`, child pointers at `children_offset` */
+};
+
+struct olc_stripe {
+	size_t active[2]; /* operations in progress, by parity of their epoch */
+	byte   pad[BTREE_CACHE_LINE - 2 * sizeof(size_t)];
+};
+
+struct btree_olc {
+	/* Size stuffs */
+	size_t  elem_size;
+	ssize_t degree;
+
+	/* comparison */
+	int (*cmp)(const void *a, const void *b);
+
+	/* Node memory, see `olc_node_new` */
+	size_t items_offset;
+	size_t children_offset;
+	size_t leaf_size;
+	size_t inner_size;
+
+	struct olc_node *root;
+
+	/* Reclamation, see `olc_enter` and `olc_reclaim` */
+	struct olc_stripe stripes[OLC_STRIPES];
+	size_t            epoch;
+	pthread_mutex_t   retire_lock;
+	struct olc_node  *retired;  /* unlinked during the current epoch */
+	struct olc_node  *draining; /* waiting for the previous epoch to end */
+};
+
+struct btree_olc_iter_t {
+	byte   *elems; /* 2t elements read, the fence, the last one returned */
+	size_t  n;
+	size_t  pos;
+	bool    started;
+};
+
+#define \
+olc_item(tree, x, i) \
+	((byte*)(x) + (tree)->items_offset + (tree)->elem_size * (i))
+
+#define \
+olc_children(tree, x) \
+	((struct olc_node**)((byte*)(x) + (tree)->children_offset))
+
+#define \
+olc_full(tree, n) ((n) >= BTREE_NODE_MAX_ITEMS((tree)->degree))
+
+#define \
+align_up(size, align) (((size) + (align) - 1) / (align) * (align))
+
+/* Versions */
+
+static void olc_pause(unsigned *spins) {
+	if (++*spins % OLC_SPINS == 0) {
+		sched_yield();
+	} else {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		__builtin_ia32_pause();
+#endif
+	}
+}
+
+/* Starts an optimistic read of `x`.
+ * returnvalue: false if `x` is locked or obsolete, true and its version in `v`
+ * otherwise */
+static bool olc_read(const struct olc_node *x, uint64_t *v) {
+	*v = __atomic_load_n(&x->version, __ATOMIC_ACQUIRE);
+	return (*v & (OLC_LOCKED | OLC_OBSOLETE)) == 0;
+}
+
+/* Whether `x` is still at version `v`, which means everything read from it
+ * since `olc_read` is consistent */
+static bool olc_valid(const struct olc_node *x, const uint64_t v) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&x->version, __ATOMIC_RELAXED) == v;
+}
+
+/* Locks `x`, provided it is still at version `v` */
+static bool olc_upgrade(struct olc_node *x, uint64_t v) {
+	if (!__atomic_compare_exchange_n(&x->version, &v, v + OLC_LOCKED, false,
+	                                 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return false;
+	}
+	/* Readers must not see any of our writes before the lock */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return true;
+}
+
+/* Waits until `x` can be locked.
+ * returnvalue: false if `x` was removed from the tree meanwhile */
+static bool olc_lock(struct olc_node *x) {
+	unsigned spins = 0;
+	uint64_t v;
+
+	for (;;) {
+		if (olc_read(x, &v)) {
+			if (olc_upgrade(x, v)) return true;
+		} else if (v & OLC_OBSOLETE) {
+			return false;
+		}
+		olc_pause(&spins);
+	}
+}
+
+static void olc_unlock(struct olc_node *x) {
+	__atomic_fetch_add(&x->version, OLC_LOCKED, __ATOMIC_RELEASE);
+}
+
+/* Unlocks `x` without writing having changed it, which restores the version
+ * it was locked at: optimistic readers that started before need not restart */
+static void olc_unlock_unchanged(struct olc_node *x) {
+	__atomic_fetch_sub(&x->version, OLC_LOCKED, __ATOMIC_RELEASE);
+}
+
+static void olc_unlock_obsolete(struct olc_node *x) {
+	__atomic_fetch_add(&x->version, OLC_LOCKED | OLC_OBSOLETE, __ATOMIC_RELEASE);
+}
+
+/* Reclamation
+ *
+ * Every operation registers itself in the counter for the parity of the
+ * current epoch. Unlinked nodes are retired to a list, which is handed over
+ * to the next epoch, and freed once the counters of the previous parity drop
+ * to zero: every operation that could have reached those nodes has ended by
+ * then, and later ones cannot find them anymore. */
+
+static size_t* olc_enter(struct btree_olc *tree) {
+	/* Threads run on separate stacks, which spreads them cheaply */
+	const int          here   = 0;
+	const size_t       stripe = (size_t)((((uintptr_t)&here >> 12)
+	                          * UINT64_C(0x9e3779b97f4a7c15)) >> 58)
+	                          % OLC_STRIPES;
+	struct olc_stripe *s      = &tree->stripes[stripe];
+
+	for (;;) {
+		const size_t e      = __atomic_load_n(&tree->epoch, __ATOMIC_SEQ_CST);
+		size_t      *active = &s->active[e & 1];
+
+		__atomic_fetch_add(active, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&tree->epoch, __ATOMIC_SEQ_CST) == e) return active;
+		/* Flipped meanwhile, register with the new epoch instead */
+		__atomic_fetch_sub(active, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void olc_exit(size_t *active) {
+	__atomic_fetch_sub(active, 1, __ATOMIC_RELEASE);
+}
+
+static void olc_retire(struct btree_olc *tree, struct olc_node *x) {
+	pthread_mutex_lock(&tree->retire_lock);
+	x->retired = tree->retired;
+	/* `olc_reclaim` peeks at the lists without taking the lock */
+	__atomic_store_n(&tree->retired, x, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&tree->retire_lock);
+}
+
+static void olc_free_list(struct olc_node *x) {
+	while (x != NULL) {
+		struct olc_node *next = x->retired;
+		free(x);
+		x = next;
+	}
+}
+
+/* Frees the draining nodes if their epoch is over, and starts a new epoch
+ * for the nodes retired since. Never waits, whoever holds the lock already
+ * does the job. Must not be called from within an operation. */
+static void olc_reclaim(struct btree_olc *tree) {
+	if (__atomic_load_n(&tree->retired,  __ATOMIC_RELAXED) == NULL
+	&&  __atomic_load_n(&tree->draining, __ATOMIC_RELAXED) == NULL) {
+		return;
+	}
+	if (pthread_mutex_trylock(&tree->retire_lock) != 0) return;
+
+	for (;;) {
+		if (tree->draining != NULL) {
+			const size_t parity = (tree->epoch - 1) & 1;
+			size_t active = 0;
+			size_t i;
+
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			for (i = 0; i < OLC_STRIPES; i++) {
+				active += __atomic_load_n(&tree->stripes[i].active[parity],
+				                          __ATOMIC_ACQUIRE);
+			}
+			if (active > 0) break;
+
+			olc_free_list(tree->draining);
+			__atomic_store_n(&tree->draining, NULL, __ATOMIC_RELAXED);
+		}
+		if (tree->retired == NULL) break;
+
+		__atomic_store_n(&tree->draining, tree->retired, __ATOMIC_RELAXED);
+		__atomic_store_n(&tree->retired,  NULL,          __ATOMIC_RELAXED);
+		__atomic_fetch_add(&tree->epoch, 1, __ATOMIC_SEQ_CST);
+	}
+
+	pthread_mutex_unlock(&tree->retire_lock);
+}
+
+/* Nodes */
+
+static struct olc_node* olc_node_new(struct btree_olc *tree, const bool leaf) {
+	void *mem;
+	struct olc_node *x;
+
+	if (posix_memalign(&mem, BTREE_CACHE_LINE,
+	                   leaf ? tree->leaf_size : tree->inner_size) != 0) {
+		fputs("BTree error: Failed to allocate new node!\n", stderr);
+		return NULL;
+	}
+	x = mem;
+	x->version = 0;
+	x->n       = 0;
+	x->leaf    = leaf;
+	x->retired = NULL;
+	return x;
+}
+
+static void olc_node_free(struct btree_olc *tree, struct olc_node *x) {
+	if (!x->leaf) {
+		ssize_t i;
+		for (i = 0; i <= x->n; i++) {
+			olc_node_free(tree, olc_children(tree, x)[i]);
+		}
+	}
+	free(x);
+}
+
+/* The number of items of `x`, as far as it fits into the node. Whatever is
+ * read while `x` is being written gets caught by the version check, but must
+ * not send us off the node before that */
+static ssize_t olc_n(const struct btree_olc *tree, const struct olc_node *x) {
+	const ssize_t n = __atomic_load_n(&x->n, __ATOMIC_RELAXED);
+
+	if (n < 0) return 0;
+	if (n > BTREE_NODE_MAX_ITEMS(tree->degree)) {
+		return BTREE_NODE_MAX_ITEMS(tree->degree);
+	}
+	return n;
+}
+
+static struct olc_node* olc_child(const struct btree_olc *tree,
+                                  const struct olc_node *x,
+                                  const ssize_t i) {
+	return __atomic_load_n(&olc_children(tree, x)[i], __ATOMIC_RELAXED);
+}
+
+/* Same as `node_find`, on the first `n` items of `x`: the index of the first
+ * item not less than `key`, with `cmp(key, item)` for it stored in `cmp_res` */
+static ssize_t olc_find(const struct btree_olc *tree,
+                        const struct olc_node *x,
+                        const ssize_t n,
+                        const void *key,
+                        int *cmp_res) {
+	ssize_t lo = 0;
+	ssize_t hi = n;
+
+	*cmp_res = BTREE_CMP_GT;
+	while (lo < hi) {
+		const ssize_t mid = lo + (hi - lo) / 2;
+		const int     res = tree->cmp(key, olc_item(tree, x, mid));
+
+		if (res > 0) {
+			lo = mid + 1;
+		} else {
+			hi       = mid;
+			*cmp_res = res;
+		}
+	}
+	return lo;
+}
+
+/* The index of the first of the `n` items of `x` greater than `key` */
+static ssize_t olc_find_upper(const struct btree_olc *tree,
+                              const struct olc_node *x,
+                              const ssize_t n,
+                              const void *key) {
+	ssize_t lo = 0;
+	ssize_t hi = n;
+
+	while (lo < hi) {
+		const ssize_t mid = lo + (hi - lo) / 2;
+
+		if (tree->cmp(key, olc_item(tree, x, mid)) >= 0) lo = mid + 1;
+		else                                             hi = mid;
+	}
+	return lo;
+}
+
+/* Writers, all nodes passed must be locked */
+
+/* Splits the full child `i` of `x`, see `node_tree_split_child` */
+static bool olc_split(struct btree_olc *tree, struct olc_node *x, ssize_t i) {
+	const ssize_t t         = tree->degree;
+	const size_t  elem_size = tree->elem_size;
+	struct olc_node **xc = olc_children(tree, x);
+	struct olc_node  *y  = xc[i];
+	struct olc_node  *z  = olc_node_new(tree, y->leaf);
+
+	if (z == NULL) return false;
+
+	/* `z` is not reachable yet, no need to lock it */
+	memcpy(olc_item(tree, z, 0), olc_item(tree, y, t), elem_size * (t-1));
+	if (!y->leaf) {
+		memcpy(olc_children(tree, z), olc_children(tree, y) + t,
+		       sizeof(struct olc_node*) * t);
+	}
+	z->n = t - 1;
+
+	memmove(xc + i + 2, xc + i + 1, sizeof(struct olc_node*) * (x->n - i));
+	memmove(olc_item(tree, x, i+1), olc_item(tree, x, i),
+	        elem_size * (x->n - i));
+	memcpy(olc_item(tree, x, i), olc_item(tree, y, t-1), elem_size);
+	xc[i+1] = z;
+	x->n++;
+
+	y->n = t - 1;
+	return true;
+}
+
+/* Merges child `i+1` of `x` and the item between into child `i`, see
+ * `node_child_merge`. The caller disposes of child `i+1` */
+static void olc_merge(struct btree_olc *tree, struct olc_node *x, ssize_t i) {
+	const size_t elem_size = tree->elem_size;
+	struct olc_node **xc = olc_children(tree, x);
+	struct olc_node  *y  = xc[i  ];
+	struct olc_node  *z  = xc[i+1];
+
+	memcpy(olc_item(tree, y, y->n), olc_item(tree, x, i), elem_size);
+	memcpy(olc_item(tree, y, y->n+1), olc_item(tree, z, 0),
+	       elem_size * z->n);
+	if (!y->leaf) {
+		memcpy(olc_children(tree, y) + y->n + 1, olc_children(tree, z),
+		       sizeof(struct olc_node*) * (z->n + 1));
+	}
+	y->n += z->n + 1;
+
+	memmove(olc_item(tree, x, i), olc_item(tree, x, i+1),
+	        elem_size * (x->n - i - 1));
+	memmove(xc + i + 1, xc + i + 2, sizeof(struct olc_node*) * (x->n - i - 1));
+	x->n--;
+}
+
+/* Moves the last item of child `i` up to `x` and the item in between down to
+ * child `i+1`, see `node_shift_right` */
+static void olc_shift_right(struct btree_olc *tree, struct olc_node *x, ssize_t i) {
+	const size_t elem_size = tree->elem_size;
+	struct olc_node *y = olc_children(tree, x)[i  ];
+	struct olc_node *z = olc_children(tree, x)[i+1];
+
+	memmove(olc_item(tree, z, 1), olc_item(tree, z, 0), elem_size * z->n);
+	memcpy(olc_item(tree, z, 0), olc_item(tree, x, i), elem_size);
+	memcpy(olc_item(tree, x, i), olc_item(tree, y, y->n-1), elem_size);
+	if (!z->leaf) {
+		struct olc_node **zc = olc_children(tree, z);
+		memmove(zc + 1, zc, sizeof(struct olc_node*) * (z->n + 1));
+		zc[0] = olc_children(tree, y)[y->n];
+	}
+	y->n--;
+	z->n++;
+}
+
+/* Moves the first item of child `i+1` up to `x` and the item in between down
+ * to child `i`, see `node_shift_left` */
+static void olc_shift_left(struct btree_olc *tree, struct olc_node *x, ssize_t i) {
+	const size_t elem_size = tree->elem_size;
+	struct olc_node *y = olc_children(tree, x)[i  ];
+	struct olc_node *z = olc_children(tree, x)[i+1];
+
+	memcpy(olc_item(tree, y, y->n), olc_item(tree, x, i), elem_size);
+	memcpy(olc_item(tree, x, i), olc_item(tree, z, 0), elem_size);
+	if (!y->leaf) {
+		struct olc_node **zc = olc_children(tree, z);
+		olc_children(tree, y)[y->n+1] = zc[0];
+		memmove(zc, zc + 1, sizeof(struct olc_node*) * z->n);
+	}
+	memmove(olc_item(tree, z, 0), olc_item(tree, z, 1), elem_size * (z->n-1));
+	y->n++;
+	z->n--;
+}
+
+/* `olc_fill` brings the locked child `i` of `x`, which has t-1 items, up to
+ * at least t, borrowing from or merging with a sibling like `node_delete`
+ * does. Siblings are only locked while holding `x`, which keeps lock order
+ * acyclic.
+ * returnvalue: the index of the child to descend into, which is locked */
+static ssize_t olc_fill(struct btree_olc *tree, struct olc_node *x, ssize_t i) {
+	const ssize_t t = tree->degree;
+	struct olc_node **xc = olc_children(tree, x);
+	struct olc_node  *y  = xc[i];
+	struct olc_node  *s;
+
+	if (i > 0) {
+		s = xc[i-1];
+		olc_lock(s);
+		if (s->n >= t) {
+			olc_shift_right(tree, x, i-1);
+			olc_unlock(s);
+			return i;
+		}
+		if (i == x->n) {
+			olc_merge(tree, x, i-1);
+			olc_unlock_obsolete(y);
+			olc_retire(tree, y);
+			return i-1;
+		}
+		olc_unlock_unchanged(s);
+	}
+
+	s = xc[i+1];
+	olc_lock(s);
+	if (s->n >= t) {
+		olc_shift_left(tree, x, i);
+		olc_unlock(s);
+	} else {
+		olc_merge(tree, x, i);
+		olc_unlock_obsolete(s);
+		olc_retire(tree, s);
+	}
+	return i;
+}
+
+/* Removes the last (`last`) or first item from the subtree of the locked
+ * non-root `y`, copying it to `out`. Unlocks the subtree.
+ * Every node on the way gets a new version, even if it was not filled: the
+ * item leaves the subtree, and searches for it below must not get past them
+ * with the version they read before */
+static void olc_pop(struct btree_olc *tree,
+                    struct olc_node *y,
+                    const bool last,
+                    byte *out) {
+	const size_t elem_size = tree->elem_size;
+
+	while (!y->leaf) {
+		ssize_t i = last ? y->n : 0;
+		struct olc_node *next;
+
+		olc_lock(olc_children(tree, y)[i]);
+		if (olc_children(tree, y)[i]->n < tree->degree) {
+			i = olc_fill(tree, y, i);
+		}
+		next = olc_children(tree, y)[i];
+
+		olc_unlock(y);
+		y = next;
+	}
+
+	if (last) {
+		memcpy(out, olc_item(tree, y, y->n-1), elem_size);
+	} else {
+		memcpy(out, olc_item(tree, y, 0), elem_size);
+		memmove(olc_item(tree, y, 0), olc_item(tree, y, 1),
+		        elem_size * (y->n-1));
+	}
+	y->n--;
+	olc_unlock(y);
+}
+
+/* Optimistic operations, returning `OLC_RESTART` whenever a node changed
+ * under them */
+
+/* Reads the root into `x`, making sure it still is the root at version `v` */
+static bool olc_read_root(struct btree_olc *tree,
+                          struct olc_node **x,
+                          uint64_t *v) {
+	*x = __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE);
+	return olc_read(*x, v)
+	    && __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE) == *x;
+}
+
+static int olc_search(struct btree_olc *tree, const void *key, void *out) {
+	struct olc_node *x;
+	uint64_t v;
+
+	if (!olc_read_root(tree, &x, &v)) return OLC_RESTART;
+
+	for (;;) {
+		const ssize_t n = olc_n(tree, x);
+		int     res;
+		ssize_t i = olc_find(tree, x, n, key, &res);
+		struct olc_node *parent;
+		uint64_t         pv;
+
+		if (res == 0) {
+			memcpy(out, olc_item(tree, x, i), tree->elem_size);
+			return olc_valid(x, v) ? 1 : OLC_RESTART;
+		} else if (x->leaf) {
+			return olc_valid(x, v) ? 0 : OLC_RESTART;
+		}
+
+		parent = x;
+		pv     = v;
+		x      = olc_child(tree, parent, i);
+		/* The child pointer must be checked before following it, and the
+		 * parent once more after, as the child might have split meanwhile */
+		if (!olc_valid(parent, pv)
+		||  !olc_read(x, &v)
+		||  !olc_valid(parent, pv)) {
+			return OLC_RESTART;
+		}
+	}
+}
+
+static int olc_insert(struct btree_olc *tree, const void *elem) {
+	const size_t elem_size = tree->elem_size;
+	struct olc_node *parent = NULL;
+	struct olc_node *x;
+	uint64_t pv = 0;
+	uint64_t v;
+	ssize_t  pi = 0;
+
+	if (!olc_read_root(tree, &x, &v)) return OLC_RESTART;
+
+	for (;;) {
+		const ssize_t n = olc_n(tree, x);
+		int     res;
+		ssize_t i;
+
+		if (olc_full(tree, n)) {
+			/* Split on the way down, locking just the node and its parent,
+			 * which has room as we would have split it otherwise */
+			bool split = false;
+
+			if (parent != NULL && !olc_upgrade(parent, pv)) return OLC_RESTART;
+			if (!olc_upgrade(x, v)) {
+				if (parent != NULL) olc_unlock(parent);
+				return OLC_RESTART;
+			}
+
+			if (parent == NULL) {
+				/* `x` is still the root, replacing it takes its lock */
+				struct olc_node *s = olc_node_new(tree, false);
+
+				if (s != NULL) {
+					olc_children(tree, s)[0] = x;
+					split = olc_split(tree, s, 0);
+					if (split) __atomic_store_n(&tree->root, s, __ATOMIC_RELEASE);
+					else       free(s);
+				}
+			} else {
+				split = olc_split(tree, parent, pi);
+			}
+
+			olc_unlock(x);
+			if (parent != NULL) olc_unlock(parent);
+			if (!split) {
+				fputs("BTree error: Failed to split node for insertion!\n", stderr);
+				return -1;
+			}
+			return OLC_RESTART;
+		}
+
+		i = olc_find(tree, x, n, elem, &res);
+		if (res == 0) {
+			return olc_valid(x, v) ? 0 : OLC_RESTART;
+		}
+
+		if (x->leaf) {
+			if (!olc_upgrade(x, v)) return OLC_RESTART;
+			memmove(olc_item(tree, x, i+1), olc_item(tree, x, i),
+			        elem_size * (x->n - i));
+			memcpy(olc_item(tree, x, i), elem, elem_size);
+			x->n++;
+			olc_unlock(x);
+			return 1;
+		}
+
+		parent = x;
+		pv     = v;
+		pi     = i;
+		x      = olc_child(tree, parent, i);
+		if (!olc_valid(parent, pv)
+		||  !olc_read(x, &v)
+		||  !olc_valid(parent, pv)) {
+			return OLC_RESTART;
+		}
+	}
+}
+
+/* Hands the root over to the only child of `x`, once a merge emptied it.
+ * `x` is locked and unlocked here */
+static void olc_collapse(struct btree_olc *tree, struct olc_node *x) {
+	__atomic_store_n(&tree->root, olc_children(tree, x)[0], __ATOMIC_RELEASE);
+	olc_unlock_obsolete(x);
+	olc_retire(tree, x);
+}
+
+static int olc_delete(struct btree_olc *tree, const void *key) {
+	const size_t elem_size = tree->elem_size;
+	const ssize_t t        = tree->degree;
+	struct olc_node *parent = NULL;
+	struct olc_node *x;
+	uint64_t pv = 0;
+	uint64_t v;
+	ssize_t  pi = 0;
+
+	if (!olc_read_root(tree, &x, &v)) return OLC_RESTART;
+
+	for (;;) {
+		const ssize_t n = olc_n(tree, x);
+		int     res;
+		ssize_t i = olc_find(tree, x, n, key, &res);
+		struct olc_node **xc;
+		struct olc_node  *y;
+		struct olc_node  *z;
+
+		if (parent != NULL && n < t && (res == 0 || !x->leaf)) {
+			/* Fill on the way down, locking just the node, its parent and
+			 * the sibling it borrows from or merges with. Leaves the key is
+			 * not in are left alone */
+			ssize_t j;
+
+			if (!olc_upgrade(parent, pv)) return OLC_RESTART;
+			if (!olc_upgrade(x, v)) {
+				olc_unlock_unchanged(parent);
+				return OLC_RESTART;
+			}
+
+			j = olc_fill(tree, parent, pi);
+			olc_unlock(olc_children(tree, parent)[j]);
+			if (parent->n == 0) olc_collapse(tree, parent);
+			else                olc_unlock(parent);
+			return OLC_RESTART;
+		}
+
+		if (res != 0 && x->leaf) {
+			return olc_valid(x, v) ? 0 : OLC_RESTART;
+		}
+
+		if (res == 0) {
+			if (!olc_upgrade(x, v)) return OLC_RESTART;
+			if (x->leaf) {
+				memmove(olc_item(tree, x, i), olc_item(tree, x, i+1),
+				        elem_size * (x->n - i - 1));
+				x->n--;
+				olc_unlock(x);
+				return 1;
+			}
+
+			/* Replace the key by its predecessor or successor, if their
+			 * subtree can spare one, or merge the children around it and
+			 * look again */
+			xc = olc_children(tree, x);
+			y  = xc[i];
+			z  = xc[i+1];
+			olc_lock(y);
+			if (y->n >= t) {
+				olc_pop(tree, y, true, olc_item(tree, x, i));
+				olc_unlock(x);
+				return 1;
+			}
+			olc_lock(z);
+			if (z->n >= t) {
+				olc_unlock_unchanged(y);
+				olc_pop(tree, z, false, olc_item(tree, x, i));
+				olc_unlock(x);
+				return 1;
+			}
+			olc_merge(tree, x, i);
+			olc_unlock_obsolete(z);
+			olc_retire(tree, z);
+			olc_unlock(y);
+			if (x->n == 0) olc_collapse(tree, x);
+			else           olc_unlock(x);
+			return OLC_RESTART;
+		}
+
+		parent = x;
+		pv     = v;
+		pi     = i;
+		x      = olc_child(tree, parent, i);
+		if (!olc_valid(parent, pv)
+		||  !olc_read(x, &v)
+		||  !olc_valid(parent, pv)) {
+			return OLC_RESTART;
+		}
+	}
+}
+
+/* Reads the elements following `after`, or the first ones if NULL, into the
+ * iterator: the rest of the leaf they are in, followed by the item of the
+ * lowest ancestor to their right, which comes next in order */
+static int olc_iter_fill(struct btree_olc *tree,
+                         struct btree_olc_iter_t *iter,
+                         const byte *after) {
+	const size_t elem_size = tree->elem_size;
+	const size_t slots     = BTREE_NODE_ITEM_SLOTS(tree->degree);
+	byte *fence = iter->elems + elem_size * slots;
+	bool  fenced = false;
+	struct olc_node *x;
+	uint64_t v;
+
+	if (!olc_read_root(tree, &x, &v)) return OLC_RESTART;
+
+	for (;;) {
+		const ssize_t n = olc_n(tree, x);
+		const ssize_t i = after != NULL ? olc_find_upper(tree, x, n, after) : 0;
+		struct olc_node *parent;
+		uint64_t         pv;
+
+		if (x->leaf) {
+			memcpy(iter->elems, olc_item(tree, x, i), elem_size * (n - i));
+			if (!olc_valid(x, v)) return OLC_RESTART;
+
+			iter->n   = n - i;
+			iter->pos = 0;
+			if (fenced) {
+				memcpy(iter->elems + elem_size * iter->n++, fence, elem_size);
+			}
+			return 0;
+		}
+
+		if (i < n) {
+			memcpy(fence, olc_item(tree, x, i), elem_size);
+			fenced = true;
+		}
+
+		parent = x;
+		pv     = v;
+		x      = olc_child(tree, parent, i);
+		if (!olc_valid(parent, pv)
+		||  !olc_read(x, &v)
+		||  !olc_valid(parent, pv)) {
+			return OLC_RESTART;
+		}
+	}
+}
+
+/* API */
+
+struct btree_olc* btree_olc_new(size_t elem_size,
+                                size_t t,
+                                int    (*cmp)(const void *a, const void *b)) {
+	struct btree_olc *tree;
+	size_t i;
+
+	if (t < 2 || elem_size == 0 || cmp == NULL) {
+		fputs("BTree error: Invalid parameters for concurrent tree!\n", stderr);
+		return NULL;
+	}
+
+	tree = malloc(sizeof(struct btree_olc));
+	if (tree == NULL) {
+		fputs("BTree error: Failed to allocate concurrent tree!\n", stderr);
+		return NULL;
+	}
+
+	tree->elem_size = elem_size;
+	tree->degree    = t;
+	tree->cmp       = cmp;
+
+	tree->items_offset    = align_up(sizeof(struct olc_node), sizeof(void*));
+	tree->children_offset = align_up(tree->items_offset
+	                                 + BTREE_NODE_ITEM_SLOTS(t) * elem_size,
+	                                 sizeof(void*));
+	tree->leaf_size       = tree->children_offset;
+	tree->inner_size      = tree->children_offset
+	                      + BTREE_NODE_CHILD_SLOTS(t) * sizeof(struct olc_node*);
+
+	for (i = 0; i < OLC_STRIPES; i++) {
+		tree->stripes[i].active[0] = 0;
+		tree->stripes[i].active[1] = 0;
+	}
+	tree->epoch    = 0;
+	tree->retired  = NULL;
+	tree->draining = NULL;
+	pthread_mutex_init(&tree->retire_lock, NULL);
+
+	/* There always is a root, so nobody has to race for creating it */
+	tree->root = olc_node_new(tree, true);
+	if (tree->root == NULL) {
+		pthread_mutex_destroy(&tree->retire_lock);
+		free(tree);
+		return NULL;
+	}
+	return tree;
+}
+
+void btree_olc_free(struct btree_olc **tree) {
+	if (tree == NULL || *tree == NULL) return;
+
+	olc_node_free(*tree, (*tree)->root);
+	olc_free_list((*tree)->retired);
+	olc_free_list((*tree)->draining);
+	pthread_mutex_destroy(&(*tree)->retire_lock);
+	free(*tree);
+	*tree = NULL;
+}
+
+int btree_olc_search(struct btree_olc *tree, const void *key, void *out) {
+	size_t  *active = olc_enter(tree);
+	unsigned spins  = 0;
+	int      res;
+
+	while ((res = olc_search(tree, key, out)) == OLC_RESTART) olc_pause(&spins);
+
+	olc_exit(active);
+	return res;
+}
+
+int btree_olc_insert(struct btree_olc *tree, const void *elem) {
+	size_t  *active = olc_enter(tree);
+	unsigned spins  = 0;
+	int      res;
+
+	while ((res = olc_insert(tree, elem)) == OLC_RESTART) olc_pause(&spins);
+
+	olc_exit(active);
+	return res;
+}
+
+int btree_olc_delete(struct btree_olc *tree, const void *key) {
+	size_t  *active = olc_enter(tree);
+	unsigned spins  = 0;
+	int      res;
+
+	while ((res = olc_delete(tree, key)) == OLC_RESTART) olc_pause(&spins);
+
+	olc_exit(active);
+	olc_reclaim(tree);
+	return res;
+}
+
+struct btree_olc_iter_t* btree_olc_iter_t_new(struct btree_olc *tree) {
+	struct btree_olc_iter_t *iter = malloc(sizeof(struct btree_olc_iter_t));
+
+	if (iter == NULL) {
+		fputs("BTree error: Failed to allocate iterator!\n", stderr);
+		return NULL;
+	}
+	/* Room for a leaf, the fence and the element last returned */
+	iter->elems = malloc(tree->elem_size
+	                     * (BTREE_NODE_ITEM_SLOTS(tree->degree) + 2));
+	if (iter->elems == NULL) {
+		fputs("BTree error: Failed to allocate iterator!\n", stderr);
+		free(iter);
+		return NULL;
+	}
+	iter->n       = 0;
+	iter->pos     = 0;
+	iter->started = false;
+	return iter;
+}
+
+void btree_olc_iter_t_free(struct btree_olc *tree,
+                           struct btree_olc_iter_t **iter) {
+	(void)tree;
+	if (iter == NULL || *iter == NULL) return;
+
+	free((*iter)->elems);
+	free(*iter);
+	*iter = NULL;
+}
+
+void* btree_olc_iter(struct btree_olc *tree, struct btree_olc_iter_t *iter) {
+	const size_t elem_size = tree->elem_size;
+	byte *last = iter->elems
+	           + elem_size * (BTREE_NODE_ITEM_SLOTS(tree->degree) + 1);
+
+	if (iter->pos == iter->n) {
+		size_t  *active;
+		unsigned spins = 0;
+
+		if (iter->started && iter->n == 0) return NULL;
+
+		/* Carry on after the last element returned, wherever it went */
+		if (iter->started) {
+			memcpy(last, iter->elems + elem_size * (iter->n - 1), elem_size);
+		}
+		active = olc_enter(tree);
+		while (olc_iter_fill(tree, iter, iter->started ? last : NULL)
+		       == OLC_RESTART) {
+			olc_pause(&spins);
+		}
+		olc_exit(active);
+
+		iter->started = true;
+		if (iter->n == 0) return NULL;
+	}
+
+	return iter->elems + elem_size * iter->pos++;
+}
@@ -0,0 +1,66 @@
+#ifndef BTREE_OLC_H
+#define BTREE_OLC_H
+
+#include <stddef.h>
+
+/* A btree that may be used from many threads at once, without any locking on
+ * the caller's side.
+ *
+ * Every node carries a version counter. Searches and iterations never take a
+ * lock: they read nodes optimistically and start over if a version changed
+ * under them (optimistic lock coupling). Insertions descend the same way and
+ * only lock the nodes they modify, that is the leaf they insert into, or a
+ * full node and its parent when splitting on the way down. Deletions descend
+ * optimistically as well, and only lock the leaf they delete from, or the
+ * inner node holding the key together with the path down to the predecessor
+ * or successor replacing it. An underfull node on the way is locked with its
+ * parent and the sibling it borrows from or merges with, filled up, and the
+ * deletion starts over. Nodes removed by deletions are freed as soon as no
+ * operation that might still be reading them is left.
+ *
+ * Since nodes are read while other threads may be writing them, `cmp` must
+ * cope with being called on half-written elements, whose results are thrown
+ * away. Comparing plain values, as most comparators do, is fine; following
+ * pointers held in elements is not.
+ *
+ * Unlike `struct btree`, keys are unique, and elements are copied out rather
+ * than handed out by pointer, as they may move at any time.
+ */
+
+struct btree_olc;
+struct btree_olc_iter_t;
+
+/* Same as `btree_new`, nodes are taken from `malloc` */
+struct btree_olc* btree_olc_new(size_t elem_size,
+                                size_t t,
+                                int    (*cmp)(const void *a, const void *b));
+
+/* Not thread-safe, no other operation may be running */
+void   btree_olc_free(struct btree_olc **tree);
+
+/* Copies the element equal to `key` to `out`.
+ * returnvalue: 1 if found, 0 otherwise.
+ */
+int    btree_olc_search(struct btree_olc *tree, const void *key, void *out);
+
+/* returnvalue: 1 if `elem` was inserted, 0 if an equal element is present,
+ * -1 if we ran out of memory.
+ */
+int    btree_olc_insert(struct btree_olc *tree, const void *elem);
+
+/* returnvalue: 1 if an element equal to `key` was deleted, 0 otherwise. */
+int    btree_olc_delete(struct btree_olc *tree, const void *key);
+
+/* Iterators hand out copies of the elements in ascending order, each one
+ * greater than the one before. The elements of a leaf are read at once, but
+ * the tree as a whole may change in between: an element present throughout
+ * the iteration is seen exactly once, others may or may not be.
+ * The returned pointer is valid until the next call.
+ */
+struct btree_olc_iter_t* btree_olc_iter_t_new(struct btree_olc *tree);
+void                     btree_olc_iter_t_free(struct btree_olc *tree,
+                                               struct btree_olc_iter_t **iter);
+
+void*  btree_olc_iter(struct btree_olc *tree, struct btree_olc_iter_t *iter);
+
+#endif
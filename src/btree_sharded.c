@@ -0,0 +1,524 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "btree.h"
+#include "btree_layout.h"
+#include "btree_sharded.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+/* Definitions */
+typedef unsigned char byte;
+
+/* One cache line or more per shard, so locking one leaves the others be */
+struct shard {
+	pthread_mutex_t lock;
+	struct btree   *tree;
+	byte            pad[BTREE_CACHE_LINE
+	                    - (sizeof(pthread_mutex_t) + sizeof(struct btree*))
+	                      % BTREE_CACHE_LINE];
+};
+
+struct btree_sharded {
+	size_t elem_size;
+	int    (*cmp)(const void *a, const void *b);
+
+	/* Partitioning, by `hash` if set, otherwise by `bounds` */
+	size_t (*hash)(const void *elem);
+	byte   *bounds;
+
+	size_t        shards;
+	struct shard *shard;
+};
+
+struct btree_sharded_iter_t {
+	size_t                shards;
+	struct btree        **snapshots;
+	struct btree_iter_t **iters;
+	/* Min-heap of the next element of every shard that has one left */
+	size_t   heap_size;
+	void   **heap_elem;
+	size_t  *heap_shard;
+};
+
+/* A bulk operation, handed out to the threads shard by shard */
+struct bulk {
+	struct btree_sharded *sharded;
+	const byte *groups;   /* the elements, grouped by shard */
+	size_t     *offsets;  /* group i starts at offsets[i] and ends at offsets[i+1] */
+	size_t      next;     /* the next shard to take on */
+	double      fill_factor;
+	bool        build;
+	size_t      done;     /* elements inserted */
+	bool        failed;
+};
+
+/* Partitioning */
+
+static size_t sharded_index(struct btree_sharded *sharded, const void *elem) {
+	size_t lo = 0;
+	size_t hi = sharded->shards - 1;
+
+	if (sharded->hash != NULL) return sharded->hash(elem) % sharded->shards;
+
+	/* The number of bounds not greater than `elem` */
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (sharded->cmp(sharded->bounds + sharded->elem_size * mid, elem) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static struct btree_sharded* sharded_new(size_t elem_size,
+                                         size_t t,
+                                         int    (*cmp)(const void *a, const void *b),
+                                         size_t (*hash)(const void *elem),
+                                         const void *bounds,
+                                         size_t shards) {
+	struct btree_sharded *sharded;
+	void  *mem;
+	size_t i;
+
+	if (shards == 0) {
+		fputs("BTree error: A sharded tree needs at least one shard!\n", stderr);
+		return NULL;
+	}
+
+	sharded = malloc(sizeof(struct btree_sharded));
+	if (sharded == NULL) {
+		fputs("BTree error: Failed to allocate sharded tree!\n", stderr);
+		return NULL;
+	}
+	sharded->elem_size = elem_size;
+	sharded->cmp       = cmp;
+	sharded->hash      = hash;
+	sharded->bounds    = NULL;
+	sharded->shards    = shards;
+
+	if (posix_memalign(&mem, BTREE_CACHE_LINE, sizeof(struct shard) * shards) != 0) {
+		fputs("BTree error: Failed to allocate shards!\n", stderr);
+		free(sharded);
+		return NULL;
+	}
+	sharded->shard = mem;
+
+	if (hash == NULL && shards > 1) {
+		sharded->bounds = malloc(elem_size * (shards - 1));
+		if (sharded->bounds == NULL) {
+			fputs("BTree error: Failed to allocate shard bounds!\n", stderr);
+			free(sharded->shard);
+			free(sharded);
+			return NULL;
+		}
+		memcpy(sharded->bounds, bounds, elem_size * (shards - 1));
+	}
+
+	for (i = 0; i < shards; i++) {
+		struct btree *tree = btree_new(elem_size, t, cmp);
+
+		if (tree == NULL) {
+			sharded->shards = i;
+			btree_sharded_free(&sharded);
+			return NULL;
+		}
+		btree_set_node_pool(tree, BTREE_SHARDED_SLAB_NODES);
+		sharded->shard[i].tree = tree;
+		pthread_mutex_init(&sharded->shard[i].lock, NULL);
+	}
+	return sharded;
+}
+
+/* Bulk operations */
+
+/* Groups the `count` elements by shard into a new array.
+ * returnvalue: the array, NULL if we ran out of memory. `offsets` is set to
+ * where each group starts, with the end of the last one appended */
+static byte* sharded_group(struct btree_sharded *sharded,
+                           const byte *elems,
+                           size_t count,
+                           size_t **offsets) {
+	const size_t elem_size = sharded->elem_size;
+	size_t *index;
+	size_t *fill;
+	byte   *groups;
+	size_t  i;
+
+	groups   = malloc(elem_size * count + 1); /* `count` may be 0 */
+	index    = malloc(sizeof(size_t) * (count + 1));
+	*offsets = calloc(sharded->shards + 1, sizeof(size_t));
+	fill     = calloc(sharded->shards, sizeof(size_t));
+	if (groups == NULL || index == NULL || *offsets == NULL || fill == NULL) {
+		fputs("BTree error: Failed to allocate groups for bulk operation!\n", stderr);
+		free(groups);
+		free(index);
+		free(*offsets);
+		free(fill);
+		return NULL;
+	}
+
+	/* Counting sort by shard */
+	for (i = 0; i < count; i++) {
+		index[i] = sharded_index(sharded, elems + elem_size * i);
+		(*offsets)[index[i] + 1]++;
+	}
+	for (i = 0; i < sharded->shards; i++) {
+		(*offsets)[i + 1] += (*offsets)[i];
+	}
+	for (i = 0; i < count; i++) {
+		const size_t dst = (*offsets)[index[i]] + fill[index[i]]++;
+		memcpy(groups + elem_size * dst, elems + elem_size * i, elem_size);
+	}
+
+	free(index);
+	free(fill);
+	return groups;
+}
+
+static void* sharded_bulk_worker(void *arg) {
+	struct bulk          *bulk    = arg;
+	struct btree_sharded *sharded = bulk->sharded;
+
+	for (;;) {
+		const size_t i     = __atomic_fetch_add(&bulk->next, 1, __ATOMIC_RELAXED);
+		const byte  *group;
+		size_t       n;
+
+		if (i >= sharded->shards) return NULL;
+
+		group = bulk->groups + sharded->elem_size * bulk->offsets[i];
+		n     = bulk->offsets[i + 1] - bulk->offsets[i];
+
+		pthread_mutex_lock(&sharded->shard[i].lock);
+		if (bulk->build) {
+			if (btree_build(sharded->shard[i].tree, group, n,
+			                bulk->fill_factor) != 0) {
+				__atomic_store_n(&bulk->failed, true, __ATOMIC_RELAXED);
+			} else {
+				__atomic_fetch_add(&bulk->done, n, __ATOMIC_RELAXED);
+			}
+		} else if (n > 0) {
+			__atomic_fetch_add(&bulk->done,
+			                   btree_insert_batch(sharded->shard[i].tree, group, n),
+			                   __ATOMIC_RELAXED);
+		}
+		pthread_mutex_unlock(&sharded->shard[i].lock);
+	}
+}
+
+/* Runs `bulk` on up to `threads` threads, the calling one included */
+static void sharded_bulk_run(struct bulk *bulk, size_t threads) {
+	pthread_t *workers = NULL;
+	size_t     started = 0;
+	size_t     i;
+
+	if (threads > bulk->sharded->shards) threads = bulk->sharded->shards;
+	if (threads > 1) workers = malloc(sizeof(pthread_t) * (threads - 1));
+
+	/* Whatever threads we do not get, we make up for ourselves */
+	if (workers != NULL) {
+		for (i = 0; i < threads - 1; i++) {
+			if (pthread_create(&workers[started], NULL,
+			                   sharded_bulk_worker, bulk) == 0) {
+				started++;
+			}
+		}
+	}
+	sharded_bulk_worker(bulk);
+
+	for (i = 0; i < started; i++) pthread_join(workers[i], NULL);
+	free(workers);
+}
+
+/* Iteration */
+
+static bool sharded_heap_less(struct btree_sharded *sharded,
+                              struct btree_sharded_iter_t *iter,
+                              size_t a,
+                              size_t b) {
+	const int res = sharded->cmp(iter->heap_elem[a], iter->heap_elem[b]);
+	/* Equal elements come out in shard order, for determinism */
+	return res < 0 || (res == 0 && iter->heap_shard[a] < iter->heap_shard[b]);
+}
+
+static void sharded_heap_swap(struct btree_sharded_iter_t *iter, size_t a, size_t b) {
+	void  *elem  = iter->heap_elem[a];
+	size_t shard = iter->heap_shard[a];
+
+	iter->heap_elem[a]  = iter->heap_elem[b];
+	iter->heap_shard[a] = iter->heap_shard[b];
+	iter->heap_elem[b]  = elem;
+	iter->heap_shard[b] = shard;
+}
+
+static void sharded_heap_down(struct btree_sharded *sharded,
+                              struct btree_sharded_iter_t *iter,
+                              size_t i) {
+	for (;;) {
+		const size_t l = 2 * i + 1;
+		const size_t r = 2 * i + 2;
+		size_t min = i;
+
+		if (l < iter->heap_size && sharded_heap_less(sharded, iter, l, min)) min = l;
+		if (r < iter->heap_size && sharded_heap_less(sharded, iter, r, min)) min = r;
+		if (min == i) return;
+
+		sharded_heap_swap(iter, i, min);
+		i = min;
+	}
+}
+
+static void sharded_heap_up(struct btree_sharded *sharded,
+                            struct btree_sharded_iter_t *iter,
+                            size_t i) {
+	while (i > 0 && sharded_heap_less(sharded, iter, i, (i - 1) / 2)) {
+		sharded_heap_swap(iter, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+/* API */
+
+struct btree_sharded* btree_sharded_new_hash(
+                        size_t elem_size,
+                        size_t t,
+                        int    (*cmp)(const void *a, const void *b),
+                        size_t (*hash)(const void *elem),
+                        size_t shards) {
+	if (hash == NULL) {
+		fputs("BTree error: Hash partitioning needs a hash function!\n", stderr);
+		return NULL;
+	}
+	return sharded_new(elem_size, t, cmp, hash, NULL, shards);
+}
+
+struct btree_sharded* btree_sharded_new_range(
+                        size_t elem_size,
+                        size_t t,
+                        int    (*cmp)(const void *a, const void *b),
+                        const void *bounds,
+                        size_t shards) {
+	if (bounds == NULL && shards > 1) {
+		fputs("BTree error: Range partitioning needs bounds!\n", stderr);
+		return NULL;
+	}
+	return sharded_new(elem_size, t, cmp, NULL, bounds, shards);
+}
+
+void btree_sharded_free(struct btree_sharded **sharded) {
+	size_t i;
+
+	if (sharded == NULL || *sharded == NULL) return;
+
+	for (i = 0; i < (*sharded)->shards; i++) {
+		btree_free(&(*sharded)->shard[i].tree);
+		pthread_mutex_destroy(&(*sharded)->shard[i].lock);
+	}
+	free((*sharded)->shard);
+	free((*sharded)->bounds);
+	free(*sharded);
+	*sharded = NULL;
+}
+
+int btree_sharded_search(struct btree_sharded *sharded,
+                         const void *key,
+                         void *out) {
+	struct shard *shard = &sharded->shard[sharded_index(sharded, key)];
+	void *elem;
+
+	pthread_mutex_lock(&shard->lock);
+	elem = btree_search(shard->tree, (void*)key);
+	if (elem != NULL) memcpy(out, elem, sharded->elem_size);
+	pthread_mutex_unlock(&shard->lock);
+
+	return elem != NULL;
+}
+
+int btree_sharded_insert(struct btree_sharded *sharded, const void *elem) {
+	struct shard *shard = &sharded->shard[sharded_index(sharded, elem)];
+	int res;
+
+	pthread_mutex_lock(&shard->lock);
+	res = btree_insert(shard->tree, (void*)elem);
+	pthread_mutex_unlock(&shard->lock);
+
+	return res;
+}
+
+int btree_sharded_delete(struct btree_sharded *sharded, const void *key) {
+	struct shard *shard = &sharded->shard[sharded_index(sharded, key)];
+	int res;
+
+	pthread_mutex_lock(&shard->lock);
+	res = btree_delete(shard->tree, (void*)key);
+	pthread_mutex_unlock(&shard->lock);
+
+	return res;
+}
+
+size_t btree_sharded_size(struct btree_sharded *sharded) {
+	size_t size = 0;
+	size_t i;
+
+	for (i = 0; i < sharded->shards; i++) {
+		pthread_mutex_lock(&sharded->shard[i].lock);
+		size += btree_size(sharded->shard[i].tree);
+		pthread_mutex_unlock(&sharded->shard[i].lock);
+	}
+	return size;
+}
+
+size_t btree_sharded_insert_batch(struct btree_sharded *sharded,
+                                  const void *elems,
+                                  size_t count,
+                                  size_t threads) {
+	struct bulk bulk;
+	byte *groups;
+
+	if (count == 0) return 0;
+
+	groups = sharded_group(sharded, elems, count, &bulk.offsets);
+	if (groups == NULL) return 0;
+
+	bulk.sharded     = sharded;
+	bulk.groups      = groups;
+	bulk.next        = 0;
+	bulk.fill_factor = 0;
+	bulk.build       = false;
+	bulk.done        = 0;
+	bulk.failed      = false;
+	sharded_bulk_run(&bulk, threads);
+
+	free(groups);
+	free(bulk.offsets);
+	return bulk.done;
+}
+
+int btree_sharded_build(struct btree_sharded *sharded,
+                        const void *elems,
+                        size_t count,
+                        double fill_factor,
+                        size_t threads) {
+	struct bulk bulk;
+	byte *groups;
+
+	groups = sharded_group(sharded, elems, count, &bulk.offsets);
+	if (groups == NULL) return -1;
+
+	bulk.sharded     = sharded;
+	bulk.groups      = groups;
+	bulk.next        = 0;
+	bulk.fill_factor = fill_factor;
+	bulk.build       = true;
+	bulk.done        = 0;
+	bulk.failed      = false;
+	sharded_bulk_run(&bulk, threads);
+
+	free(groups);
+	free(bulk.offsets);
+	return bulk.failed ? -1 : 0;
+}
+
+struct btree_sharded_iter_t* btree_sharded_iter_t_new(
+                                 struct btree_sharded *sharded) {
+	const size_t shards = sharded->shards;
+	struct btree_sharded_iter_t *iter;
+	size_t i;
+
+	iter = malloc(sizeof(struct btree_sharded_iter_t));
+	if (iter == NULL) {
+		fputs("BTree error: Failed to allocate iterator!\n", stderr);
+		return NULL;
+	}
+	iter->shards     = 0;
+	iter->heap_size  = 0;
+	iter->snapshots  = calloc(shards, sizeof(struct btree*));
+	iter->iters      = calloc(shards, sizeof(struct btree_iter_t*));
+	iter->heap_elem  = malloc(sizeof(void*) * shards);
+	iter->heap_shard = malloc(sizeof(size_t) * shards);
+	if (iter->snapshots == NULL || iter->iters == NULL
+	||  iter->heap_elem == NULL || iter->heap_shard == NULL) {
+		fputs("BTree error: Failed to allocate iterator!\n", stderr);
+		btree_sharded_iter_t_free(sharded, &iter);
+		return NULL;
+	}
+
+	for (i = 0; i < shards; i++) {
+		void *elem;
+
+		pthread_mutex_lock(&sharded->shard[i].lock);
+		iter->snapshots[i] = btree_snapshot(sharded->shard[i].tree);
+		pthread_mutex_unlock(&sharded->shard[i].lock);
+		iter->shards = i + 1;
+
+		if (iter->snapshots[i] == NULL) {
+			btree_sharded_iter_t_free(sharded, &iter);
+			return NULL;
+		}
+		iter->iters[i] = btree_iter_t_new(iter->snapshots[i]);
+		if (iter->iters[i] == NULL) {
+			btree_sharded_iter_t_free(sharded, &iter);
+			return NULL;
+		}
+
+		elem = btree_iter(iter->snapshots[i], iter->iters[i]);
+		if (elem != NULL) {
+			iter->heap_elem[iter->heap_size]  = elem;
+			iter->heap_shard[iter->heap_size] = i;
+			sharded_heap_up(sharded, iter, iter->heap_size++);
+		}
+	}
+	return iter;
+}
+
+void btree_sharded_iter_t_free(struct btree_sharded *sharded,
+                               struct btree_sharded_iter_t **iter) {
+	size_t i;
+
+	(void)sharded;
+	if (iter == NULL || *iter == NULL) return;
+
+	for (i = 0; i < (*iter)->shards; i++) {
+		/* `btree_iter_t_new` allocates with the tree's allocator, `malloc` */
+		free((*iter)->iters[i]);
+		btree_free(&(*iter)->snapshots[i]);
+	}
+	free((*iter)->snapshots);
+	free((*iter)->iters);
+	free((*iter)->heap_elem);
+	free((*iter)->heap_shard);
+	free(*iter);
+	*iter = NULL;
+}
+
+void* btree_sharded_iter(struct btree_sharded *sharded,
+                         struct btree_sharded_iter_t *iter) {
+	void  *elem;
+	void  *next;
+	size_t i;
+
+	if (iter->heap_size == 0) return NULL;
+
+	/* Take the smallest head, and replace it with the next one of its shard */
+	elem = iter->heap_elem[0];
+	i    = iter->heap_shard[0];
+	next = btree_iter(iter->snapshots[i], iter->iters[i]);
+	if (next != NULL) {
+		iter->heap_elem[0] = next;
+	} else {
+		iter->heap_size--;
+		iter->heap_elem[0]  = iter->heap_elem[iter->heap_size];
+		iter->heap_shard[0] = iter->heap_shard[iter->heap_size];
+	}
+	sharded_heap_down(sharded, iter, 0);
+
+	return elem;
+}
@@ -0,0 +1,93 @@
+#ifndef BTREE_SHARDED_H
+#define BTREE_SHARDED_H
+
+#include <stddef.h>
+
+/* A front-end spreading elements over several independent btrees (shards),
+ * each behind its own lock and drawing nodes from its own slab pool, so
+ * threads working on different shards never wait for each other.
+ *
+ * Elements are assigned to shards either by hashing them, which spreads any
+ * workload evenly, or by ranges of keys, which keeps each shard ordered with
+ * respect to the others. Either way, iterating yields all elements in order.
+ *
+ * All functions may be called from any thread at any time, except for
+ * `btree_sharded_free`.
+ */
+
+/* Nodes per slab of the shards' node pools, see `btree_set_node_pool` */
+#define BTREE_SHARDED_SLAB_NODES 64
+
+struct btree_sharded;
+struct btree_sharded_iter_t;
+
+/* `shards` trees of degree `t`, an element goes to shard
+ * `hash(elem) % shards`. Equal elements must hash alike.
+ */
+struct btree_sharded* btree_sharded_new_hash(
+                        size_t elem_size,
+                        size_t t,
+                        int    (*cmp)(const void *a, const void *b),
+                        size_t (*hash)(const void *elem),
+                        size_t shards);
+
+/* `shards` trees of degree `t`, split at the `shards - 1` keys in `bounds`,
+ * which must be sorted: shard i holds the elements not less than
+ * bounds[i-1] and less than bounds[i].
+ */
+struct btree_sharded* btree_sharded_new_range(
+                        size_t elem_size,
+                        size_t t,
+                        int    (*cmp)(const void *a, const void *b),
+                        const void *bounds,
+                        size_t shards);
+
+void   btree_sharded_free(struct btree_sharded **sharded);
+
+/* Copies the element equal to `key` to `out`, if there is one, as the shard
+ * may change as soon as we let go of it.
+ * returnvalue: 1 if found, 0 otherwise.
+ */
+int    btree_sharded_search(struct btree_sharded *sharded,
+                            const void *key,
+                            void *out);
+/* returnvalue: see `btree_insert` and `btree_delete` */
+int    btree_sharded_insert(struct btree_sharded *sharded, const void *elem);
+int    btree_sharded_delete(struct btree_sharded *sharded, const void *key);
+
+size_t btree_sharded_size(struct btree_sharded *sharded);
+
+/* Bulk operations: the elements are grouped by shard first, then up to
+ * `threads` threads, including the calling one, take on one shard after the
+ * other. */
+
+/* Same as `btree_insert_batch`, on every shard at once */
+size_t btree_sharded_insert_batch(struct btree_sharded *sharded,
+                                  const void *elems,
+                                  size_t count,
+                                  size_t threads);
+
+/* Same as `btree_build`, replacing the contents of every shard at once.
+ * returnvalue: 0 on success, -1 if we ran out of memory, in which case some
+ * shards may have been replaced and others not.
+ */
+int    btree_sharded_build(struct btree_sharded *sharded,
+                           const void *elems,
+                           size_t count,
+                           double fill_factor,
+                           size_t threads);
+
+/* Iterators merge the shards into one ordered sequence. They work on
+ * snapshots taken of each shard on creation (see `btree_snapshot`), which
+ * leaves the shards free to change meanwhile. The returned elements are valid
+ * until the iterator is freed, which must happen before the sharded tree is.
+ */
+struct btree_sharded_iter_t* btree_sharded_iter_t_new(
+                                 struct btree_sharded *sharded);
+void   btree_sharded_iter_t_free(struct btree_sharded *sharded,
+                                 struct btree_sharded_iter_t **iter);
+
+void*  btree_sharded_iter(struct btree_sharded *sharded,
+                          struct btree_sharded_iter_t *iter);
+
+#endif
@@ -0,0 +1,202 @@
+#include "btree.h"
+#include "btree_simd.h"
+
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BTREE_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* Nodes are narrowed down with a scalar binary search until at most this many
+ * keys remain, which are then scanned with vector compares */
+#define SIMD_SCAN_WIDTH 64
+
+int btree_cmp_u32(const void *a, const void *b) {
+	const uint32_t x = *(const uint32_t*)a;
+	const uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+int btree_cmp_u64(const void *a, const void *b) {
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/* Generates `narrow_<type>`, which shrinks [lo, hi) to at most `width` items
+ * still containing the first item not less than `key`, and
+ * `find_<type>_scalar`, the fallback kernel */
+#define SIMD_SCALAR(type)                                                    \
+static void narrow_##type(const type *items, const type key, ssize_t width,  \
+                          ssize_t *lo, ssize_t *hi) {                        \
+	while (*hi - *lo > width) {                                              \
+		const ssize_t mid = *lo + (*hi - *lo) / 2;                           \
+		if (items[mid] < key) *lo = mid + 1;                                 \
+		else                  *hi = mid;                                     \
+	}                                                                        \
+}                                                                            \
+                                                                             \
+static ssize_t find_##type##_scalar(const void *items, ssize_t n,            \
+                                    const void *key, int *cmp_res) {         \
+	const type *k  = (const type*)items;                                     \
+	const type  kv = *(const type*)key;                                      \
+	ssize_t     lo = 0;                                                      \
+	ssize_t     hi = n;                                                      \
+	narrow_##type(k, kv, 0, &lo, &hi);                                       \
+	*cmp_res = lo == n ? BTREE_CMP_GT                                        \
+	         : (k[lo] == kv ? BTREE_CMP_EQ : BTREE_CMP_LT);                  \
+	return lo;                                                               \
+}
+
+SIMD_SCALAR(uint32_t)
+SIMD_SCALAR(uint64_t)
+
+#undef SIMD_SCALAR
+
+#ifdef BTREE_SIMD_X86
+
+/* All kernels below count the items less than `key` in the narrowed range,
+ * which, as the items are sorted, is the offset of the first item not less
+ * than `key`. SSE2 and AVX2 only compare signed integers, so both sides get
+ * their sign bits flipped first. */
+
+__attribute__((target("sse2")))
+static ssize_t find_u32_sse2(const void *items, ssize_t n,
+                             const void *key, int *cmp_res) {
+	const uint32_t *k    = (const uint32_t*)items;
+	const uint32_t  kv   = *(const uint32_t*)key;
+	const __m128i   flip = _mm_set1_epi32((int)0x80000000u);
+	const __m128i   vkey = _mm_xor_si128(_mm_set1_epi32((int)kv), flip);
+	ssize_t lo = 0;
+	ssize_t hi = n;
+
+	narrow_uint32_t(k, kv, SIMD_SCAN_WIDTH, &lo, &hi);
+
+	for (; lo + 4 <= hi; lo += 4) {
+		const __m128i v  = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(k + lo)),
+		                                 flip);
+		const int     lt = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(vkey, v)));
+		if (lt != 0xF) {
+			lo += __builtin_popcount(lt);
+			hi  = lo;
+			break;
+		}
+	}
+	while (lo < hi && k[lo] < kv) lo++;
+
+	*cmp_res = lo == n ? BTREE_CMP_GT : (k[lo] == kv ? BTREE_CMP_EQ : BTREE_CMP_LT);
+	return lo;
+}
+
+__attribute__((target("avx2")))
+static ssize_t find_u32_avx2(const void *items, ssize_t n,
+                             const void *key, int *cmp_res) {
+	const uint32_t *k    = (const uint32_t*)items;
+	const uint32_t  kv   = *(const uint32_t*)key;
+	const __m256i   flip = _mm256_set1_epi32((int)0x80000000u);
+	const __m256i   vkey = _mm256_xor_si256(_mm256_set1_epi32((int)kv), flip);
+	ssize_t lo = 0;
+	ssize_t hi = n;
+
+	narrow_uint32_t(k, kv, SIMD_SCAN_WIDTH, &lo, &hi);
+
+	for (; lo + 8 <= hi; lo += 8) {
+		const __m256i v  = _mm256_xor_si256(
+		                   _mm256_loadu_si256((const __m256i*)(k + lo)), flip);
+		const int     lt = _mm256_movemask_ps(
+		                   _mm256_castsi256_ps(_mm256_cmpgt_epi32(vkey, v)));
+		if (lt != 0xFF) {
+			lo += __builtin_popcount(lt);
+			hi  = lo;
+			break;
+		}
+	}
+	while (lo < hi && k[lo] < kv) lo++;
+
+	*cmp_res = lo == n ? BTREE_CMP_GT : (k[lo] == kv ? BTREE_CMP_EQ : BTREE_CMP_LT);
+	return lo;
+}
+
+/* SSE2 has no 64-bit compare, so it is assembled from 32-bit ones: the high
+ * halves decide, unless they are equal, then the low halves do. Flipping bit
+ * 31 as well makes the signed compare of the low halves unsigned. */
+__attribute__((target("sse2")))
+static ssize_t find_u64_sse2(const void *items, ssize_t n,
+                             const void *key, int *cmp_res) {
+	const uint64_t *k    = (const uint64_t*)items;
+	const uint64_t  kv   = *(const uint64_t*)key;
+	const __m128i   flip = _mm_set1_epi32((int)0x80000000u);
+	const __m128i   vkey = _mm_xor_si128(_mm_set1_epi64x((int64_t)kv), flip);
+	ssize_t lo = 0;
+	ssize_t hi = n;
+
+	narrow_uint64_t(k, kv, SIMD_SCAN_WIDTH, &lo, &hi);
+
+	for (; lo + 2 <= hi; lo += 2) {
+		const __m128i v  = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(k + lo)),
+		                                 flip);
+		const __m128i gt = _mm_cmpgt_epi32(vkey, v);
+		const __m128i eq = _mm_cmpeq_epi32(vkey, v);
+		const __m128i r  = _mm_or_si128(gt, _mm_and_si128(eq, _mm_slli_epi64(gt, 32)));
+		const int     lt = _mm_movemask_ps(_mm_castsi128_ps(r)) & 0xA;
+		if (lt != 0xA) {
+			lo += __builtin_popcount(lt);
+			hi  = lo;
+			break;
+		}
+	}
+	while (lo < hi && k[lo] < kv) lo++;
+
+	*cmp_res = lo == n ? BTREE_CMP_GT : (k[lo] == kv ? BTREE_CMP_EQ : BTREE_CMP_LT);
+	return lo;
+}
+
+__attribute__((target("avx2")))
+static ssize_t find_u64_avx2(const void *items, ssize_t n,
+                             const void *key, int *cmp_res) {
+	const uint64_t *k    = (const uint64_t*)items;
+	const uint64_t  kv   = *(const uint64_t*)key;
+	const __m256i   flip = _mm256_set1_epi64x(INT64_MIN);
+	const __m256i   vkey = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)kv), flip);
+	ssize_t lo = 0;
+	ssize_t hi = n;
+
+	narrow_uint64_t(k, kv, SIMD_SCAN_WIDTH, &lo, &hi);
+
+	for (; lo + 4 <= hi; lo += 4) {
+		const __m256i v  = _mm256_xor_si256(
+		                   _mm256_loadu_si256((const __m256i*)(k + lo)), flip);
+		const int     lt = _mm256_movemask_pd(
+		                   _mm256_castsi256_pd(_mm256_cmpgt_epi64(vkey, v)));
+		if (lt != 0xF) {
+			lo += __builtin_popcount(lt);
+			hi  = lo;
+			break;
+		}
+	}
+	while (lo < hi && k[lo] < kv) lo++;
+
+	*cmp_res = lo == n ? BTREE_CMP_GT : (k[lo] == kv ? BTREE_CMP_EQ : BTREE_CMP_LT);
+	return lo;
+}
+
+#endif /* BTREE_SIMD_X86 */
+
+btree_find_kernel btree_simd_find_u32(void) {
+#ifdef BTREE_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return find_u32_avx2;
+	if (__builtin_cpu_supports("sse2")) return find_u32_sse2;
+#endif
+	return find_uint32_t_scalar;
+}
+
+btree_find_kernel btree_simd_find_u64(void) {
+#ifdef BTREE_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return find_u64_avx2;
+	if (__builtin_cpu_supports("sse2")) return find_u64_sse2;
+#endif
+	return find_uint64_t_scalar;
+}
@@ -0,0 +1,23 @@
+#ifndef BTREE_SIMD_H
+#define BTREE_SIMD_H
+
+#include <sys/types.h>
+
+/* In-node search kernels for nodes of unsigned 32-bit and 64-bit integers.
+ * Same contract as `node_find`: returns the index of the first of the `n`
+ * sorted `items` not less than `key` and stores the comparison of `key`
+ * against it in `cmp_res`. */
+typedef ssize_t (*btree_find_kernel)(const void *items,
+                                     ssize_t     n,
+                                     const void *key,
+                                     int        *cmp_res);
+
+/* Return the fastest kernel the running CPU supports, falling back to a
+ * scalar search when no vector instructions are available. */
+btree_find_kernel btree_simd_find_u32(void);
+btree_find_kernel btree_simd_find_u64(void);
+
+int btree_cmp_u32(const void *a, const void *b);
+int btree_cmp_u64(const void *a, const void *b);
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef BTREE_TYPED_H
+#define BTREE_TYPED_H
+
+/* Header-only generator for btrees over a fixed key type.
+ *
+ * `BTREE_DEFINE(name, key_type, cmp_expr)` emits `struct name` together with
+ * `name_new`, `name_free`, `name_insert`, `name_search`, `name_delete`,
+ * `name_size` and the `struct name_iter` iterator (`name_iter_init`,
+ * `name_iter_next`). Keys are passed and stored by value, copied with plain
+ * assignments, and `cmp_expr` is an expression over the keys `a` and `b`,
+ * evaluating to <0, 0 or >0 like the comparators of the generic `btree_*` API.
+ * Since it is expanded in place, the compiler is free to inline it.
+ *
+ *   BTREE_DEFINE(u64tree, uint64_t, BTREE_CMP_NUM(a, b))
+ *
+ *   struct u64tree *tree = u64tree_new(32);
+ *   u64tree_insert(tree, 42);
+ *   if (u64tree_search(tree, 42) != NULL) { ... }
+ *   u64tree_free(&tree);
+ *
+ * Nodes are sized exactly like the nodes of btree.c, see btree_layout.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "btree.h"
+#include "btree_layout.h"
+
+/* Three-way comparison of two numbers, usable as `cmp_expr` */
+#define BTREE_CMP_NUM(a, b) (((a) > (b)) - ((a) < (b)))
+
+/* Deepest tree an iterator can walk, a degree 2 tree this deep would hold
+ * more than 2^64 keys */
+#define BTREE_TYPED_ITER_DEPTH 64
+
+#if defined(__GNUC__)
+#define BTREE_TYPED_FN static __inline__ __attribute__((unused))
+#else
+#define BTREE_TYPED_FN static
+#endif
+
+/* Swallows the semicolon following `BTREE_DEFINE(...)` */
+#define BTREE_TYPED_END_DEFINE struct btree_typed_end_define_
+
+#define BTREE_DEFINE(name, key_type, cmp_expr)                                   \
+struct name##_node {                                                             \
+	ssize_t              n; /* number of keys */                                 \
+	ssize_t              c; /* number of children */                             \
+	key_type            *items;                                                  \
+	struct name##_node **children;                                               \
+};                                                                               \
+                                                                                 \
+struct name {                                                                    \
+	ssize_t             degree;                                                  \
+	size_t              size;                                                    \
+	struct name##_node *root;                                                    \
+};                                                                               \
+                                                                                 \
+struct name##_iter {                                                             \
+	size_t head;                                                                 \
+	struct {                                                                     \
+		ssize_t             pos;                                                 \
+		struct name##_node *node;                                                \
+	} stack[BTREE_TYPED_ITER_DEPTH];                                             \
+};                                                                               \
+                                                                                 \
+BTREE_TYPED_FN int name##_cmp(const key_type a, const key_type b) {              \
+	return (cmp_expr);                                                           \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN struct name##_node* name##_node_new(ssize_t t, int leaf) {        \
+	struct name##_node *x = (struct name##_node*)malloc(sizeof(*x));             \
+	if (x == NULL) return NULL;                                                  \
+	x->n        = 0;                                                             \
+	x->c        = 0;                                                             \
+	x->items    = (key_type*)malloc(                                             \
+	              sizeof(key_type) * BTREE_NODE_ITEM_SLOTS(t));                  \
+	x->children = leaf ? NULL : (struct name##_node**)calloc(                    \
+	              BTREE_NODE_CHILD_SLOTS(t), sizeof(struct name##_node*));       \
+	if (x->items == NULL || (!leaf && x->children == NULL)) {                    \
+		free(x->items);                                                          \
+		free(x->children);                                                       \
+		free(x);                                                                 \
+		return NULL;                                                             \
+	}                                                                            \
+	return x;                                                                    \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN void name##_node_release(struct name##_node *x) {                 \
+	free(x->children);                                                           \
+	free(x->items);                                                              \
+	free(x);                                                                     \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN void name##_node_free(struct name##_node *x) {                    \
+	ssize_t i;                                                                   \
+	if (x == NULL) return;                                                       \
+	for (i = 0; x->children != NULL && i < x->c; i++) {                          \
+		name##_node_free(x->children[i]);                                        \
+	}                                                                            \
+	name##_node_release(x);                                                      \
+}                                                                                \
+                                                                                 \
+/* Same contract as `node_find` in btree.c: index of the first key not less      \
+ * than `key`, with the comparison against it stored in `res` */                 \
+BTREE_TYPED_FN ssize_t name##_find(const struct name##_node *x,                  \
+                                   const key_type key,                           \
+                                   int *res) {                                   \
+	ssize_t lo = 0;                                                              \
+	ssize_t hi = x->n;                                                           \
+	int     r  = BTREE_CMP_GT;                                                   \
+	int     c  = BTREE_CMP_GT;                                                   \
+                                                                                 \
+	while (hi - lo > BTREE_SEARCH_CUTOFF_DEFAULT) {                              \
+		const ssize_t mid = lo + (hi - lo) / 2;                                  \
+		c = name##_cmp(key, x->items[mid]);                                      \
+		if (c > 0) lo = mid + 1;                                                 \
+		else { hi = mid; r = c; }                                                \
+	}                                                                            \
+	while (lo < hi && (c = name##_cmp(key, x->items[lo])) > 0) lo++;             \
+	if (lo < hi) r = c;                                                          \
+                                                                                 \
+	*res = r;                                                                    \
+	return lo;                                                                   \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN int name##_split_child(ssize_t t,                                 \
+                                      struct name##_node *x,                     \
+                                      ssize_t i) {                               \
+	struct name##_node *y = x->children[i];                                      \
+	struct name##_node *z = name##_node_new(t, y->children == NULL);             \
+	if (z == NULL) return 0;                                                     \
+                                                                                 \
+	z->n = t - 1;                                                                \
+	memcpy(z->items, y->items + t, sizeof(key_type) * (t - 1));                  \
+	if (y->children != NULL) {                                                   \
+		memcpy(z->children, y->children + t, sizeof(*z->children) * t);          \
+		y->c = t;                                                                \
+		z->c = t;                                                                \
+	}                                                                            \
+	y->n = t - 1;                                                                \
+                                                                                 \
+	memmove(x->children + i + 2, x->children + i + 1,                            \
+	        sizeof(*x->children) * (x->c - i - 1));                              \
+	x->children[i + 1] = z;                                                      \
+	x->c++;                                                                      \
+                                                                                 \
+	memmove(x->items + i + 1, x->items + i, sizeof(key_type) * (x->n - i));      \
+	x->items[i] = y->items[t - 1];                                               \
+	x->n++;                                                                      \
+	return 1;                                                                    \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN void name##_merge(struct name##_node *x, ssize_t i) {             \
+	struct name##_node *y = x->children[i];                                      \
+	struct name##_node *z = x->children[i + 1];                                  \
+                                                                                 \
+	y->items[y->n++] = x->items[i];                                              \
+	memcpy(y->items + y->n, z->items, sizeof(key_type) * z->n);                  \
+	y->n += z->n;                                                                \
+	if (z->children != NULL) {                                                   \
+		memcpy(y->children + y->c, z->children, sizeof(*z->children) * z->c);    \
+		y->c += z->c;                                                            \
+	}                                                                            \
+                                                                                 \
+	memmove(x->children + i + 1, x->children + i + 2,                            \
+	        sizeof(*x->children) * (x->c - i - 2));                              \
+	x->c--;                                                                      \
+	memmove(x->items + i, x->items + i + 1, sizeof(key_type) * (x->n - i - 1));  \
+	x->n--;                                                                      \
+                                                                                 \
+	name##_node_release(z);                                                      \
+}                                                                                \
+                                                                                 \
+/* Moves x.k[i] down into the left child, the right child's first key up */      \
+BTREE_TYPED_FN void name##_shift_left(struct name##_node *x, ssize_t i) {        \
+	struct name##_node *y = x->children[i];                                      \
+	struct name##_node *z = x->children[i + 1];                                  \
+                                                                                 \
+	y->items[y->n++] = x->items[i];                                              \
+	x->items[i] = z->items[0];                                                   \
+	memmove(z->items, z->items + 1, sizeof(key_type) * (z->n - 1));              \
+	z->n--;                                                                      \
+	if (z->children != NULL) {                                                   \
+		y->children[y->c++] = z->children[0];                                    \
+		memmove(z->children, z->children + 1,                                    \
+		        sizeof(*z->children) * (z->c - 1));                              \
+		z->c--;                                                                  \
+	}                                                                            \
+}                                                                                \
+                                                                                 \
+/* Moves x.k[i] down into the right child, the left child's last key up */       \
+BTREE_TYPED_FN void name##_shift_right(struct name##_node *x, ssize_t i) {       \
+	struct name##_node *y = x->children[i];                                      \
+	struct name##_node *z = x->children[i + 1];                                  \
+                                                                                 \
+	memmove(z->items + 1, z->items, sizeof(key_type) * z->n);                    \
+	z->items[0] = x->items[i];                                                   \
+	z->n++;                                                                      \
+	x->items[i] = y->items[--y->n];                                              \
+	if (z->children != NULL) {                                                   \
+		memmove(z->children + 1, z->children, sizeof(*z->children) * z->c);      \
+		z->children[0] = y->children[--y->c];                                    \
+		z->c++;                                                                  \
+	}                                                                            \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN struct name* name##_new(size_t t) {                               \
+	struct name *tree = (struct name*)malloc(sizeof(*tree));                     \
+	if (tree == NULL) return NULL;                                               \
+	tree->degree = t < 2 ? 2 : (ssize_t)t;                                       \
+	tree->size   = 0;                                                            \
+	tree->root   = NULL;                                                         \
+	return tree;                                                                 \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN void name##_free(struct name **tree) {                            \
+	if (*tree == NULL) return;                                                   \
+	name##_node_free((*tree)->root);                                             \
+	free(*tree);                                                                 \
+	*tree = NULL;                                                                \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN size_t name##_size(const struct name *tree) {                     \
+	return tree->size;                                                           \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN key_type* name##_search(const struct name *tree,                  \
+                                       const key_type key) {                     \
+	const struct name##_node *x = tree->root;                                    \
+	while (x != NULL) {                                                          \
+		int     res;                                                             \
+		ssize_t i = name##_find(x, key, &res);                                   \
+		if (i < x->n && res == 0) return (key_type*)&x->items[i];                \
+		if (x->children == NULL) return NULL;                                    \
+		x = x->children[i];                                                      \
+	}                                                                            \
+	return NULL;                                                                 \
+}                                                                                \
+                                                                                 \
+/* returnvalue: 1 if `key` was inserted, 0 if we ran out of memory */            \
+BTREE_TYPED_FN int name##_insert(struct name *tree, const key_type key) {        \
+	const ssize_t t = tree->degree;                                              \
+	struct name##_node *x;                                                       \
+                                                                                 \
+	if (tree->root == NULL) {                                                    \
+		tree->root = name##_node_new(t, 1);                                      \
+		if (tree->root == NULL) return 0;                                        \
+	}                                                                            \
+	if (BTREE_NODE_FULL(t, tree->root)) {                                        \
+		struct name##_node *s = name##_node_new(t, 0);                           \
+		if (s == NULL) return 0;                                                 \
+		s->children[s->c++] = tree->root;                                        \
+		if (!name##_split_child(t, s, 0)) {                                      \
+			name##_node_release(s);                                              \
+			return 0;                                                            \
+		}                                                                        \
+		tree->root = s;                                                          \
+	}                                                                            \
+                                                                                 \
+	x = tree->root;                                                              \
+	for (;;) {                                                                   \
+		int     res;                                                             \
+		ssize_t i = name##_find(x, key, &res);                                   \
+		if (x->children == NULL) {                                               \
+			memmove(x->items + i + 1, x->items + i,                              \
+			        sizeof(key_type) * (x->n - i));                              \
+			x->items[i] = key;                                                   \
+			x->n++;                                                              \
+			tree->size++;                                                        \
+			return 1;                                                            \
+		}                                                                        \
+		if (BTREE_NODE_FULL(t, x->children[i])) {                                \
+			if (!name##_split_child(t, x, i)) return 0;                          \
+			if (name##_cmp(key, x->items[i]) > 0) i++;                           \
+		}                                                                        \
+		x = x->children[i];                                                      \
+	}                                                                            \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN int name##_node_delete(ssize_t t,                                 \
+                                      struct name##_node *x,                     \
+                                      key_type key) {                            \
+	for (;;) {                                                                   \
+		int     res;                                                             \
+		ssize_t i = name##_find(x, key, &res);                                   \
+                                                                                 \
+		if (i < x->n && res == 0) {                                              \
+			struct name##_node *tmp;                                             \
+			if (x->children == NULL) {                                           \
+				memmove(x->items + i, x->items + i + 1,                          \
+				        sizeof(key_type) * (x->n - i - 1));                      \
+				x->n--;                                                          \
+				return 1;                                                        \
+			}                                                                    \
+			if (x->children[i]->n >= t) {                                        \
+				/* replace by the predecessor and delete that instead */         \
+				tmp = x->children[i];                                            \
+				while (tmp->children != NULL) tmp = tmp->children[tmp->c - 1];   \
+				key = x->items[i] = tmp->items[tmp->n - 1];                      \
+				x = x->children[i];                                              \
+			} else if (x->children[i + 1]->n >= t) {                             \
+				/* replace by the successor and delete that instead */           \
+				tmp = x->children[i + 1];                                        \
+				while (tmp->children != NULL) tmp = tmp->children[0];            \
+				key = x->items[i] = tmp->items[0];                               \
+				x = x->children[i + 1];                                          \
+			} else {                                                             \
+				name##_merge(x, i);                                              \
+				x = x->children[i];                                              \
+			}                                                                    \
+			continue;                                                            \
+		}                                                                        \
+		if (x->children == NULL) return 0;                                       \
+                                                                                 \
+		if (x->children[i]->n < t) {                                             \
+			if (i > 0 && x->children[i - 1]->n >= t) {                           \
+				name##_shift_right(x, i - 1);                                    \
+			} else if (i < x->c - 1 && x->children[i + 1]->n >= t) {             \
+				name##_shift_left(x, i);                                         \
+			} else if (i > 0) {                                                  \
+				name##_merge(x, --i);                                            \
+			} else {                                                             \
+				name##_merge(x, i);                                              \
+			}                                                                    \
+		}                                                                        \
+		x = x->children[i];                                                      \
+	}                                                                            \
+}                                                                                \
+                                                                                 \
+/* returnvalue: 1 if `key` was found and removed, 0 otherwise */                 \
+BTREE_TYPED_FN int name##_delete(struct name *tree, const key_type key) {        \
+	struct name##_node *root = tree->root;                                       \
+	int res;                                                                     \
+	if (root == NULL) return 0;                                                  \
+	res = name##_node_delete(tree->degree, root, key);                           \
+	tree->size -= res;                                                           \
+	if (root->n == 0 && root->children != NULL) {                                \
+		tree->root = root->children[0];                                          \
+		name##_node_release(root);                                               \
+	}                                                                            \
+	return res;                                                                  \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN void name##_iter_descend(struct name##_iter *it,                  \
+                                        struct name##_node *x) {                 \
+	while (x != NULL) {                                                          \
+		it->stack[it->head].pos  = 0;                                            \
+		it->stack[it->head].node = x;                                            \
+		it->head++;                                                              \
+		x = x->children == NULL ? NULL : x->children[0];                         \
+	}                                                                            \
+}                                                                                \
+                                                                                 \
+BTREE_TYPED_FN void name##_iter_init(const struct name *tree,                    \
+                                     struct name##_iter *it) {                   \
+	it->head = 0;                                                                \
+	name##_iter_descend(it, tree->root);                                         \
+}                                                                                \
+                                                                                 \
+/* returnvalue: the next key in order, NULL once all keys have been visited */   \
+BTREE_TYPED_FN key_type* name##_iter_next(struct name##_iter *it) {              \
+	while (it->head > 0) {                                                       \
+		struct name##_node *x = it->stack[it->head - 1].node;                    \
+		ssize_t pos = it->stack[it->head - 1].pos;                               \
+		if (pos < x->n) {                                                        \
+			it->stack[it->head - 1].pos++;                                       \
+			if (x->children != NULL) {                                           \
+				name##_iter_descend(it, x->children[pos + 1]);                   \
+			}                                                                    \
+			return &x->items[pos];                                               \
+		}                                                                        \
+		it->head--;                                                              \
+	}                                                                            \
+	return NULL;                                                                 \
+}                                                                                \
+BTREE_TYPED_END_DEFINE
+
+#endif
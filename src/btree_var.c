@@ -0,0 +1,848 @@
+#include "btree_var.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Definitions */
+typedef unsigned char byte;
+
+/* A node is a block of `node_size` bytes: the header, an array of slots
+ * growing upwards, and the records growing downwards from the end, below the
+ * prefix shared by all keys of the node. A record holds the payload, that is
+ * the value in a leaf and the child in a branching node, followed by the rest
+ * of the key past the prefix.
+ *
+ * Branching nodes are like the leaves of a B+tree: slot i leads to the keys
+ * not less than key i and less than key i + 1. The key of slot 0 is never
+ * looked at, nor stored. */
+
+struct vslot {
+	uint16_t off;  /* of the record */
+	uint16_t len;  /* of the key, past the prefix */
+	uint32_t head; /* its first 4 bytes, big-endian, zero-padded */
+};
+
+struct vnode {
+	struct vnode *next;    /* the next leaf, leaves only */
+	uint16_t      n;
+	uint16_t      prefix;  /* length of the prefix, a multiple of 8 */
+	uint16_t      heap;    /* where the records start */
+	uint16_t      garbage; /* bytes of records no longer referenced */
+	bool          leaf;
+};
+
+/* A key in two pieces, as gathered from a node, and its payload. New keys
+ * come in one piece. */
+struct ventry {
+	const byte *pre;
+	size_t      plen;
+	const byte *suf;
+	size_t      slen;
+	const void *payload;
+};
+
+/* A node split off to the right, on its way to the parent */
+struct vsplit {
+	byte         *key;
+	size_t        len;
+	struct vnode *node;
+};
+
+/* A full node splits in up to three */
+#define VAR_MAX_SPLIT 2
+
+struct btree_var {
+	/* Size stuffs */
+	size_t value_size;
+	size_t node_size;
+	size_t max_key;
+	size_t count;
+	size_t height;
+
+	struct vnode *root;
+
+	/* Nodes are rebuilt in `scratch` from `entries` */
+	struct vnode  *scratch;
+	struct ventry *entries;
+	/* Split off nodes, by parity of depth, as a level reads its children's
+	 * while writing its own */
+	struct vsplit  split[2][VAR_MAX_SPLIT];
+	bool           replaced;
+
+	/* Nodes set aside so that an insertion, once started, cannot fail */
+	struct vnode  *spare;
+	size_t         spares;
+};
+
+struct btree_var_iter_t {
+	struct vnode *leaf;
+	size_t        pos;
+	byte         *key; /* the last key returned, `max_key` bytes */
+};
+
+#define \
+align_up(size, align) (((size) + (align) - 1) / (align) * (align))
+
+#define VAR_HEADER align_up(sizeof(struct vnode), 8)
+
+#define \
+vnode_slots(x) ((struct vslot*)((byte*)(x) + VAR_HEADER))
+
+#define \
+vnode_prefix(tree, x) ((byte*)(x) + (tree)->node_size - (x)->prefix)
+
+#define \
+vnode_payload_size(tree, x) \
+	((x)->leaf ? (tree)->value_size : sizeof(struct vnode*))
+
+#define \
+vnode_record(x, i) ((byte*)(x) + vnode_slots(x)[i].off)
+
+#define \
+vnode_child(x, i) (*(struct vnode**)vnode_record(x, i))
+
+#define \
+ventry_len(e) ((e)->plen + (e)->slen)
+
+#define \
+ventry_byte(e, k) \
+	((k) < (e)->plen ? (e)->pre[k] : (e)->suf[(k) - (e)->plen])
+
+/********/
+/* Keys */
+/********/
+
+static uint32_t var_head(const byte *key, size_t len) {
+	uint32_t head = 0;
+	size_t   i;
+
+	for (i = 0; i < 4; i++) head = head << 8 | (i < len ? key[i] : 0);
+	return head;
+}
+
+static uint32_t ventry_head(const struct ventry *e, size_t from) {
+	const size_t len  = ventry_len(e);
+	uint32_t     head = 0;
+	size_t       i;
+
+	for (i = from; i < from + 4; i++) {
+		head = head << 8 | (i < len ? ventry_byte(e, i) : 0);
+	}
+	return head;
+}
+
+static void ventry_copy(const struct ventry *e,
+                        size_t from,
+                        size_t len,
+                        byte *dst) {
+	if (from < e->plen) {
+		const size_t n = len < e->plen - from ? len : e->plen - from;
+		memcpy(dst, e->pre + from, n);
+		dst  += n;
+		from += n;
+		len  -= n;
+	}
+	if (len > 0) memcpy(dst, e->suf + from - e->plen, len);
+}
+
+/* Length of the longest common prefix of `a` and `b` */
+static size_t ventry_common(const struct ventry *a, const struct ventry *b) {
+	const size_t la = ventry_len(a);
+	const size_t lb = ventry_len(b);
+	const size_t n  = la < lb ? la : lb;
+	size_t       i  = 0;
+
+	while (i < n && ventry_byte(a, i) == ventry_byte(b, i)) i++;
+	return i;
+}
+
+/* The prefix stored for sorted entries [from, to), of which the keys of
+ * [first, to) count. Keeping it a multiple of 8 keeps the records aligned,
+ * and makes sure a part of a node never needs more room than all of it. */
+static size_t ventry_prefix(const struct ventry *e, size_t first, size_t to) {
+	if (first >= to) return 0;
+	return ventry_common(e + first, e + to - 1) / 8 * 8;
+}
+
+static void var_payload_copy(byte *dst, const void *src, size_t size) {
+	if (size == 0) return;
+	if (src != NULL) memcpy(dst, src, size);
+	else             memset(dst, 0, size);
+}
+
+/**********************/
+/* Node functionality */
+/**********************/
+
+static struct vnode* vnode_new(struct btree_var *tree, bool leaf) {
+	struct vnode *x = malloc(tree->node_size);
+
+	if (x == NULL) return NULL;
+	x->next    = NULL;
+	x->n       = 0;
+	x->prefix  = 0;
+	x->heap    = tree->node_size;
+	x->garbage = 0;
+	x->leaf    = leaf;
+	return x;
+}
+
+static void vnode_free(struct vnode *x) {
+	size_t i;
+
+	if (!x->leaf) {
+		for (i = 0; i < x->n; i++) vnode_free(vnode_child(x, i));
+	}
+	free(x);
+}
+
+/* Takes one of the nodes set aside by `var_reserve` */
+static struct vnode* vnode_take(struct btree_var *tree) {
+	struct vnode *x = tree->spare;
+
+	tree->spare = x->next;
+	tree->spares--;
+	x->next = NULL;
+	return x;
+}
+
+static void vnode_release(struct btree_var *tree, struct vnode *x) {
+	if (tree->spares > 2 * tree->height + 1) {
+		free(x);
+		return;
+	}
+	x->next     = tree->spare;
+	tree->spare = x;
+	tree->spares++;
+}
+
+/* An insertion splits at most two nodes off each node on its path, and grows
+ * a new root */
+static int var_reserve(struct btree_var *tree) {
+	while (tree->spares < VAR_MAX_SPLIT * tree->height + 1) {
+		struct vnode *x = vnode_new(tree, true);
+		if (x == NULL) {
+			fputs("BTree error: Failed to allocate new node!\n", stderr);
+			return -1;
+		}
+		x->next     = tree->spare;
+		tree->spare = x;
+		tree->spares++;
+	}
+	return 0;
+}
+
+static size_t vnode_used(const struct btree_var *tree, const struct vnode *x) {
+	return VAR_HEADER + x->n * sizeof(struct vslot)
+	     + (tree->node_size - x->heap) - x->garbage;
+}
+
+/* Compares `key`, past the prefix of `x`, to the key in slot `i` */
+static int vnode_cmp(const struct btree_var *tree,
+                     const struct vnode *x,
+                     size_t i,
+                     const byte *key,
+                     size_t len,
+                     uint32_t head) {
+	const struct vslot *s = vnode_slots(x) + i;
+	const size_t        n = len < s->len ? len : s->len;
+	size_t              k;
+	int                 c;
+
+	if (head != s->head) return head < s->head ? -1 : 1;
+
+	/* Equal heads of long enough keys already agree on 4 bytes */
+	k = n < 4 ? 0 : 4;
+	c = memcmp(key + k,
+	           vnode_record(x, i) + vnode_payload_size(tree, x) + k,
+	           n - k);
+	if (c != 0) return c;
+	return len < s->len ? -1 : len > s->len;
+}
+
+/* The first slot whose key is not less than (`upper`: greater than) `key`.
+ * Slot 0 of branching nodes is skipped, as it stands for everything less
+ * than slot 1. */
+static size_t vnode_bound(const struct btree_var *tree,
+                          const struct vnode *x,
+                          const byte *key,
+                          size_t len,
+                          bool upper) {
+	const size_t pl = x->prefix;
+	size_t       lo = x->leaf ? 0 : 1;
+	size_t       hi = x->n;
+	uint32_t     head;
+	int          c;
+
+	/* Keys not sharing the prefix are less or greater than all of them */
+	c = memcmp(key, vnode_prefix(tree, x), len < pl ? len : pl);
+	if (c < 0 || (c == 0 && len < pl)) return lo;
+	if (c > 0) return hi;
+
+	key  += pl;
+	len  -= pl;
+	head  = var_head(key, len);
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		c = vnode_cmp(tree, x, mid, key, len, head);
+		if (c < 0 || (c == 0 && !upper)) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+static bool vnode_equal(const struct btree_var *tree,
+                        const struct vnode *x,
+                        size_t i,
+                        const byte *key,
+                        size_t len) {
+	const struct vslot *s  = vnode_slots(x) + i;
+	const size_t        pl = x->prefix;
+
+	return len == pl + s->len
+	    && memcmp(key, vnode_prefix(tree, x), pl) == 0
+	    && memcmp(key + pl,
+	              vnode_record(x, i) + vnode_payload_size(tree, x),
+	              s->len) == 0;
+}
+
+/* The leaf in which `key` belongs */
+static struct vnode* var_leaf(const struct btree_var *tree,
+                              const byte *key,
+                              size_t len) {
+	struct vnode *x = tree->root;
+
+	while (!x->leaf) {
+		x = vnode_child(x, vnode_bound(tree, x, key, len, true) - 1);
+	}
+	return x;
+}
+
+/* Stores the entries of `x` to `e`.
+ * returnvalue: their number */
+static size_t vnode_gather(const struct btree_var *tree,
+                           const struct vnode *x,
+                           struct ventry *e) {
+	const size_t ps = vnode_payload_size(tree, x);
+	size_t       i;
+
+	for (i = 0; i < x->n; i++) {
+		e[i].pre     = vnode_prefix(tree, x);
+		e[i].plen    = x->leaf || i > 0 ? x->prefix : 0;
+		e[i].suf     = vnode_record(x, i) + ps;
+		e[i].slen    = vnode_slots(x)[i].len;
+		e[i].payload = vnode_record(x, i);
+	}
+	return x->n;
+}
+
+/* Bytes taken by a node made of entries [from, to) */
+static size_t vnode_need(const struct btree_var *tree,
+                         bool leaf,
+                         const struct ventry *e,
+                         size_t from,
+                         size_t to) {
+	const size_t ps    = leaf ? tree->value_size : sizeof(struct vnode*);
+	const size_t first = leaf ? from : from + 1;
+	const size_t pl    = ventry_prefix(e, first, to);
+	size_t       need  = VAR_HEADER + (to - from) * sizeof(struct vslot) + pl;
+	size_t       i;
+
+	for (i = from; i < to; i++) {
+		need += align_up(ps + (i >= first ? ventry_len(e + i) - pl : 0), 8);
+	}
+	return need;
+}
+
+/* Lays out entries [from, to) in `x`, which must not be where they come from */
+static void vnode_fill(const struct btree_var *tree,
+                       struct vnode *x,
+                       bool leaf,
+                       const struct ventry *e,
+                       size_t from,
+                       size_t to) {
+	const size_t ps    = leaf ? tree->value_size : sizeof(struct vnode*);
+	const size_t first = leaf ? from : from + 1;
+	const size_t pl    = ventry_prefix(e, first, to);
+	size_t       heap  = tree->node_size - pl;
+	size_t       i;
+
+	if (pl > 0) ventry_copy(e + first, 0, pl, (byte*)x + heap);
+	for (i = from; i < to; i++) {
+		struct vslot *s    = vnode_slots(x) + (i - from);
+		const size_t  slen = i >= first ? ventry_len(e + i) - pl : 0;
+
+		heap -= align_up(ps + slen, 8);
+		var_payload_copy((byte*)x + heap, e[i].payload, ps);
+		ventry_copy(e + i, pl, slen, (byte*)x + heap + ps);
+		s->off  = heap;
+		s->len  = slen;
+		s->head = ventry_head(e + i, pl);
+	}
+	x->n       = to - from;
+	x->prefix  = pl;
+	x->heap    = heap;
+	x->garbage = 0;
+	x->leaf    = leaf;
+}
+
+/* Adds the `m` one-piece entries `e` at slot `i` without moving anything
+ * else, if they share the prefix of `x` and there is room left.
+ * returnvalue: whether they were added */
+static bool vnode_put_inplace(const struct btree_var *tree,
+                              struct vnode *x,
+                              size_t i,
+                              const struct ventry *e,
+                              size_t m) {
+	const size_t ps   = vnode_payload_size(tree, x);
+	const size_t pl   = x->prefix;
+	size_t       need = m * sizeof(struct vslot);
+	size_t       heap = x->heap;
+	size_t       k;
+
+	for (k = 0; k < m; k++) {
+		if (e[k].plen < pl
+		||  memcmp(e[k].pre, vnode_prefix(tree, x), pl) != 0) {
+			return false;
+		}
+		need += align_up(ps + e[k].plen - pl, 8);
+	}
+	if (VAR_HEADER + x->n * sizeof(struct vslot) + need > x->heap) return false;
+
+	memmove(vnode_slots(x) + i + m, vnode_slots(x) + i,
+	        sizeof(struct vslot) * (x->n - i));
+	for (k = 0; k < m; k++) {
+		struct vslot *s    = vnode_slots(x) + i + k;
+		const size_t  slen = e[k].plen - pl;
+
+		heap -= align_up(ps + slen, 8);
+		var_payload_copy((byte*)x + heap, e[k].payload, ps);
+		memcpy((byte*)x + heap + ps, e[k].pre + pl, slen);
+		s->off  = heap;
+		s->len  = slen;
+		s->head = var_head(e[k].pre + pl, slen);
+	}
+	x->heap  = heap;
+	x->n    += m;
+	return true;
+}
+
+/* Cuts entries [0, n) into nodes, the new ones being [j, j + m).
+ * returnvalue: the number of nodes, node p starting at entry `at[p]` */
+static size_t vnode_parts(const struct btree_var *tree,
+                          bool leaf,
+                          const struct ventry *e,
+                          size_t n,
+                          size_t j,
+                          size_t m,
+                          size_t *at) {
+	const size_t cap = tree->node_size;
+	size_t       lo  = 1;
+	size_t       hi  = n - 1;
+	size_t       parts;
+
+	at[0] = 0;
+	if (vnode_need(tree, leaf, e, 0, n) <= cap) {
+		at[1] = n;
+		return 1;
+	}
+
+	/* Halves of about the same size */
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (vnode_need(tree, leaf, e, 0, mid)
+		  < vnode_need(tree, leaf, e, mid, n)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (hi = lo; hi + 1 >= lo && hi > 0; hi--) {
+		if (vnode_need(tree, leaf, e, 0, hi) <= cap
+		&&  vnode_need(tree, leaf, e, hi, n) <= cap) {
+			at[1] = hi;
+			at[2] = n;
+			return 2;
+		}
+	}
+
+	/* The new keys spoil the prefix of whichever half they go to, give them
+	 * a node of their own. The rest fitted before. */
+	parts = 1;
+	if (j > 0)     at[parts++] = j;
+	if (j + m < n) at[parts++] = j + m;
+	at[parts] = n;
+	return parts;
+}
+
+/* Adds the `m` one-piece entries `e` at slot `i` of `x`, at depth `depth`,
+ * splitting it if need be.
+ * returnvalue: the number of nodes split off, see `tree->split` */
+static size_t vnode_put(struct btree_var *tree,
+                        struct vnode *x,
+                        size_t depth,
+                        size_t i,
+                        const struct ventry *e,
+                        size_t m) {
+	struct ventry *all  = tree->entries;
+	struct vsplit *out  = tree->split[depth & 1];
+	struct vnode  *next = x->next;
+	size_t         at[VAR_MAX_SPLIT + 2];
+	size_t         n, parts, p;
+
+	if (vnode_put_inplace(tree, x, i, e, m)) return 0;
+
+	n = vnode_gather(tree, x, all);
+	memmove(all + i + m, all + i, sizeof(struct ventry) * (n - i));
+	memcpy(all + i, e, sizeof(struct ventry) * m);
+	n += m;
+
+	parts = vnode_parts(tree, x->leaf, all, n, i, m, at);
+	for (p = 1; p < parts; p++) {
+		const struct ventry *r = all + at[p];
+		struct vsplit       *s = out + p - 1;
+
+		/* Leaves pass up just enough of their first key to tell them from
+		 * their left neighbour, branching nodes pass up their first key */
+		s->len = x->leaf ? ventry_common(r - 1, r) + 1 : ventry_len(r);
+		ventry_copy(r, 0, s->len, s->key);
+		s->node = vnode_take(tree);
+		vnode_fill(tree, s->node, x->leaf, all, at[p], at[p + 1]);
+	}
+	vnode_fill(tree, tree->scratch, x->leaf, all, 0, at[1]);
+	memcpy(x, tree->scratch, tree->node_size);
+
+	for (p = parts - 1; p > 0 && x->leaf; p--) {
+		out[p - 1].node->next = next;
+		next = out[p - 1].node;
+	}
+	x->next = x->leaf ? next : NULL;
+	return parts - 1;
+}
+
+/* Removes slot `i` of `x` */
+static void vnode_remove(const struct btree_var *tree,
+                         struct vnode *x,
+                         size_t i) {
+	const struct vslot *s = vnode_slots(x) + i;
+
+	x->garbage += align_up(vnode_payload_size(tree, x) + s->len, 8);
+	memmove(vnode_slots(x) + i, vnode_slots(x) + i + 1,
+	        sizeof(struct vslot) * (x->n - i - 1));
+	x->n--;
+	if (x->n == 0) {
+		x->prefix  = 0;
+		x->heap    = tree->node_size;
+		x->garbage = 0;
+	}
+}
+
+/* Merges child `i + 1` of `x` into child `i`, if they fit in one node */
+static void vnode_merge(struct btree_var *tree, struct vnode *x, size_t i) {
+	struct vnode  *y = vnode_child(x, i);
+	struct vnode  *z = vnode_child(x, i + 1);
+	struct ventry *e = tree->entries;
+	struct vnode  *next = z->next;
+	size_t         n;
+
+	n  = vnode_gather(tree, y, e);
+	n += vnode_gather(tree, z, e + n);
+	if (!y->leaf) {
+		/* The first child of `z` gets the key which led to `z` */
+		e[y->n].pre  = vnode_prefix(tree, x);
+		e[y->n].plen = x->prefix;
+		e[y->n].suf  = vnode_record(x, i + 1) + sizeof(struct vnode*);
+		e[y->n].slen = vnode_slots(x)[i + 1].len;
+	}
+	if (vnode_need(tree, y->leaf, e, 0, n) > tree->node_size) return;
+
+	vnode_fill(tree, tree->scratch, y->leaf, e, 0, n);
+	memcpy(y, tree->scratch, tree->node_size);
+	y->next = y->leaf ? next : NULL;
+
+	vnode_release(tree, z);
+	vnode_remove(tree, x, i + 1);
+}
+
+/* Inserts into the subtree of `x`, at depth `depth`.
+ * returnvalue: the number of nodes split off `x`, see `tree->split` */
+static size_t vnode_insert(struct btree_var *tree,
+                           struct vnode *x,
+                           size_t depth,
+                           const byte *key,
+                           size_t len,
+                           const void *value) {
+	struct ventry e[VAR_MAX_SPLIT];
+	size_t        i, n, k;
+
+	if (x->leaf) {
+		i = vnode_bound(tree, x, key, len, false);
+		if (i < x->n && vnode_equal(tree, x, i, key, len)) {
+			var_payload_copy(vnode_record(x, i), value, tree->value_size);
+			tree->replaced = true;
+			return 0;
+		}
+		e[0].pre     = key;
+		e[0].plen    = len;
+		e[0].suf     = NULL;
+		e[0].slen    = 0;
+		e[0].payload = value;
+		return vnode_put(tree, x, depth, i, e, 1);
+	}
+
+	i = vnode_bound(tree, x, key, len, true) - 1;
+	n = vnode_insert(tree, vnode_child(x, i), depth + 1, key, len, value);
+	for (k = 0; k < n; k++) {
+		const struct vsplit *s = tree->split[(depth + 1) & 1] + k;
+		e[k].pre     = s->key;
+		e[k].plen    = s->len;
+		e[k].suf     = NULL;
+		e[k].slen    = 0;
+		e[k].payload = &s->node;
+	}
+	return n > 0 ? vnode_put(tree, x, depth, i + 1, e, n) : 0;
+}
+
+/* Deletes from the subtree of `x`, merging children which got light.
+ * returnvalue: whether `key` was found */
+static bool vnode_delete(struct btree_var *tree,
+                         struct vnode *x,
+                         const byte *key,
+                         size_t len) {
+	struct vnode *y;
+	size_t        i;
+
+	if (x->leaf) {
+		i = vnode_bound(tree, x, key, len, false);
+		if (i == x->n || !vnode_equal(tree, x, i, key, len)) return false;
+		vnode_remove(tree, x, i);
+		return true;
+	}
+
+	i = vnode_bound(tree, x, key, len, true) - 1;
+	y = vnode_child(x, i);
+	if (!vnode_delete(tree, y, key, len)) return false;
+
+	if (x->n > 1 && vnode_used(tree, y) < tree->node_size / 4) {
+		vnode_merge(tree, x, i + 1 < x->n ? i : i - 1);
+	}
+	return true;
+}
+
+/*******/
+/* API */
+/*******/
+
+struct btree_var* btree_var_new(size_t value_size, size_t node_size) {
+	struct btree_var *tree;
+	size_t            entries, room, i;
+	byte             *keys;
+
+	if (node_size == 0) node_size = BTREE_VAR_NODE_SIZE;
+	node_size = node_size / 8 * 8;
+
+	/* Four keys of any length must fit a node, so that a node can always be
+	 * split, and a node of its own is enough for the keys split off below */
+	room = (node_size - VAR_HEADER - 4 * sizeof(struct vslot)) / 4 / 8 * 8;
+	if (node_size < 256 || node_size > 32768
+	||  room <= value_size || room <= sizeof(struct vnode*)) {
+		fputs("BTree error: Invalid parameters for variable-length tree!\n",
+		      stderr);
+		return NULL;
+	}
+
+	tree = malloc(sizeof(struct btree_var));
+	if (tree == NULL) {
+		fputs("BTree error: Failed to allocate variable-length tree!\n",
+		      stderr);
+		return NULL;
+	}
+
+	tree->value_size = value_size;
+	tree->node_size  = node_size;
+	tree->max_key    = room - (value_size > sizeof(struct vnode*)
+	                           ? value_size : sizeof(struct vnode*));
+	tree->count      = 0;
+	tree->height     = 1;
+	tree->replaced   = false;
+	tree->spare      = NULL;
+	tree->spares     = 0;
+
+	/* Two nodes' worth, for merges, and the keys split off below */
+	entries = 2 * (node_size - VAR_HEADER) / sizeof(struct vslot)
+	        + VAR_MAX_SPLIT;
+	tree->root    = vnode_new(tree, true);
+	tree->scratch = malloc(node_size);
+	tree->entries = malloc(sizeof(struct ventry) * entries);
+	keys          = malloc(2 * VAR_MAX_SPLIT * tree->max_key);
+	if (tree->root == NULL || tree->scratch == NULL
+	||  tree->entries == NULL || keys == NULL) {
+		fputs("BTree error: Failed to allocate variable-length tree!\n",
+		      stderr);
+		free(tree->root);
+		free(tree->scratch);
+		free(tree->entries);
+		free(keys);
+		free(tree);
+		return NULL;
+	}
+	for (i = 0; i < 2 * VAR_MAX_SPLIT; i++) {
+		tree->split[i / VAR_MAX_SPLIT][i % VAR_MAX_SPLIT].key =
+			keys + tree->max_key * i;
+	}
+	return tree;
+}
+
+void btree_var_free(struct btree_var **tree) {
+	struct vnode *x;
+
+	if (tree == NULL || *tree == NULL) return;
+
+	vnode_free((*tree)->root);
+	while ((x = (*tree)->spare) != NULL) {
+		(*tree)->spare = x->next;
+		free(x);
+	}
+	free((*tree)->scratch);
+	free((*tree)->entries);
+	free((*tree)->split[0][0].key);
+	free(*tree);
+	*tree = NULL;
+}
+
+size_t btree_var_max_key(const struct btree_var *tree) {
+	return tree->max_key;
+}
+
+size_t btree_var_size(const struct btree_var *tree) {
+	return tree->count;
+}
+
+size_t btree_var_height(const struct btree_var *tree) {
+	return tree->height;
+}
+
+void* btree_var_search(struct btree_var *tree, const void *key, size_t len) {
+	const struct vnode *x = var_leaf(tree, key, len);
+	const size_t        i = vnode_bound(tree, x, key, len, false);
+
+	if (i < x->n && vnode_equal(tree, x, i, key, len)) {
+		return vnode_record(x, i);
+	}
+	return NULL;
+}
+
+int btree_var_insert(struct btree_var *tree,
+                     const void *key,
+                     size_t len,
+                     const void *value) {
+	struct vnode  *root = tree->root;
+	struct ventry  e[VAR_MAX_SPLIT + 1];
+	size_t         n, k;
+
+	if (len > tree->max_key) {
+		fputs("BTree error: Key too long!\n", stderr);
+		return -1;
+	}
+	if (var_reserve(tree) != 0) return -1;
+
+	tree->replaced = false;
+	n = vnode_insert(tree, root, 0, key, len, value);
+	if (n > 0) {
+		/* Grow a new root over the old one and the nodes split off it */
+		e[0].pre     = NULL;
+		e[0].plen    = 0;
+		e[0].suf     = NULL;
+		e[0].slen    = 0;
+		e[0].payload = &root;
+		for (k = 0; k < n; k++) {
+			e[k + 1].pre     = tree->split[0][k].key;
+			e[k + 1].plen    = tree->split[0][k].len;
+			e[k + 1].suf     = NULL;
+			e[k + 1].slen    = 0;
+			e[k + 1].payload = &tree->split[0][k].node;
+		}
+		tree->root = vnode_take(tree);
+		vnode_fill(tree, tree->root, false, e, 0, n + 1);
+		tree->height++;
+	}
+
+	if (tree->replaced) return 0;
+	tree->count++;
+	return 1;
+}
+
+int btree_var_delete(struct btree_var *tree, const void *key, size_t len) {
+	struct vnode *root = tree->root;
+
+	if (!vnode_delete(tree, root, key, len)) return 0;
+	tree->count--;
+
+	if (!root->leaf && root->n == 1) {
+		tree->root = vnode_child(root, 0);
+		tree->height--;
+		vnode_release(tree, root);
+	}
+	return 1;
+}
+
+struct btree_var_iter_t* btree_var_iter_t_new(struct btree_var *tree) {
+	struct btree_var_iter_t *iter;
+
+	iter = malloc(sizeof(struct btree_var_iter_t) + tree->max_key);
+	if (iter == NULL) {
+		fputs("BTree error: Failed to allocate iterator!\n", stderr);
+		return NULL;
+	}
+	iter->key  = (byte*)(iter + 1);
+	iter->leaf = tree->root;
+	while (!iter->leaf->leaf) iter->leaf = vnode_child(iter->leaf, 0);
+	iter->pos  = 0;
+	return iter;
+}
+
+void btree_var_iter_t_free(struct btree_var *tree,
+                           struct btree_var_iter_t **iter) {
+	(void)tree;
+	if (iter == NULL) return;
+	free(*iter);
+	*iter = NULL;
+}
+
+void btree_var_seek(struct btree_var *tree,
+                    struct btree_var_iter_t *iter,
+                    const void *key,
+                    size_t len) {
+	iter->leaf = var_leaf(tree, key, len);
+	iter->pos  = vnode_bound(tree, iter->leaf, key, len, false);
+}
+
+void* btree_var_iter(struct btree_var *tree,
+                     struct btree_var_iter_t *iter,
+                     const void **key,
+                     size_t *len) {
+	struct vnode *x = iter->leaf;
+	struct vslot *s;
+
+	/* Leaves emptied by deletions stay around until merged */
+	while (x != NULL && iter->pos >= x->n) {
+		x         = x->next;
+		iter->pos = 0;
+	}
+	iter->leaf = x;
+	if (x == NULL) return NULL;
+
+	s = vnode_slots(x) + iter->pos;
+	memcpy(iter->key, vnode_prefix(tree, x), x->prefix);
+	memcpy(iter->key + x->prefix, vnode_record(x, iter->pos)
+	                              + tree->value_size, s->len);
+	if (key != NULL) *key = iter->key;
+	if (len != NULL) *len = x->prefix + s->len;
+	return vnode_record(x, iter->pos++);
+}
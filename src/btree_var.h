@@ -0,0 +1,79 @@
+#ifndef BTREE_VAR_H
+#define BTREE_VAR_H
+
+#include <stddef.h>
+
+/* A btree mapping keys of varying length, such as strings, to values of a
+ * fixed size.
+ *
+ * Nodes are blocks of `node_size` bytes holding the key bytes themselves,
+ * reached through an array of offsets, rather than pointers to keys kept
+ * elsewhere. The leading bytes all keys of a node share are stored once per
+ * node and stripped from its keys, and branching nodes only keep as much of a
+ * key as it takes to tell their children apart. Comparisons thus never leave
+ * the node, and the more keys have in common, the more of them fit a node.
+ * Like a B+tree, all values live in the leaves, which are linked in order.
+ *
+ * Keys are compared bytewise as by `memcmp`, a key ordering before any longer
+ * key it is a prefix of. Keys are unique.
+ */
+
+/* Nodes are of this size unless another one is given to `btree_var_new` */
+#define BTREE_VAR_NODE_SIZE 4096
+
+struct btree_var;
+struct btree_var_iter_t;
+
+/* Values are `value_size` bytes, which may be 0 for a set of keys.
+ * `node_size` is rounded down to a multiple of 8, and must lie between 256 and
+ * 32768; 0 picks BTREE_VAR_NODE_SIZE.
+ */
+struct btree_var* btree_var_new(size_t value_size, size_t node_size);
+void   btree_var_free(struct btree_var **tree);
+
+/* Keys longer than this are rejected, a quarter of a node or so */
+size_t btree_var_max_key(const struct btree_var *tree);
+size_t btree_var_size(const struct btree_var *tree);
+size_t btree_var_height(const struct btree_var *tree);
+
+/* returnvalue: a pointer to the value stored with `key`, NULL if there is
+ * none. It is valid until the tree is modified.
+ */
+void*  btree_var_search(struct btree_var *tree, const void *key, size_t len);
+
+/* Stores `key` with a copy of `value`, or zeroes if `value` is NULL,
+ * replacing the value if `key` is present already.
+ * returnvalue: 1 if `key` is new, 0 if its value was replaced, -1 if the key
+ * is too long or we ran out of memory, like `btree_put`.
+ */
+int    btree_var_insert(struct btree_var *tree,
+                        const void *key,
+                        size_t len,
+                        const void *value);
+
+/* returnvalue: 1 if `key` was deleted, 0 if it was not present. */
+int    btree_var_delete(struct btree_var *tree, const void *key, size_t len);
+
+/* Iterators walk the leaves in key order, starting at the smallest key. They
+ * are invalidated by insertions and deletions.
+ */
+struct btree_var_iter_t* btree_var_iter_t_new(struct btree_var *tree);
+void   btree_var_iter_t_free(struct btree_var *tree,
+                             struct btree_var_iter_t **iter);
+
+/* Positions `iter` in front of the first key not less than `key` */
+void   btree_var_seek(struct btree_var *tree,
+                      struct btree_var_iter_t *iter,
+                      const void *key,
+                      size_t len);
+
+/* returnvalue: the value of the next key, NULL past the last one. The key is
+ * stored to `key` and `len` unless they are NULL; it is copied into the
+ * iterator and valid until the next call.
+ */
+void*  btree_var_iter(struct btree_var *tree,
+                      struct btree_var_iter_t *iter,
+                      const void **key,
+                      size_t *len);
+
+#endif
@@ -0,0 +1,56 @@
+CASE(olc_sequential)
+CASE(olc_concurrent)
+CASE(file_persist)
+CASE(file_zeroed_header)
+CASE(wal_crash_replay)
+CASE(wal_torn_tail)
+CASE(wal_checkpoint)
+CASE(wal_commit_failure)
+CASE(snapshot_unchanged_by_writes)
+CASE(snapshot_order_stats)
+CASE(snapshot_read_while_writing)
+CASE(dup_multiset_order)
+CASE(dup_reject)
+CASE(dup_replace)
+CASE(dup_insert_or_get)
+CASE(tomb_reference_map)
+CASE(tomb_compact_budget)
+CASE(tomb_settings)
+CASE(search_strategies)
+CASE(search_switch_strategy)
+CASE(typed_reference)
+CASE(typed_custom_order)
+CASE(simd_matches_scalar)
+CASE(simd_extremes)
+CASE(alloc_all_through_allocator)
+CASE(alloc_node_pool)
+CASE(layout_packed_matches_split)
+CASE(layout_packed_nodes)
+CASE(build_sorted_fill)
+CASE(build_sizes)
+CASE(build_unsorted)
+CASE(batch_matches_single_inserts)
+CASE(batch_order_stats)
+CASE(range_bounds)
+CASE(range_callback)
+CASE(cursor_walk_both_ways)
+CASE(cursor_seek_and_turn)
+CASE(rank_select)
+CASE(rank_duplicates)
+CASE(sharded_hash_concurrent)
+CASE(sharded_range_concurrent)
+CASE(sharded_bulk)
+CASE(dump_roundtrip)
+CASE(dump_edge_cases)
+CASE(kv_put_get_delete)
+CASE(kv_unsupported)
+CASE(bplus_reference)
+CASE(bplus_bounds_and_batches)
+CASE(var_insert_search_delete)
+CASE(var_prefix_order)
+CASE(stats_shape)
+CASE(stats_counters)
+CASE(parallel_build)
+CASE(parallel_for_each)
+CASE(prefetch_search_many)
+CASE(prefetch_same_results)
@@ -35,6 +35,12 @@ unsigned ((*test_cases[TestCase_MAXCASES])(void)) = {
 
 int total_assertions = 0;
 
+int cmp_long(const void *a, const void *b) {
+  const long x = *(const long*)a;
+  const long y = *(const long*)b;
+  return (x > y) - (x < y);
+}
+
 int main () {
   int failed_assertions = 0;
   int failed_cases = 0;
@@ -19,4 +19,7 @@
 
 extern int total_assertions;
 
+/* Orders `long` elements, shared by the test files */
+int cmp_long(const void *a, const void *b);
+
 #endif
@@ -0,0 +1,114 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define ALLOC_KEYS 20000
+
+/* An allocator keeping count of the blocks it handed out and got back */
+static size_t alloc_calls;
+static long   alloc_live;
+
+static void* alloc_counting(size_t size) {
+	alloc_calls++;
+	alloc_live++;
+	return malloc(size);
+}
+
+static void alloc_release(void *ptr) {
+	alloc_live--;
+	free(ptr);
+}
+
+static struct btree* alloc_tree(size_t nodes_per_slab) {
+	struct btree *tree = btree_new_with_allocator(sizeof(long), 3, &cmp_long,
+	                     &alloc_counting, &alloc_release);
+
+	alloc_calls = 0;
+	if (nodes_per_slab > 0 && btree_set_node_pool(tree, nodes_per_slab) != 0) {
+		return NULL;
+	}
+	return tree;
+}
+
+/* Inserts all keys, deletes every other one and inserts them again */
+static int alloc_churn(struct btree *tree) {
+	long key;
+	int  ok = 1;
+
+	for (key = 0; key < ALLOC_KEYS; key++) ok &= btree_insert(tree, &key) == 0;
+	for (key = 0; key < ALLOC_KEYS; key += 2) ok &= btree_delete(tree, &key) == 1;
+	for (key = 0; key < ALLOC_KEYS; key += 2) ok &= btree_insert(tree, &key) == 0;
+	for (key = 0; key < ALLOC_KEYS; key++) {
+		ok &= *(long*)btree_search(tree, &key) == key;
+	}
+	return ok && btree_size(tree) == ALLOC_KEYS;
+}
+
+TEST_CASE(alloc_all_through_allocator, {
+	struct btree *tree = alloc_tree(0);
+	struct btree *snap;
+	struct btree_iter_t *it;
+	long *elems = malloc(sizeof(long) * ALLOC_KEYS);
+	long  key;
+
+	CHECK(alloc_churn(tree));
+	CHECK(alloc_calls > ALLOC_KEYS / 10);
+
+	/* Snapshots, iterators, batches and bulk builds, too */
+	snap = btree_snapshot(tree);
+	for (key = 0; key < ALLOC_KEYS; key += 3) btree_delete(tree, &key);
+	it = btree_iter_t_new(snap);
+	CHECK(*(long*)btree_iter(snap, it) == 0);
+	alloc_release(it);
+	btree_free(&snap);
+
+	for (key = 0; key < ALLOC_KEYS; key++) elems[key] = ALLOC_KEYS - key;
+	CHECK(btree_insert_batch(tree, elems, ALLOC_KEYS) == ALLOC_KEYS);
+	CHECK(btree_build(tree, elems, ALLOC_KEYS, 0.8) == 0);
+	CHECK(btree_size(tree) == ALLOC_KEYS);
+
+	btree_free(&tree);
+	CHECK(alloc_live == 0);
+	free(elems);
+})
+
+TEST_CASE(alloc_node_pool, {
+	struct btree *tree = alloc_tree(0);
+	size_t single;
+	long   key;
+
+	CHECK(alloc_churn(tree));
+	single = alloc_calls;
+	btree_free(&tree);
+	CHECK(alloc_live == 0);
+
+	/* Slabs of 256 nodes take far fewer calls for the same work */
+	tree = alloc_tree(256);
+	CHECK(tree != NULL);
+	CHECK(alloc_churn(tree));
+	CHECK(alloc_calls < single / 50);
+	btree_free(&tree);
+	CHECK(alloc_live == 0);
+
+	/* Freed nodes are recycled rather than asked for again */
+	tree = alloc_tree(64);
+	CHECK(alloc_churn(tree));
+	single = alloc_calls;
+	for (key = 0; key < ALLOC_KEYS; key++) btree_delete(tree, &key);
+	for (key = 0; key < ALLOC_KEYS; key++) btree_insert(tree, &key);
+	CHECK(alloc_calls == single);
+
+	/* The pool can only be set up on an empty tree */
+	CHECK(btree_set_node_pool(tree, 16) == -1);
+	CHECK(btree_set_node_pool(tree, 0) == -1);
+	btree_free(&tree);
+	CHECK(alloc_live == 0);
+
+	/* and may be turned off again */
+	tree = alloc_tree(64);
+	CHECK(btree_set_node_pool(tree, 0) == 0);
+	CHECK(alloc_churn(tree));
+	btree_free(&tree);
+	CHECK(alloc_live == 0);
+})
@@ -0,0 +1,95 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define BATCH_KEYS 20000
+
+/* Whether both trees hold the same elements in the same order */
+static int batch_same(struct btree *a, struct btree *b) {
+	struct btree_iter_t *ia = btree_iter_t_new(a);
+	struct btree_iter_t *ib = btree_iter_t_new(b);
+	long *x;
+	long *y;
+	int   ok = btree_size(a) == btree_size(b);
+
+	do {
+		x = btree_iter(a, ia);
+		y = btree_iter(b, ib);
+		ok &= (x == NULL) == (y == NULL) && (x == NULL || *x == *y);
+	} while (x != NULL && y != NULL);
+	free(ia);
+	free(ib);
+	return ok;
+}
+
+TEST_CASE(batch_matches_single_inserts, {
+	long *elems = malloc(sizeof(long) * BATCH_KEYS);
+	struct btree *batch  = btree_new(sizeof(long), 3, &cmp_long);
+	struct btree *single = btree_new(sizeof(long), 3, &cmp_long);
+	unsigned seed = 7;
+	size_t   i;
+	size_t   n;
+	int      round;
+	long     key;
+	int      ok = 1;
+
+	/* Batches of all sizes, in random order, over a tree already filled, with
+	 * keys repeating within and across batches */
+	for (key = 0; key < BATCH_KEYS; key += 5) {
+		btree_insert(batch, &key);
+		btree_insert(single, &key);
+	}
+	for (round = 0; round < 40; round++) {
+		n = rand_r(&seed) % (BATCH_KEYS / 20) + 1;
+		for (i = 0; i < n; i++) elems[i] = rand_r(&seed) % BATCH_KEYS;
+		ok &= btree_insert_batch(batch, elems, n) == n;
+		for (i = 0; i < n; i++) btree_insert(single, &elems[i]);
+	}
+	CHECK(ok);
+	CHECK(batch_same(batch, single));
+
+	/* One large sorted run, then one in reverse */
+	for (key = 0; key < BATCH_KEYS; key++) elems[key] = BATCH_KEYS + key;
+	CHECK(btree_insert_batch(batch, elems, BATCH_KEYS) == BATCH_KEYS);
+	for (key = 0; key < BATCH_KEYS; key++) btree_insert(single, &elems[key]);
+	for (key = 0; key < BATCH_KEYS; key++) elems[key] = -key;
+	CHECK(btree_insert_batch(batch, elems, BATCH_KEYS) == BATCH_KEYS);
+	for (key = 0; key < BATCH_KEYS; key++) btree_insert(single, &elems[key]);
+	CHECK(batch_same(batch, single));
+
+	/* Deleting works the same on both afterwards */
+	for (key = -BATCH_KEYS; key < 2 * BATCH_KEYS; key += 3) {
+		ok &= btree_delete(batch, &key) == btree_delete(single, &key);
+	}
+	CHECK(ok);
+	CHECK(batch_same(batch, single));
+	CHECK(btree_insert_batch(batch, elems, 0) == 0);
+
+	btree_free(&single);
+	btree_free(&batch);
+	free(elems);
+})
+
+TEST_CASE(batch_order_stats, {
+	long *elems = malloc(sizeof(long) * BATCH_KEYS);
+	struct btree *tree = btree_new(sizeof(long), 4, &cmp_long);
+	long key;
+	int  ok = 1;
+
+	CHECK(btree_set_order_stats(tree, 1) == 0);
+	for (key = 0; key < BATCH_KEYS; key++) elems[key] = 2 * (key * 7919 % BATCH_KEYS);
+	CHECK(btree_insert_batch(tree, elems, BATCH_KEYS / 2) == BATCH_KEYS / 2);
+	CHECK(btree_insert_batch(tree, elems + BATCH_KEYS / 2, BATCH_KEYS / 2)
+	      == BATCH_KEYS / 2);
+
+	/* The subtree counts are kept up to date along the way */
+	for (key = 0; key < 2 * BATCH_KEYS; key += 101) {
+		ok &= btree_rank(tree, &key) == (size_t)(key + 1) / 2;
+		ok &= *(long*)btree_select(tree, key / 2) == key / 2 * 2;
+	}
+	CHECK(ok);
+
+	btree_free(&tree);
+	free(elems);
+})
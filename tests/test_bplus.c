@@ -0,0 +1,130 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define BPLUS_KEYS 6000
+
+/* Only the key goes into the inner nodes */
+struct bplus_elem {
+	long key;
+	long payload;
+};
+
+static int cmp_key(const void *a, const void *b) {
+	const long x = *(const long*)a;
+	const long y = *(const long*)b;
+	return (x > y) - (x < y);
+}
+
+/* Whether searches, iterators and cursors all agree with `ref` */
+static int bplus_matches(struct btree *tree, const unsigned char *ref) {
+	struct btree_iter_t   *it  = btree_iter_t_new(tree);
+	struct btree_cursor_t *cur = btree_cursor_t_new(tree);
+	struct bplus_elem *elem;
+	size_t live = 0;
+	long   key;
+	int    ok = 1;
+
+	for (key = 0; key < BPLUS_KEYS; key++) {
+		elem = btree_search(tree, &key);
+		ok &= ref[key] ? elem != NULL && elem->key == key && elem->payload == -key
+		               : elem == NULL;
+		live += ref[key];
+	}
+	ok &= btree_size(tree) == live;
+
+	key = 0;
+	while ((elem = btree_iter(tree, it)) != NULL) {
+		while (key < elem->key) ok &= !ref[key++];
+		ok &= ref[key++];
+	}
+	while (key < BPLUS_KEYS) ok &= !ref[key++];
+
+	/* Backwards from leaf to leaf */
+	key  = BPLUS_KEYS - 1;
+	elem = btree_cursor_last(tree, cur);
+	while (elem != NULL) {
+		while (key > elem->key) ok &= !ref[key--];
+		ok &= ref[key--];
+		elem = btree_cursor_prev(tree, cur);
+	}
+	while (key >= 0) ok &= !ref[key--];
+
+	btree_cursor_t_free(tree, &cur);
+	free(it);
+	return ok;
+}
+
+TEST_CASE(bplus_reference, {
+	static unsigned char ref[BPLUS_KEYS];
+	struct btree *tree = btree_new_bplus(sizeof(struct bplus_elem), sizeof(long),
+	                                     3, &cmp_key);
+	struct bplus_elem elem;
+	unsigned seed = 18;
+	long r;
+	int  ok = 1;
+
+	for (r = 0; r < 4 * BPLUS_KEYS; r++) {
+		elem.key     = rand_r(&seed) % BPLUS_KEYS;
+		elem.payload = -elem.key;
+		if (rand_r(&seed) % 3) {
+			if (!ref[elem.key]) ok &= btree_insert(tree, &elem) == 0;
+			ref[elem.key] = 1;
+		} else {
+			ok &= btree_delete(tree, &elem) == ref[elem.key];
+			ref[elem.key] = 0;
+		}
+		if (r % 2000 == 0) ok &= bplus_matches(tree, ref);
+	}
+	CHECK(ok);
+	CHECK(bplus_matches(tree, ref));
+
+	btree_free(&tree);
+})
+
+TEST_CASE(bplus_bounds_and_batches, {
+	struct btree *tree = btree_new_bplus(sizeof(struct bplus_elem), sizeof(long),
+	                                     4, &cmp_key);
+	struct bplus_elem *elems = malloc(sizeof(struct bplus_elem) * BPLUS_KEYS);
+	struct btree_iter_t   *it;
+	struct btree_cursor_t *cur;
+	struct bplus_elem *elem;
+	long key;
+
+	/* Even keys, as a batch in any order */
+	for (key = 0; key < BPLUS_KEYS; key++) {
+		elems[key].key     = 2 * (key * 11 % BPLUS_KEYS);
+		elems[key].payload = -elems[key].key;
+	}
+	CHECK(btree_insert_batch(tree, elems, BPLUS_KEYS) == BPLUS_KEYS);
+	CHECK(((struct bplus_elem*)btree_first(tree))->key == 0);
+	CHECK(((struct bplus_elem*)btree_last(tree))->key == 2 * BPLUS_KEYS - 2);
+
+	it  = btree_iter_t_new(tree);
+	key = 1001;
+	btree_lower_bound(tree, it, &key);
+	elem = btree_iter(tree, it);
+	CHECK(elem != NULL && elem->key == 1002);
+	key = 1002;
+	btree_upper_bound(tree, it, &key);
+	elem = btree_iter(tree, it);
+	CHECK(elem != NULL && elem->key == 1004);
+	free(it);
+
+	cur  = btree_cursor_t_new(tree);
+	key  = 2 * BPLUS_KEYS;
+	CHECK(btree_cursor_seek(tree, cur, &key) == NULL);
+	elem = btree_cursor_prev(tree, cur);
+	CHECK(elem != NULL && elem->key == 2 * BPLUS_KEYS - 2);
+	btree_cursor_t_free(tree, &cur);
+
+	/* What B+trees do not support */
+	CHECK(btree_set_order_stats(tree, 1) == -1);
+	CHECK(btree_build_sorted(tree, elems, 0, 1.0) == -1);
+	CHECK(btree_snapshot(tree) == NULL);
+	CHECK(btree_size(tree) == BPLUS_KEYS);
+
+	btree_free(&tree);
+	free(elems);
+})
@@ -0,0 +1,136 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define BUILD_KEYS 30000
+
+/* Whether the tree holds exactly 0, `step`, 2 * `step`, ... below `hi` */
+static int build_holds(struct btree *tree, long hi, long step) {
+	struct btree_iter_t *it = btree_iter_t_new(tree);
+	long *elem;
+	long  key;
+	int   ok = 1;
+
+	for (key = 0; key < hi; key += step) {
+		elem = btree_iter(tree, it);
+		ok &= elem != NULL && *elem == key;
+		elem = btree_search(tree, &key);
+		ok &= elem != NULL && *elem == key;
+	}
+	ok &= btree_iter(tree, it) == NULL;
+	ok &= btree_size(tree) == (size_t)((hi + step - 1) / step);
+	free(it);
+	return ok;
+}
+
+/* Whether no node but the root holds fewer than t - 1 items, as far as the
+ * histogram tells */
+static int build_balanced(struct btree *tree, size_t t) {
+	struct btree_stats stats;
+	size_t under = 0;
+	size_t i;
+
+	btree_stats(tree, &stats);
+	for (i = 0; i < BTREE_STATS_FILL_BUCKETS; i++) {
+		if ((i + 1) * (2 * t - 1) <= (t - 1) * BTREE_STATS_FILL_BUCKETS) {
+			under += stats.fill_histogram[i];
+		}
+	}
+	return under <= 1;
+}
+
+TEST_CASE(build_sorted_fill, {
+	long *elems = malloc(sizeof(long) * BUILD_KEYS);
+	struct btree *tree = btree_new(sizeof(long), 8, &cmp_long);
+	struct btree_stats stats;
+	size_t full_nodes;
+	long   key;
+
+	for (key = 0; key < BUILD_KEYS; key++) elems[key] = key;
+
+	CHECK(btree_build_sorted(tree, elems, BUILD_KEYS, 1.0) == 0);
+	CHECK(build_holds(tree, BUILD_KEYS, 1));
+	btree_stats(tree, &stats);
+	CHECK(stats.fill > 0.95);
+	full_nodes = stats.nodes;
+
+	/* Lower fill factors make for more, emptier nodes */
+	CHECK(btree_build_sorted(tree, elems, BUILD_KEYS, 0.5) == 0);
+	CHECK(build_holds(tree, BUILD_KEYS, 1));
+	btree_stats(tree, &stats);
+	CHECK(stats.fill > 0.45 && stats.fill < 0.6);
+	CHECK(stats.nodes > full_nodes * 18 / 10);
+	CHECK(build_balanced(tree, 8));
+
+	/* Too low a factor still leaves t - 1 per node */
+	CHECK(btree_build_sorted(tree, elems, BUILD_KEYS, 0.01) == 0);
+	CHECK(build_holds(tree, BUILD_KEYS, 1));
+	CHECK(build_balanced(tree, 8));
+
+	/* Built trees take inserts and deletes like any other */
+	for (key = 0; key < BUILD_KEYS; key += 2) btree_delete(tree, &key);
+	CHECK(build_holds(tree, BUILD_KEYS, 1) == 0);
+	for (key = 0; key < BUILD_KEYS; key += 2) btree_insert(tree, &key);
+	CHECK(build_holds(tree, BUILD_KEYS, 1));
+	CHECK(build_balanced(tree, 8));
+
+	btree_free(&tree);
+	free(elems);
+})
+
+TEST_CASE(build_sizes, {
+	long *elems = malloc(sizeof(long) * 1000);
+	struct btree *tree = btree_new(sizeof(long), 2, &cmp_long);
+	struct btree *stats_tree = btree_new(sizeof(long), 3, &cmp_long);
+	size_t count;
+	long   key;
+	int    ok = 1;
+
+	/* Counts around every node boundary, for the tree as a whole */
+	for (count = 0; count < 200; count++) {
+		for (key = 0; key < (long)count; key++) elems[key] = 3 * key;
+		ok &= btree_build_sorted(tree, elems, count, 0.7) == 0;
+		ok &= build_holds(tree, 3 * (long)count, 3);
+		ok &= build_balanced(tree, 2);
+	}
+	CHECK(ok);
+
+	/* Building replaces what was there, and keeps order statistics */
+	CHECK(btree_set_order_stats(stats_tree, 1) == 0);
+	for (key = 0; key < 1000; key++) btree_insert(stats_tree, &key);
+	for (key = 0; key < 1000; key++) elems[key] = 2 * key;
+	CHECK(btree_build_sorted(stats_tree, elems, 1000, 0.9) == 0);
+	CHECK(build_holds(stats_tree, 2000, 2));
+	key = 500;
+	CHECK(btree_rank(stats_tree, &key) == 250);
+	CHECK(*(long*)btree_select(stats_tree, 999) == 1998);
+
+	btree_free(&stats_tree);
+	btree_free(&tree);
+	free(elems);
+})
+
+TEST_CASE(build_unsorted, {
+	long *elems = malloc(sizeof(long) * BUILD_KEYS);
+	long *copy  = malloc(sizeof(long) * BUILD_KEYS);
+	struct btree *tree = btree_new(sizeof(long), 5, &cmp_long);
+	long key;
+	int  ok = 1;
+
+	for (key = 0; key < BUILD_KEYS; key++) {
+		elems[key] = key * 7919 % BUILD_KEYS;
+		copy[key]  = elems[key];
+	}
+	CHECK(btree_build(tree, elems, BUILD_KEYS, 0.8) == 0);
+	CHECK(build_holds(tree, BUILD_KEYS, 1));
+	CHECK(build_balanced(tree, 5));
+
+	/* The input is left as it is */
+	for (key = 0; key < BUILD_KEYS; key++) ok &= elems[key] == copy[key];
+	CHECK(ok);
+
+	btree_free(&tree);
+	free(copy);
+	free(elems);
+})
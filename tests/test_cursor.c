@@ -0,0 +1,87 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define CURSOR_KEYS 5000
+
+/* Whether `elem` is the key `key`, or NULL if `key` is off the tree */
+static int cursor_at(const long *elem, long key) {
+	if (key < 0 || key >= 3 * CURSOR_KEYS) return elem == NULL;
+	return elem != NULL && *elem == key;
+}
+
+TEST_CASE(cursor_walk_both_ways, {
+	struct btree *tree = btree_new(sizeof(long), 3, &cmp_long);
+	struct btree_cursor_t *cur = btree_cursor_t_new(tree);
+	long key;
+	int  ok = 1;
+
+	/* Multiples of 3 */
+	for (key = 0; key < CURSOR_KEYS; key++) {
+		long k = 3 * (key * 11 % CURSOR_KEYS);
+		btree_insert(tree, &k);
+	}
+
+	ok &= cursor_at(btree_cursor_first(tree, cur), 0);
+	for (key = 3; key < 3 * CURSOR_KEYS; key += 3) {
+		ok &= cursor_at(btree_cursor_next(tree, cur), key);
+	}
+	ok &= btree_cursor_next(tree, cur) == NULL;
+	ok &= btree_cursor_get(tree, cur) == NULL;
+	CHECK(ok);
+
+	/* Stepping back from past the end yields the last element */
+	for (key = 3 * CURSOR_KEYS - 3; key >= 0; key -= 3) {
+		ok &= cursor_at(btree_cursor_prev(tree, cur), key);
+	}
+	ok &= btree_cursor_prev(tree, cur) == NULL;
+	ok &= cursor_at(btree_cursor_next(tree, cur), 0);
+	CHECK(ok);
+
+	ok &= cursor_at(btree_cursor_last(tree, cur), 3 * CURSOR_KEYS - 3);
+	ok &= cursor_at(btree_cursor_get(tree, cur), 3 * CURSOR_KEYS - 3);
+	CHECK(ok);
+
+	btree_cursor_t_free(tree, &cur);
+	CHECK(cur == NULL);
+	btree_free(&tree);
+})
+
+TEST_CASE(cursor_seek_and_turn, {
+	struct btree *tree = btree_new(sizeof(long), 2, &cmp_long);
+	struct btree_cursor_t *cur = btree_cursor_t_new(tree);
+	long key;
+	long at;
+	int  steps;
+	int  ok = 1;
+
+	CHECK(btree_cursor_first(tree, cur) == NULL);
+	CHECK(btree_cursor_last(tree, cur) == NULL);
+	key = 1;
+	CHECK(btree_cursor_seek(tree, cur, &key) == NULL);
+
+	for (key = 0; key < 3 * CURSOR_KEYS; key += 3) btree_insert(tree, &key);
+
+	/* Seek every key and the gaps between them, then wander back and forth,
+	 * which turns around on every level of the tree */
+	for (key = -1; key < 3 * CURSOR_KEYS + 2; key += 2) {
+		at = key < 0 ? 0 : (key + 2) / 3 * 3;
+		ok &= cursor_at(btree_cursor_seek(tree, cur, &key), at);
+		if (at >= 3 * CURSOR_KEYS) continue;
+
+		for (steps = 0; steps < 7; steps++) {
+			at += 3;
+			ok &= cursor_at(btree_cursor_next(tree, cur), at);
+			if (at >= 3 * CURSOR_KEYS) break;
+		}
+		for (steps = 0; steps < 11 && at >= 0; steps++) {
+			at -= 3;
+			ok &= cursor_at(btree_cursor_prev(tree, cur), at);
+		}
+	}
+	CHECK(ok);
+
+	btree_cursor_t_free(tree, &cur);
+	btree_free(&tree);
+})
@@ -0,0 +1,145 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define DUMP_KEYS 50000
+
+/* Dumps `tree` to a temporary file and loads it back, NULL if either failed */
+static struct btree* dump_reload(struct btree *tree) {
+	FILE *file = tmpfile();
+	struct btree *loaded = NULL;
+
+	if (file == NULL) return NULL;
+	if (btree_dump(tree, fileno(file)) == 0
+	&&  lseek(fileno(file), 0, SEEK_SET) == 0) {
+		loaded = btree_load(fileno(file), &cmp_long);
+	}
+	fclose(file);
+	return loaded;
+}
+
+TEST_CASE(dump_roundtrip, {
+	struct btree *tree = btree_new(sizeof(long), 6, &cmp_long);
+	struct btree *loaded;
+	struct btree_iter_t *a;
+	struct btree_iter_t *b;
+	long *x;
+	long *y;
+	long  key;
+	int   ok = 1;
+
+	CHECK(btree_set_order_stats(tree, 1) == 0);
+	CHECK(btree_set_layout(tree, BTREE_LAYOUT_SPLIT) == 0);
+	for (key = 0; key < DUMP_KEYS; key++) {
+		long k = key * 7919 % DUMP_KEYS;
+		btree_insert(tree, &k);
+	}
+	for (key = 0; key < DUMP_KEYS; key += 4) btree_delete(tree, &key);
+
+	loaded = dump_reload(tree);
+	CHECK(loaded != NULL);
+	CHECK(btree_size(loaded) == btree_size(tree));
+
+	a = btree_iter_t_new(tree);
+	b = btree_iter_t_new(loaded);
+	do {
+		x = btree_iter(tree, a);
+		y = btree_iter(loaded, b);
+		ok &= (x == NULL) == (y == NULL) && (x == NULL || *x == *y);
+	} while (x != NULL && y != NULL);
+	CHECK(ok);
+	free(a);
+	free(b);
+
+	/* Order statistics come along, and the tree takes changes as usual */
+	key = 1001;
+	CHECK(btree_rank(loaded, &key) == btree_rank(tree, &key));
+	CHECK(*(long*)btree_select(loaded, 100) == *(long*)btree_select(tree, 100));
+	CHECK(btree_delete(loaded, &key) == 1);
+	CHECK(btree_insert(loaded, &key) == 0);
+
+	btree_free(&loaded);
+	btree_free(&tree);
+})
+
+/* Offsets into a dump: 8 bytes of magic, 4 each of version and flags, then 8
+ * each of element size, degree and count, then the elements */
+#define DUMP_ELEM_SIZE 16
+#define DUMP_DEGREE    24
+#define DUMP_ELEMS     40
+
+/* Whether loading a dump of `tree` fails, once `value` is written over the 8
+ * bytes at `offset` */
+static int dump_rejected(struct btree *tree, off_t offset, uint64_t value) {
+	FILE *file = tmpfile();
+	struct btree *loaded = NULL;
+	int ok;
+
+	if (file == NULL) return 0;
+	ok = btree_dump(tree, fileno(file)) == 0
+	  && pwrite(fileno(file), &value, sizeof(value), offset) == sizeof(value)
+	  && lseek(fileno(file), 0, SEEK_SET) == 0;
+	if (ok) loaded = btree_load(fileno(file), &cmp_long);
+	fclose(file);
+	if (loaded == NULL) return ok;
+	btree_free(&loaded);
+	return 0;
+}
+
+TEST_CASE(dump_edge_cases, {
+	struct btree *tree = btree_new(sizeof(long), 3, &cmp_long);
+	struct btree *loaded;
+	FILE *file;
+	long  key;
+
+	/* An empty tree */
+	loaded = dump_reload(tree);
+	CHECK(loaded != NULL);
+	CHECK(btree_size(loaded) == 0);
+	CHECK(btree_first(loaded) == NULL);
+	btree_free(&loaded);
+
+	/* A truncated dump, and one that is none */
+	for (key = 0; key < 1000; key++) btree_insert(tree, &key);
+	file = tmpfile();
+	CHECK(file != NULL);
+	CHECK(btree_dump(tree, fileno(file)) == 0);
+	CHECK(ftruncate(fileno(file), lseek(fileno(file), 0, SEEK_CUR) - 8) == 0);
+	lseek(fileno(file), 0, SEEK_SET);
+	CHECK(btree_load(fileno(file), &cmp_long) == NULL);
+
+	CHECK(ftruncate(fileno(file), 0) == 0);
+	lseek(fileno(file), 0, SEEK_SET);
+	CHECK(write(fileno(file), "not a tree dump at all", 22) == 22);
+	lseek(fileno(file), 0, SEEK_SET);
+	CHECK(btree_load(fileno(file), &cmp_long) == NULL);
+	fclose(file);
+
+	/* Headers of nodes too large to size, of a few elements each */
+	btree_free(&tree);
+	tree = btree_new(sizeof(long), 3, &cmp_long);
+	for (key = 0; key < 4; key++) btree_insert(tree, &key);
+	CHECK(dump_rejected(tree, DUMP_DEGREE, (uint64_t)1 << 60));
+	CHECK(dump_rejected(tree, DUMP_DEGREE, ((uint64_t)1 << 61) + 1));
+	CHECK(dump_rejected(tree, DUMP_DEGREE, (uint64_t)-1));
+	CHECK(dump_rejected(tree, DUMP_DEGREE, 1));
+	CHECK(dump_rejected(tree, DUMP_ELEM_SIZE, (uint64_t)1 << 62));
+	CHECK(dump_rejected(tree, DUMP_ELEM_SIZE, (uint64_t)-1));
+
+	/* Elements out of order, the first being the largest now */
+	CHECK(dump_rejected(tree, DUMP_ELEMS, 100));
+	CHECK(!dump_rejected(tree, DUMP_ELEMS, (uint64_t)-1));
+
+	btree_free(&tree);
+
+	/* Key-value trees are not dumped */
+	tree = btree_new_kv(sizeof(long), sizeof(long), 3, &cmp_long);
+	file = tmpfile();
+	CHECK(btree_dump(tree, fileno(file)) == -1);
+	fclose(file);
+	btree_free(&tree);
+})
@@ -0,0 +1,149 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define DUP_KEYS    50
+#define DUP_INSERTS 2000
+
+/* Elements are equal by key, `seq` tells them apart */
+struct dup {
+	long key;
+	long seq;
+};
+
+static int cmp_dup(const void *a, const void *b) {
+	const long x = ((const struct dup*)a)->key;
+	const long y = ((const struct dup*)b)->key;
+	return (x > y) - (x < y);
+}
+
+/* Inserts DUP_INSERTS elements over DUP_KEYS keys, one by one or as a batch */
+static struct btree* dup_fill(enum btree_duplicates mode, int batch) {
+	struct btree *tree = btree_new(sizeof(struct dup), 2, &cmp_dup);
+	struct dup   *elems = malloc(sizeof(struct dup) * DUP_INSERTS);
+	long i;
+
+	btree_set_duplicates(tree, mode);
+	for (i = 0; i < DUP_INSERTS; i++) {
+		elems[i].key = (i * 37) % DUP_KEYS;
+		elems[i].seq = i;
+		if (!batch) btree_insert(tree, &elems[i]);
+	}
+	if (batch) btree_insert_batch(tree, elems, DUP_INSERTS);
+	free(elems);
+	return tree;
+}
+
+/* Whether every key holds the elements `first` or `last` would, in order */
+static int dup_check(struct btree *tree, int multiset, int first) {
+	struct btree_iter_t *it = btree_iter_t_new(tree);
+	struct dup *elem;
+	struct dup  prev = { -1, -1 };
+	size_t n = 0;
+	int    ok = 1;
+
+	while ((elem = btree_iter(tree, it)) != NULL) {
+		if (multiset) {
+			ok &= elem->key > prev.key
+			   || (elem->key == prev.key && elem->seq > prev.seq);
+		} else {
+			/* The first or last of the inserts with that key */
+			const long seq = elem->seq;
+			ok &= elem->key > prev.key && elem->key == seq * 37 % DUP_KEYS;
+			ok &= first ? seq < DUP_KEYS : seq >= DUP_INSERTS - DUP_KEYS;
+		}
+		prev = *elem;
+		n++;
+	}
+	free(it);
+	return ok && n == (multiset ? DUP_INSERTS : DUP_KEYS)
+	          && btree_size(tree) == n;
+}
+
+TEST_CASE(dup_multiset_order, {
+	struct btree *tree = dup_fill(BTREE_DUPLICATES_MULTISET, 0);
+	struct btree *batch = dup_fill(BTREE_DUPLICATES_MULTISET, 1);
+	struct dup key;
+	size_t i;
+
+	key.key = 7;
+	key.seq = 0;
+
+	CHECK(dup_check(tree, 1, 0));
+	CHECK(dup_check(batch, 1, 0));
+
+	/* Deleting takes one of the equal elements at a time */
+	for (i = 0; i < DUP_INSERTS / DUP_KEYS; i++) {
+		CHECK(btree_delete(tree, &key) == 1);
+	}
+	CHECK(btree_delete(tree, &key) == 0);
+	CHECK(btree_search(tree, &key) == NULL);
+	CHECK(btree_size(tree) == DUP_INSERTS - DUP_INSERTS / DUP_KEYS);
+
+	btree_free(&batch);
+	btree_free(&tree);
+})
+
+TEST_CASE(dup_reject, {
+	struct btree *tree = dup_fill(BTREE_DUPLICATES_REJECT, 0);
+	struct btree *batch = dup_fill(BTREE_DUPLICATES_REJECT, 1);
+	struct dup elem;
+
+	elem.key = 3;
+	elem.seq = -1;
+
+	CHECK(dup_check(tree, 0, 1));
+	CHECK(dup_check(batch, 0, 1));
+
+	CHECK(btree_insert(tree, &elem) == 0);
+	CHECK(btree_size(tree) == DUP_KEYS);
+	CHECK(((struct dup*)btree_search(tree, &elem))->seq != -1);
+
+	btree_free(&batch);
+	btree_free(&tree);
+})
+
+TEST_CASE(dup_replace, {
+	struct btree *tree = dup_fill(BTREE_DUPLICATES_REPLACE, 0);
+	struct btree *batch = dup_fill(BTREE_DUPLICATES_REPLACE, 1);
+	struct dup elem;
+
+	elem.key = 3;
+	elem.seq = -1;
+
+	CHECK(dup_check(tree, 0, 0));
+	CHECK(dup_check(batch, 0, 0));
+
+	CHECK(btree_insert(tree, &elem) == 0);
+	CHECK(btree_size(tree) == DUP_KEYS);
+	CHECK(((struct dup*)btree_search(tree, &elem))->seq == -1);
+
+	btree_free(&batch);
+	btree_free(&tree);
+})
+
+TEST_CASE(dup_insert_or_get, {
+	struct btree *tree = btree_new(sizeof(struct dup), 3, &cmp_dup);
+	struct dup  elem;
+	struct dup *got;
+
+	elem.key = 5;
+	elem.seq = 1;
+
+	/* Upserts in place, whatever the mode */
+	got = btree_insert_or_get(tree, &elem);
+	CHECK(got != NULL && got->seq == 1);
+	elem.seq = 2;
+	got = btree_insert_or_get(tree, &elem);
+	CHECK(got != NULL && got->seq == 1);
+	got->seq = 3;
+	CHECK(((struct dup*)btree_search(tree, &elem))->seq == 3);
+	CHECK(btree_size(tree) == 1);
+
+	btree_free(&tree);
+
+	tree = btree_new_bplus(sizeof(struct dup), sizeof(long), 3, &cmp_dup);
+	CHECK(btree_set_duplicates(tree, BTREE_DUPLICATES_REJECT) == -1);
+	btree_free(&tree);
+})
@@ -0,0 +1,336 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FILE_KEYS 10000
+
+/* An empty file to open, `path` must have room for 32 bytes */
+static void file_temp(char *path) {
+	strcpy(path, "/tmp/btree-test-XXXXXX");
+	close(mkstemp(path));
+}
+
+static void file_remove(const char *path) {
+	char wal[64];
+
+	sprintf(wal, "%s-wal", path);
+	unlink(path);
+	unlink(wal);
+}
+
+/* Whether the tree holds exactly the keys in [0, FILE_KEYS) with `present`
+ * set to 1, in order. Keys set to `FILE_MAYBE` may be there or not */
+#define FILE_MAYBE 2
+
+static int file_holds(struct btree *tree, const unsigned char *present) {
+	struct btree_iter_t *it = btree_iter_t_new(tree);
+	size_t count = 0;
+	long  *elem;
+	long   key;
+	int    ok = 1;
+
+	for (key = 0; key < FILE_KEYS; key++) {
+		const int found = btree_search(tree, &key) != NULL;
+
+		ok    &= present[key] == FILE_MAYBE || found == present[key];
+		count += found;
+	}
+	ok &= btree_size(tree) == count;
+
+	key = -1;
+	while ((elem = btree_iter(tree, it)) != NULL) {
+		ok &= *elem > key && present[*elem];
+		key = *elem;
+	}
+	free(it);
+	return ok;
+}
+
+/* Runs `ops` on the tree in `path` in a child process, which exits without
+ * closing the tree, as if it crashed.
+ * returnvalue: whatever `ops` returned */
+static int file_crash(const char *path, int (*ops)(struct btree *tree)) {
+	pid_t pid = fork();
+	int   status;
+
+	if (pid == 0) {
+		struct btree *tree = btree_open(path, sizeof(long), 0, &cmp_long);
+		_exit(tree != NULL ? ops(tree) : 1);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+		return -1;
+	}
+	return WEXITSTATUS(status);
+}
+
+static off_t file_log_size(const char *path) {
+	char wal[64];
+	struct stat st;
+
+	sprintf(wal, "%s-wal", path);
+	return stat(wal, &st) == 0 ? st.st_size : -1;
+}
+
+TEST_CASE(file_persist, {
+	static unsigned char present[FILE_KEYS];
+	struct btree        *tree;
+	struct btree_iter_t *it;
+	char  path[32];
+	long  key;
+	long *elem;
+	int   ok = 1;
+
+	file_temp(path);
+	/* Small pages make for a few levels */
+	tree = btree_open(path, sizeof(long), 512, &cmp_long);
+	CHECK(tree != NULL);
+
+	for (key = 0; key < FILE_KEYS; key++) {
+		long k = key * 7919 % FILE_KEYS;
+		ok &= btree_insert(tree, &k) == 0;
+		present[k] = 1;
+	}
+	CHECK(ok);
+	for (key = 0; key < FILE_KEYS; key += 3) {
+		ok &= btree_delete(tree, &key) == 1;
+		present[key] = 0;
+	}
+	CHECK(ok);
+	key = 3;
+	CHECK(btree_delete(tree, &key) == 0);
+	CHECK(file_holds(tree, present));
+
+	CHECK(*(long*)btree_first(tree) == 1);
+	CHECK(*(long*)btree_last(tree) == FILE_KEYS - 2);
+	it  = btree_iter_t_new(tree);
+	key = 3000;
+	btree_lower_bound(tree, it, &key);
+	elem = btree_iter(tree, it);
+	CHECK(elem != NULL && *elem == 3001);
+	free(it);
+
+	CHECK(btree_close(&tree) == 0);
+	CHECK(tree == NULL);
+
+	/* Everything is in the file now, whatever page size is asked for */
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	CHECK(file_holds(tree, present));
+	CHECK(btree_close(&tree) == 0);
+
+	CHECK(btree_open(path, sizeof(int), 0, &cmp_long) == NULL);
+	file_remove(path);
+})
+
+TEST_CASE(file_zeroed_header, {
+	static unsigned char present[FILE_KEYS];
+	struct btree *tree;
+	char path[32];
+	long key;
+
+	/* A file that was grown, but never got its header */
+	file_temp(path);
+	CHECK(truncate(path, 16 * 512) == 0);
+	tree = btree_open(path, sizeof(long), 512, &cmp_long);
+	CHECK(tree != NULL);
+	for (key = 0; key < 100; key++) {
+		btree_insert(tree, &key);
+		present[key] = 1;
+	}
+	CHECK(btree_close(&tree) == 0);
+
+	tree = btree_open(path, sizeof(long), 512, &cmp_long);
+	CHECK(tree != NULL);
+	CHECK(file_holds(tree, present));
+	CHECK(btree_close(&tree) == 0);
+	file_remove(path);
+})
+
+/* Inserts 0..999 and syncs, then inserts 1000..1099 without syncing */
+static int wal_insert_then_crash(struct btree *tree) {
+	long key;
+	int  fails = 0;
+
+	for (key = 0; key < 1000; key++) fails += btree_insert(tree, &key) != 0;
+	fails += btree_sync(tree) != 0;
+	for (key = 1000; key < 1100; key++) fails += btree_insert(tree, &key) != 0;
+	return fails != 0;
+}
+
+/* Deletes 0..9 and syncs */
+static int wal_delete_then_crash(struct btree *tree) {
+	long key;
+	int  fails = 0;
+
+	for (key = 0; key < 10; key++) fails += btree_delete(tree, &key) != 1;
+	return fails != 0 || btree_sync(tree) != 0;
+}
+
+TEST_CASE(wal_crash_replay, {
+	static unsigned char present[FILE_KEYS];
+	struct btree *tree;
+	char path[32];
+	long key;
+
+	file_temp(path);
+	CHECK(file_crash(path, &wal_insert_then_crash) == 0);
+	CHECK(file_log_size(path) > 0);
+
+	/* The synced inserts are replayed, the others may be lost */
+	for (key = 0;    key < 1000; key++) present[key] = 1;
+	for (key = 1000; key < 1100; key++) present[key] = FILE_MAYBE;
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	CHECK(file_holds(tree, present));
+	/* Replaying checkpoints, so the log starts over */
+	CHECK(file_log_size(path) == 0);
+
+	/* Crashing again replays on top of that */
+	CHECK(btree_close(&tree) == 0);
+	CHECK(file_crash(path, &wal_delete_then_crash) == 0);
+	for (key = 0; key < 10; key++) present[key] = 0;
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	CHECK(file_holds(tree, present));
+	CHECK(btree_close(&tree) == 0);
+	file_remove(path);
+})
+
+TEST_CASE(wal_torn_tail, {
+	static unsigned char present[FILE_KEYS];
+	struct btree *tree;
+	char  path[32];
+	char  wal[64];
+	FILE *log;
+	long  key;
+
+	file_temp(path);
+	sprintf(wal, "%s-wal", path);
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	for (key = 0; key < 100; key++) {
+		btree_insert(tree, &key);
+		present[key] = 1;
+	}
+	CHECK(btree_close(&tree) == 0);
+
+	/* Garbage behind the last record is ignored */
+	CHECK(file_crash(path, &wal_delete_then_crash) == 0);
+	log = fopen(wal, "ab");
+	CHECK(log != NULL);
+	fputs("garbage", log);
+	fclose(log);
+
+	for (key = 0; key < 10; key++) present[key] = 0;
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	CHECK(file_holds(tree, present));
+
+	/* So is the last record, if it was not written in full */
+	for (key = 0; key < 10; key++) btree_insert(tree, &key);
+	CHECK(btree_close(&tree) == 0);
+	CHECK(file_crash(path, &wal_delete_then_crash) == 0);
+	CHECK(truncate(wal, file_log_size(path) - 5) == 0);
+
+	for (key = 0; key < 9; key++) present[key] = 0;
+	present[9] = 1;
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	CHECK(file_holds(tree, present));
+	CHECK(btree_close(&tree) == 0);
+	file_remove(path);
+})
+
+TEST_CASE(wal_checkpoint, {
+	static unsigned char present[FILE_KEYS];
+	struct btree *tree;
+	char path[32];
+	long key;
+	int  ok = 1;
+
+	file_temp(path);
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	for (key = 0; key < FILE_KEYS; key++) {
+		ok &= btree_insert(tree, &key) == 0;
+		present[key] = 1;
+	}
+	CHECK(ok);
+	CHECK(btree_sync(tree) == 0);
+	CHECK(file_log_size(path) > 0);
+
+	/* Closing writes the pages back and drops the log */
+	CHECK(btree_close(&tree) == 0);
+	CHECK(file_log_size(path) <= 0);
+
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	CHECK(file_holds(tree, present));
+	for (key = 0; key < FILE_KEYS; key += 2) {
+		ok &= btree_delete(tree, &key) == 1;
+		present[key] = 0;
+	}
+	CHECK(ok);
+	CHECK(btree_close(&tree) == 0);
+
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	CHECK(file_holds(tree, present));
+	CHECK(btree_close(&tree) == 0);
+	file_remove(path);
+})
+
+/* Keeps the log from growing, then deletes a whole group's worth of keys, so
+ * that committing the group fails once all of them have been logged and made */
+static int wal_fail_commit(struct btree *tree) {
+	struct rlimit limit;
+	long key;
+	int  fails = 0;
+
+	signal(SIGXFSZ, SIG_IGN);
+	limit.rlim_cur = 0;
+	limit.rlim_max = RLIM_INFINITY;
+	if (setrlimit(RLIMIT_FSIZE, &limit) != 0) return 1;
+
+	for (key = 0; key < BTREE_WAL_GROUP + 10; key++) {
+		fails += btree_delete(tree, &key) != 1;
+		fails += btree_search(tree, &key) != NULL;
+	}
+	/* The failure sticks */
+	fails += btree_sync(tree) != -1;
+	fails += btree_sync(tree) != -1;
+	fails += btree_close(&tree) != -1;
+	return fails != 0;
+}
+
+TEST_CASE(wal_commit_failure, {
+	static unsigned char present[FILE_KEYS];
+	struct btree *tree;
+	char path[32];
+	long key;
+
+	file_temp(path);
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	for (key = 0; key < 2 * BTREE_WAL_GROUP; key++) {
+		btree_insert(tree, &key);
+		present[key] = 1;
+	}
+	CHECK(btree_close(&tree) == 0);
+
+	/* The deletes were made, and reported as such, but none reached the log */
+	CHECK(file_crash(path, &wal_fail_commit) == 0);
+	tree = btree_open(path, sizeof(long), 0, &cmp_long);
+	CHECK(tree != NULL);
+	CHECK(file_holds(tree, present));
+	CHECK(btree_close(&tree) == 0);
+	file_remove(path);
+})
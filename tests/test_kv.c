@@ -0,0 +1,102 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define KV_KEYS 5000
+
+/* A value large enough to thin out nodes, if it were kept in them */
+struct kv_value {
+	long key;
+	long version;
+	char text[100];
+};
+
+static void kv_value(struct kv_value *value, long key, long version) {
+	value->key     = key;
+	value->version = version;
+	memset(value->text, (int)(key + version), sizeof(value->text));
+}
+
+static int kv_is(const struct kv_value *value, long key, long version) {
+	struct kv_value expect;
+
+	kv_value(&expect, key, version);
+	return value != NULL && value->key == key && value->version == version
+	    && memcmp(value->text, expect.text, sizeof(expect.text)) == 0;
+}
+
+TEST_CASE(kv_put_get_delete, {
+	struct btree *tree = btree_new_kv(sizeof(long), sizeof(struct kv_value), 3,
+	                                  &cmp_long);
+	struct btree_iter_t *it;
+	struct kv_value  value;
+	struct kv_value *first;
+	long *elem;
+	long  key;
+	int   ok = 1;
+
+	for (key = 0; key < KV_KEYS; key++) {
+		long k = key * 7 % KV_KEYS;
+		kv_value(&value, k, 0);
+		ok &= btree_put(tree, &k, &value) == 1;
+	}
+	CHECK(ok);
+	CHECK(btree_size(tree) == KV_KEYS);
+
+	/* Values stay where they are while the nodes around their keys change */
+	key   = 1234;
+	first = btree_get(tree, &key);
+	for (key = 0; key < KV_KEYS; key += 2) {
+		kv_value(&value, key, 1);
+		ok &= btree_put(tree, &key, &value) == 0;
+	}
+	for (key = 1; key < KV_KEYS; key += 4) ok &= btree_delete(tree, &key) == 1;
+	CHECK(ok);
+	key = 1234;
+	CHECK(btree_get(tree, &key) == first);
+	CHECK(kv_is(first, 1234, 1));
+
+	for (key = 0; key < KV_KEYS; key++) {
+		struct kv_value *got = btree_get(tree, &key);
+		if (key % 4 == 1) ok &= got == NULL;
+		else              ok &= kv_is(got, key, key % 2 == 0);
+	}
+	CHECK(ok);
+	CHECK(btree_size(tree) == KV_KEYS - KV_KEYS / 4);
+
+	/* Iterators return the keys, with their values beside them */
+	it  = btree_iter_t_new(tree);
+	key = -1;
+	while ((elem = btree_iter(tree, it)) != NULL) {
+		ok &= *elem > key && *elem % 4 != 1;
+		ok &= kv_is(btree_value(tree, elem), *elem, *elem % 2 == 0);
+		key = *elem;
+	}
+	CHECK(ok);
+	free(it);
+
+	key = 1;
+	CHECK(btree_delete(tree, &key) == 0);
+	CHECK(btree_get(tree, &key) == NULL);
+	btree_free(&tree);
+})
+
+TEST_CASE(kv_unsupported, {
+	struct btree *tree = btree_new_kv(sizeof(long), sizeof(long), 3, &cmp_long);
+	struct btree *plain = btree_new(sizeof(long), 3, &cmp_long);
+	long key = 1;
+
+	/* Elements of key-value trees are put, not inserted */
+	CHECK(btree_insert(tree, &key) == -1);
+	CHECK(btree_snapshot(tree) == NULL);
+	CHECK(btree_size(tree) == 0);
+
+	/* and plain trees have no values */
+	CHECK(btree_put(plain, &key, &key) == -1);
+	CHECK(btree_get(plain, &key) == NULL);
+
+	btree_free(&plain);
+	btree_free(&tree);
+})
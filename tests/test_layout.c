@@ -0,0 +1,118 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LAYOUT_KEYS 6000
+
+/* An odd size, so items end off any alignment */
+struct odd {
+	char key[5];
+	char pad[8];
+};
+
+static int cmp_odd(const void *a, const void *b) {
+	return memcmp(((const struct odd*)a)->key, ((const struct odd*)b)->key, 5);
+}
+
+static size_t layout_calls;
+
+static void* layout_alloc(size_t size) {
+	layout_calls++;
+	return malloc(size);
+}
+
+static void layout_odd(struct odd *elem, long i) {
+	sprintf(elem->key, "%04ld", i);
+	memset(elem->pad, (int)i, sizeof(elem->pad));
+}
+
+/* Fills a tree with the given layout, deletes every fourth element and checks
+ * what is left, including the padding, which splits and merges move along */
+static int layout_run(enum btree_layout layout, size_t t, int order_stats) {
+	struct btree *tree = btree_new(sizeof(struct odd), t, &cmp_odd);
+	struct btree_iter_t *it;
+	struct odd  elem;
+	struct odd *found;
+	long i;
+	int  ok = 1;
+
+	ok &= btree_set_layout(tree, layout) == 0;
+	ok &= btree_set_order_stats(tree, order_stats) == 0;
+	for (i = 0; i < LAYOUT_KEYS; i++) {
+		layout_odd(&elem, i * 7 % LAYOUT_KEYS);
+		ok &= btree_insert(tree, &elem) == 0;
+	}
+	for (i = 0; i < LAYOUT_KEYS; i += 4) {
+		layout_odd(&elem, i);
+		ok &= btree_delete(tree, &elem) == 1;
+	}
+
+	it = btree_iter_t_new(tree);
+	for (i = 0; i < LAYOUT_KEYS; i++) {
+		if (i % 4 == 0) continue;
+		layout_odd(&elem, i);
+		found = btree_iter(tree, it);
+		ok &= found != NULL && memcmp(found, &elem, sizeof(elem)) == 0;
+	}
+	ok &= btree_iter(tree, it) == NULL;
+	free(it);
+
+	if (order_stats) {
+		layout_odd(&elem, 9);
+		ok &= btree_rank(tree, &elem) == 6;
+		found = btree_select(tree, 6);
+		ok &= found != NULL && memcmp(found, &elem, sizeof(elem)) == 0;
+	}
+	btree_free(&tree);
+	return ok;
+}
+
+TEST_CASE(layout_packed_matches_split, {
+	size_t t;
+
+	for (t = 2; t <= 50; t = 2 * t + 1) {
+		CHECK(layout_run(BTREE_LAYOUT_PACKED, t, 0));
+		CHECK(layout_run(BTREE_LAYOUT_SPLIT, t, 0));
+		CHECK(layout_run(BTREE_LAYOUT_PACKED, t, 1));
+		CHECK(layout_run(BTREE_LAYOUT_SPLIT, t, 1));
+	}
+})
+
+TEST_CASE(layout_packed_nodes, {
+	struct btree *packed = btree_new_with_allocator(sizeof(long), 4, &cmp_long,
+	                       &layout_alloc, &free);
+	struct btree *split = btree_new_with_allocator(sizeof(long), 4, &cmp_long,
+	                      &layout_alloc, &free);
+	size_t packed_calls;
+	long  *elem;
+	long   key;
+	int    ok = 1;
+
+	CHECK(btree_set_layout(split, BTREE_LAYOUT_SPLIT) == 0);
+
+	layout_calls = 0;
+	for (key = 0; key < LAYOUT_KEYS; key++) btree_insert(packed, &key);
+	packed_calls = layout_calls;
+	layout_calls = 0;
+	for (key = 0; key < LAYOUT_KEYS; key++) btree_insert(split, &key);
+
+	/* One block per node, against one for the header and one for the items
+	 * at the least */
+	CHECK(2 * packed_calls <= layout_calls);
+
+	/* Items stay aligned for what they hold */
+	for (key = 0; key < LAYOUT_KEYS; key++) {
+		elem = btree_search(packed, &key);
+		ok &= elem != NULL && *elem == key && (uintptr_t)elem % sizeof(long) == 0;
+	}
+	CHECK(ok);
+
+	/* The layout can only be chosen for an empty tree */
+	CHECK(btree_set_layout(packed, BTREE_LAYOUT_SPLIT) == -1);
+
+	btree_free(&packed);
+	btree_free(&split);
+})
@@ -0,0 +1,178 @@
+#include "test.h"
+#include "btree_olc.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OLC_WRITERS 4
+#define OLC_READERS 2
+#define OLC_KEYS    8192
+#define OLC_ROUNDS  40000
+
+/* Every writer owns the keys equal to its number modulo `OLC_WRITERS`, so it
+ * knows what each of its operations has to return */
+struct olc_shared {
+	struct btree_olc *tree;
+	unsigned char     own[OLC_KEYS];
+	int               done;
+	int               errors;
+};
+
+struct olc_worker {
+	struct olc_shared *shared;
+	unsigned           id;
+};
+
+static void* olc_writer(void *arg) {
+	struct olc_worker *w      = arg;
+	struct olc_shared *shared = w->shared;
+	unsigned seed = w->id * 7919 + 1;
+	int errors = 0;
+	int r;
+
+	for (r = 0; r < OLC_ROUNDS; r++) {
+		long key = (long)(rand_r(&seed) % (OLC_KEYS / OLC_WRITERS))
+		         * OLC_WRITERS + w->id;
+		long out = -1;
+
+		if (rand_r(&seed) % 2) {
+			if (btree_olc_insert(shared->tree, &key) != !shared->own[key]) errors++;
+			shared->own[key] = 1;
+		} else {
+			if (btree_olc_delete(shared->tree, &key) != shared->own[key]) errors++;
+			shared->own[key] = 0;
+		}
+		if (btree_olc_search(shared->tree, &key, &out) != shared->own[key]
+		||  (shared->own[key] && out != key)) {
+			errors++;
+		}
+	}
+	__atomic_add_fetch(&shared->errors, errors, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/* Readers cannot tell which keys are present, but whatever they find must be
+ * what they looked for, and iterators must see keys in strictly rising order */
+static void* olc_reader(void *arg) {
+	struct olc_worker *w      = arg;
+	struct olc_shared *shared = w->shared;
+	unsigned seed = w->id;
+	int errors = 0;
+	long n = 0;
+
+	while (!__atomic_load_n(&shared->done, __ATOMIC_ACQUIRE)) {
+		long key = rand_r(&seed) % OLC_KEYS;
+		long out;
+
+		if (btree_olc_search(shared->tree, &key, &out) == 1 && out != key) errors++;
+
+		if (++n % 2048 == 0) {
+			struct btree_olc_iter_t *it = btree_olc_iter_t_new(shared->tree);
+			long *elem;
+			long  prev = -1;
+
+			while ((elem = btree_olc_iter(shared->tree, it)) != NULL) {
+				if (*elem <= prev) errors++;
+				prev = *elem;
+			}
+			btree_olc_iter_t_free(shared->tree, &it);
+		}
+	}
+	__atomic_add_fetch(&shared->errors, errors, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+TEST_CASE(olc_sequential, {
+	struct btree_olc *tree = btree_olc_new(sizeof(long), 3, &cmp_long);
+	struct btree_olc_iter_t *it;
+	long  key;
+	long  out;
+	long *elem;
+	long  expect = 0;
+	int  ok = 1;
+
+	CHECK(tree != NULL);
+	for (key = 0; key < 1000; key++) {
+		long k = (key * 7) % 1000;
+		ok &= btree_olc_insert(tree, &k) == 1;
+	}
+	CHECK(ok);
+	key = 500;
+	CHECK(btree_olc_insert(tree, &key) == 0);
+
+	/* Take every odd key out, from both ends towards the middle */
+	for (key = 1; key < 500; key += 2) {
+		long k = 1000 - key;
+		ok &= btree_olc_delete(tree, &key) == 1;
+		ok &= btree_olc_delete(tree, &k) == 1;
+	}
+	CHECK(ok);
+	key = 1;
+	CHECK(btree_olc_delete(tree, &key) == 0);
+
+	for (key = 0; key < 1000; key++) {
+		ok &= btree_olc_search(tree, &key, &out) == (key % 2 == 0);
+	}
+	CHECK(ok);
+
+	it = btree_olc_iter_t_new(tree);
+	while ((elem = btree_olc_iter(tree, it)) != NULL) {
+		ok &= *elem == expect;
+		expect += 2;
+	}
+	CHECK(ok);
+	CHECK(expect == 1000);
+	btree_olc_iter_t_free(tree, &it);
+
+	for (key = 0; key < 1000; key += 2) ok &= btree_olc_delete(tree, &key) == 1;
+	CHECK(ok);
+	it = btree_olc_iter_t_new(tree);
+	CHECK(btree_olc_iter(tree, it) == NULL);
+	btree_olc_iter_t_free(tree, &it);
+
+	btree_olc_free(&tree);
+	CHECK(tree == NULL);
+})
+
+TEST_CASE(olc_concurrent, {
+	static struct olc_shared shared;
+	struct olc_worker workers[OLC_WRITERS + OLC_READERS];
+	pthread_t threads[OLC_WRITERS + OLC_READERS];
+	struct btree_olc_iter_t *it;
+	long  key;
+	long *elem;
+	unsigned i;
+	int ok = 1;
+
+	/* A small degree makes for many splits and merges */
+	memset(&shared, 0, sizeof(shared));
+	shared.tree = btree_olc_new(sizeof(long), 2, &cmp_long);
+	CHECK(shared.tree != NULL);
+
+	for (i = 0; i < OLC_WRITERS + OLC_READERS; i++) {
+		workers[i].shared = &shared;
+		workers[i].id     = i < OLC_WRITERS ? i : 100 + i;
+		pthread_create(&threads[i], NULL,
+		               i < OLC_WRITERS ? &olc_writer : &olc_reader, &workers[i]);
+	}
+	for (i = 0; i < OLC_WRITERS; i++) pthread_join(threads[i], NULL);
+	__atomic_store_n(&shared.done, 1, __ATOMIC_RELEASE);
+	for (i = OLC_WRITERS; i < OLC_WRITERS + OLC_READERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	CHECK(shared.errors == 0);
+
+	/* What is left is exactly what the writers think they left */
+	it  = btree_olc_iter_t_new(shared.tree);
+	key = 0;
+	while ((elem = btree_olc_iter(shared.tree, it)) != NULL) {
+		while (key < *elem) ok &= !shared.own[key++];
+		ok &= shared.own[key++];
+	}
+	while (key < OLC_KEYS) ok &= !shared.own[key++];
+	CHECK(ok);
+	btree_olc_iter_t_free(shared.tree, &it);
+
+	btree_olc_free(&shared.tree);
+})
@@ -0,0 +1,135 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PARALLEL_KEYS    200000
+#define PARALLEL_THREADS 4
+
+/* Whether both trees hold the same elements in nodes of the same shape */
+static int parallel_same(struct btree *a, struct btree *b) {
+	struct btree_iter_t *ia = btree_iter_t_new(a);
+	struct btree_iter_t *ib = btree_iter_t_new(b);
+	struct btree_stats sa;
+	struct btree_stats sb;
+	long *x;
+	long *y;
+	int   ok = 1;
+
+	do {
+		x = btree_iter(a, ia);
+		y = btree_iter(b, ib);
+		ok &= (x == NULL) == (y == NULL) && (x == NULL || *x == *y);
+	} while (x != NULL && y != NULL);
+	free(ia);
+	free(ib);
+
+	btree_stats(a, &sa);
+	btree_stats(b, &sb);
+	return ok && sa.nodes == sb.nodes && sa.height == sb.height
+	          && memcmp(sa.fill_histogram, sb.fill_histogram,
+	                    sizeof(sa.fill_histogram)) == 0;
+}
+
+TEST_CASE(parallel_build, {
+	long *elems = malloc(sizeof(long) * PARALLEL_KEYS);
+	struct btree *serial = btree_new(sizeof(long), 16, &cmp_long);
+	struct btree *tree;
+	size_t threads;
+	size_t count;
+	long   key;
+	int    ok = 1;
+
+	for (key = 0; key < PARALLEL_KEYS; key++) elems[key] = 3 * key;
+
+	/* As many chunks as threads, or fewer, down to none */
+	for (count = PARALLEL_KEYS; count > 0; count /= 7) {
+		CHECK(btree_build_sorted(serial, elems, count, 0.8) == 0);
+		for (threads = 1; threads <= PARALLEL_THREADS + 1; threads++) {
+			tree = btree_new(sizeof(long), 16, &cmp_long);
+			if (threads % 2 == 0) btree_set_node_pool(tree, 128);
+			ok &= btree_build_sorted_parallel(tree, elems, count, 0.8, threads) == 0;
+			ok &= btree_size(tree) == count;
+			ok &= parallel_same(tree, serial);
+			btree_free(&tree);
+		}
+	}
+	CHECK(ok);
+
+	/* With order statistics, which the upper levels sum up */
+	tree = btree_new(sizeof(long), 4, &cmp_long);
+	CHECK(btree_set_order_stats(tree, 1) == 0);
+	CHECK(btree_build_sorted_parallel(tree, elems, PARALLEL_KEYS, 1.0,
+	                                  PARALLEL_THREADS) == 0);
+	key = 3 * 12345;
+	CHECK(btree_rank(tree, &key) == 12345);
+	CHECK(*(long*)btree_select(tree, 54321) == 3 * 54321);
+	btree_free(&tree);
+
+	btree_free(&serial);
+	free(elems);
+})
+
+/* Sums, counts and order checks per worker */
+struct parallel_slot {
+	long   sum;
+	size_t count;
+	size_t descents; /* times an element was less than the one before */
+	long   prev;
+	char   pad[64];
+};
+
+static void parallel_visit(void *elem, void *ctx, size_t worker) {
+	struct parallel_slot *slot = (struct parallel_slot*)ctx + worker;
+	const long key = *(long*)elem;
+
+	slot->sum += key;
+	slot->count++;
+	slot->descents += slot->count > 1 && key < slot->prev;
+	slot->prev = key;
+}
+
+static int parallel_sum(struct btree *tree, size_t threads, long expect) {
+	struct parallel_slot slots[PARALLEL_THREADS + 1];
+	size_t count = 0;
+	size_t descents = 0;
+	long   sum = 0;
+	size_t i;
+
+	memset(slots, 0, sizeof(slots));
+	if (btree_parallel_for_each(tree, threads, &parallel_visit, slots) != 0) {
+		return 0;
+	}
+	for (i = 0; i < threads; i++) {
+		sum      += slots[i].sum;
+		count    += slots[i].count;
+		descents += slots[i].descents;
+	}
+	/* Workers jump back only when taking on the next subtree */
+	return sum == expect && count == btree_size(tree)
+	    && descents < btree_size(tree) / 16 + 1;
+}
+
+TEST_CASE(parallel_for_each, {
+	struct btree *tree = btree_new(sizeof(long), 8, &cmp_long);
+	struct btree *bplus = btree_new_bplus(sizeof(long), sizeof(long), 8, &cmp_long);
+	size_t threads;
+	long   key;
+	long   sum = 0;
+
+	CHECK(parallel_sum(tree, PARALLEL_THREADS, 0));
+	key = 5;
+	btree_insert(tree, &key);
+	CHECK(parallel_sum(tree, PARALLEL_THREADS, 5));
+
+	for (key = 6; key < PARALLEL_KEYS; key++) btree_insert(tree, &key);
+	for (key = 5; key < PARALLEL_KEYS; key++) sum += key;
+	for (threads = 1; threads <= PARALLEL_THREADS + 1; threads++) {
+		CHECK(parallel_sum(tree, threads, sum));
+	}
+
+	CHECK(btree_parallel_for_each(bplus, 2, &parallel_visit, NULL) == -1);
+	btree_free(&bplus);
+	btree_free(&tree);
+})
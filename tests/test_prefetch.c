@@ -0,0 +1,119 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define PREFETCH_KEYS 20000
+
+/* Whether `btree_search_many` finds what `btree_search` does, for `n` keys,
+ * about half of which are in the tree */
+static int prefetch_many(struct btree *tree, size_t n) {
+	long  *keys = malloc(sizeof(long) * (n + 1));
+	void **out  = malloc(sizeof(void*) * (n + 1));
+	size_t found = 0;
+	size_t i;
+	int    ok = 1;
+
+	for (i = 0; i < n; i++) keys[i] = (long)(i * 7919 % (2 * PREFETCH_KEYS));
+	out[n] = keys;
+	ok &= btree_search_many(tree, keys, n, out) <= n;
+	for (i = 0; i < n; i++) {
+		void *elem = btree_search(tree, &keys[i]);
+		ok &= out[i] == elem;
+		found += elem != NULL;
+	}
+	ok &= btree_search_many(tree, keys, n, out) == found;
+	/* Nothing is written past the `n` results */
+	ok &= out[n] == keys;
+	free(out);
+	free(keys);
+	return ok;
+}
+
+/* Even keys below 2 * PREFETCH_KEYS */
+static void prefetch_fill(struct btree *tree) {
+	long key;
+
+	for (key = 0; key < PREFETCH_KEYS; key++) {
+		long k = 2 * (key * 7 % PREFETCH_KEYS);
+		btree_insert(tree, &k);
+	}
+}
+
+TEST_CASE(prefetch_search_many, {
+	struct btree *tree = btree_new(sizeof(long), 4, &cmp_long);
+	struct btree *bplus = btree_new_bplus(sizeof(long), sizeof(long), 4, &cmp_long);
+	struct btree *kv = btree_new_kv(sizeof(long), sizeof(long), 4, &cmp_long);
+	long key;
+
+	/* Fewer keys than a group, and counts off its multiples */
+	CHECK(prefetch_many(tree, 0));
+	CHECK(prefetch_many(tree, 5));
+
+	prefetch_fill(tree);
+	CHECK(prefetch_many(tree, 1));
+	CHECK(prefetch_many(tree, BTREE_SEARCH_GROUP - 1));
+	CHECK(prefetch_many(tree, BTREE_SEARCH_GROUP));
+	CHECK(prefetch_many(tree, 10 * BTREE_SEARCH_GROUP + 3));
+	CHECK(prefetch_many(tree, 2 * PREFETCH_KEYS));
+	btree_set_search(tree, BTREE_SEARCH_LINEAR, 0);
+	CHECK(prefetch_many(tree, 1000));
+
+	/* B+trees take the keys one by one, key-value trees take keys */
+	prefetch_fill(bplus);
+	CHECK(prefetch_many(bplus, 1000));
+	for (key = 0; key < PREFETCH_KEYS; key += 2) btree_put(kv, &key, &key);
+	CHECK(prefetch_many(kv, 1000));
+
+	btree_free(&kv);
+	btree_free(&bplus);
+	btree_free(&tree);
+})
+
+TEST_CASE(prefetch_same_results, {
+	struct btree *plain = btree_new(sizeof(long), 8, &cmp_long);
+	struct btree *fetch = btree_new(sizeof(long), 8, &cmp_long);
+	struct btree_iter_t *ia;
+	struct btree_iter_t *ib;
+	long *x;
+	long *y;
+	long  key;
+	int   ok = 1;
+
+	btree_set_prefetch(fetch, 1);
+	prefetch_fill(plain);
+	prefetch_fill(fetch);
+
+	for (key = -1; key <= 2 * PREFETCH_KEYS; key++) {
+		x = btree_search(plain, &key);
+		y = btree_search(fetch, &key);
+		ok &= (x == NULL) == (y == NULL) && (x == NULL || *x == *y);
+	}
+	CHECK(ok);
+
+	/* Iterating prefetches the next subtree, which must change nothing */
+	ia  = btree_iter_t_new(plain);
+	ib = btree_iter_t_new(fetch);
+	key = 1001;
+	btree_lower_bound(plain, ia, &key);
+	btree_lower_bound(fetch, ib, &key);
+	do {
+		x = btree_iter(plain, ia);
+		y = btree_iter(fetch, ib);
+		ok &= (x == NULL) == (y == NULL) && (x == NULL || *x == *y);
+	} while (x != NULL && y != NULL);
+	CHECK(ok);
+	free(ia);
+	free(ib);
+
+	/* Turning it off again is fine at any time */
+	btree_set_prefetch(fetch, 0);
+	for (key = 0; key < 2 * PREFETCH_KEYS; key += 2) {
+		ok &= btree_delete(fetch, &key) == 1;
+	}
+	CHECK(ok);
+	CHECK(btree_size(fetch) == 0);
+
+	btree_free(&fetch);
+	btree_free(&plain);
+})
@@ -0,0 +1,141 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define RANGE_KEYS 3000
+
+/* The even keys below 2 * RANGE_KEYS, with 1000 in three times */
+static struct btree* range_tree(size_t t) {
+	struct btree *tree = btree_new(sizeof(long), t, &cmp_long);
+	long key;
+
+	for (key = 0; key < RANGE_KEYS; key++) {
+		long k = 2 * (key * 7 % RANGE_KEYS);
+		btree_insert(tree, &k);
+	}
+	key = 1000;
+	btree_insert(tree, &key);
+	btree_insert(tree, &key);
+	return tree;
+}
+
+/* Whether iterating from a bound yields `first` and then the keys in order */
+static int range_from(struct btree *tree, struct btree_iter_t *it, long first) {
+	long *elem = btree_iter(tree, it);
+	long  prev;
+	int   ok;
+
+	if (first >= 2 * RANGE_KEYS) return elem == NULL;
+	ok   = elem != NULL && *elem == first;
+	prev = first;
+	while (ok && (elem = btree_iter(tree, it)) != NULL) {
+		ok &= *elem >= prev && *elem <= prev + 2;
+		prev = *elem;
+	}
+	return ok && prev == 2 * RANGE_KEYS - 2;
+}
+
+TEST_CASE(range_bounds, {
+	struct btree *tree = range_tree(3);
+	struct btree_iter_t *it = btree_iter_t_new(tree);
+	long *elem;
+	long  key;
+	int   ok = 1;
+
+	for (key = -3; key <= 2 * RANGE_KEYS + 1; key += 7) {
+		const long lower = key <= 0 ? 0 : (key + 1) / 2 * 2;
+		const long upper = key < 0 ? 0 : key / 2 * 2 + 2;
+
+		btree_lower_bound(tree, it, &key);
+		ok &= range_from(tree, it, lower);
+		btree_upper_bound(tree, it, &key);
+		ok &= range_from(tree, it, upper);
+	}
+	CHECK(ok);
+
+	/* Equal elements lie between both bounds */
+	key = 1000;
+	btree_lower_bound(tree, it, &key);
+	CHECK(*(long*)btree_iter(tree, it) == 1000);
+	CHECK(*(long*)btree_iter(tree, it) == 1000);
+	CHECK(*(long*)btree_iter(tree, it) == 1000);
+	CHECK(*(long*)btree_iter(tree, it) == 1002);
+	btree_upper_bound(tree, it, &key);
+	CHECK(*(long*)btree_iter(tree, it) == 1002);
+
+	/* Bounds of an empty tree iterate nothing */
+	free(it);
+	btree_free(&tree);
+	tree = btree_new(sizeof(long), 3, &cmp_long);
+	it   = btree_iter_t_new(tree);
+	btree_lower_bound(tree, it, &key);
+	elem = btree_iter(tree, it);
+	CHECK(elem == NULL);
+
+	free(it);
+	btree_free(&tree);
+})
+
+struct range_ctx {
+	long   prev;
+	size_t stop_after;
+	size_t seen;
+	int    ok;
+};
+
+static int range_collect(void *elem, void *ctx) {
+	struct range_ctx *c = ctx;
+	const long key = *(long*)elem;
+
+	c->ok  &= key >= c->prev;
+	c->prev = key;
+	return ++c->seen == c->stop_after;
+}
+
+TEST_CASE(range_callback, {
+	struct btree *tree = range_tree(4);
+	struct range_ctx ctx;
+	long lo;
+	long hi;
+	int  ok = 1;
+
+	for (lo = -5; lo < 2 * RANGE_KEYS; lo += 97) {
+		for (hi = lo; hi < lo + 300; hi += 31) {
+			const long from = lo < 0 ? 0 : (lo + 1) / 2 * 2;
+			const long to   = hi < 0 ? 0 : (hi + 1) / 2 * 2;
+			const long till = to > 2 * RANGE_KEYS ? 2 * RANGE_KEYS : to;
+			size_t expect = till > from ? (size_t)(till - from) / 2 : 0;
+
+			if (from <= 1000 && till > 1000) expect += 2;
+			ctx.prev       = from;
+			ctx.stop_after = 0;
+			ctx.seen       = 0;
+			ctx.ok         = 1;
+			ok &= btree_range(tree, &lo, &hi, &range_collect, &ctx) == expect;
+			ok &= ctx.ok && ctx.prev < (till > from ? till : from + 1);
+		}
+	}
+	CHECK(ok);
+
+	/* Open ends */
+	ctx.prev       = 0;
+	ctx.stop_after = 0;
+	ctx.seen       = 0;
+	ctx.ok         = 1;
+	CHECK(btree_range(tree, NULL, NULL, &range_collect, &ctx) == RANGE_KEYS + 2);
+	CHECK(ctx.ok && ctx.prev == 2 * RANGE_KEYS - 2);
+	hi = 10;
+	CHECK(btree_range(tree, NULL, &hi, &range_collect, &ctx) == 5);
+	lo = 2 * RANGE_KEYS - 10;
+	CHECK(btree_range(tree, &lo, NULL, &range_collect, &ctx) == 5);
+
+	/* The callback stops the scan */
+	ctx.prev       = 0;
+	ctx.stop_after = 42;
+	ctx.seen       = 0;
+	CHECK(btree_range(tree, NULL, NULL, &range_collect, &ctx) == 42);
+	CHECK(ctx.prev == 82);
+
+	btree_free(&tree);
+})
@@ -0,0 +1,83 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define RANK_KEYS 4000
+
+/* Whether rank and select agree with `ref`, for every key */
+static int rank_matches(struct btree *tree, const unsigned char *ref) {
+	size_t below = 0;
+	long  *elem;
+	long   key;
+	int    ok = 1;
+
+	for (key = 0; key < RANK_KEYS; key++) {
+		ok &= btree_rank(tree, &key) == below;
+		if (!ref[key]) continue;
+		elem = btree_select(tree, below);
+		ok &= elem != NULL && *elem == key;
+		below++;
+	}
+	ok &= btree_select(tree, below) == NULL;
+	ok &= btree_size(tree) == below;
+	return ok;
+}
+
+/* Random inserts and deletes, checking rank and select now and then */
+static int rank_run(size_t t, int order_stats) {
+	static unsigned char ref[RANK_KEYS];
+	struct btree *tree = btree_new(sizeof(long), t, &cmp_long);
+	unsigned seed = 10;
+	long key;
+	long r;
+	int  ok = btree_set_order_stats(tree, order_stats) == 0;
+
+	for (key = 0; key < RANK_KEYS; key++) ref[key] = 0;
+	for (r = 0; r < 3 * RANK_KEYS; r++) {
+		key = rand_r(&seed) % RANK_KEYS;
+		if (rand_r(&seed) % 3) {
+			if (!ref[key]) btree_insert(tree, &key);
+			ref[key] = 1;
+		} else {
+			btree_delete(tree, &key);
+			ref[key] = 0;
+		}
+		if (r % 1000 == 0) ok &= rank_matches(tree, ref);
+	}
+	ok &= rank_matches(tree, ref);
+	btree_free(&tree);
+	return ok;
+}
+
+TEST_CASE(rank_select, {
+	CHECK(rank_run(2, 1));
+	CHECK(rank_run(5, 1));
+	CHECK(rank_run(3, 0));
+})
+
+TEST_CASE(rank_duplicates, {
+	struct btree *tree = btree_new(sizeof(long), 2, &cmp_long);
+	long key;
+	int  i;
+
+	CHECK(btree_set_order_stats(tree, 1) == 0);
+	for (i = 0; i < 50; i++) {
+		for (key = 0; key < 10; key++) btree_insert(tree, &key);
+	}
+	CHECK(btree_size(tree) == 500);
+
+	/* Rank counts the elements strictly less than the key */
+	key = 4;
+	CHECK(btree_rank(tree, &key) == 200);
+	CHECK(*(long*)btree_select(tree, 199) == 3);
+	CHECK(*(long*)btree_select(tree, 200) == 4);
+	CHECK(*(long*)btree_select(tree, 249) == 4);
+	CHECK(*(long*)btree_select(tree, 250) == 5);
+	key = 100;
+	CHECK(btree_rank(tree, &key) == 500);
+
+	/* Order statistics must be chosen before filling the tree */
+	CHECK(btree_set_order_stats(tree, 0) == -1);
+	btree_free(&tree);
+})
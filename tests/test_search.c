@@ -0,0 +1,96 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define SEARCH_KEYS 3000
+
+/* Inserts and deletes keys at random with the given in-node search, checking
+ * every result against `ref`, then iterates the tree against it */
+static int search_run(size_t t, enum btree_search strategy, size_t cutoff) {
+	static unsigned char ref[SEARCH_KEYS];
+	struct btree        *tree = btree_new(sizeof(long), t, &cmp_long);
+	struct btree_iter_t *it;
+	unsigned seed = 1;
+	long *elem;
+	long  key;
+	long  r;
+	int   ok = 1;
+
+	btree_set_search(tree, strategy, cutoff);
+	for (key = 0; key < SEARCH_KEYS; key++) ref[key] = 0;
+
+	for (r = 0; r < 4 * SEARCH_KEYS; r++) {
+		key = rand_r(&seed) % SEARCH_KEYS;
+		if (rand_r(&seed) % 3) {
+			if (!ref[key]) btree_insert(tree, &key);
+			ref[key] = 1;
+		} else {
+			ok &= btree_delete(tree, &key) == ref[key];
+			ref[key] = 0;
+		}
+		elem = btree_search(tree, &key);
+		ok &= ref[key] ? elem != NULL && *elem == key : elem == NULL;
+	}
+
+	/* Keys below, between and above the ones in the tree */
+	for (key = -1; key <= SEARCH_KEYS; key++) {
+		elem = btree_search(tree, &key);
+		ok &= key >= 0 && key < SEARCH_KEYS && ref[key]
+		    ? elem != NULL && *elem == key : elem == NULL;
+	}
+
+	it  = btree_iter_t_new(tree);
+	key = 0;
+	while ((elem = btree_iter(tree, it)) != NULL) {
+		while (key < *elem) ok &= !ref[key++];
+		ok &= ref[key++];
+	}
+	while (key < SEARCH_KEYS) ok &= !ref[key++];
+	free(it);
+
+	btree_free(&tree);
+	return ok;
+}
+
+TEST_CASE(search_strategies, {
+	size_t t;
+
+	/* Degrees 2, 8, 26 and 80, the last being binary searched a while */
+	for (t = 2; t <= 80; t = 3 * t + 2) {
+		CHECK(search_run(t, BTREE_SEARCH_LINEAR, 0));
+		CHECK(search_run(t, BTREE_SEARCH_BINARY, 0));
+		CHECK(search_run(t, BTREE_SEARCH_HYBRID, 0));
+		CHECK(search_run(t, BTREE_SEARCH_HYBRID, 1));
+		CHECK(search_run(t, BTREE_SEARCH_HYBRID, BTREE_SEARCH_CUTOFF_DEFAULT));
+		CHECK(search_run(t, BTREE_SEARCH_HYBRID, 1000));
+	}
+})
+
+TEST_CASE(search_switch_strategy, {
+	struct btree *tree = btree_new(sizeof(long), 32, &cmp_long);
+	long key;
+	int  ok = 1;
+
+	for (key = 0; key < SEARCH_KEYS; key += 2) btree_insert(tree, &key);
+
+	/* Changing the strategy of a filled tree is fine, too */
+	btree_set_search(tree, BTREE_SEARCH_LINEAR, 0);
+	for (key = 0; key < SEARCH_KEYS; key++) {
+		ok &= (btree_search(tree, &key) != NULL) == (key % 2 == 0);
+	}
+	btree_set_search(tree, BTREE_SEARCH_BINARY, 0);
+	for (key = 0; key < SEARCH_KEYS; key++) {
+		ok &= (btree_search(tree, &key) != NULL) == (key % 2 == 0);
+	}
+	CHECK(ok);
+
+	/* SIMD is only for integer trees, other trees keep what they had */
+	btree_set_search(tree, BTREE_SEARCH_SIMD, 0);
+	for (key = 0; key < SEARCH_KEYS; key++) {
+		ok &= (btree_search(tree, &key) != NULL) == (key % 2 == 0);
+	}
+	CHECK(ok);
+
+	btree_free(&tree);
+})
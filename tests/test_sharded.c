@@ -0,0 +1,132 @@
+#include "test.h"
+#include "btree_sharded.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define SHARDED_THREADS 4
+#define SHARDED_KEYS    20000
+
+static size_t hash_long(const void *elem) {
+	return (size_t)*(const long*)elem * 2654435761u;
+}
+
+/* Whether iterating yields every key below `hi` that is a multiple of `step` */
+static int sharded_holds(struct btree_sharded *sharded, long hi, long step) {
+	struct btree_sharded_iter_t *it = btree_sharded_iter_t_new(sharded);
+	long *elem;
+	long  key;
+	int   ok = 1;
+
+	for (key = 0; key < hi; key += step) {
+		elem = btree_sharded_iter(sharded, it);
+		ok &= elem != NULL && *elem == key;
+	}
+	ok &= btree_sharded_iter(sharded, it) == NULL;
+	ok &= btree_sharded_size(sharded) == (size_t)((hi + step - 1) / step);
+	btree_sharded_iter_t_free(sharded, &it);
+	return ok;
+}
+
+struct sharded_worker {
+	struct btree_sharded *sharded;
+	long                  id;
+	int                   ok;
+};
+
+/* Inserts the keys equal to its number modulo the thread count, then deletes
+ * the odd ones, checking each step */
+static void* sharded_write(void *arg) {
+	struct sharded_worker *w = arg;
+	long key;
+	long out;
+
+	w->ok = 1;
+	for (key = w->id; key < SHARDED_KEYS; key += SHARDED_THREADS) {
+		w->ok &= btree_sharded_insert(w->sharded, &key) == 0;
+		w->ok &= btree_sharded_search(w->sharded, &key, &out) == 1 && out == key;
+	}
+	for (key = w->id; key < SHARDED_KEYS; key += SHARDED_THREADS) {
+		if (key % 2 == 0) continue;
+		w->ok &= btree_sharded_delete(w->sharded, &key) == 1;
+		w->ok &= btree_sharded_search(w->sharded, &key, &out) == 0;
+	}
+	return NULL;
+}
+
+static int sharded_concurrent(struct btree_sharded *sharded) {
+	struct sharded_worker workers[SHARDED_THREADS];
+	pthread_t threads[SHARDED_THREADS];
+	int ok = 1;
+	int i;
+
+	for (i = 0; i < SHARDED_THREADS; i++) {
+		workers[i].sharded = sharded;
+		workers[i].id      = i;
+		pthread_create(&threads[i], NULL, &sharded_write, &workers[i]);
+	}
+	for (i = 0; i < SHARDED_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		ok &= workers[i].ok;
+	}
+	return ok && sharded_holds(sharded, SHARDED_KEYS, 2);
+}
+
+TEST_CASE(sharded_hash_concurrent, {
+	struct btree_sharded *sharded = btree_sharded_new_hash(sizeof(long), 4,
+	                                &cmp_long, &hash_long, 7);
+
+	CHECK(sharded != NULL);
+	CHECK(sharded_concurrent(sharded));
+	btree_sharded_free(&sharded);
+	CHECK(sharded == NULL);
+})
+
+TEST_CASE(sharded_range_concurrent, {
+	long bounds[3];
+	struct btree_sharded *sharded;
+
+	bounds[0] = SHARDED_KEYS / 4;
+	bounds[1] = SHARDED_KEYS / 2;
+	bounds[2] = SHARDED_KEYS / 2 + 1;
+	sharded = btree_sharded_new_range(sizeof(long), 3, &cmp_long, bounds, 4);
+
+	CHECK(sharded != NULL);
+	CHECK(sharded_concurrent(sharded));
+	btree_sharded_free(&sharded);
+})
+
+TEST_CASE(sharded_bulk, {
+	long *elems = malloc(sizeof(long) * SHARDED_KEYS);
+	struct btree_sharded *sharded = btree_sharded_new_hash(sizeof(long), 8,
+	                                &cmp_long, &hash_long, 5);
+	struct btree_sharded_iter_t *it;
+	long key;
+
+	for (key = 0; key < SHARDED_KEYS; key++) {
+		elems[key] = 3 * (key * 7919 % SHARDED_KEYS);
+	}
+	CHECK(btree_sharded_build(sharded, elems, SHARDED_KEYS, 0.8, 3) == 0);
+	CHECK(sharded_holds(sharded, 3 * SHARDED_KEYS, 3));
+
+	/* Iterators go on with the shards as they were when created */
+	it = btree_sharded_iter_t_new(sharded);
+	for (key = 0; key < SHARDED_KEYS; key++) elems[key] = 3 * key + 1;
+	CHECK(btree_sharded_insert_batch(sharded, elems, SHARDED_KEYS, 3)
+	      == SHARDED_KEYS);
+	for (key = 0; key < 3 * SHARDED_KEYS; key += 3) {
+		long *elem = btree_sharded_iter(sharded, it);
+		if (elem == NULL || *elem != key) break;
+	}
+	CHECK(key == 3 * SHARDED_KEYS);
+	CHECK(btree_sharded_iter(sharded, it) == NULL);
+	btree_sharded_iter_t_free(sharded, &it);
+
+	for (key = 0; key < SHARDED_KEYS; key++) elems[key] = 3 * key + 2;
+	CHECK(btree_sharded_insert_batch(sharded, elems, SHARDED_KEYS, 1)
+	      == SHARDED_KEYS);
+	CHECK(sharded_holds(sharded, 3 * SHARDED_KEYS, 1));
+
+	btree_sharded_free(&sharded);
+	free(elems);
+})
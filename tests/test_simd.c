@@ -0,0 +1,117 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SIMD_KEYS 4000
+
+/* Spreads keys over the whole range, so that half of them have the top bit
+ * set, which signed vector compares would get wrong */
+static uint64_t simd_key(long i, int bits) {
+	const uint64_t k = (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+	return bits == 32 ? k >> 32 : k;
+}
+
+/* Whether SIMD and scalar search of a `bits` wide tree of degree `t` agree
+ * with what was inserted, after deleting every third key */
+static int simd_run(int bits, size_t t, enum btree_search strategy) {
+	struct btree *tree = bits == 32 ? btree_new_u32(t) : btree_new_u64(t);
+	struct btree_iter_t *it;
+	uint64_t prev = 0;
+	void *elem;
+	long  i;
+	int   ok = tree != NULL;
+
+	if (!ok) return 0;
+	btree_set_search(tree, strategy, 0);
+	for (i = 0; i < SIMD_KEYS; i++) {
+		const uint64_t k64 = simd_key(i, bits);
+		const uint32_t k32 = (uint32_t)k64;
+		ok &= btree_insert(tree, bits == 32 ? (void*)&k32 : (void*)&k64) == 0;
+	}
+	for (i = 0; i < SIMD_KEYS; i += 3) {
+		const uint64_t k64 = simd_key(i, bits);
+		const uint32_t k32 = (uint32_t)k64;
+		ok &= btree_delete(tree, bits == 32 ? (void*)&k32 : (void*)&k64) == 1;
+	}
+
+	for (i = 0; i < SIMD_KEYS; i++) {
+		const uint64_t k64 = simd_key(i, bits);
+		const uint32_t k32 = (uint32_t)k64;
+		const uint64_t k1  = k64 + 1;
+		const uint32_t k1_32 = k32 + 1;
+
+		elem = btree_search(tree, bits == 32 ? (void*)&k32 : (void*)&k64);
+		ok &= (elem != NULL) == (i % 3 != 0);
+		if (elem != NULL) {
+			ok &= bits == 32 ? *(uint32_t*)elem == k32 : *(uint64_t*)elem == k64;
+		}
+		/* The keys are far apart, so none of their successors is there */
+		ok &= btree_search(tree, bits == 32 ? (void*)&k1_32 : (void*)&k1) == NULL;
+	}
+
+	it = btree_iter_t_new(tree);
+	i  = 0;
+	while ((elem = btree_iter(tree, it)) != NULL) {
+		const uint64_t k = bits == 32 ? *(uint32_t*)elem : *(uint64_t*)elem;
+		ok &= i == 0 || k > prev;
+		prev = k;
+		i++;
+	}
+	ok &= i == SIMD_KEYS - (SIMD_KEYS + 2) / 3;
+	ok &= btree_size(tree) == (size_t)i;
+	free(it);
+
+	btree_free(&tree);
+	return ok;
+}
+
+TEST_CASE(simd_matches_scalar, {
+	size_t t;
+
+	/* Node sizes below, at and off multiples of the vector width */
+	for (t = 2; t <= 40; t += 3) {
+		CHECK(simd_run(32, t, BTREE_SEARCH_SIMD));
+		CHECK(simd_run(32, t, BTREE_SEARCH_BINARY));
+		CHECK(simd_run(64, t, BTREE_SEARCH_SIMD));
+		CHECK(simd_run(64, t, BTREE_SEARCH_LINEAR));
+	}
+})
+
+TEST_CASE(simd_extremes, {
+	struct btree *tree = btree_new_u64(4);
+	uint64_t key;
+	uint32_t small;
+	int ok = 1;
+
+	key = UINT64_MAX;
+	btree_insert(tree, &key);
+	key = 0;
+	btree_insert(tree, &key);
+	key = (uint64_t)1 << 63;
+	btree_insert(tree, &key);
+	key = ((uint64_t)1 << 63) - 1;
+	btree_insert(tree, &key);
+
+	CHECK(*(uint64_t*)btree_first(tree) == 0);
+	CHECK(*(uint64_t*)btree_last(tree) == UINT64_MAX);
+	key = (uint64_t)1 << 63;
+	CHECK(btree_search(tree, &key) != NULL);
+	key = 1;
+	CHECK(btree_search(tree, &key) == NULL);
+	btree_free(&tree);
+
+	tree = btree_new_u32(2);
+	for (small = 0; small < 100; small++) {
+		uint32_t k = UINT32_MAX - small;
+		btree_insert(tree, &k);
+	}
+	for (small = 0; small < 100; small++) {
+		uint32_t k = UINT32_MAX - small;
+		ok &= *(uint32_t*)btree_search(tree, &k) == k;
+	}
+	CHECK(ok);
+	CHECK(*(uint32_t*)btree_first(tree) == UINT32_MAX - 99);
+	btree_free(&tree);
+})
@@ -0,0 +1,142 @@
+#include "test.h"
+#include "btree.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define SNAPSHOT_KEYS 5000
+
+/* Whether `tree` holds exactly the keys `lo`, `lo + step`, ... below `hi` */
+static int snapshot_holds(struct btree *tree, long lo, long hi, long step) {
+	struct btree_iter_t *it = btree_iter_t_new(tree);
+	long *elem;
+	long  key;
+	int   ok = 1;
+
+	for (key = lo; key < hi; key += step) {
+		elem = btree_iter(tree, it);
+		ok &= elem != NULL && *elem == key;
+	}
+	ok &= btree_iter(tree, it) == NULL;
+	ok &= btree_size(tree) == (size_t)((hi - lo + step - 1) / step);
+	free(it);
+	return ok;
+}
+
+TEST_CASE(snapshot_unchanged_by_writes, {
+	struct btree *tree = btree_new(sizeof(long), 3, &cmp_long);
+	struct btree *before;
+	struct btree *middle;
+	struct btree_cursor_t *cur;
+	long key;
+	int  ok = 1;
+
+	for (key = 0; key < SNAPSHOT_KEYS; key++) btree_insert(tree, &key);
+	before = btree_snapshot(tree);
+	CHECK(before != NULL);
+
+	for (key = SNAPSHOT_KEYS; key < 2 * SNAPSHOT_KEYS; key++) {
+		btree_insert(tree, &key);
+	}
+	middle = btree_snapshot(tree);
+	CHECK(middle != NULL);
+	for (key = 0; key < 2 * SNAPSHOT_KEYS; key += 2) {
+		ok &= btree_delete(tree, &key) == 1;
+	}
+	CHECK(ok);
+
+	CHECK(snapshot_holds(before, 0, SNAPSHOT_KEYS, 1));
+	CHECK(snapshot_holds(middle, 0, 2 * SNAPSHOT_KEYS, 1));
+	CHECK(snapshot_holds(tree,   1, 2 * SNAPSHOT_KEYS, 2));
+
+	key = 10;
+	CHECK(btree_search(before, &key) != NULL);
+	CHECK(btree_search(tree,   &key) == NULL);
+	CHECK(*(long*)btree_last(before) == SNAPSHOT_KEYS - 1);
+	CHECK(*(long*)btree_first(middle) == 0);
+
+	cur = btree_cursor_t_new(before);
+	CHECK(*(long*)btree_cursor_seek(before, cur, &key) == 10);
+	CHECK(*(long*)btree_cursor_prev(before, cur) == 9);
+	btree_cursor_t_free(before, &cur);
+
+	/* Snapshots are read-only */
+	key = -1;
+	CHECK(btree_insert(before, &key) == -1);
+	key = 1;
+	CHECK(btree_delete(before, &key) == 0);
+	CHECK(snapshot_holds(before, 0, SNAPSHOT_KEYS, 1));
+
+	/* Freeing one leaves the others, and the tree, as they are */
+	btree_free(&middle);
+	CHECK(middle == NULL);
+	for (key = 1; key < 2 * SNAPSHOT_KEYS; key += 2) btree_delete(tree, &key);
+	CHECK(btree_size(tree) == 0);
+	CHECK(snapshot_holds(before, 0, SNAPSHOT_KEYS, 1));
+
+	btree_free(&before);
+	btree_free(&tree);
+})
+
+TEST_CASE(snapshot_order_stats, {
+	struct btree *tree = btree_new(sizeof(long), 4, &cmp_long);
+	struct btree *snap;
+	long key;
+	int  ok = 1;
+
+	CHECK(btree_set_order_stats(tree, 1) == 0);
+	for (key = 0; key < SNAPSHOT_KEYS; key++) btree_insert(tree, &key);
+	snap = btree_snapshot(tree);
+	for (key = 0; key < SNAPSHOT_KEYS; key += 3) btree_delete(tree, &key);
+
+	for (key = 0; key < SNAPSHOT_KEYS; key += 97) {
+		ok &= btree_rank(snap, &key) == (size_t)key;
+		ok &= *(long*)btree_select(snap, key) == key;
+		ok &= btree_rank(tree, &key) == (size_t)(key - (key + 2) / 3);
+	}
+	CHECK(ok);
+
+	btree_free(&snap);
+	btree_free(&tree);
+})
+
+struct snapshot_reader {
+	struct btree *snap;
+	int           ok;
+};
+
+static void* snapshot_read(void *arg) {
+	struct snapshot_reader *r = arg;
+	int i;
+
+	r->ok = 1;
+	for (i = 0; i < 20; i++) {
+		r->ok &= snapshot_holds(r->snap, 0, SNAPSHOT_KEYS, 1);
+	}
+	btree_free(&r->snap);
+	return NULL;
+}
+
+TEST_CASE(snapshot_read_while_writing, {
+	struct btree *tree = btree_new(sizeof(long), 2, &cmp_long);
+	struct snapshot_reader reader;
+	pthread_t thread;
+	long key;
+	int  round;
+
+	for (key = 0; key < SNAPSHOT_KEYS; key++) btree_insert(tree, &key);
+	reader.snap = btree_snapshot(tree);
+	pthread_create(&thread, NULL, &snapshot_read, &reader);
+
+	/* Every node is copied and freed again and again meanwhile */
+	for (round = 0; round < 10; round++) {
+		for (key = 0; key < SNAPSHOT_KEYS; key += 2) btree_delete(tree, &key);
+		for (key = 0; key < SNAPSHOT_KEYS; key += 2) btree_insert(tree, &key);
+	}
+	pthread_join(thread, NULL);
+	CHECK(reader.ok);
+	CHECK(reader.snap == NULL);
+	CHECK(snapshot_holds(tree, 0, SNAPSHOT_KEYS, 1));
+
+	btree_free(&tree);
+})
@@ -0,0 +1,101 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define STATS_KEYS 10000
+
+/* Whether the shape in `stats` adds up, for a tree of degree `t` */
+static int stats_consistent(const struct btree_stats *stats, size_t t) {
+	size_t bucketed = 0;
+	double items;
+	size_t i;
+
+	for (i = 0; i < BTREE_STATS_FILL_BUCKETS; i++) {
+		bucketed += stats->fill_histogram[i];
+	}
+	/* Every element sits in exactly one node */
+	items = stats->fill * stats->nodes * (2 * t - 1);
+	return bucketed == stats->nodes
+	    && stats->leaves <= stats->nodes
+	    && stats->node_bytes <= stats->allocated_bytes
+	    && items > stats->elements - 0.5 && items < stats->elements + 0.5;
+}
+
+TEST_CASE(stats_shape, {
+	struct btree *tree = btree_new(sizeof(long), 3, &cmp_long);
+	struct btree_stats stats;
+	long *elems = malloc(sizeof(long) * STATS_KEYS);
+	long  key;
+
+	CHECK(btree_stats(tree, &stats) == 0);
+	CHECK(stats.elements == 0 && stats.nodes == 0 && stats.height == 0);
+
+	key = 1;
+	btree_insert(tree, &key);
+	CHECK(btree_stats(tree, &stats) == 0);
+	/* The height counts the levels below the root */
+	CHECK(stats.nodes == 1 && stats.leaves == 1 && stats.height == 0);
+
+	for (key = 2; key < STATS_KEYS; key++) btree_insert(tree, &key);
+	CHECK(btree_stats(tree, &stats) == 0);
+	CHECK(stats.elements == STATS_KEYS - 1);
+	CHECK(stats_consistent(&stats, 3));
+	/* Degree 3 packs 2 to 5 keys per node, so 10000 keys take 5 to 8 levels */
+	CHECK(stats.height >= 4 && stats.height <= 7);
+	CHECK(stats.leaves > stats.nodes / 2);
+
+	/* Building out of no elements leaves no nodes */
+	CHECK(btree_build(tree, NULL, 0, 1.0) == 0);
+	CHECK(btree_stats(tree, &stats) == 0 && stats.nodes == 0);
+	btree_free(&tree);
+
+	/* A full bulk build leaves all but a few nodes at the end of each level
+	 * full */
+	tree = btree_new(sizeof(long), 3, &cmp_long);
+	CHECK(btree_set_node_pool(tree, 32) == 0);
+	for (key = 0; key < STATS_KEYS; key++) elems[key] = key;
+	CHECK(btree_build_sorted(tree, elems, STATS_KEYS, 1.0) == 0);
+	CHECK(btree_stats(tree, &stats) == 0);
+	CHECK(stats_consistent(&stats, 3));
+	CHECK(stats.fill_histogram[BTREE_STATS_FILL_BUCKETS - 1]
+	      + 3 * (stats.height + 1) >= stats.nodes);
+	btree_free(&tree);
+	free(elems);
+})
+
+TEST_CASE(stats_counters, {
+	struct btree *tree = btree_new(sizeof(long), 2, &cmp_long);
+	struct btree *bplus = btree_new_bplus(sizeof(long), sizeof(long), 2, &cmp_long);
+	struct btree_stats stats;
+	long key;
+
+	for (key = 0; key < STATS_KEYS; key++) btree_insert(tree, &key);
+	btree_stats_reset(tree);
+	key = 77;
+	btree_search(tree, &key);
+	CHECK(btree_stats(tree, &stats) == 0);
+
+	if (stats.counting) {
+		/* One node searched per level, no more than log2(2t) compares each */
+		CHECK(stats.counters.finds == stats.height + 1);
+		CHECK(stats.counters.cmps > 0 && stats.counters.cmps <= 2 * (stats.height + 1));
+		CHECK(stats.counters.splits == 0);
+
+		for (key = 0; key < STATS_KEYS; key++) btree_delete(tree, &key);
+		btree_stats(tree, &stats);
+		CHECK(stats.counters.merges > 0);
+		CHECK(stats.counters.shifts_left + stats.counters.shifts_right > 0);
+	} else {
+		/* Counting compiles to nothing without BTREE_STATS */
+		CHECK(stats.counters.finds == 0 && stats.counters.cmps == 0);
+		CHECK(stats.counters.splits == 0 && stats.counters.merges == 0);
+	}
+
+	/* Only plain trees are walked */
+	CHECK(btree_stats(bplus, &stats) == -1);
+	CHECK(btree_stats(tree, NULL) == -1);
+
+	btree_free(&bplus);
+	btree_free(&tree);
+})
@@ -0,0 +1,171 @@
+#include "test.h"
+#include "btree.h"
+
+#include <stdlib.h>
+
+#define TOMB_KEYS 4000
+
+/* Whether the tree maps exactly the keys with `ref` not -1 to their `ref` */
+static int tomb_matches(struct btree *tree, const long *ref) {
+	struct btree_iter_t   *it  = btree_iter_t_new(tree);
+	struct btree_cursor_t *cur = btree_cursor_t_new(tree);
+	size_t live = 0;
+	long  *elem;
+	long   key;
+	long   first = -1;
+	long   last  = -1;
+	int    ok = 1;
+
+	for (key = 0; key < TOMB_KEYS; key++) {
+		long *value = btree_get(tree, &key);
+
+		ok &= ref[key] == -1 ? value == NULL : value != NULL && *value == ref[key];
+		if (ref[key] == -1) continue;
+		if (first == -1) first = key;
+		last = key;
+		live++;
+	}
+	ok &= btree_size(tree) == live;
+
+	key = -1;
+	while ((elem = btree_iter(tree, it)) != NULL) {
+		ok &= *elem > key && ref[*elem] != -1;
+		ok &= *(long*)btree_value(tree, elem) == ref[*elem];
+		key = *elem;
+	}
+
+	elem = btree_cursor_first(tree, cur);
+	ok &= first == -1 ? elem == NULL : elem != NULL && *elem == first;
+	elem = btree_cursor_last(tree, cur);
+	ok &= last == -1 ? elem == NULL : elem != NULL && *elem == last;
+	if (last != -1) {
+		/* Stepping back skips tombstones, too */
+		elem = btree_cursor_prev(tree, cur);
+		for (key = last - 1; key >= 0 && ref[key] == -1; key--);
+		ok &= key < 0 ? elem == NULL : elem != NULL && *elem == key;
+	}
+
+	btree_cursor_t_free(tree, &cur);
+	free(it);
+	return ok;
+}
+
+static size_t tomb_count(struct btree *tree) {
+	struct btree_stats stats;
+	btree_stats(tree, &stats);
+	return stats.tombstones;
+}
+
+TEST_CASE(tomb_reference_map, {
+	static long ref[TOMB_KEYS];
+	struct btree *tree = btree_new_kv(sizeof(long), sizeof(long), 3, &cmp_long);
+	unsigned seed = 25;
+	long key;
+	long r;
+	int  ok = 1;
+
+	CHECK(btree_set_tombstones(tree, 1) == 0);
+	for (key = 0; key < TOMB_KEYS; key++) ref[key] = -1;
+
+	for (r = 0; r < 60000; r++) {
+		const unsigned op = rand_r(&seed) % 100;
+
+		key = rand_r(&seed) % TOMB_KEYS;
+		if (op < 45) {
+			ok &= btree_put(tree, &key, &r) == (ref[key] == -1);
+			ref[key] = r;
+		} else if (op < 90) {
+			ok &= btree_delete(tree, &key) == (ref[key] != -1);
+			ref[key] = -1;
+		} else if (op < 99) {
+			ok &= btree_compact(tree, rand_r(&seed) % 200 + 1) == tomb_count(tree);
+		} else {
+			ok &= tomb_matches(tree, ref);
+		}
+	}
+	CHECK(ok);
+	CHECK(tomb_matches(tree, ref));
+
+	/* A full compaction rebuilds the tree out of what is left */
+	CHECK(btree_compact(tree, 0) == 0);
+	CHECK(tomb_count(tree) == 0);
+	CHECK(tomb_matches(tree, ref));
+
+	btree_free(&tree);
+})
+
+TEST_CASE(tomb_compact_budget, {
+	static long ref[TOMB_KEYS];
+	struct btree *tree = btree_new_kv(sizeof(long), sizeof(long), 4, &cmp_long);
+	struct btree_stats before;
+	struct btree_stats after;
+	size_t left;
+	size_t calls = 0;
+	size_t i;
+	long   key;
+
+	CHECK(btree_set_tombstones(tree, 1) == 0);
+	for (key = 0; key < TOMB_KEYS; key++) {
+		btree_put(tree, &key, &key);
+		ref[key] = key;
+	}
+	/* Leave runs of leaves with nothing but tombstones */
+	for (key = 0; key < TOMB_KEYS; key++) {
+		if (key % 10 == 0 || key % 1000 < 300) continue;
+		btree_delete(tree, &key);
+		ref[key] = -1;
+	}
+	btree_stats(tree, &before);
+	CHECK(before.tombstones > 0);
+	CHECK(btree_size(tree) == before.elements);
+
+	/* Small budgets get through in bounded steps */
+	left = before.tombstones;
+	while (left > 0 && calls < TOMB_KEYS) {
+		const size_t now = btree_compact(tree, 50);
+
+		CHECK(now <= left);
+		left = now;
+		calls++;
+	}
+	CHECK(left == 0);
+	CHECK(calls < TOMB_KEYS / 10);
+	CHECK(tomb_matches(tree, ref));
+
+	/* No node but the root is left less than half full */
+	btree_stats(tree, &after);
+	CHECK(after.nodes < before.nodes);
+	for (i = 0, left = 0; i < 4; i++) left += after.fill_histogram[i];
+	CHECK(left <= 1);
+
+	/* Nothing to do without tombstones */
+	CHECK(btree_compact(tree, 50) == 0);
+	key = 301;
+	CHECK(btree_get(tree, &key) == NULL);
+	CHECK(btree_put(tree, &key, &key) == 1);
+	CHECK(btree_delete(tree, &key) == 1);
+	/* Even the smallest budget gets on by a run of leaves per call */
+	for (calls = 0; btree_compact(tree, 1) > 0 && calls < TOMB_KEYS; calls++);
+	CHECK(calls < after.leaves);
+	CHECK(tomb_count(tree) == 0);
+
+	btree_free(&tree);
+})
+
+TEST_CASE(tomb_settings, {
+	struct btree *tree = btree_new_kv(sizeof(long), sizeof(long), 3, &cmp_long);
+	struct btree *plain = btree_new(sizeof(long), 3, &cmp_long);
+	long key = 1;
+
+	CHECK(btree_set_tombstones(plain, 1) == -1);
+	CHECK(btree_set_order_stats(tree, 1) == 0);
+	CHECK(btree_set_tombstones(tree, 1) == -1);
+	btree_free(&tree);
+
+	tree = btree_new_kv(sizeof(long), sizeof(long), 3, &cmp_long);
+	btree_put(tree, &key, &key);
+	CHECK(btree_set_tombstones(tree, 1) == -1);
+
+	btree_free(&plain);
+	btree_free(&tree);
+})
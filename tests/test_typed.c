@@ -0,0 +1,88 @@
+#include "test.h"
+#include "btree_typed.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define TYPED_KEYS 5000
+
+BTREE_DEFINE(typed_u64, uint64_t, BTREE_CMP_NUM(a, b));
+
+/* Orders by descending value, to make sure the expression is what is used */
+BTREE_DEFINE(typed_desc, int, BTREE_CMP_NUM(b, a));
+
+TEST_CASE(typed_reference, {
+	static unsigned char ref[TYPED_KEYS];
+	struct typed_u64 *tree = typed_u64_new(3);
+	struct typed_u64_iter it;
+	uint64_t *elem;
+	uint64_t  key;
+	size_t    live = 0;
+	unsigned  seed = 2;
+	long      r;
+	int       ok = 1;
+
+	CHECK(tree != NULL);
+	for (r = 0; r < 5 * TYPED_KEYS; r++) {
+		key = rand_r(&seed) % TYPED_KEYS;
+		if (rand_r(&seed) % 3) {
+			if (!ref[key]) {
+				ok &= typed_u64_insert(tree, key) == 1;
+				live++;
+			}
+			ref[key] = 1;
+		} else {
+			ok &= typed_u64_delete(tree, key) == ref[key];
+			live -= ref[key];
+			ref[key] = 0;
+		}
+		elem = typed_u64_search(tree, key);
+		ok &= ref[key] ? elem != NULL && *elem == key : elem == NULL;
+	}
+	CHECK(ok);
+	CHECK(typed_u64_size(tree) == live);
+
+	typed_u64_iter_init(tree, &it);
+	key = 0;
+	while ((elem = typed_u64_iter_next(&it)) != NULL) {
+		while (key < *elem) ok &= !ref[key++];
+		ok &= ref[key++];
+	}
+	while (key < TYPED_KEYS) ok &= !ref[key++];
+	CHECK(ok);
+
+	/* An emptied tree iterates nothing and takes new keys */
+	for (key = 0; key < TYPED_KEYS; key++) typed_u64_delete(tree, key);
+	CHECK(typed_u64_size(tree) == 0);
+	typed_u64_iter_init(tree, &it);
+	CHECK(typed_u64_iter_next(&it) == NULL);
+	CHECK(typed_u64_insert(tree, 7) == 1);
+	CHECK(typed_u64_search(tree, 7) != NULL);
+
+	typed_u64_free(&tree);
+	CHECK(tree == NULL);
+})
+
+TEST_CASE(typed_custom_order, {
+	struct typed_desc *tree = typed_desc_new(2);
+	struct typed_desc_iter it;
+	int *elem;
+	int  key;
+	int  expect = 999;
+	int  ok = 1;
+
+	for (key = 0; key < 1000; key++) typed_desc_insert(tree, key * 7 % 1000);
+	typed_desc_iter_init(tree, &it);
+	while ((elem = typed_desc_iter_next(&it)) != NULL) ok &= *elem == expect--;
+	CHECK(ok);
+	CHECK(expect == -1);
+
+	/* Equal keys are all kept, like the generic tree does */
+	typed_desc_insert(tree, 500);
+	CHECK(typed_desc_size(tree) == 1001);
+	CHECK(typed_desc_delete(tree, 500) == 1);
+	CHECK(typed_desc_delete(tree, 500) == 1);
+	CHECK(typed_desc_delete(tree, 500) == 0);
+
+	typed_desc_free(&tree);
+})
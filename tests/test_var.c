@@ -0,0 +1,130 @@
+#include "test.h"
+#include "btree_var.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VAR_KEYS 5000
+
+/* Keys sharing long prefixes, of varying length: "user/<n>/" followed by
+ * `n % 7` bytes, some of them zero */
+static size_t var_key(char *buf, long n) {
+	size_t len = (size_t)sprintf(buf, "user/%06ld/", n);
+	long   i;
+
+	for (i = 0; i < n % 7; i++) buf[len++] = (char)(i % 3 == 0 ? 0 : 'a' + i);
+	return len;
+}
+
+/* Whether iterating from `from` on yields the keys n, n + step, ... in order,
+ * which holds as all keys are of the same length up to the trailing bytes */
+static int var_walk(struct btree_var *tree, long from, long hi, long step) {
+	struct btree_var_iter_t *it = btree_var_iter_t_new(tree);
+	const void *key;
+	char   buf[32];
+	size_t len;
+	long  *value;
+	long   n;
+	int    ok = 1;
+
+	len = var_key(buf, from);
+	btree_var_seek(tree, it, buf, len);
+	for (n = from; n < hi; n += step) {
+		value = btree_var_iter(tree, it, &key, &len);
+		ok &= value != NULL && *value == n;
+		ok &= len == var_key(buf, n) && memcmp(key, buf, len) == 0;
+	}
+	ok &= btree_var_iter(tree, it, NULL, NULL) == NULL;
+	btree_var_iter_t_free(tree, &it);
+	return ok;
+}
+
+TEST_CASE(var_insert_search_delete, {
+	struct btree_var *tree = btree_var_new(sizeof(long), 256);
+	char   buf[32];
+	size_t len;
+	long  *value;
+	long   n;
+	int    ok = 1;
+
+	CHECK(tree != NULL);
+	for (n = 0; n < VAR_KEYS; n++) {
+		const long k = n * 7919 % VAR_KEYS;
+		len = var_key(buf, k);
+		ok &= btree_var_insert(tree, buf, len, &k) == 1;
+	}
+	CHECK(ok);
+	CHECK(btree_var_size(tree) == VAR_KEYS);
+	CHECK(btree_var_height(tree) > 2);
+	CHECK(var_walk(tree, 0, VAR_KEYS, 1));
+	CHECK(var_walk(tree, 4321, VAR_KEYS, 1));
+
+	/* Replacing a value keeps the key once */
+	n   = -5;
+	len = var_key(buf, 17);
+	CHECK(btree_var_insert(tree, buf, len, &n) == 0);
+	CHECK(*(long*)btree_var_search(tree, buf, len) == -5);
+	n = 17;
+	CHECK(btree_var_insert(tree, buf, len, &n) == 0);
+	CHECK(btree_var_size(tree) == VAR_KEYS);
+
+	/* A prefix of a key is a key of its own */
+	CHECK(btree_var_search(tree, buf, len - 1) == NULL);
+	CHECK(btree_var_search(tree, "user/", 5) == NULL);
+
+	for (n = 1; n < VAR_KEYS; n += 2) {
+		len = var_key(buf, n);
+		ok &= btree_var_delete(tree, buf, len) == 1;
+		ok &= btree_var_delete(tree, buf, len) == 0;
+	}
+	CHECK(ok);
+	for (n = 0; n < VAR_KEYS; n++) {
+		len   = var_key(buf, n);
+		value = btree_var_search(tree, buf, len);
+		ok &= n % 2 ? value == NULL : value != NULL && *value == n;
+	}
+	CHECK(ok);
+	CHECK(var_walk(tree, 0, VAR_KEYS, 2));
+	CHECK(btree_var_size(tree) == VAR_KEYS / 2);
+
+	btree_var_free(&tree);
+	CHECK(tree == NULL);
+})
+
+TEST_CASE(var_prefix_order, {
+	struct btree_var *tree = btree_var_new(0, 0);
+	struct btree_var_iter_t *it;
+	char  *big;
+	const void *key;
+	size_t len;
+
+	CHECK(btree_var_insert(tree, "abc", 3, NULL) == 1);
+	CHECK(btree_var_insert(tree, "ab", 2, NULL) == 1);
+	CHECK(btree_var_insert(tree, "", 0, NULL) == 1);
+	CHECK(btree_var_insert(tree, "abd", 3, NULL) == 1);
+	CHECK(btree_var_insert(tree, "ab\0", 3, NULL) == 1);
+
+	/* Shorter keys order before the longer ones they are a prefix of */
+	it = btree_var_iter_t_new(tree);
+	CHECK(btree_var_iter(tree, it, &key, &len) != NULL && len == 0);
+	CHECK(btree_var_iter(tree, it, &key, &len) != NULL && len == 2);
+	CHECK(btree_var_iter(tree, it, &key, &len) != NULL && len == 3
+	      && memcmp(key, "ab\0", 3) == 0);
+	CHECK(btree_var_iter(tree, it, &key, &len) != NULL
+	      && len == 3 && memcmp(key, "abc", 3) == 0);
+	CHECK(btree_var_iter(tree, it, &key, &len) != NULL
+	      && len == 3 && memcmp(key, "abd", 3) == 0);
+	CHECK(btree_var_iter(tree, it, &key, &len) == NULL);
+	btree_var_iter_t_free(tree, &it);
+
+	/* Keys too long for the node are turned away */
+	len = btree_var_max_key(tree);
+	big = calloc(len + 1, 1);
+	CHECK(btree_var_insert(tree, big, len, NULL) == 1);
+	CHECK(btree_var_insert(tree, big, len + 1, NULL) == -1);
+	CHECK(btree_var_size(tree) == 6);
+	free(big);
+
+	btree_var_free(&tree);
+})